@@ -0,0 +1,122 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class BinaryLog
+ *  Encoding of the binary measurement log
+ */
+
+#include <string.h>
+
+#include "BinaryLog.h"
+
+
+//==============================================================================
+// Little endian fields
+//
+uint8_t* BinaryLog::put(uint8_t* buffer, uint32_t value, uint8_t size) {
+  for (uint8_t i = 0; i < size; ++i) {
+    *buffer++ = uint8_t(value);
+    value >>= 8;
+  }
+  return buffer;
+}
+
+uint32_t BinaryLog::get(const uint8_t* buffer, uint8_t size) {
+  uint32_t value = 0;
+  for (uint8_t i = size; i > 0; --i) {
+    value = (value << 8) | buffer[i - 1];
+  }
+  return value;
+}
+
+// Round to the field unit, saturating at the field range
+int32_t BinaryLog::scale(float value, float unit, int32_t minValue, int32_t maxValue) {
+  float units = value / unit;
+  if (units <= minValue) {
+    return minValue;
+  }
+  if (units >= maxValue) {
+    return maxValue;
+  }
+  return int32_t(units < 0 ? units - 0.5 : units + 0.5);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// File header
+//
+void BinaryLog::encodeHeader(uint8_t* buffer) {
+
+  const float scales[6] = {
+    BINARY_LOG_CURRENT_SCALE, BINARY_LOG_VOLTAGE_SCALE, BINARY_LOG_POWER_SCALE,
+    BINARY_LOG_POWER_FACTOR_SCALE, BINARY_LOG_WINDOW_TIME_SCALE, BINARY_LOG_FREQUENCY_SCALE
+  };
+
+  memset(buffer, 0, BINARY_LOG_HEADER_SIZE);
+  memcpy(buffer, BINARY_LOG_MAGIC, 4);
+  buffer[4] = BINARY_LOG_VERSION;
+  buffer[5] = BINARY_LOG_RECORD_SIZE;
+  buffer[6] = BINARY_LOG_HEADER_SIZE;
+
+  uint8_t* cursor = buffer + 8;
+  for (uint8_t i = 0; i < 6; ++i) {
+    uint32_t bits;
+    memcpy(&bits, &scales[i], sizeof(bits));
+    cursor = put(cursor, bits, 4);
+  }
+}
+
+// Return the header is of a known version
+bool BinaryLog::decodeHeader(const uint8_t* buffer, BinaryLogScales* scales) {
+
+  if (memcmp(buffer, BINARY_LOG_MAGIC, 4) != 0 || buffer[4] != BINARY_LOG_VERSION) {
+    return false;
+  }
+  scales->version = buffer[4];
+  scales->recordSize = buffer[5];
+  scales->headerSize = buffer[6];
+  if (scales->recordSize < BINARY_LOG_RECORD_SIZE || scales->headerSize < BINARY_LOG_HEADER_SIZE) {
+    return false;
+  }
+
+  float* fields[6] = {
+    &scales->current, &scales->voltage, &scales->power,
+    &scales->powerFactor, &scales->windowTime, &scales->lineFrequency
+  };
+  for (uint8_t i = 0; i < 6; ++i) {
+    uint32_t bits = get(buffer + 8 + 4 * i, 4);
+    memcpy(fields[i], &bits, sizeof(bits));
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Records
+//
+void BinaryLog::encodeRecord(uint8_t* buffer, const BinaryLogRecord* record) {
+  buffer = put(buffer, record->timestamp, 4);
+  buffer = put(buffer, scale(record->current, BINARY_LOG_CURRENT_SCALE, 0, 0xFFFF), 2);
+  buffer = put(buffer, scale(record->voltage, BINARY_LOG_VOLTAGE_SCALE, 0, 0xFFFF), 2);
+  buffer = put(buffer, scale(record->realPower, BINARY_LOG_POWER_SCALE, -0x7FFFFFFF, 0x7FFFFFFF), 4);
+  buffer = put(buffer, scale(record->apparentPower, BINARY_LOG_POWER_SCALE, 0, 0x7FFFFFFF), 4);
+  buffer = put(buffer, scale(record->powerFactor, BINARY_LOG_POWER_FACTOR_SCALE, -0x7FFF, 0x7FFF), 2);
+  buffer = put(buffer, scale(record->windowTime, BINARY_LOG_WINDOW_TIME_SCALE, 0, 0xFFFF), 2);
+  put(buffer, scale(record->lineFrequency, BINARY_LOG_FREQUENCY_SCALE, 0, 0xFFFF), 2);
+}
+
+void BinaryLog::decodeRecord(const uint8_t* buffer, const BinaryLogScales* scales, BinaryLogRecord* record) {
+  record->timestamp = get(buffer, 4);
+  record->current = get(buffer + 4, 2) * scales->current;
+  record->voltage = get(buffer + 6, 2) * scales->voltage;
+  record->realPower = int32_t(get(buffer + 8, 4)) * scales->power;
+  record->apparentPower = get(buffer + 12, 4) * scales->power;
+  record->powerFactor = int16_t(get(buffer + 16, 2)) * scales->powerFactor;
+  record->windowTime = get(buffer + 18, 2) * scales->windowTime;
+  record->lineFrequency = get(buffer + 20, 2) * scales->lineFrequency;
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,69 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _BINARY_LOG_H_
+#define _BINARY_LOG_H_
+
+#include <stdint.h>
+
+// File header: magic, version, sizes and the scale of each record field
+#define BINARY_LOG_MAGIC       "MPBL"
+#define BINARY_LOG_VERSION     1
+#define BINARY_LOG_HEADER_SIZE 32
+#define BINARY_LOG_RECORD_SIZE 22
+
+// Value of one unit of each field, as written in the header of new files
+#define BINARY_LOG_CURRENT_SCALE      0.001   // A      (uint16)
+#define BINARY_LOG_VOLTAGE_SCALE      0.01    // V      (uint16)
+#define BINARY_LOG_POWER_SCALE        0.01    // W, VA  (int32, uint32)
+#define BINARY_LOG_POWER_FACTOR_SCALE 0.0001  //        (int16)
+#define BINARY_LOG_WINDOW_TIME_SCALE  0.001   // s      (uint16)
+#define BINARY_LOG_FREQUENCY_SCALE    0.01    // Hz     (uint16)
+
+
+/*----------------------------------------------------------------------------
+ *  Struct BinaryLogRecord
+ *  One reading, as recorded in a CSV row
+ */
+struct BinaryLogRecord {
+  uint32_t timestamp;  // RTC date and time, seconds since 1970
+  float current, voltage, realPower, apparentPower, powerFactor;
+  float windowTime, lineFrequency;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Struct BinaryLogScales
+ *  Field scales read from a file header
+ */
+struct BinaryLogScales {
+  uint8_t version, headerSize, recordSize;
+  float current, voltage, power, powerFactor, windowTime, lineFrequency;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class BinaryLog
+ *  Little endian encoding of the binary measurement log:
+ *
+ *    header  magic[4] version recordSize headerSize reserved
+ *            float scales: current voltage power powerFactor windowTime lineFrequency
+ *    record  timestamp(u32) current(u16) voltage(u16) realPower(i32)
+ *            apparentPower(u32) powerFactor(i16) windowTime(u16) lineFrequency(u16)
+ */
+class BinaryLog {
+
+  public:
+    static void encodeHeader(uint8_t* buffer);
+    static bool decodeHeader(const uint8_t* buffer, BinaryLogScales* scales);
+    static void encodeRecord(uint8_t* buffer, const BinaryLogRecord* record);
+    static void decodeRecord(const uint8_t* buffer, const BinaryLogScales* scales, BinaryLogRecord* record);
+    static uint8_t* put(uint8_t* buffer, uint32_t value, uint8_t size);  // Little endian integer
+    static uint32_t get(const uint8_t* buffer, uint8_t size);
+
+  private:
+    static int32_t scale(float value, float unit, int32_t minValue, int32_t maxValue);
+};
+
+
+#endif // _BINARY_LOG_H_
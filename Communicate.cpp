@@ -15,14 +15,12 @@ volatile char Communicate::request = 0;
 
 
 //==============================================================================
-// Checks if there is any char in Serial Monitor buffer at each interruption
+// Checks if there is any char in Serial Monitor buffer at each interruption.
+// While a request is handled, the following chars are left to its input
 //
 void serialEvent() {
-  while (Serial.available()) {
-    char inChar = Serial.read();
-    if (Communicate::request == 0) {
-      Communicate::request = inChar;
-    }
+  if (Communicate::request == 0 && Serial.available()) {
+    Communicate::request = Serial.read();
   }
 }
 //------------------------------------------------------------------------------
@@ -31,12 +29,20 @@ void serialEvent() {
 //==============================================================================
 // SETUP of the class object
 //
-void Communicate::begin(uint16_t baudRate=9600) {
+void Communicate::begin(uint16_t baudRate) {
+  this->baudRate = baudRate;
   pinMode(BLUETOOTH_STATE_PIN, INPUT);
   Serial.begin(baudRate);
   Bluetooth.attachInterrupt(bluetoothEvent);
   Bluetooth.begin(baudRate);
 }
+
+// Change the USB serial rate once the pending output is sent. The bluetooth
+// module keeps the rate it was configured with
+void Communicate::setSerialBaudRate(uint32_t baudRate) {
+  Serial.flush();
+  Serial.begin(baudRate ? baudRate : this->baudRate);
+}
 //------------------------------------------------------------------------------
 
 
@@ -82,6 +88,46 @@ char* Communicate::waitForInput() {
 //------------------------------------------------------------------------------
 
 
+//==============================================================================
+// Read the chars waiting, without blocking -- Return the first word of a
+// complete line, or NULL while the line is incomplete. The request being
+// handled must have disabled the bluetooth interrupt
+//
+char* Communicate::pollInput() {
+
+  bool complete = false;
+  while (!complete && commPort->available()) {
+    char inChar = commPort->read();
+    lastInputTime = HalClock::millis();
+    if (inChar == '\n' || inChar == '\r') {
+      complete = (inputLength > 0);
+    }
+    else if (inputLength < sizeof(cinBuff) - 1) {
+      cinBuff[inputLength++] = inChar;
+    }
+  }
+
+  if (!complete && !(inputLength > 0 && HalClock::millis() - lastInputTime >= INPUT_LINE_GAP)) {
+    return NULL;
+  }
+  cinBuff[inputLength] = '\0';
+  inputLength = 0;
+
+  // First word of the line, as "cin >> cinBuff"
+  char* word = cinBuff;
+  while (*word == ' ' || *word == '\t') {
+    ++word;
+  }
+  char* end = word;
+  while (*end != '\0' && *end != ' ' && *end != '\t') {
+    ++end;
+  }
+  *end = '\0';
+  return (*word != '\0') ? word : NULL;
+}
+//------------------------------------------------------------------------------
+
+
 //==============================================================================
 // Check wether USB or Bluetooth are connected
 //
@@ -5,11 +5,11 @@
 #ifndef _COMMUNICATE_H_
 #define _COMMUNICATE_H_
 
-#include <SdFat.h>
-#include <NeoSWSerial.h>
-#include <Wire.h>
+#include "HAL.h"
 
-#include "Arduino.h"
+// An input line without terminator ends after this pause (ms), as the
+// readline of ArduinoInStream does
+#define INPUT_LINE_GAP 10
 
 
 /*----------------------------------------------------------------------------
@@ -30,17 +30,23 @@ class Communicate {
       commPort = &Serial;
       serialMonitorConnected = false;
       bluetoothConnected = false;
+      inputLength = 0;
+      lastInputTime = 0;
+      baudRate = 9600;
     }
 
     void begin(uint16_t baudRate=9600);
+    void setSerialBaudRate(uint32_t baudRate);  // USB serial only (0: back to the rate of begin)
     void clearSerialBuffer();
     void waitForConnection();
     char* waitForInput();
+    char* pollInput();
+    void clearInput() { inputLength = 0; }
     bool isUSBConnected();
     bool isBluetoothConnected();
-    bool isDeviceConnected() const {return isBluetoothConnected() || isUSBConnected(); }
+    bool isDeviceConnected() { return isBluetoothConnected() || isUSBConnected(); }
     char getRequest() const { return request; }
-    char resetRequest() { request = 0; }
+    void resetRequest() { request = 0; }
     void bluetoothListen() { Bluetooth.attachInterrupt(bluetoothEvent); }
     void bluetoothIgnore() { Bluetooth.detachInterrupt(); }
     Stream* getCommPort() const { return commPort; }
@@ -52,12 +58,15 @@ class Communicate {
 
     ArduinoOutStream* cout;
     Stream* commPort;
-    NeoSWSerial Bluetooth;
+    HalSoftSerial Bluetooth;
+    uint16_t baudRate;
 
     bool serialMonitorConnected;
     bool bluetoothConnected;
 
     char cinBuff[21];
+    uint8_t inputLength;
+    uint32_t lastInputTime;
 
     // Trigger interrupt when any char is received at the buffer by bluetooth
     static void bluetoothEvent(uint8_t inChar) { if (request == 0) {request = inChar;} }
@@ -0,0 +1,258 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class DeltaLog
+ *  Row to row coding of the day files, for the compressed transfer
+ */
+
+#include "DeltaLog.h"
+#include "FileSystem.h"
+
+// Binary record fields after the timestamp, as BinaryLog::encodeRecord
+static const uint8_t FIELD_SIZES[DELTA_BINARY_FIELDS] = { 2, 2, 4, 4, 2, 2, 2 };
+static const bool FIELD_SIGNED[DELTA_BINARY_FIELDS] = { false, false, true, false, true, false, false };
+
+
+//==============================================================================
+// Stream header
+//
+void DeltaLog::begin(uint8_t logFormat, uint8_t csvDecimals) {
+  format = logFormat;
+  decimals = csvDecimals;
+  lastTime = 0;
+  memset(last, 0, sizeof(last));
+}
+
+void DeltaLog::encodeHeader(uint8_t* buffer) const {
+  memcpy(buffer, DELTA_LOG_MAGIC, 4);
+  buffer[4] = DELTA_LOG_VERSION;
+  buffer[5] = format;
+  buffer[6] = decimals;
+  buffer[7] = 0;
+}
+
+bool DeltaLog::decodeHeader(const uint8_t* buffer) {
+  if (memcmp(buffer, DELTA_LOG_MAGIC, 4) != 0 || buffer[4] != DELTA_LOG_VERSION) {
+    return false;
+  }
+  begin(buffer[5], buffer[6]);
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Zigzag varints: small differences of either sign take one byte
+//
+uint8_t DeltaLog::putVarint(uint8_t* buffer, int32_t value) {
+  uint32_t zigzag = (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+  uint8_t size = 0;
+  while (zigzag >= 0x80) {
+    buffer[size++] = uint8_t(zigzag) | 0x80;
+    zigzag >>= 7;
+  }
+  buffer[size++] = uint8_t(zigzag);
+  return size;
+}
+
+uint8_t DeltaLog::getVarint(const uint8_t* data, uint16_t size, int32_t* value) {
+  uint32_t zigzag = 0;
+  for (uint8_t i = 0; i < DELTA_VARINT_SIZE && i < size; ++i) {
+    zigzag |= uint32_t(data[i] & 0x7F) << (7 * i);
+    if (!(data[i] & 0x80)) {
+      *value = int32_t((zigzag >> 1) ^ (0 - (zigzag & 1)));
+      return i + 1;
+    }
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Encoder: differences against the previous row, kept for the next one
+//
+bool DeltaLog::encodeRow(Print* output, const char* row, uint8_t length) {
+
+  uint32_t time;
+  int32_t values[DELTA_MAX_COLUMNS];
+  uint8_t columns = 0;
+
+  if (length < DELTA_DATE_TIME || !parseDateTime(row, &time)) {
+    return false;
+  }
+  for (uint8_t start = DELTA_DATE_TIME; start < length; ) {
+    if (row[start] != ';' || columns == DELTA_MAX_COLUMNS) {
+      return false;
+    }
+    const char* end = (const char*)memchr(row + start + 1, ';', length - start - 1);
+    uint8_t fieldEnd = end ? uint8_t(end - row) : length;
+    if (!parseColumn(row + start + 1, fieldEnd - start - 1, decimals, &values[columns++])) {
+      return false;
+    }
+    start = fieldEnd;
+  }
+
+  uint8_t buffer[DELTA_VARINT_SIZE];
+  output->write(uint8_t(columns + DELTA_TAG_COLUMNS));
+  output->write(buffer, putVarint(buffer, int32_t(time - lastTime)));
+  for (uint8_t column = 0; column < columns; ++column) {
+    output->write(buffer, putVarint(buffer, int32_t(uint32_t(values[column]) - uint32_t(last[column]))));
+    last[column] = values[column];
+  }
+  lastTime = time;
+  return true;
+}
+
+void DeltaLog::encodeRecord(Print* output, const uint8_t* record) {
+
+  uint8_t buffer[DELTA_VARINT_SIZE];
+  uint32_t time = BinaryLog::get(record, 4);
+  output->write(uint8_t(DELTA_BINARY_FIELDS + DELTA_TAG_COLUMNS));
+  output->write(buffer, putVarint(buffer, int32_t(time - lastTime)));
+  lastTime = time;
+
+  record += 4;
+  for (uint8_t field = 0; field < DELTA_BINARY_FIELDS; ++field) {
+    int32_t value = BinaryLog::get(record, FIELD_SIZES[field]);
+    if (FIELD_SIGNED[field] && FIELD_SIZES[field] == 2) {
+      value = int16_t(value);
+    }
+    output->write(buffer, putVarint(buffer, int32_t(uint32_t(value) - uint32_t(last[field]))));
+    last[field] = value;
+    record += FIELD_SIZES[field];
+  }
+}
+
+// "DD/MM/YYYY;hh:mm:ss" -- Return false unless it is written back the same
+bool DeltaLog::parseDateTime(const char* text, uint32_t* time) {
+
+  char check[DELTA_DATE_TIME + 1];
+  for (uint8_t i = 0; i < DELTA_DATE_TIME; ++i) {
+    bool separator = (i == 2 || i == 5 || i == 10 || i == 13 || i == 16);
+    if (separator == (text[i] >= '0' && text[i] <= '9')) {
+      return false;
+    }
+  }
+  HalDateTime dateTime(atoi(text + 6), atoi(text + 3), atoi(text), atoi(text + 11), atoi(text + 14), atoi(text + 17));
+  sprintf(check, DATE_FORMAT COMMA HOUR_FORMAT, dateTime.day(), dateTime.month(), dateTime.year(),
+          dateTime.hour(), dateTime.minute(), dateTime.second());
+  *time = dateTime.unixtime();
+  return memcmp(check, text, DELTA_DATE_TIME) == 0;
+}
+
+// "-123.4567" in units of the last decimal -- Return false unless it is
+// written back the same (no leading zero, no negative zero)
+bool DeltaLog::parseColumn(const char* text, uint8_t length, uint8_t decimals, int32_t* value) {
+
+  bool negative = (length > 0 && text[0] == '-');
+  uint8_t i = negative ? 1 : 0;
+  uint8_t digits = 0, fraction = 0;
+  bool point = false;
+  int32_t units = 0;
+
+  if (length - i > 1 && text[i] == '0' && text[i + 1] != '.') {
+    return false;
+  }
+  for (; i < length; ++i) {
+    if (text[i] == '.' && !point && digits > 0) {
+      point = true;
+      continue;
+    }
+    if (text[i] < '0' || text[i] > '9' || ++digits > DELTA_MAX_DIGITS) {
+      return false;
+    }
+    units = units * 10 + (text[i] - '0');
+    fraction += point ? 1 : 0;
+  }
+  if (digits == 0 || fraction != decimals || point != (decimals > 0) || (negative && units == 0)) {
+    return false;
+  }
+  *value = negative ? -units : units;
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Decoder
+//
+uint16_t DeltaLog::decodeRow(const uint8_t* data, uint16_t size, Print* output) {
+
+  if (size == 0 || data[0] == DELTA_TAG_END) {
+    return 0;
+  }
+  uint8_t tag = data[0];
+  uint16_t used = 1;
+
+  // Up to the '\n', or to the end of the stream after a row cut by a reset
+  if (tag == DELTA_TAG_LITERAL) {
+    for (uint16_t i = used; i < size; ++i) {
+      if (data[i] == '\n' || data[i] == 0) {
+        uint16_t end = (data[i] == '\n') ? i + 1 : i;
+        output->write(data + used, end - used);
+        return end;
+      }
+    }
+    return 0;
+  }
+
+  uint8_t columns = tag - DELTA_TAG_COLUMNS;
+  if (columns > DELTA_MAX_COLUMNS || (format == LOG_FORMAT_BINARY && columns != DELTA_BINARY_FIELDS)) {
+    return 0;
+  }
+  int32_t difference, values[DELTA_MAX_COLUMNS];
+  uint8_t varint = getVarint(data + used, size - used, &difference);
+  uint32_t time = lastTime + uint32_t(difference);
+  for (uint8_t column = 0; varint && column < columns; ++column) {
+    used += varint;
+    varint = getVarint(data + used, size - used, &difference);
+    values[column] = int32_t(uint32_t(last[column]) + uint32_t(difference));
+  }
+  if (varint == 0) {
+    return 0;
+  }
+  used += varint;
+
+  lastTime = time;
+  memcpy(last, values, columns * sizeof(int32_t));
+  writeColumns(output, time, values, columns);
+  return used;
+}
+
+void DeltaLog::writeColumns(Print* output, uint32_t time, const int32_t* values, uint8_t columns) {
+
+  if (format == LOG_FORMAT_BINARY) {
+    uint8_t record[BINARY_LOG_RECORD_SIZE];
+    uint8_t* cursor = BinaryLog::put(record, time, 4);
+    for (uint8_t field = 0; field < DELTA_BINARY_FIELDS; ++field) {
+      cursor = BinaryLog::put(cursor, uint32_t(values[field]), FIELD_SIZES[field]);
+    }
+    output->write(record, sizeof(record));
+    return;
+  }
+
+  char text[DELTA_DATE_TIME + 2];
+  HalDateTime dateTime(time);
+  sprintf(text, DATE_FORMAT COMMA HOUR_FORMAT, dateTime.day(), dateTime.month(), dateTime.year(),
+          dateTime.hour(), dateTime.minute(), dateTime.second());
+  output->write(text);
+
+  uint32_t unit = 1;
+  for (uint8_t i = 0; i < decimals; ++i) {
+    unit *= 10;
+  }
+  for (uint8_t column = 0; column < columns; ++column) {
+    uint32_t magnitude = (values[column] < 0) ? 0 - uint32_t(values[column]) : uint32_t(values[column]);
+    sprintf(text, ";%s%lu", (values[column] < 0) ? "-" : "", (unsigned long)(magnitude / unit));
+    output->write(text);
+    if (decimals > 0) {
+      sprintf(text, ".%0*lu", int(decimals), (unsigned long)(magnitude % unit));
+      output->write(text);
+    }
+  }
+  output->write('\n');
+}
+//------------------------------------------------------------------------------
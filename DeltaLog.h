@@ -0,0 +1,81 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _DELTA_LOG_H_
+#define _DELTA_LOG_H_
+
+#include "HAL.h"
+
+// Stream header: magic, version, format of the day file (LOG_FORMAT_), CSV
+// decimals and a reserved byte
+#define DELTA_LOG_MAGIC       "MPDL"
+#define DELTA_LOG_VERSION     1
+#define DELTA_LOG_HEADER_SIZE 8
+
+// Rows of the stream start with a tag byte
+#define DELTA_TAG_END     0  // End of the stream
+#define DELTA_TAG_LITERAL 1  // Row as in the file, up to its '\n'
+#define DELTA_TAG_COLUMNS 2  // Coded row: the tag less this is its count of columns
+
+// Differences are kept for this many columns after the date and time. A CSV
+// row is coded when it fits the line buffer (on the stack while a row is
+// coded) and every column is written with the CSV decimals; the other rows
+// are sent literal
+#define DELTA_MAX_COLUMNS  12
+#define DELTA_LINE_SIZE    128
+#define DELTA_VARINT_SIZE  5
+#define DELTA_DATE_TIME    19    // "DD/MM/YYYY;hh:mm:ss"
+#define DELTA_MAX_DIGITS   9     // Digits of a column, so it fits an int32
+
+// Binary records: fields after the timestamp (sizes, sign of the field)
+#define DELTA_BINARY_FIELDS 7
+
+
+/*----------------------------------------------------------------------------
+ *  Class DeltaLog
+ *  Compressed transfer of the day files. Each row is coded against the
+ *  previous one: the time, then every column as an integer (CSV: in units
+ *  of the last decimal, binary: the record field), as the zigzag varint of
+ *  the difference. Readings change slowly, so most differences take one or
+ *  two bytes. The decoded rows are the rows of the file, byte for byte
+ *
+ *    row  tag [time difference, column differences...] | tag row text '\n'
+ */
+class DeltaLog {
+
+  public:
+    DeltaLog() {
+      begin(0, 0);
+    }
+
+    // Previous row cleared, at the start of a stream
+    void begin(uint8_t logFormat, uint8_t csvDecimals);
+    void encodeHeader(uint8_t* buffer) const;
+    bool decodeHeader(const uint8_t* buffer);  // Return the header is of a known version
+    uint8_t getFormat() const { return format; }
+
+    // A CSV row without its '\n' -- Return false if it can not be coded (to
+    // be sent literal), the previous row left as it was
+    bool encodeRow(Print* output, const char* row, uint8_t length);
+    void encodeRecord(Print* output, const uint8_t* record);  // Binary record
+
+    // A row of the stream to the output, as in the day file (binary records
+    // without the file header) -- Return the bytes of the stream used, 0 at
+    // the end of the stream or when the row is cut
+    uint16_t decodeRow(const uint8_t* data, uint16_t size, Print* output);
+
+    static uint8_t putVarint(uint8_t* buffer, int32_t value);  // Zigzag, return its size
+    static uint8_t getVarint(const uint8_t* data, uint16_t size, int32_t* value);  // Return its size, 0 when cut
+
+  private:
+    static bool parseDateTime(const char* text, uint32_t* time);
+    static bool parseColumn(const char* text, uint8_t length, uint8_t decimals, int32_t* value);
+    void writeColumns(Print* output, uint32_t time, const int32_t* values, uint8_t columns);
+
+    uint8_t format, decimals;
+    uint32_t lastTime;
+    int32_t last[DELTA_MAX_COLUMNS];
+};
+
+
+#endif // _DELTA_LOG_H_
@@ -0,0 +1,261 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class EnergySummary
+ *  Hourly and daily aggregates of the readings
+ */
+
+#include "EnergySummary.h"
+#include "BinaryLog.h"
+#include "FrameLink.h"
+
+
+//==============================================================================
+// Readings: the hour and the day start again when the reading is past them
+//
+bool EnergySummary::add(uint32_t time, Measure* measure) {
+  return add(time, measure->getLastPeriod(), measure->getVoltageRMS(), measure->getCurrentRMS(),
+             measure->getRealPower(), measure->getApparentPower(), measure->getPowerFactor());
+}
+
+bool EnergySummary::add(uint32_t time, PhaseSet* phaseSet) {
+  Measure* first = phaseSet->getPhase(0);
+  return add(time, phaseSet->getLastPeriod(), first->getVoltageRMS(), first->getCurrentRMS(),
+             phaseSet->getRealPower(), phaseSet->getApparentPower(), phaseSet->getPowerFactor());
+}
+
+bool EnergySummary::add(uint32_t time, float seconds, float voltage, float current, float realPower, float apparentPower, float powerFactor) {
+
+  uint32_t hourStart = time - time % SECONDS_PER_HOUR;
+
+  if (!started) {
+    clearRecord(&hour, hourStart);
+    clearRecord(&day, time - time % SECONDS_PER_DAY);
+    startSubinterval(time);
+    demandCount = 0;
+    started = true;
+  }
+  else if (hour.start != hourStart) {
+    // First call: the subinterval goes to the ended hour, to be recorded
+    if (!hourEnded) {
+      closeSubinterval();
+      startSubinterval(time);
+      hourEnded = true;
+      return false;
+    }
+    clearRecord(&hour, hourStart);
+    if (day.start != time - time % SECONDS_PER_DAY) {
+      clearRecord(&day, time - time % SECONDS_PER_DAY);
+    }
+  }
+  else if (time / DEMAND_SUBINTERVAL_SECONDS != subinterval) {
+    closeSubinterval();
+    startSubinterval(time);
+  }
+  hourEnded = false;
+
+  // Energy and sums of the subinterval, extremes of the hour and the day
+  float reactivePower = apparentPower * apparentPower - realPower * realPower;
+  reactivePower = (reactivePower > 0) ? sqrt(reactivePower) : 0;
+  subEnergy += realPower * seconds;
+  subReactiveEnergy += reactivePower * seconds;
+  subSeconds += seconds;
+
+  const float values[SUMMARY_QUANTITIES] = { voltage, current, realPower, powerFactor };
+  for (uint8_t quantity = 0; quantity < SUMMARY_QUANTITIES; ++quantity) {
+    subSum[quantity] += values[quantity];
+    addValue(&hour, quantity, values[quantity]);
+    addValue(&day, quantity, values[quantity]);
+  }
+  ++hour.readings;
+  ++day.readings;
+  return true;
+}
+
+void EnergySummary::addValue(SummaryRecord* record, uint8_t quantity, float value) {
+  if (record->readings == 0 || value < record->min[quantity]) {
+    record->min[quantity] = value;
+  }
+  if (record->readings == 0 || value > record->max[quantity]) {
+    record->max[quantity] = value;
+  }
+}
+
+void EnergySummary::clearRecord(SummaryRecord* record, uint32_t start) {
+  memset(record, 0, sizeof(SummaryRecord));
+  record->start = start;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Subintervals: folded into the hour and the day as they end. The demand
+// interval restarts after a gap in the subintervals
+//
+void EnergySummary::startSubinterval(uint32_t time) {
+
+  uint32_t next = time / DEMAND_SUBINTERVAL_SECONDS;
+  if (next != subinterval + 1) {
+    demandCount = 0;
+  }
+  subinterval = next;
+  subEnergy = 0;
+  subReactiveEnergy = 0;
+  subSeconds = 0;
+  for (uint8_t quantity = 0; quantity < SUMMARY_QUANTITIES; ++quantity) {
+    subSum[quantity] = 0;
+  }
+}
+
+void EnergySummary::closeSubinterval() {
+
+  SummaryRecord* records[2] = { &hour, &day };
+  for (uint8_t i = 0; i < 2; ++i) {
+    records[i]->energy += subEnergy / SECONDS_PER_HOUR;
+    records[i]->reactiveEnergy += subReactiveEnergy / SECONDS_PER_HOUR;
+    records[i]->seconds += subSeconds;
+    for (uint8_t quantity = 0; quantity < SUMMARY_QUANTITIES; ++quantity) {
+      records[i]->sum[quantity] += subSum[quantity];
+    }
+  }
+
+  if (subSeconds <= 0) {
+    return;
+  }
+  demandEnergy[demandIndex] = subEnergy;
+  demandSeconds[demandIndex] = subSeconds;
+  demandIndex = (demandIndex + 1) % DEMAND_SUBINTERVALS;
+  if (demandCount < DEMAND_SUBINTERVALS) {
+    ++demandCount;
+  }
+  if (demandCount < DEMAND_SUBINTERVALS) {
+    return;
+  }
+
+  float energy = 0, seconds = 0;
+  for (uint8_t i = 0; i < DEMAND_SUBINTERVALS; ++i) {
+    energy += demandEnergy[i];
+    seconds += demandSeconds[i];
+  }
+  float demand = energy / seconds;
+  for (uint8_t i = 0; i < 2; ++i) {
+    if (demand > records[i]->maxDemand) {
+      records[i]->maxDemand = demand;
+    }
+  }
+}
+
+// A record as written: with the subinterval in progress (none when an hour
+// ended, its subinterval is already folded)
+void EnergySummary::getRecord(const SummaryRecord& source, SummaryRecord* record) const {
+
+  *record = source;
+  record->energy += subEnergy / SECONDS_PER_HOUR;
+  record->reactiveEnergy += subReactiveEnergy / SECONDS_PER_HOUR;
+  record->seconds += subSeconds;
+  for (uint8_t quantity = 0; quantity < SUMMARY_QUANTITIES; ++quantity) {
+    record->sum[quantity] += subSum[quantity];
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Records read back after a reset: the demand interval starts again
+//
+void EnergySummary::restore(const SummaryRecord* hourRecord, const SummaryRecord* dayRecord, uint32_t time) {
+
+  if (hourRecord) {
+    hour = *hourRecord;
+  }
+  else {
+    clearRecord(&hour, time - time % SECONDS_PER_HOUR);
+  }
+  if (dayRecord) {
+    day = *dayRecord;
+  }
+  else {
+    clearRecord(&day, time - time % SECONDS_PER_DAY);
+  }
+  startSubinterval(time);
+  demandCount = 0;
+  hourEnded = false;
+  lastCheckpoint = time;
+  started = true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Little endian encoding: start, readings, sequence of the write (16 bits),
+// seconds, energy, reactive energy, max demand, then min, max and sum of each
+// quantity (floats) and the CRC16
+//
+void EnergySummary::encodeRecord(uint8_t* buffer, const SummaryRecord* record, uint16_t sequence) {
+
+  const float* fields[4] = { &record->seconds, &record->energy, &record->reactiveEnergy, &record->maxDemand };
+  const float* quantities[3] = { record->min, record->max, record->sum };
+
+  uint8_t* cursor = BinaryLog::put(buffer, record->start, 4);
+  cursor = BinaryLog::put(cursor, record->readings, 4);
+  cursor = BinaryLog::put(cursor, sequence, 2);
+  for (uint8_t i = 0; i < 4; ++i) {
+    cursor = putFloat(cursor, *fields[i]);
+  }
+  for (uint8_t i = 0; i < 3; ++i) {
+    for (uint8_t quantity = 0; quantity < SUMMARY_QUANTITIES; ++quantity) {
+      cursor = putFloat(cursor, quantities[i][quantity]);
+    }
+  }
+  BinaryLog::put(cursor, FrameLink::crc16(0xFFFF, buffer, SUMMARY_RECORD_SIZE - 2), 2);
+}
+
+bool EnergySummary::decodeRecord(const uint8_t* buffer, SummaryRecord* record) {
+
+  uint32_t start;
+  uint16_t sequence;
+  if (!checkRecord(buffer, &start, &sequence)) {
+    return false;
+  }
+  float* fields[4] = { &record->seconds, &record->energy, &record->reactiveEnergy, &record->maxDemand };
+  float* quantities[3] = { record->min, record->max, record->sum };
+
+  record->start = start;
+  record->readings = BinaryLog::get(buffer + 4, 4);
+  const uint8_t* cursor = buffer + 10;
+  for (uint8_t i = 0; i < 4; ++i, cursor += 4) {
+    *fields[i] = getFloat(cursor);
+  }
+  for (uint8_t i = 0; i < 3; ++i) {
+    for (uint8_t quantity = 0; quantity < SUMMARY_QUANTITIES; ++quantity, cursor += 4) {
+      quantities[i][quantity] = getFloat(cursor);
+    }
+  }
+  return true;
+}
+
+bool EnergySummary::checkRecord(const uint8_t* buffer, uint32_t* start, uint16_t* sequence) {
+
+  if (FrameLink::crc16(0xFFFF, buffer, SUMMARY_RECORD_SIZE - 2) != BinaryLog::get(buffer + SUMMARY_RECORD_SIZE - 2, 2)) {
+    return false;
+  }
+  *start = BinaryLog::get(buffer, 4);
+  *sequence = BinaryLog::get(buffer + 8, 2);
+  return BinaryLog::get(buffer + 4, 4) > 0;
+}
+
+uint8_t* EnergySummary::putFloat(uint8_t* buffer, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return BinaryLog::put(buffer, bits, 4);
+}
+
+float EnergySummary::getFloat(const uint8_t* buffer) {
+  uint32_t bits = BinaryLog::get(buffer, 4);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+//------------------------------------------------------------------------------
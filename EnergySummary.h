@@ -0,0 +1,122 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _ENERGY_SUMMARY_H_
+#define _ENERGY_SUMMARY_H_
+
+#include "HAL.h"
+#include "PhaseSet.h"
+
+#define SECONDS_PER_HOUR 3600UL
+#define SECONDS_PER_DAY  86400UL
+
+// Readings are summed over subintervals of the clock, then folded into the
+// hour and the day, so the float sums keep their precision for a whole day.
+// The rolling demand is the mean real power of the last DEMAND_SUBINTERVALS
+// subintervals (15 minutes, sliding every 5), taken as each one ends
+#define DEMAND_SUBINTERVALS        3
+#define DEMAND_SUBINTERVAL_SECONDS 300
+
+// The records of the present hour and day are written at most this often (s)
+// and when an hour ends
+#define SUMMARY_CHECKPOINT_PERIOD 60
+
+// Summary file of a month: per day of the month, a slot per hour and then
+// the day slot. A slot holds two copies of its record, written in turn with
+// a sequence number, and the newer valid one is read: a write torn by a reset
+// leaves the copy before it. A record ends with a CRC16 of the rest
+#define SUMMARY_SLOTS_PER_DAY 25
+#define SUMMARY_DAY_SLOT      24
+#define SUMMARY_RECORD_SIZE   76
+#define SUMMARY_RECORD_COPIES 2
+#define SUMMARY_SLOT_SIZE     (SUMMARY_RECORD_COPIES * SUMMARY_RECORD_SIZE)
+
+// Quantities with minimum, mean and maximum
+#define SUMMARY_VOLTAGE      0
+#define SUMMARY_CURRENT      1
+#define SUMMARY_POWER        2
+#define SUMMARY_POWER_FACTOR 3
+#define SUMMARY_QUANTITIES   4
+
+#define SUMMARY_HEADER "period;date;time;duration(s);readings;energy(Wh);reactiveEnergy(varh);maxDemand(W);" \
+                       "minVoltage(V);meanVoltage(V);maxVoltage(V);minCurrent(A);meanCurrent(A);maxCurrent(A);" \
+                       "minPower(W);meanPower(W);maxPower(W);minPowerFactor;meanPowerFactor;maxPowerFactor"
+
+
+/*----------------------------------------------------------------------------
+ *  Struct SummaryRecord
+ *  Aggregates of an hour or a day, as written to the summary file
+ */
+struct SummaryRecord {
+  uint32_t start;                 // Unix time of the start of the hour or day
+  uint32_t readings;
+  float seconds;                  // Time measured
+  float energy, reactiveEnergy;   // Wh, varh
+  float maxDemand;                // W, 0 before a whole demand interval
+  float min[SUMMARY_QUANTITIES], max[SUMMARY_QUANTITIES], sum[SUMMARY_QUANTITIES];
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class EnergySummary
+ *  Energy, reactive energy, rolling demand and the minimum, mean and
+ *  maximum of voltage, current, real power and power factor of the present
+ *  hour and day, updated at every reading. About 230 bytes of RAM
+ */
+class EnergySummary {
+
+  public:
+    EnergySummary() {
+      started = false;
+      hourEnded = false;
+      lastCheckpoint = 0;
+      subinterval = 0;
+      demandIndex = 0;
+      demandCount = 0;
+    }
+
+    // Reading of a measure, or of a phase set (total powers, voltage and
+    // current of the first phase) -- Return false when the reading starts
+    // another hour: the ended hour is recorded, then the reading added again
+    bool add(uint32_t time, Measure* measure);
+    bool add(uint32_t time, PhaseSet* phaseSet);
+    bool add(uint32_t time, float seconds, float voltage, float current, float realPower, float apparentPower, float powerFactor);
+
+    // Records with the subinterval in progress, and their checkpoint
+    bool isStarted() const { return started; }
+    void getHour(SummaryRecord* record) const { getRecord(hour, record); }
+    void getDay(SummaryRecord* record) const { getRecord(day, record); }
+    bool isCheckpointDue(uint32_t time) const { return started && time - lastCheckpoint >= SUMMARY_CHECKPOINT_PERIOD; }
+    void setCheckpoint(uint32_t time) { lastCheckpoint = time; }
+
+    // Records read back after a reset (NULL: not found), to go on at time
+    void restore(const SummaryRecord* hourRecord, const SummaryRecord* dayRecord, uint32_t time);
+
+    static void encodeRecord(uint8_t* buffer, const SummaryRecord* record, uint16_t sequence);
+    static bool decodeRecord(const uint8_t* buffer, SummaryRecord* record);  // Return the record is valid
+    // Return the CRC matches and the record holds readings, with its start and sequence
+    static bool checkRecord(const uint8_t* buffer, uint32_t* start, uint16_t* sequence);
+
+  private:
+    static void clearRecord(SummaryRecord* record, uint32_t start);
+    void getRecord(const SummaryRecord& source, SummaryRecord* record) const;
+    void startSubinterval(uint32_t time);
+    void closeSubinterval();
+    static void addValue(SummaryRecord* record, uint8_t quantity, float value);
+    static uint8_t* putFloat(uint8_t* buffer, float value);  // Little endian IEEE bits
+    static float getFloat(const uint8_t* buffer);
+
+    bool started, hourEnded;
+    uint32_t lastCheckpoint;
+    SummaryRecord hour, day;
+
+    // Subinterval in progress and the last ones of the demand interval
+    uint32_t subinterval;
+    float subEnergy, subReactiveEnergy, subSeconds;  // Ws, vars, s
+    float subSum[SUMMARY_QUANTITIES];
+    float demandEnergy[DEMAND_SUBINTERVALS], demandSeconds[DEMAND_SUBINTERVALS];
+    uint8_t demandIndex, demandCount;
+};
+
+
+#endif // _ENERGY_SUMMARY_H_
@@ -11,10 +11,46 @@
 #include "FileSystem.h"
 
 
+/*----------------------------------------------------------------------------
+ *  Class PieceWriter
+ *  Print that passes on a window of what is written to it: a row formatted
+ *  again at every step of a transfer goes out from the first byte not sent,
+ *  as much as the port takes
+ */
+class PieceWriter : public Print {
+
+  public:
+    PieceWriter(Print* output, uint16_t skip, uint16_t budget) {
+      this->output = output;
+      first = skip;
+      end = skip + budget;
+      position = 0;
+    }
+
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const uint8_t* buffer, size_t size) {
+      uint16_t from = (position < first) ? first : position;
+      uint16_t to = (position + size > end) ? end : position + size;
+      if (from < to) {
+        output->write(buffer + from - position, to - from);
+      }
+      position += size;
+      return size;
+    }
+
+    bool isComplete() const { return position <= end; }  // The rest of the text went out
+    uint16_t getEnd() const { return end; }
+
+  private:
+    Print* output;
+    uint16_t first, end, position;
+};
+
+
 //==============================================================================
 // Return date and time using FAT_DATE macro to format fields
 //
-static void FileSystem::FATDateTime(uint16_t* date, uint16_t* time) {
+void FileSystem::FATDateTime(uint16_t* date, uint16_t* time) {
   *date = FAT_DATE(timeCounter.getYear(), timeCounter.getMonth(), timeCounter.getDay());
   *time = FAT_TIME(timeCounter.getHour(), timeCounter.getMinutes(), timeCounter.getSeconds());
 }
@@ -35,10 +71,10 @@ bool FileSystem::begin() {
 //
 bool FileSystem::saveActiveSession(char* dir, char* fileName) {
 
-  File autoconfigFile;
+  HalFile autoconfigFile;
   ArduinoOutStream fileStream(autoconfigFile);
 
-  SdFile::dateTimeCallback(FATDateTime);
+  HalFile::dateTimeCallback(FATDateTime);
   autoconfigFile = sd.open(fileName, O_RDWR | O_CREAT);
   if (!autoconfigFile) {
     return false;
@@ -69,7 +105,7 @@ bool FileSystem::deleteAutoconfigFile(char* fileName) {
 //
 bool FileSystem::restoreSession(char* fileName) {
 
-  File autoconfigFile;
+  HalFile autoconfigFile;
   autoconfigFile = sd.open(fileName, O_RDONLY);
   if (!autoconfigFile) {
     return false;
@@ -102,6 +138,7 @@ bool FileSystem::restoreSession(char* fileName) {
 // Navigate to specified folder
 //
 bool FileSystem::changeDir (char* dir) {
+  closeLog(false);
   return sd.chdir(dir);
 }
 //------------------------------------------------------------------------------
@@ -116,7 +153,7 @@ bool FileSystem::makeDir(char* dir) {
     return false;
   }
   if (!sd.exists(dir)) {
-    SdFile::dateTimeCallback(FATDateTime);
+    HalFile::dateTimeCallback(FATDateTime);
     return sd.mkdir(dir);
   }
   return true;
@@ -125,48 +162,1526 @@ bool FileSystem::makeDir(char* dir) {
 
 
 //==============================================================================
-// Open file and record the calculated values on the SD Card
+// Persistent log of the day file
+//
+void FileSystem::setPersistentLog(bool enable, uint32_t syncInterval) {
+  if (!enable) {
+    closeLog();
+  }
+  persistentLog = enable;
+  logSyncInterval = syncInterval;
+}
+
+// Keep the day file open, closing the previous one on day rollover
+bool FileSystem::openLog(char* fileName) {
+
+  if (logFile && !strcmp(logName, fileName)) {
+    return true;
+  }
+  closeLog();
+
+  uint32_t startMicros = HalClock::micros();
+  HalFile::dateTimeCallback(FATDateTime);
+  if (!preallocatedReadings) {
+    logFile = sd.open(fileName, O_RDWR | O_CREAT | O_AT_END);
+  }
+  else if (!createLogExtent(fileName)) {
+    // Existing day file (a reset), or no contiguous room: append after the data
+    logFile = sd.open(fileName, O_RDWR | O_CREAT);
+    if (logFile) {
+      logFile.seekSet(findDataEnd(&logFile));
+    }
+  }
+  addPhaseTime(PHASE_SD_OPEN, startMicros);
+  if (!logFile) {
+    return false;
+  }
+
+  strncpy(logName, fileName, sizeof(logName) - 1);
+  logName[sizeof(logName) - 1] = '\0';
+  syncedBlock = logFile.curPosition() / LOG_BLOCK_SIZE;
+  lastSyncTime = HalClock::millis();
+  return true;
+}
+
+// New day file as an erased extent of a day of records -- Return false if
+// the file exists or the card has no contiguous room for it
+bool FileSystem::createLogExtent(char* fileName) {
+
+  if (sd.exists(fileName)) {
+    return false;
+  }
+  uint32_t size = preallocatedReadings * getRecordSize();
+  if (logFormat == LOG_FORMAT_BINARY) {
+    size += BINARY_LOG_HEADER_SIZE;
+  }
+  if (!logFile.createContiguous(sd.vwd(), fileName, size)) {
+    if (logFile) {
+      logFile.close();
+    }
+    return false;
+  }
+
+  // Old contents of the blocks would be taken as data: without the erase
+  // the extent is given back and the file grows
+  uint32_t firstBlock, lastBlock;
+  if (!logFile.contiguousRange(&firstBlock, &lastBlock) || !sd.card()->erase(firstBlock, lastBlock)) {
+    logFile.truncate(0);
+  }
+  return true;
+}
+
+uint16_t FileSystem::getRecordSize() const {
+  if (logFormat == LOG_FORMAT_BINARY) {
+    return BINARY_LOG_RECORD_SIZE;
+  }
+  return CSV_ROW_SIZE * phaseColumns + (harmonicColumns ? CSV_HARMONIC_SIZE : 0);
+}
+
+// End of the data: binary search of the first erased slot, a byte of CSV or
+// the timestamp of a binary record. A file with no erased end takes a read
+uint32_t FileSystem::findDataEnd(HalFile* file) {
+
+  uint32_t size = file->fileSize();
+  uint8_t magic[4];
+  uint32_t first = 0;
+  uint8_t slotSize = 1, checkSize = 1;
+
+  if (size == 0 || isErasedSlot(file, 0, 1)) {
+    return 0;
+  }
+  file->seekSet(0);
+  if (size >= BINARY_LOG_HEADER_SIZE && file->read(magic, 4) == 4 && !memcmp(magic, BINARY_LOG_MAGIC, 4)) {
+    first = BINARY_LOG_HEADER_SIZE;
+    slotSize = BINARY_LOG_RECORD_SIZE;
+    checkSize = 4;
+  }
+
+  // Slots below low hold data, the slot at high is erased
+  uint32_t low = 0;
+  uint32_t high = (size - first) / slotSize;
+  if (high == 0 || !isErasedSlot(file, first + (high - 1) * slotSize, checkSize)) {
+    return size;
+  }
+  --high;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (isErasedSlot(file, first + middle * slotSize, checkSize)) {
+      high = middle;
+    }
+    else {
+      low = middle + 1;
+    }
+  }
+  return first + low * slotSize;
+}
+
+bool FileSystem::isErasedSlot(HalFile* file, uint32_t position, uint8_t size) {
+
+  uint8_t buffer[4];
+  if (!file->seekSet(position) || file->read(buffer, size) != size) {
+    return true;
+  }
+  bool zeros = true, ones = true;
+  for (uint8_t i = 0; i < size; ++i) {
+    zeros = zeros && buffer[i] == 0x00;
+    ones = ones && buffer[i] == 0xFF;
+  }
+  return zeros || ones;
+}
+
+// Write the cached block and the file size to the card
+bool FileSystem::syncLog() {
+
+  if (!logFile) {
+    return true;
+  }
+  uint32_t startMicros = HalClock::micros();
+  syncedBlock = logFile.curPosition() / LOG_BLOCK_SIZE;
+  lastSyncTime = HalClock::millis();
+  bool synced = logFile.sync();
+  addPhaseTime(PHASE_SD_WRITE, startMicros);
+  return synced;
+}
+
+// Shutdown, day rollover, directory change or wipe: nothing may be left in
+// the cache. The erased end of a preallocated file is given back only when
+// released (day rollover, shutdown): a file closed for a directory change or
+// a reset is opened again at the end of its data, and keeps its extent
+void FileSystem::closeLog(bool release) {
+  if (logFile) {
+    uint32_t startMicros = HalClock::micros();
+    if (release && logFile.curPosition() < logFile.fileSize()) {
+      logFile.truncate(logFile.curPosition());
+    }
+    logFile.close();
+    addPhaseTime(PHASE_SD_CLOSE, startMicros);
+  }
+  logName[0] = '\0';
+  indexedSlots = INDEX_UNKNOWN;  // A day file of another folder may have the name
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Record the calculated values on the SD Card, opening and closing the file
+// or appending to the persistent log
 //
 bool FileSystem::recordValues(char* fileName, Measure* measure) {
+  return appendRecord(fileName, measure, NULL);
+}
+
+// Binary records hold the first phase only
+bool FileSystem::recordValues(char* fileName, PhaseSet* phaseSet) {
+  return appendRecord(fileName, phaseSet->getPhase(0), phaseSet);
+}
+
+bool FileSystem::appendRecord(char* fileName, Measure* measure, PhaseSet* phaseSet) {
+
+  uint32_t startMicros = HalClock::micros();
+  HalFile dataFile;
+  HalFile* file = &dataFile;
+
+  if (persistentLog) {
+    if (!openLog(fileName)) {
+      return false;
+    }
+    file = &logFile;
+  }
+  else {
+    uint32_t openMicros = HalClock::micros();
+    HalFile::dateTimeCallback(FATDateTime);
+    dataFile = sd.open(fileName, O_RDWR | O_CREAT | O_AT_END);
+    addPhaseTime(PHASE_SD_OPEN, openMicros);
+    if (!dataFile) {
+      return false;
+    }
+  }
+
+  updateIndex(fileName, file->curPosition());
+
+  uint32_t formatMicros = HalClock::micros();
+  if (logFormat == LOG_FORMAT_BINARY) {
+    writeBinaryRecord(file, measure);
+  }
+  else if (phaseSet) {
+    writePhasesCSVRecord(file, phaseSet);
+  }
+  else {
+    writeCSVRecord(file, measure);
+  }
+  addPhaseTime(PHASE_FORMAT, formatMicros);
+
+  // Rows stay in the SD cache until it fills a block or the interval expires
+  // (interval 0: synced by the caller with syncLog)
+  if (persistentLog) {
+    bool intervalExpired = logSyncInterval && HalClock::millis() - lastSyncTime >= logSyncInterval;
+    if (logFile.curPosition() / LOG_BLOCK_SIZE != syncedBlock || intervalExpired) {
+      syncLog();
+    }
+  }
+  else {
+    uint32_t closeMicros = HalClock::micros();
+    dataFile.close();
+    addPhaseTime(PHASE_SD_CLOSE, closeMicros);
+  }
+
+  lastRecordMicros = HalClock::micros() - startMicros;
+  if (lastRecordMicros > maxRecordMicros) {
+    maxRecordMicros = lastRecordMicros;
+  }
+  ++recordCount;
+  return true;
+}
 
-  File dataFile;
-  ArduinoOutStream fileStream(dataFile);
+// Entries of the index up to the interval of the record about to be written
+// at the offset. The index is opened once per interval (and once per day to
+// read its entries)
+void FileSystem::updateIndex(char* fileName, uint32_t offset) {
 
-  SdFile::dateTimeCallback(FATDateTime);
-  dataFile = sd.open(fileName, O_RDWR | O_CREAT | O_AT_END);
-  if (!dataFile) {
+  uint16_t slot = (timeCounter.getHour() * 60 + timeCounter.getMinutes()) / INDEX_INTERVAL;
+  if (strcmp(indexedLog, fileName)) {
+    strncpy(indexedLog, fileName, sizeof(indexedLog) - 1);
+    indexedLog[sizeof(indexedLog) - 1] = '\0';
+    indexedSlots = INDEX_UNKNOWN;
+  }
+  if (indexedSlots != INDEX_UNKNOWN && slot < indexedSlots) {
+    return;
+  }
+
+  uint32_t startMicros = HalClock::micros();
+  char indexName[INDEX_NAME_SIZE];
+  HalFile indexFile;
+  uint8_t entry[INDEX_ENTRY_SIZE];
+
+  makeIndexName(fileName, indexName);
+  indexFile = sd.open(indexName, O_RDWR | O_CREAT);
+  if (!indexFile) {
+    return;
+  }
+
+  // Appended after the last whole entry
+  indexedSlots = indexFile.fileSize() / INDEX_ENTRY_SIZE;
+  indexFile.seekSet(uint32_t(indexedSlots) * INDEX_ENTRY_SIZE);
+  BinaryLog::put(entry, offset, INDEX_ENTRY_SIZE);
+  while (indexedSlots <= slot) {
+    indexFile.write(entry, INDEX_ENTRY_SIZE);
+    ++indexedSlots;
+  }
+  indexFile.close();
+  addPhaseTime(PHASE_SD_WRITE, startMicros);
+}
+
+void FileSystem::makeIndexName(const char* fileName, char* indexName) {
+  strncpy(indexName, fileName, LOG_NAME_SIZE - 1);
+  indexName[LOG_NAME_SIZE - 1] = '\0';
+  strcat(indexName, INDEX_EXTENSION);
+}
+
+// Offset of the first record of the interval of a time: from the last entry
+// when the index ends before it, from the start without an index
+uint32_t FileSystem::findIndexOffset(const char* fileName, uint32_t time) {
+
+  char indexName[INDEX_NAME_SIZE];
+  uint8_t entry[INDEX_ENTRY_SIZE];
+  uint32_t offset = 0;
+
+  makeIndexName(fileName, indexName);
+  HalFile indexFile = sd.open(indexName, O_RDONLY);
+  if (!indexFile) {
+    return 0;
+  }
+  uint32_t entries = indexFile.fileSize() / INDEX_ENTRY_SIZE;
+  uint32_t slot = (time % SECONDS_PER_DAY) / (INDEX_INTERVAL * 60);
+  if (slot >= entries) {
+    slot = entries - 1;
+  }
+  if (entries && indexFile.seekSet(slot * INDEX_ENTRY_SIZE) && indexFile.read(entry, INDEX_ENTRY_SIZE) == INDEX_ENTRY_SIZE) {
+    offset = BinaryLog::get(entry, INDEX_ENTRY_SIZE);
+  }
+  indexFile.close();
+  return offset;
+}
+
+// One CSV row, in the DATA_HEADER layout, assembled in RAM and written at once
+void FileSystem::writeCSVRecord(HalFile* file, Measure* measure) {
+
+  char buffer[CSV_ROW_SIZE];
+  RowBuffer row(file, buffer, sizeof(buffer));
+
+  row.add(timeCounter.getDate());
+  row.add(COMMA);
+  row.add(timeCounter.getTime());
+  row.add(COMMA);
+  row.addNumber(measure->getCurrentRMS(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(measure->getVoltageRMS(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(measure->getRealPower(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(measure->getApparentPower(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(measure->getPowerFactor(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(measure->getLastPeriod(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(measure->getLineFrequency(), CSV_DECIMALS);
+  addHarmonicColumns(&row, measure);
+  row.add('\n');
+  row.flush();
+}
+
+// One row of every phase, then the totals and the harmonics of the first
+// phase. Longer than the buffer: written in several pieces
+void FileSystem::writePhasesCSVRecord(HalFile* file, PhaseSet* phaseSet) {
+
+  char buffer[CSV_ROW_SIZE];
+  RowBuffer row(file, buffer, sizeof(buffer));
+
+  row.add(timeCounter.getDate());
+  row.add(COMMA);
+  row.add(timeCounter.getTime());
+  for (uint8_t phase = 0; phase < phaseSet->getNumPhases(); ++phase) {
+    Measure* measure = phaseSet->getPhase(phase);
+    row.add(COMMA);
+    row.addNumber(measure->getCurrentRMS(), CSV_DECIMALS);
+    row.add(COMMA);
+    row.addNumber(measure->getVoltageRMS(), CSV_DECIMALS);
+    row.add(COMMA);
+    row.addNumber(measure->getRealPower(), CSV_DECIMALS);
+    row.add(COMMA);
+    row.addNumber(measure->getApparentPower(), CSV_DECIMALS);
+    row.add(COMMA);
+    row.addNumber(measure->getPowerFactor(), CSV_DECIMALS);
+  }
+  row.add(COMMA);
+  row.addNumber(phaseSet->getRealPower(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(phaseSet->getApparentPower(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(phaseSet->getPowerFactor(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(phaseSet->getLastPeriod(), CSV_DECIMALS);
+  row.add(COMMA);
+  row.addNumber(phaseSet->getLineFrequency(), CSV_DECIMALS);
+  addHarmonicColumns(&row, phaseSet->getPhase(0));
+  row.add('\n');
+  row.flush();
+}
+
+// Harmonic columns overflow the buffer: written in several pieces
+void FileSystem::addHarmonicColumns(RowBuffer* row, Measure* measure) {
+
+  Harmonics* harmonics = measure->getHarmonics();
+  if (!harmonicColumns || !harmonics) {
+    return;
+  }
+
+  row->add(COMMA);
+  row->addNumber(harmonics->getVoltageTHD(), CSV_DECIMALS);
+  row->add(COMMA);
+  row->addNumber(harmonics->getCurrentTHD(), CSV_DECIMALS);
+  for (uint8_t order = 1; order <= HARMONIC_ORDERS; ++order) {
+    row->add(COMMA);
+    row->addNumber(harmonics->getVoltageHarmonic(order), CSV_DECIMALS);
+  }
+  for (uint8_t order = 1; order <= HARMONIC_ORDERS; ++order) {
+    row->add(COMMA);
+    row->addNumber(harmonics->getCurrentHarmonic(order), CSV_DECIMALS);
+  }
+}
+
+// One binary record, after the file header when the file is new (or its
+// extent still empty)
+void FileSystem::writeBinaryRecord(HalFile* file, Measure* measure) {
+
+  uint8_t buffer[BINARY_LOG_HEADER_SIZE];
+  BinaryLogRecord record;
+
+  if (file->curPosition() == 0) {
+    BinaryLog::encodeHeader(buffer);
+    file->write(buffer, BINARY_LOG_HEADER_SIZE);
+  }
+
+  record.timestamp = timeCounter.getUnixTime();
+  record.current = measure->getCurrentRMS();
+  record.voltage = measure->getVoltageRMS();
+  record.realPower = measure->getRealPower();
+  record.apparentPower = measure->getApparentPower();
+  record.powerFactor = measure->getPowerFactor();
+  record.windowTime = measure->getLastPeriod();
+  record.lineFrequency = measure->getLineFrequency();
+
+  BinaryLog::encodeRecord(buffer, &record);
+  file->write(buffer, BINARY_LOG_RECORD_SIZE);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Print the CSV header, of PhaseSet rows when set, with the harmonic columns when enabled
+//
+void FileSystem::printHeader(ArduinoOutStream* cout) {
+
+  if (phaseColumns > 1) {
+    char columns[sizeof(PHASE_HEADER) + 5];
+    *cout << F("date;time");
+    for (uint8_t phase = 1; phase <= phaseColumns; ++phase) {
+      sprintf(columns, PHASE_HEADER, phase, phase, phase, phase, phase);
+      *cout << COMMA << columns;
+    }
+    *cout << COMMA << PHASE_TOTALS_HEADER;
+  }
+  else {
+    *cout << DATA_HEADER;
+  }
+  if (harmonicColumns) {
+    *cout << COMMA << HARMONICS_HEADER;
+    for (uint8_t order = 1; order <= HARMONIC_ORDERS; ++order) {
+      *cout << COMMA << 'V' << int(order) << F("(V)");
+    }
+    for (uint8_t order = 1; order <= HARMONIC_ORDERS; ++order) {
+      *cout << COMMA << 'I' << int(order) << F("(A)");
+    }
+  }
+  *cout << endl;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Append the phase statistics to a side file, with the date and time of the
+// RTC on each row
+//
+bool FileSystem::recordStats(char* fileName, PhaseStats* phaseStats) {
+
+  HalFile statsFile;
+  char prefix[22];
+
+  HalFile::dateTimeCallback(FATDateTime);
+  statsFile = sd.open(fileName, O_RDWR | O_CREAT | O_AT_END);
+  if (!statsFile) {
     return false;
   }
 
-  fileStream << timeCounter.getDate() << COMMA << timeCounter.getTime() << COMMA << setprecision(4);
-  fileStream << measure->getCurrentRMS() << COMMA << measure->getVoltageRMS() << COMMA;
-  fileStream << measure->getRealPower() << COMMA << measure->getApparentPower() << COMMA << measure->getPowerFactor() << COMMA;
-  fileStream << measure->getLastPeriod() << endl;
-  dataFile.close();
+  ArduinoOutStream fileStream(statsFile);
+  if (statsFile.fileSize() == 0) {
+    fileStream << F("date;time;") << PHASE_STATS_HEADER << endl;
+  }
+  sprintf(prefix, "%s;%s;", timeCounter.getDate(), timeCounter.getTime());
+  phaseStats->print(&fileStream, prefix);
+  statsFile.close();
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Append a step of the pending power quality event to the events file: its
+// row, then its waveform, EVENT_ROWS_PER_STEP rows per call. The event is
+// released when complete, or dropped if the file can not be opened
+//
+bool FileSystem::recordEvent(char* fileName, PowerEvents* events) {
+
+  if (!events->isRecordPending()) {
+    return true;
+  }
+
+  HalFile eventsFile;
+  HalFile::dateTimeCallback(FATDateTime);
+  eventsFile = sd.open(fileName, O_RDWR | O_CREAT | O_AT_END);
+  if (!eventsFile) {
+    events->release();
+    eventRows = 0;
+    return false;
+  }
+
+  const PowerEvent& event = events->getRecord();
+  uint8_t totalRows = 1 + (event.captured ? EVENT_CAPTURE_PAIRS : 0);
+  char buffer[CSV_ROW_SIZE];
+  RowBuffer row(&eventsFile, buffer, sizeof(buffer));
+
+  if (eventRows == 0 && eventsFile.fileSize() == 0) {
+    row.add(F(EVENT_HEADER "\n" EVENT_WAVEFORM_HEADER "\n"));
+  }
+  for (uint8_t step = 0; step < EVENT_ROWS_PER_STEP && eventRows < totalRows; ++step, ++eventRows) {
+    if (eventRows == 0) {
+      writeEventRow(&row, event, events->getPairRate());
+      continue;
+    }
+    uint8_t pairIndex = eventRows - 1;
+    row.add(F("wave;"));
+    row.addNumber(int16_t(pairIndex) - EVENT_PRETRIGGER_PAIRS, 0);
+    row.add(COMMA);
+    row.addNumber(events->getCapturedCurrent(pairIndex), CSV_DECIMALS);
+    row.add(COMMA);
+    row.addNumber(events->getCapturedVoltage(pairIndex), CSV_DECIMALS);
+    row.add('\n');
+  }
+  row.flush();
+  eventsFile.close();
 
+  if (eventRows == totalRows) {
+    events->release();
+    eventRows = 0;
+  }
   return true;
 }
+
+// Start of the event from its age, against the cached date and time (with
+// the milliseconds of the present second when the seconds are counted)
+void FileSystem::writeEventRow(RowBuffer* row, const PowerEvent& event, uint16_t pairRate) {
+
+  char text[24];
+  int64_t startMillis = int64_t(timeCounter.getUnixTime()) * 1000 + timeCounter.getMilliseconds() - (HalClock::millis() - event.startMillis);
+  HalDateTime start(uint32_t(startMillis / 1000));
+
+  sprintf(text, DATE_FORMAT COMMA HOUR_FORMAT ".%03u", start.day(), start.month(), start.year(),
+          start.hour(), start.minute(), start.second(), unsigned(startMillis % 1000));
+  row->add(text);
+  row->add(COMMA);
+  row->add(PowerEvents::getName(event.type));
+  row->add(COMMA);
+  row->addNumber(event.durationMillis, 1);
+  row->add(COMMA);
+  row->addNumber(event.minVoltage, CSV_DECIMALS);
+  row->add(COMMA);
+  row->addNumber(event.maxVoltage, CSV_DECIMALS);
+  row->add(COMMA);
+  row->addNumber(event.maxCurrent, CSV_DECIMALS);
+  row->add(COMMA);
+  row->addNumber(pairRate, 0);
+  row->add('\n');
+}
 //------------------------------------------------------------------------------
 
 
 //==============================================================================
-// Transfer specified file 
+// Transfer specified file, blocking until it is sent
 //
 bool FileSystem::transferFile(char* fileName, ArduinoOutStream* cout, Communicate* communicate) {
-  
-  File dataFile;
 
-  dataFile = sd.open(fileName, O_RDONLY);
-  if (dataFile) {
-    *cout << DATA_HEADER << endl;
-    while (dataFile.available() && communicate->isDeviceConnected()) {
-      *cout << char(dataFile.read());
+  if (!beginTransfer(fileName, cout)) {
+    return false;
+  }
+
+  uint8_t status;
+  while ((status = continueTransfer(communicate)) == TRANSFER_ACTIVE) {
+    SysCall::yield();
+  }
+  return (status == TRANSFER_DONE);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Framed transfer of a file from an offset, blocking until it is sent
+//
+bool FileSystem::transferFileFrames(char* fileName, uint32_t offset, Communicate* communicate, FrameLink* link) {
+
+  if (!beginFrameTransfer(fileName, offset, communicate, link)) {
+    return false;
+  }
+
+  uint8_t status;
+  while ((status = continueTransfer(communicate)) == TRANSFER_ACTIVE) {
+    SysCall::yield();
+  }
+  return (status == TRANSFER_DONE);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Hour and day records of the energy summary, written at their slots of the
+// month file over the older of the two copies: a write torn by a reset
+// leaves the copy before it, at most a checkpoint period behind
+//
+bool FileSystem::recordSummary(const char* nameFormat, EnergySummary* summary) {
+
+  if (!summary->isStarted()) {
+    return true;
+  }
+
+  SummaryRecord hour, day;
+  char name[LOG_NAME_SIZE];
+  summary->getHour(&hour);
+  summary->getDay(&day);
+  summary->setCheckpoint(timeCounter.getUnixTime());
+
+  HalDateTime start(hour.start);
+  sprintf(name, nameFormat, start.year(), start.month());
+  HalFile::dateTimeCallback(FATDateTime);
+  HalFile summaryFile = sd.open(name, O_RDWR | O_CREAT);
+  if (!summaryFile) {
+    return false;
+  }
+  bool written = writeSummaryRecord(&summaryFile, &hour, false) && writeSummaryRecord(&summaryFile, &day, true);
+  summaryFile.close();
+  return written;
+}
+
+// Records of the present hour and day, when the month file holds them: the
+// summary goes on from them (from empty records otherwise)
+bool FileSystem::restoreSummary(const char* nameFormat, EnergySummary* summary, uint32_t time) {
+
+  SummaryRecord hour, day;
+  bool hourFound = false, dayFound = false;
+  char name[LOG_NAME_SIZE];
+
+  HalDateTime now(time);
+  sprintf(name, nameFormat, now.year(), now.month());
+  HalFile summaryFile = sd.open(name, O_RDONLY);
+  if (summaryFile) {
+    hourFound = readSummaryRecord(&summaryFile, time - time % SECONDS_PER_HOUR, false, &hour);
+    dayFound = readSummaryRecord(&summaryFile, time - time % SECONDS_PER_DAY, true, &day);
+    summaryFile.close();
+  }
+  summary->restore(hourFound ? &hour : NULL, dayFound ? &day : NULL, time);
+  return hourFound || dayFound;
+}
+
+// Slot of the hour or of the day in the month file
+uint32_t FileSystem::summaryOffset(uint32_t start, bool dayRecord) {
+  HalDateTime time(start);
+  uint8_t slot = dayRecord ? SUMMARY_DAY_SLOT : time.hour();
+  return (uint32_t(time.day() - 1) * SUMMARY_SLOTS_PER_DAY + slot) * SUMMARY_SLOT_SIZE;
+}
+
+// Newer valid copy of a slot, with its start and sequence -- Return its
+// index, -1 if the slot holds none
+int8_t FileSystem::findSummaryCopy(HalFile* file, uint32_t offset, uint32_t* start, uint16_t* sequence) {
+
+  uint8_t buffer[SUMMARY_RECORD_SIZE];
+  int8_t found = -1;
+
+  for (uint8_t copy = 0; copy < SUMMARY_RECORD_COPIES; ++copy) {
+    uint32_t copyStart;
+    uint16_t copySequence;
+    if (!file->seekSet(offset + copy * SUMMARY_RECORD_SIZE) || file->read(buffer, sizeof(buffer)) != sizeof(buffer) ||
+        !EnergySummary::checkRecord(buffer, &copyStart, &copySequence)) {
+      continue;
     }
-    dataFile.close();
+    if (found < 0 || int16_t(copySequence - *sequence) > 0) {
+      found = copy;
+      *start = copyStart;
+      *sequence = copySequence;
+    }
+  }
+  return found;
+}
+
+// The record goes over the older or invalid copy, with the next sequence.
+// The file is extended with zeros (records not written) up to the copy
+bool FileSystem::writeSummaryRecord(HalFile* file, const SummaryRecord* record, bool dayRecord) {
+
+  uint8_t buffer[SUMMARY_RECORD_SIZE];
+  uint32_t offset = summaryOffset(record->start, dayRecord);
+  uint32_t start;
+  uint16_t sequence = 0;
+
+  int8_t copy = findSummaryCopy(file, offset, &start, &sequence);
+  if (copy >= 0 && start == record->start) {
+    offset += (copy ^ 1) * SUMMARY_RECORD_SIZE;
+    ++sequence;
+  }
+  else {
+    sequence = 0;
+  }
+
+  if (file->fileSize() < offset) {
+    memset(buffer, 0, sizeof(buffer));
+    file->seekSet(file->fileSize());
+    while (file->curPosition() < offset) {
+      uint32_t remaining = offset - file->curPosition();
+      uint8_t piece = (remaining < sizeof(buffer)) ? uint8_t(remaining) : sizeof(buffer);
+      if (file->write(buffer, piece) != piece) {
+        return false;
+      }
+    }
+  }
+
+  EnergySummary::encodeRecord(buffer, record, sequence);
+  return file->seekSet(offset) && file->write(buffer, sizeof(buffer)) == sizeof(buffer);
+}
+
+// Newer valid copy of a slot -- Return false if it holds none
+bool FileSystem::readSummarySlot(HalFile* file, uint32_t offset, SummaryRecord* record) {
+
+  uint8_t buffer[SUMMARY_RECORD_SIZE];
+  uint32_t start;
+  uint16_t sequence;
+
+  int8_t copy = findSummaryCopy(file, offset, &start, &sequence);
+  return copy >= 0 && file->seekSet(offset + copy * SUMMARY_RECORD_SIZE) &&
+         file->read(buffer, sizeof(buffer)) == sizeof(buffer) && EnergySummary::decodeRecord(buffer, record);
+}
+
+bool FileSystem::readSummaryRecord(HalFile* file, uint32_t start, bool dayRecord, SummaryRecord* record) {
+  return readSummarySlot(file, summaryOffset(start, dayRecord), record) && record->start == start;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Incremental transfers: begin opens the file, then each continueTransfer
+// sends at most what the port takes without blocking, so the measurement
+// keeps running between the steps. A single transfer is active at a time
+//
+
+// Start sending a file as text, after the CSV header
+bool FileSystem::beginTransfer(char* fileName, ArduinoOutStream* cout) {
+
+  endTransfer();
+
+  // The size of the open log file is only updated on the card by a sync
+  syncLog();
+  transferData = sd.open(fileName, O_RDONLY);
+  if (!transferData) {
+    return false;
+  }
+  transferSize = findDataEnd(&transferData);
+  transferData.seekSet(0);
+
+  if (logFormat == LOG_FORMAT_CSV) {
+    printHeader(cout);
+  }
+  transferMode = TRANSFER_TEXT;
+  return true;
+}
+
+// Start the framed transfer of a file from an offset, so an interrupted
+// transfer can be resumed. Frames of FRAME_MAX_PAYLOAD bytes are sent up to a
+// window ahead of the acknowledgements (go back N): a NACK or a timeout
+// resends from the first frame not acknowledged
+bool FileSystem::beginFrameTransfer(char* fileName, uint32_t offset, Communicate* communicate, FrameLink* link) {
+
+  endTransfer();
+  transferLink = link;
+  transferLink->setPort(communicate->getCommPort());
+
+  syncLog();
+  transferData = sd.open(fileName, O_RDONLY);
+  if (transferData) {
+    transferSize = findDataEnd(&transferData);
+  }
+  if (!transferData || offset > transferSize) {
+    transferLink->beginFrame(FRAME_ERROR, 0, offset, 0);
+    transferLink->endFrame();
+    if (transferData) {
+      transferData.close();
+    }
+    return false;
+  }
+
+  transferMode = TRANSFER_FRAMES;
+  transferOffset = offset;
+  baseFrame = 0;
+  nextFrame = 0;
+  rewindFrame = 0;
+  rewindPending = false;
+  frameLength = 0;
+  frameSent = 0;
+  frameOpen = false;
+  frameReadError = false;
+  retries = 0;
+  lastProgressTime = HalClock::millis();
+  return true;
+}
+
+// Send the next piece of the active transfer -- Return TRANSFER_ACTIVE
+// while there is more to send, then TRANSFER_DONE or TRANSFER_FAILED
+uint8_t FileSystem::continueTransfer(Communicate* communicate) {
+
+  if (transferMode == TRANSFER_NONE) {
+    return TRANSFER_FAILED;
+  }
+  if (!communicate->isDeviceConnected()) {
+    endTransfer();
+    return TRANSFER_FAILED;
+  }
+
+  uint8_t status;
+  if (transferMode == TRANSFER_TEXT) {
+    status = continueText(communicate->getCommPort());
+  }
+  else if (transferMode == TRANSFER_FRAMES) {
+    status = continueFrames(communicate->getCommPort());
+  }
+  else if (transferMode == TRANSFER_QUERY) {
+    status = continueQuery(communicate->getCommPort());
+  }
+  else if (transferMode == TRANSFER_EXPORT) {
+    status = continueExport(communicate->getCommPort());
+  }
+  else if (transferMode == TRANSFER_DELTA) {
+    status = continueDelta(communicate->getCommPort());
+  }
+  else {
+    status = continueSummary(communicate->getCommPort());
+  }
+  if (status != TRANSFER_ACTIVE) {
+    endTransfer();
+  }
+  return status;
+}
+
+// Close the file of the active transfer, if any
+void FileSystem::endTransfer() {
+  if (transferMode != TRANSFER_NONE) {
+    transferData.close();
+    transferMode = TRANSFER_NONE;
+  }
+}
+
+// Bytes the port takes without blocking, limited to the read buffer. Ports
+// that can not tell (software serial) take TRANSFER_STEP_SIZE
+uint16_t FileSystem::transferBudget(Stream* port) {
+  int space = port->availableForWrite();
+  if (space <= 0) {
+    space = TRANSFER_STEP_SIZE;
+  }
+  return (space < TRANSFER_READ_SIZE) ? uint16_t(space) : TRANSFER_READ_SIZE;
+}
+
+uint8_t FileSystem::continueText(Stream* port) {
+
+  uint8_t buffer[TRANSFER_READ_SIZE];
+  uint32_t remaining = transferSize - transferData.curPosition();
+  uint16_t budget = transferBudget(port);
+  int count = transferData.read(buffer, (remaining < budget) ? uint16_t(remaining) : budget);
+  if (count <= 0) {
+    return (count == 0) ? TRANSFER_DONE : TRANSFER_FAILED;
+  }
+  port->write(buffer, count);
+  return TRANSFER_ACTIVE;
+}
+
+uint8_t FileSystem::continueFrames(Stream* port) {
+
+  uint32_t size = transferSize;
+
+  // Replies: sequences are the low 16 bits of the frame count
+  uint8_t type;
+  uint16_t sequence;
+  while (transferLink->pollReply(&type, &sequence)) {
+    uint32_t frame = baseFrame + uint16_t(sequence - uint16_t(baseFrame));
+    if (frame >= nextFrame) {
+      continue;
+    }
+    if (type == FRAME_ACK) {
+      baseFrame = frame + 1;
+      retries = 0;
+      lastProgressTime = HalClock::millis();
+    }
+    else if (type == FRAME_NACK) {
+      baseFrame = frame;
+      rewindFrame = frame;
+      rewindPending = true;
+      ++retries;
+    }
+  }
+  if (retries > TRANSFER_MAX_RETRIES) {
+    return TRANSFER_FAILED;
+  }
+
+  // A frame is sent whole, in pieces, before going back
+  if (frameOpen) {
+    sendFramePiece(port);
+    return TRANSFER_ACTIVE;
+  }
+  if (rewindPending) {
+    nextFrame = (rewindFrame > baseFrame) ? rewindFrame : baseFrame;
+    rewindPending = false;
+  }
+
+  if (transferOffset + baseFrame * FRAME_MAX_PAYLOAD >= size) {
+    transferLink->beginFrame(FRAME_END, uint16_t(nextFrame), size, 0);
+    transferLink->endFrame();
+    return TRANSFER_DONE;
+  }
+
+  // Fill the window
+  uint32_t nextOffset = transferOffset + nextFrame * FRAME_MAX_PAYLOAD;
+  if (nextFrame - baseFrame < TRANSFER_WINDOW_FRAMES && nextOffset < size) {
+    uint32_t remaining = size - nextOffset;
+    frameLength = (remaining < FRAME_MAX_PAYLOAD) ? uint16_t(remaining) : FRAME_MAX_PAYLOAD;
+    frameSent = 0;
+    frameOpen = true;
+    frameReadError = !transferData.seekSet(nextOffset);
+    transferLink->beginFrame(FRAME_DATA, uint16_t(nextFrame), nextOffset, frameLength);
+    return TRANSFER_ACTIVE;
+  }
+
+  // Window full and no reply in time: go back to the first frame not acknowledged
+  if (HalClock::millis() - lastProgressTime >= TRANSFER_ACK_TIMEOUT) {
+    nextFrame = baseFrame;
+    lastProgressTime = HalClock::millis();
+    ++retries;
+  }
+  return TRANSFER_ACTIVE;
+}
+
+// Send the next piece of the open frame, read from the file
+void FileSystem::sendFramePiece(Stream* port) {
+
+  uint8_t buffer[TRANSFER_READ_SIZE];
+  uint16_t piece = transferBudget(port);
+  if (piece > frameLength - frameSent) {
+    piece = frameLength - frameSent;
+  }
+
+  if (piece > 0) {
+    if (frameReadError || transferData.read(buffer, piece) != int(piece)) {
+      memset(buffer, 0, piece);
+      frameReadError = true;
+    }
+    transferLink->writePayload(buffer, piece);
+    frameSent += piece;
+  }
+  if (frameSent < frameLength) {
+    return;
+  }
+
+  // A frame that could not be read goes out with a bad CRC, to be resent
+  frameReadError ? transferLink->abortFrame() : transferLink->endFrame();
+  frameOpen = false;
+  ++nextFrame;
+  lastProgressTime = HalClock::millis();
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Range query: a day file at a time, from the indexed interval of the start
+// time, each step matching a record or sending a piece of it
+//
+bool FileSystem::beginQuery(const char* nameFormat, uint32_t from, uint32_t to, ArduinoOutStream* cout) {
+
+  endTransfer();
+  if (to < from) {
+    return false;
+  }
+
+  syncLog();
+  queryNameFormat = nameFormat;
+  queryFrom = from;
+  queryTo = to;
+  queryDay = from - from % SECONDS_PER_DAY;
+
+  // Binary records go after the file header, sent by the first steps
+  if (logFormat == LOG_FORMAT_CSV) {
+    printHeader(cout);
+    queryState = QUERY_RECORD;
+  }
+  else {
+    queryState = QUERY_HEADER;
+    queryRemaining = BINARY_LOG_HEADER_SIZE;
+  }
+  transferMode = TRANSFER_QUERY;
+  return true;
+}
+
+uint8_t FileSystem::continueQuery(Stream* port) {
+
+  if (queryState == QUERY_HEADER) {
+    if (sendHeaderPiece(port)) {
+      queryState = QUERY_RECORD;
+    }
+    return TRANSFER_ACTIVE;
+  }
+
+  if (!transferData) {
+    return openQueryDay() ? TRANSFER_ACTIVE : TRANSFER_DONE;
+  }
+  if (queryState == QUERY_RECORD) {
+    uint8_t match = matchQueryRecord();
+    if (match != TRANSFER_ACTIVE) {
+      return match;
+    }
+  }
+  if (queryState == QUERY_SEND || queryState == QUERY_SKIP) {
+    sendQueryPiece(port);
+  }
+  return TRANSFER_ACTIVE;
+}
+
+// A piece of the binary file header, queryRemaining bytes of it left --
+// Return true once it is sent
+bool FileSystem::sendHeaderPiece(Stream* port) {
+  uint8_t header[BINARY_LOG_HEADER_SIZE];
+  uint16_t piece = transferBudget(port);
+  if (piece > queryRemaining) {
+    piece = queryRemaining;
+  }
+  BinaryLog::encodeHeader(header);
+  port->write(header + BINARY_LOG_HEADER_SIZE - queryRemaining, piece);
+  queryRemaining -= piece;
+  return (queryRemaining == 0);
+}
+
+// Name of the day file of queryDay
+void FileSystem::makeDayName(char* name) const {
+  HalDateTime day(queryDay);
+  sprintf(name, queryNameFormat, day.year(), day.month(), day.day());
+}
+
+// Next day file of the range, a day without one skipped per step -- Return
+// false after the last day
+bool FileSystem::openQueryDay() {
+
+  char name[LOG_NAME_SIZE];
+
+  if (queryDay > queryTo) {
+    return false;
+  }
+  makeDayName(name);
+  transferData = sd.open(name, O_RDONLY);
+  if (!transferData) {
+    queryDay += SECONDS_PER_DAY;
     return true;
   }
 
-  return false;
+  transferSize = findDataEnd(&transferData);
+  uint32_t offset = (queryFrom > queryDay) ? findIndexOffset(name, queryFrom) : 0;
+  if (logFormat == LOG_FORMAT_BINARY && offset < BINARY_LOG_HEADER_SIZE) {
+    offset = BINARY_LOG_HEADER_SIZE;
+  }
+  transferData.seekSet(offset);
+  queryState = QUERY_RECORD;
+  return true;
+}
+
+// Time of the record at the position: records before the range are skipped,
+// the first one after it ends the query -- Return TRANSFER_DONE then
+uint8_t FileSystem::matchQueryRecord() {
+
+  uint8_t buffer[QUERY_ROW_PREFIX + 1];
+  uint32_t position = transferData.curPosition();
+  uint8_t size = (logFormat == LOG_FORMAT_BINARY) ? 4 : QUERY_ROW_PREFIX;
+
+  // End of the day: the next one, at the next step
+  if (position + size > transferSize || transferData.read(buffer, size) != size) {
+    transferData.close();
+    queryDay += SECONDS_PER_DAY;
+    return TRANSFER_ACTIVE;
+  }
+
+  uint32_t recordTime;
+  bool valid = true;
+  if (logFormat == LOG_FORMAT_BINARY) {
+    recordTime = BinaryLog::get(buffer, 4);
+  }
+  else {
+    // "DD/MM/YYYY;hh:mm:ss", of the day of the file
+    const char* text = (const char*)buffer;
+    buffer[QUERY_ROW_PREFIX] = '\0';
+    valid = (text[10] == ';' && text[13] == ':' && text[16] == ':');
+    recordTime = queryDay + (atoi(text + 11) * 60UL + atoi(text + 14)) * 60 + atoi(text + 17);
+  }
+  if (valid && recordTime > queryTo) {
+    return TRANSFER_DONE;
+  }
+
+  bool send = valid && recordTime >= queryFrom;
+  if (logFormat == LOG_FORMAT_BINARY) {
+    queryRemaining = BINARY_LOG_RECORD_SIZE;
+    if (!send) {
+      transferData.seekSet(position + BINARY_LOG_RECORD_SIZE);
+      return TRANSFER_ACTIVE;
+    }
+  }
+  queryState = send ? QUERY_SEND : QUERY_SKIP;
+  transferData.seekSet(position);
+  return TRANSFER_ACTIVE;
+}
+
+// A piece of the record being sent (binary: up to its size, CSV: up to the
+// end of the row) or of the CSV row being skipped
+void FileSystem::sendQueryPiece(Stream* port) {
+
+  uint8_t buffer[TRANSFER_READ_SIZE];
+  uint32_t position = transferData.curPosition();
+  uint16_t piece = (queryState == QUERY_SEND) ? transferBudget(port) : TRANSFER_READ_SIZE;
+  if (logFormat == LOG_FORMAT_BINARY && piece > queryRemaining) {
+    piece = queryRemaining;
+  }
+  if (piece > transferSize - position) {
+    piece = transferSize - position;
+  }
+
+  int count = transferData.read(buffer, piece);
+  if (count <= 0) {
+    queryState = QUERY_RECORD;  // Ends the day
+    return;
+  }
+
+  bool recordEnd;
+  if (logFormat == LOG_FORMAT_BINARY) {
+    queryRemaining -= count;
+    recordEnd = (queryRemaining == 0);
+  }
+  else {
+    const uint8_t* newline = (const uint8_t*)memchr(buffer, '\n', count);
+    recordEnd = (newline != NULL);
+    if (recordEnd) {
+      count = newline - buffer + 1;
+      transferData.seekSet(position + count);
+    }
+  }
+
+  if (queryState == QUERY_SEND) {
+    port->write(buffer, count);
+  }
+  if (recordEnd) {
+    queryState = QUERY_RECORD;
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Export: the manifest a day per step, then the header and the data of the
+// day files, read in pieces as the text transfer. The day files are opened
+// twice, by the manifest and by the data, so no size is kept per day
+//
+bool FileSystem::beginExport(const char* nameFormat, uint32_t firstDay, uint32_t lastDay, ArduinoOutStream* cout) {
+
+  endTransfer();
+  if (lastDay > timeCounter.getUnixTime()) {
+    lastDay = timeCounter.getUnixTime();
+  }
+  if (lastDay < firstDay) {
+    return false;
+  }
+
+  queryNameFormat = nameFormat;
+  queryFrom = firstDay - firstDay % SECONDS_PER_DAY;
+  queryTo = lastDay - lastDay % SECONDS_PER_DAY;
+  queryDay = queryFrom;
+  queryState = EXPORT_MANIFEST;
+  rowSent = 0;
+  *cout << F(EXPORT_MANIFEST_HEADER) << endl;
+  transferMode = TRANSFER_EXPORT;
+  return true;
+}
+
+uint8_t FileSystem::continueExport(Stream* port) {
+
+  if (queryState == EXPORT_MANIFEST) {
+    sendManifestRow(port);
+    return TRANSFER_ACTIVE;
+  }
+  if (queryState == EXPORT_MANIFEST_END) {
+    port->write('\n');
+    queryDay = queryFrom;
+    queryRemaining = BINARY_LOG_HEADER_SIZE;
+    queryState = EXPORT_HEADER;
+    return TRANSFER_ACTIVE;
+  }
+  if (queryState == EXPORT_HEADER) {
+    if (logFormat == LOG_FORMAT_CSV) {
+      ArduinoOutStream portStream(*port);
+      printHeader(&portStream);
+      queryState = EXPORT_DATA;
+    }
+    else if (sendHeaderPiece(port)) {
+      queryState = EXPORT_DATA;
+    }
+    return TRANSFER_ACTIVE;
+  }
+
+  if (!transferData) {
+    return openExportDay() ? TRANSFER_ACTIVE : TRANSFER_DONE;
+  }
+  uint8_t status = continueText(port);
+  if (status == TRANSFER_DONE) {
+    transferData.close();
+    queryDay += SECONDS_PER_DAY;
+    return TRANSFER_ACTIVE;
+  }
+  return status;
+}
+
+// A row of the manifest, from the first byte not sent. The size of its file
+// is taken as the row starts (the active file synced first)
+void FileSystem::sendManifestRow(Stream* port) {
+
+  char name[LOG_NAME_SIZE];
+  makeDayName(name);
+  if (rowSent == 0) {
+    if (queryDay == queryTo) {
+      syncLog();
+    }
+    HalFile dayFile = sd.open(name, O_RDONLY);
+    exportSize = EXPORT_MISSING;
+    if (dayFile) {
+      exportSize = exportedSize(&dayFile);
+      dayFile.close();
+    }
+    if (queryDay == queryTo) {
+      exportLastSize = exportSize;
+    }
+  }
+
+  char text[CSV_ROW_SIZE], number[FIXED_TEXT_SIZE];
+  PieceWriter piece(port, rowSent, transferBudget(port));
+  RowBuffer row(&piece, text, sizeof(text));
+  row.add(name);
+  row.add(COMMA);
+  if (exportSize == EXPORT_MISSING) {
+    row.add(F("missing"));
+  }
+  else {
+    FixedFormat::formatUnsigned(number, exportSize);
+    row.add(number);
+  }
+  row.add('\n');
+  row.flush();
+
+  if (!piece.isComplete()) {
+    rowSent = piece.getEnd();
+    return;
+  }
+  rowSent = 0;
+  queryDay += SECONDS_PER_DAY;
+  if (queryDay > queryTo) {
+    queryState = EXPORT_MANIFEST_END;
+  }
+}
+
+// Bytes of a day file in the stream: its data, binary files without the header
+uint32_t FileSystem::exportedSize(HalFile* file) const {
+  uint32_t size = findDataEnd(file);
+  if (logFormat == LOG_FORMAT_BINARY) {
+    size = (size > BINARY_LOG_HEADER_SIZE) ? size - BINARY_LOG_HEADER_SIZE : 0;
+  }
+  return size;
+}
+
+// Next day file of the export, a missing day skipped per step. The last day
+// ends at the size of the manifest -- Return false after the last day
+bool FileSystem::openExportDay() {
+
+  char name[LOG_NAME_SIZE];
+
+  if (queryDay > queryTo) {
+    return false;
+  }
+  makeDayName(name);
+  transferData = sd.open(name, O_RDONLY);
+  if (transferData && queryDay == queryTo && exportLastSize == EXPORT_MISSING) {
+    transferData.close();  // Created after the manifest
+  }
+  if (!transferData) {
+    queryDay += SECONDS_PER_DAY;
+    return true;
+  }
+
+  uint32_t start = (logFormat == LOG_FORMAT_BINARY) ? BINARY_LOG_HEADER_SIZE : 0;
+  uint32_t size = exportedSize(&transferData);
+  if (queryDay == queryTo && size > exportLastSize) {
+    size = exportLastSize;
+  }
+  transferSize = (size > 0) ? start + size : 0;
+  transferData.seekSet(transferSize ? start : 0);
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Compressed transfer: the stream header and the file header (CSV: a literal
+// row) at the start, then a row per step, coded again from the file at each
+// step and sent from the first byte not sent yet
+//
+bool FileSystem::beginDeltaTransfer(char* fileName, DeltaLog* delta) {
+
+  endTransfer();
+  syncLog();
+  transferData = sd.open(fileName, O_RDONLY);
+  if (!transferData) {
+    return false;
+  }
+  transferSize = findDataEnd(&transferData);
+  transferData.seekSet(0);
+
+  deltaLog = delta;
+  deltaLog->begin(logFormat, CSV_DECIMALS);
+  queryState = DELTA_HEADER;
+  rowSent = 0;
+  transferMode = TRANSFER_DELTA;
+  return true;
+}
+
+uint8_t FileSystem::continueDelta(Stream* port) {
+
+  if (queryState == DELTA_HEADER || queryState == DELTA_FILE_HEADER) {
+    sendDeltaHeader(port);
+    return TRANSFER_ACTIVE;
+  }
+  if (queryState == DELTA_LITERAL) {
+    sendLiteralPiece(port);
+    return TRANSFER_ACTIVE;
+  }
+
+  uint32_t position = transferData.curPosition();
+  uint8_t line[DELTA_LINE_SIZE];
+  uint16_t size = (transferSize - position < sizeof(line)) ? uint16_t(transferSize - position) : sizeof(line);
+  uint16_t used = (logFormat == LOG_FORMAT_BINARY) ? BINARY_LOG_RECORD_SIZE : 0;
+
+  // The end tag; a binary record cut by a reset is left out
+  if (size == 0 || size < used) {
+    port->write(uint8_t(DELTA_TAG_END));
+    return TRANSFER_DONE;
+  }
+  if (transferData.read(line, size) != int(size)) {
+    return TRANSFER_FAILED;
+  }
+
+  DeltaLog previous = *deltaLog;
+  PieceWriter piece(port, rowSent, transferBudget(port));
+  if (logFormat == LOG_FORMAT_BINARY) {
+    deltaLog->encodeRecord(&piece, line);
+  }
+  else {
+    const uint8_t* newline = (const uint8_t*)memchr(line, '\n', size);
+    if (newline) {
+      used = newline - line + 1;
+    }
+    if (!newline || !deltaLog->encodeRow(&piece, (const char*)line, used - 1)) {
+      port->write(uint8_t(DELTA_TAG_LITERAL));
+      queryState = DELTA_LITERAL;
+      transferData.seekSet(position);
+      return TRANSFER_ACTIVE;
+    }
+  }
+
+  // Row sent in part: coded again at the next step, from the same previous row
+  if (!piece.isComplete()) {
+    *deltaLog = previous;
+    rowSent = piece.getEnd();
+    transferData.seekSet(position);
+    return TRANSFER_ACTIVE;
+  }
+  rowSent = 0;
+  transferData.seekSet(position + used);
+  return TRANSFER_ACTIVE;
+}
+
+// The stream header, then the CSV header as a literal row or the header of
+// the binary file as it is (in pieces)
+void FileSystem::sendDeltaHeader(Stream* port) {
+
+  if (queryState == DELTA_HEADER) {
+    uint8_t header[DELTA_LOG_HEADER_SIZE];
+    deltaLog->encodeHeader(header);
+    port->write(header, sizeof(header));
+    if (logFormat == LOG_FORMAT_CSV) {
+      ArduinoOutStream portStream(*port);
+      port->write(uint8_t(DELTA_TAG_LITERAL));
+      printHeader(&portStream);
+      queryState = DELTA_ROW;
+    }
+    else {
+      queryState = DELTA_FILE_HEADER;
+    }
+    return;
+  }
+
+  uint8_t buffer[TRANSFER_READ_SIZE];
+  uint32_t position = transferData.curPosition();
+  uint16_t piece = transferBudget(port);
+  if (piece > BINARY_LOG_HEADER_SIZE - position) {
+    piece = BINARY_LOG_HEADER_SIZE - position;
+  }
+  int count = transferData.read(buffer, piece);
+  if (count > 0) {
+    port->write(buffer, count);
+  }
+  if (count <= 0 || transferData.curPosition() >= BINARY_LOG_HEADER_SIZE) {
+    queryState = DELTA_ROW;
+  }
+}
+
+// A piece of the literal row, up to its '\n' or the end of the data
+void FileSystem::sendLiteralPiece(Stream* port) {
+
+  uint8_t buffer[TRANSFER_READ_SIZE];
+  uint32_t position = transferData.curPosition();
+  uint16_t piece = transferBudget(port);
+  if (piece > transferSize - position) {
+    piece = transferSize - position;
+  }
+
+  int count = transferData.read(buffer, piece);
+  const uint8_t* newline = (count > 0) ? (const uint8_t*)memchr(buffer, '\n', count) : NULL;
+  if (newline) {
+    count = newline - buffer + 1;
+    transferData.seekSet(position + count);
+  }
+  if (count > 0) {
+    port->write(buffer, count);
+  }
+  if (newline || count <= 0) {
+    queryState = DELTA_ROW;
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Summary transfer: a record per step, its row formatted again at each step
+// and sent from the first byte not sent yet
+//
+bool FileSystem::beginSummaryTransfer(const char* nameFormat, uint16_t year, uint8_t month, uint8_t day, ArduinoOutStream* cout) {
+
+  char name[LOG_NAME_SIZE];
+
+  endTransfer();
+  if (day > SUMMARY_MONTH_DAYS) {
+    return false;
+  }
+  sprintf(name, nameFormat, year, month);
+  transferData = sd.open(name, O_RDONLY);
+  if (!transferData) {
+    return false;
+  }
+
+  if (day == 0) {
+    summarySlot = SUMMARY_DAY_SLOT;
+    summaryEnd = SUMMARY_MONTH_DAYS * SUMMARY_SLOTS_PER_DAY;
+    summaryStride = SUMMARY_SLOTS_PER_DAY;
+  }
+  else {
+    summarySlot = (day - 1) * SUMMARY_SLOTS_PER_DAY;
+    summaryEnd = summarySlot + SUMMARY_SLOTS_PER_DAY;
+    summaryStride = 1;
+  }
+  rowSent = 0;
+  *cout << F(SUMMARY_HEADER) << endl;
+  transferMode = TRANSFER_SUMMARY;
+  return true;
+}
+
+uint8_t FileSystem::continueSummary(Stream* port) {
+
+  SummaryRecord record;
+  uint32_t offset = uint32_t(summarySlot) * SUMMARY_SLOT_SIZE;
+
+  if (summarySlot >= summaryEnd || offset + SUMMARY_RECORD_SIZE > transferData.fileSize()) {
+    return TRANSFER_DONE;
+  }
+  if (!readSummarySlot(&transferData, offset, &record)) {
+    summarySlot += summaryStride;
+    return TRANSFER_ACTIVE;
+  }
+
+  char text[CSV_ROW_SIZE];
+  PieceWriter piece(port, rowSent, transferBudget(port));
+  RowBuffer row(&piece, text, sizeof(text));
+  writeSummaryRow(&row, record, summarySlot % SUMMARY_SLOTS_PER_DAY == SUMMARY_DAY_SLOT);
+  row.flush();
+
+  if (piece.isComplete()) {
+    summarySlot += summaryStride;
+    rowSent = 0;
+  }
+  else {
+    rowSent = piece.getEnd();
+  }
+  return TRANSFER_ACTIVE;
+}
+
+// A SUMMARY_HEADER row: the means are the sums over the readings
+void FileSystem::writeSummaryRow(RowBuffer* row, const SummaryRecord& record, bool dayRecord) {
+
+  char text[24];
+  HalDateTime start(record.start);
+
+  row->add(dayRecord ? F("day") : F("hour"));
+  row->add(COMMA);
+  sprintf(text, DATE_FORMAT COMMA HOUR_FORMAT, start.day(), start.month(), start.year(), start.hour(), start.minute(), start.second());
+  row->add(text);
+  row->add(COMMA);
+  row->addNumber(record.seconds, 1);
+  row->add(COMMA);
+  row->addNumber(record.readings, 0);
+  row->add(COMMA);
+  row->addNumber(record.energy, CSV_DECIMALS);
+  row->add(COMMA);
+  row->addNumber(record.reactiveEnergy, CSV_DECIMALS);
+  row->add(COMMA);
+  row->addNumber(record.maxDemand, CSV_DECIMALS);
+  for (uint8_t quantity = 0; quantity < SUMMARY_QUANTITIES; ++quantity) {
+    row->add(COMMA);
+    row->addNumber(record.min[quantity], CSV_DECIMALS);
+    row->add(COMMA);
+    row->addNumber(record.sum[quantity] / record.readings, CSV_DECIMALS);
+    row->add(COMMA);
+    row->addNumber(record.max[quantity], CSV_DECIMALS);
+  }
+  row->add('\n');
 }
 //------------------------------------------------------------------------------
 
@@ -202,6 +1717,7 @@ void FileSystem::listFiles(Stream* commPort) {
 // Wipe files from already formatted SD Card and reset module
 //
 bool FileSystem::wipeSDCard(Stream* commPort) {
+  closeLog(false);
   return (sd.wipe(commPort) && begin());
 }
 //------------------------------------------------------------------------------
@@ -5,19 +5,118 @@
 #ifndef _FILE_SYSTEM_H_
 #define _FILE_SYSTEM_H_
 
-#include <SPI.h>
-#include <SdFat.h>
-
-#include "Arduino.h"
+#include "HAL.h"
 #include "Measure.h"
+#include "PhaseSet.h"
 #include "Communicate.h"
 #include "TimeCounter.h"
+#include "BinaryLog.h"
+#include "FrameLink.h"
+#include "PhaseStats.h"
+#include "FixedFormat.h"
+#include "PowerEvents.h"
+#include "EnergySummary.h"
+#include "DeltaLog.h"
 
 extern TimeCounter timeCounter;
 
 // CSV separator
 #define COMMA       ";"
-#define DATA_HEADER "date;time;current(A);voltage(V);realPower(W);apparentPower(VA);powerFactor;windowTime(s)"
+#define DATA_HEADER "date;time;current(A);voltage(V);realPower(W);apparentPower(VA);powerFactor;windowTime(s);lineFrequency(Hz)"
+
+// PhaseSet rows: the columns of each phase (numbered from 1), then the totals
+#define PHASE_HEADER        "current%u(A);voltage%u(V);realPower%u(W);apparentPower%u(VA);powerFactor%u"
+#define PHASE_TOTALS_HEADER "realPower(W);apparentPower(VA);powerFactor;windowTime(s);lineFrequency(Hz)"
+
+// CSV rows: decimals of every value, and the row buffer (on the stack while
+// a record is written). A row of DATA_HEADER takes about 80 characters
+#define CSV_DECIMALS 4
+#define CSV_ROW_SIZE 96
+
+// Record formats of the day files
+#define LOG_FORMAT_CSV    0  // DATA_HEADER rows, the header is sent on transfer
+#define LOG_FORMAT_BINARY 1  // BinaryLog header and records
+
+// Persistent log: the day file stays open and rows go to the 512 byte SD
+// cache block, synced when a block fills, after this interval (ms), on day
+// rollover or when the log is closed. An interval of 0 leaves the interval
+// sync to the caller (syncLog)
+#define LOG_BLOCK_SIZE    512
+#define LOG_SYNC_INTERVAL 30000
+#define LOG_NAME_SIZE     15
+
+// Preallocated persistent log: a new day file is created as one contiguous
+// extent for a day of records and erased, so the appends allocate no cluster
+// and write no FAT block. The data ends at the first erased slot (bytes all
+// 0x00 or 0xFF: never a CSV row nor a binary timestamp), found again after a
+// reset or a directory change; the file is truncated to the data when the
+// log is released (day rollover, shutdown).
+// CSV_HARMONIC_SIZE bounds the harmonic columns of a row
+#define CSV_HARMONIC_SIZE ((2 + 2 * HARMONIC_ORDERS) * 10)
+
+// Framed transfer: frames sent ahead of the acknowledgements, time to wait
+// for a reply (ms) and resends of the same frame before giving up
+#define TRANSFER_WINDOW_FRAMES 4
+#define TRANSFER_ACK_TIMEOUT   1000
+#define TRANSFER_MAX_RETRIES   5
+#define TRANSFER_READ_SIZE     64   // Piece of a file read at once
+
+// Incremental transfers send per step what the port takes without blocking,
+// or this many bytes when the port can not tell (software serial)
+#define TRANSFER_STEP_SIZE 8
+
+// Transfer modes and status of continueTransfer
+#define TRANSFER_NONE    0
+#define TRANSFER_TEXT    1
+#define TRANSFER_FRAMES  2
+#define TRANSFER_QUERY   3
+#define TRANSFER_SUMMARY 4
+#define TRANSFER_EXPORT  5
+#define TRANSFER_DELTA   6
+#define TRANSFER_ACTIVE  0
+#define TRANSFER_DONE    1
+#define TRANSFER_FAILED  2
+
+// Time index: next to each day file, its name with INDEX_EXTENSION holds the
+// offset (uint32, little endian) of the first record of every INDEX_INTERVAL
+// minutes of the day. Entries are appended when a record starts a new
+// interval, the intervals without records getting the same offset
+#define INDEX_INTERVAL   5
+#define INDEX_EXTENSION  ".idx"
+#define INDEX_NAME_SIZE  (LOG_NAME_SIZE + 4)
+#define INDEX_ENTRY_SIZE 4
+#define INDEX_UNKNOWN    0xFFFF  // Entries of the index not read yet
+
+// Range query: the records of the day files from a start to an end time
+// (unix seconds of the RTC), in the format of the log. Each day is read from
+// the indexed interval of the start; CSV rows are matched by their
+// "DD/MM/YYYY;hh:mm:ss" prefix, binary records by the timestamp
+#define QUERY_ROW_PREFIX 19
+
+// Export: the day files of a range as one stream. A manifest first, a row
+// per day with the name of its file and the bytes it takes in the stream
+// ("missing" without a file), ended by an empty row. Then the header once
+// (CSV header or binary file header) and the data of each file in order,
+// binary files without their header. The size of the active file is taken
+// by the manifest: the records written during the export are left out
+#define EXPORT_MANIFEST_HEADER "file;size(bytes)"
+#define EXPORT_MISSING         0xFFFFFFFFUL
+
+// Summary file of a month (see EnergySummary.h): its hour and day records
+// are sent as SUMMARY_HEADER rows, the records of a day or the day records of
+// the month. Records not written (no readings, torn) are skipped
+#define SUMMARY_MONTH_DAYS 31
+
+// Harmonic columns, appended when enabled: THD then each order of voltage and current
+#define HARMONICS_HEADER "voltageTHD(%);currentTHD(%)"
+
+// Events file: a row per power quality event, then a 'wave' row per pair of
+// its waveform (pairs numbered from the end of the half-cycle that triggered).
+// Each call of recordEvent writes this many rows, so the measurement goes on
+// between the card writes
+#define EVENT_HEADER          "date;time;event;duration(ms);minVoltage(V);maxVoltage(V);maxCurrent(A);pairRate(Hz)"
+#define EVENT_WAVEFORM_HEADER "wave;pair;current(A);voltage(V)"
+#define EVENT_ROWS_PER_STEP   16
 
 
 /*----------------------------------------------------------------------------
@@ -27,7 +126,23 @@ extern TimeCounter timeCounter;
 class FileSystem {
 
   public:
-    FileSystem() {}
+    FileSystem() {
+      harmonicColumns = false;
+      phaseColumns = 1;
+      logFormat = LOG_FORMAT_CSV;
+      persistentLog = false;
+      logSyncInterval = LOG_SYNC_INTERVAL;
+      logName[0] = '\0';
+      preallocatedReadings = 0;
+      transferMode = TRANSFER_NONE;
+      transferLink = NULL;
+      deltaLog = NULL;
+      stats = NULL;
+      eventRows = 0;
+      indexedLog[0] = '\0';
+      indexedSlots = INDEX_UNKNOWN;
+      resetRecordStats();
+    }
 
     bool begin();
     bool saveActiveSession(char* dir, char* fileName);
@@ -36,14 +151,118 @@ class FileSystem {
     bool changeDir(char* dir);
     bool makeDir(char* dir);
     bool recordValues(char* fileName, Measure* measure);
+    bool recordValues(char* fileName, PhaseSet* phaseSet);  // One row with every phase (CSV format)
     bool transferFile(char* fileName, ArduinoOutStream* cout, Communicate* communicate);
+    bool transferFileFrames(char* fileName, uint32_t offset, Communicate* communicate, FrameLink* link);
+    bool beginTransfer(char* fileName, ArduinoOutStream* cout);
+    bool beginFrameTransfer(char* fileName, uint32_t offset, Communicate* communicate, FrameLink* link);
+    bool beginDeltaTransfer(char* fileName, DeltaLog* delta);  // Compressed, see DeltaLog.h
+    bool beginQuery(const char* nameFormat, uint32_t from, uint32_t to, ArduinoOutStream* cout);  // Day file names as FILE_NAME_FORMAT
+    bool beginExport(const char* nameFormat, uint32_t firstDay, uint32_t lastDay, ArduinoOutStream* cout);  // Days as unix times, up to today
+    bool beginSummaryTransfer(const char* nameFormat, uint16_t year, uint8_t month, uint8_t day, ArduinoOutStream* cout);  // Day 0: the days of the month
+    uint8_t continueTransfer(Communicate* communicate);
+    void endTransfer();
+    bool isTransferActive() const { return (transferMode != TRANSFER_NONE); }
     void printFreeSpace(ArduinoOutStream* cout);
     void listFiles(Stream* commPort);
     bool wipeSDCard(Stream* commPort);
+    void setHarmonicColumns(bool enable) { harmonicColumns = enable; } // CSV format only
+    void setPhaseColumns(uint8_t phases) { phaseColumns = phases; }    // Header of PhaseSet rows
+    void setLogFormat(uint8_t format) { logFormat = format; }
+    uint8_t getLogFormat() const { return logFormat; }
+    void setPersistentLog(bool enable, uint32_t syncInterval=LOG_SYNC_INTERVAL);
+    void setPreallocation(uint32_t readingsPerDay) { preallocatedReadings = readingsPerDay; } // 0: the file grows
+    uint16_t getRecordSize() const;  // Upper bound of a record, in the current format
+    bool syncLog();
+    void closeLog(bool release=true);  // false: a preallocated file keeps its erased end
+    uint32_t getRecordCount() const { return recordCount; }
+    uint32_t getLastRecordMicros() const { return lastRecordMicros; }
+    uint32_t getMaxRecordMicros() const { return maxRecordMicros; } // Worst case latency of recordValues
+    void resetRecordStats() { recordCount = 0; lastRecordMicros = 0; maxRecordMicros = 0; }
+    void setStats(PhaseStats* phaseStats) { stats = phaseStats; } // NULL: phases not timed
+    bool recordStats(char* fileName, PhaseStats* phaseStats);
+    bool recordEvent(char* fileName, PowerEvents* events);  // A step of the pending event
+    bool recordSummary(const char* nameFormat, EnergySummary* summary);  // Month file names as "%4d.%02d.sum"
+    bool restoreSummary(const char* nameFormat, EnergySummary* summary, uint32_t time);
     static void FATDateTime(uint16_t* date, uint16_t* time);
 
   private:
-    SdFat sd;
+    enum { QUERY_HEADER, QUERY_RECORD, QUERY_SEND, QUERY_SKIP };
+    enum { EXPORT_MANIFEST, EXPORT_MANIFEST_END, EXPORT_HEADER, EXPORT_DATA };
+    enum { DELTA_HEADER, DELTA_FILE_HEADER, DELTA_ROW, DELTA_LITERAL };
+
+    void printHeader(ArduinoOutStream* cout);
+    bool openLog(char* fileName);
+    bool createLogExtent(char* fileName);
+    static uint32_t findDataEnd(HalFile* file);
+    static bool isErasedSlot(HalFile* file, uint32_t position, uint8_t size);
+    bool appendRecord(char* fileName, Measure* measure, PhaseSet* phaseSet);
+    void writeCSVRecord(HalFile* file, Measure* measure);
+    void writePhasesCSVRecord(HalFile* file, PhaseSet* phaseSet);
+    void addHarmonicColumns(RowBuffer* row, Measure* measure);
+    void writeBinaryRecord(HalFile* file, Measure* measure);
+    void writeEventRow(RowBuffer* row, const PowerEvent& event, uint16_t pairRate);
+    void updateIndex(char* fileName, uint32_t offset);
+    static void makeIndexName(const char* fileName, char* indexName);
+    uint32_t findIndexOffset(const char* fileName, uint32_t time);
+    static uint16_t transferBudget(Stream* port);
+    uint8_t continueText(Stream* port);
+    uint8_t continueFrames(Stream* port);
+    void sendFramePiece(Stream* port);
+    uint8_t continueQuery(Stream* port);
+    bool openQueryDay();
+    uint8_t matchQueryRecord();
+    void sendQueryPiece(Stream* port);
+    bool sendHeaderPiece(Stream* port);
+    void makeDayName(char* name) const;
+    uint32_t exportedSize(HalFile* file) const;
+    uint8_t continueExport(Stream* port);
+    void sendManifestRow(Stream* port);
+    bool openExportDay();
+    uint8_t continueDelta(Stream* port);
+    void sendDeltaHeader(Stream* port);
+    void sendLiteralPiece(Stream* port);
+    static uint32_t summaryOffset(uint32_t start, bool dayRecord);
+    static int8_t findSummaryCopy(HalFile* file, uint32_t offset, uint32_t* start, uint16_t* sequence);
+    static bool writeSummaryRecord(HalFile* file, const SummaryRecord* record, bool dayRecord);
+    static bool readSummarySlot(HalFile* file, uint32_t offset, SummaryRecord* record);
+    static bool readSummaryRecord(HalFile* file, uint32_t start, bool dayRecord, SummaryRecord* record);
+    uint8_t continueSummary(Stream* port);
+    static void writeSummaryRow(RowBuffer* row, const SummaryRecord& record, bool dayRecord);
+    void addPhaseTime(uint8_t phase, uint32_t startMicros) { if (stats) { stats->add(phase, HalClock::micros() - startMicros); } }
+
+    HalStorage sd;
+    bool harmonicColumns;
+    uint8_t phaseColumns;
+    uint8_t logFormat;
+
+    HalFile logFile;
+    char logName[LOG_NAME_SIZE];
+    bool persistentLog;
+    uint32_t logSyncInterval, lastSyncTime, syncedBlock;
+    uint32_t preallocatedReadings;
+    uint32_t recordCount, lastRecordMicros, maxRecordMicros;
+    PhaseStats* stats;
+    uint8_t eventRows;  // Rows of the pending event already written
+    char indexedLog[LOG_NAME_SIZE];
+    uint16_t indexedSlots;  // Entries of its index
+
+    HalFile transferData;
+    uint8_t transferMode;
+    FrameLink* transferLink;  // Of the sketch, during a framed transfer
+    uint32_t transferSize;  // End of the data, before the erased part of a preallocated file
+    uint32_t transferOffset, baseFrame, nextFrame, rewindFrame, lastProgressTime;
+    uint16_t frameLength, frameSent;
+    uint8_t retries;
+    bool rewindPending, frameOpen, frameReadError;
+    const char* queryNameFormat;
+    uint32_t queryFrom, queryTo, queryDay;
+    uint8_t queryState, queryRemaining;
+    uint32_t exportSize, exportLastSize;  // Of the manifest row being sent, of the last day
+    uint16_t summarySlot, summaryEnd;
+    uint8_t summaryStride;
+    uint16_t rowSent;  // Bytes of the summary, manifest or coded row already sent
+    DeltaLog* deltaLog;  // Of the sketch, during a compressed transfer
 };
 
 
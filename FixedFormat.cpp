@@ -0,0 +1,193 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the classes FixedFormat and RowBuffer
+ *  Number formatting in integer fixed point
+ */
+
+#include "FixedFormat.h"
+
+// Rounding added by the SdFat ostream for each number of decimals: 0.5 times
+// 0.1f as many times, each product rounded to float as the stream does
+static const float ROUNDING[FIXED_MAX_DECIMALS + 1] PROGMEM = {
+  0.5f,
+  0.5f * 0.1f,
+  0.5f * 0.1f * 0.1f,
+  0.5f * 0.1f * 0.1f * 0.1f,
+  0.5f * 0.1f * 0.1f * 0.1f * 0.1f,
+  0.5f * 0.1f * 0.1f * 0.1f * 0.1f * 0.1f,
+  0.5f * 0.1f * 0.1f * 0.1f * 0.1f * 0.1f * 0.1f
+};
+
+// Digits in groups of 4, each digit by a 16 bit multiply: x / 10 is
+// x * 0xCCCD >> 19 for x below 81920. Only numbers of 10000 and up take a
+// 32 bit division
+#define DIGIT_GROUP       10000
+#define DIGIT_GROUP_SIZE  4
+#define TENTH_MULTIPLIER  0xCCCDUL
+#define TENTH_SHIFT       19
+
+// Float layout: 23 bit mantissa with an implicit 24th bit, exponent bias 127
+#define FLOAT_IMPLICIT_BIT     0x800000UL
+#define FLOAT_MANTISSA_MASK    0x7FFFFFUL
+#define FLOAT_EXPONENT_MASK    0xFFUL
+#define FLOAT_EXPONENT_BIAS    150  // Bias plus the mantissa bits: value = significand * 2^(exponent - 150)
+#define FLOAT_SIGNIFICAND_BITS 24
+
+
+//==============================================================================
+// Fixed number of decimals, the same text as the SdFat ostream: the value
+// plus its rounding (one float add, as the stream does), then the integer
+// part and each decimal of the fraction times 10 rounded to float, here in
+// integers. NaN is "nan"; infinity, as any value past 4E9, is "BIG FLT"
+//
+uint8_t FixedFormat::format(char* text, float value, uint8_t decimals) {
+
+  char* cursor = text;
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  if (((bits >> 23) & FLOAT_EXPONENT_MASK) == FLOAT_EXPONENT_MASK && (bits & FLOAT_MANTISSA_MASK)) {
+    strcpy(cursor, "nan");
+    return 3;
+  }
+  if (decimals > FIXED_MAX_DECIMALS) {
+    decimals = FIXED_MAX_DECIMALS;
+  }
+  if (value < 0.0) {
+    *cursor++ = '-';
+    value = -value;
+  }
+  if (value > 4.0E9) {
+    strcpy(cursor, "BIG FLT");
+    return uint8_t(cursor - text) + 7;
+  }
+
+  value += pgm_read_float(&ROUNDING[decimals]);
+
+  // value = significand / 2^shift: the integer part, and the fraction as
+  // significand / 2^shift with the integer bits cleared
+  memcpy(&bits, &value, sizeof(bits));
+  int16_t shift = FLOAT_EXPONENT_BIAS - int16_t((bits >> 23) & FLOAT_EXPONENT_MASK);
+  uint32_t significand = (bits & FLOAT_MANTISSA_MASK) | FLOAT_IMPLICIT_BIT;
+  uint32_t integer = 0;
+
+  if (shift <= 0) {
+    integer = significand << -shift;
+    significand = 0;
+  }
+  else if (shift < 32) {
+    integer = significand >> shift;
+    significand &= (1UL << shift) - 1;
+  }
+
+  cursor += formatUnsigned(cursor, integer);
+  if (decimals) {
+    *cursor++ = '.';
+  }
+  // Fraction times 10 (28 bits at most), rounded to the 24 bits of a float
+  // to nearest, ties to even; its integer part is the digit
+  while (decimals-- > 0) {
+    uint32_t product = significand * 10;
+    if (product >> FLOAT_SIGNIFICAND_BITS) {
+      uint8_t drop = 1 + ((product >> (FLOAT_SIGNIFICAND_BITS + 1)) != 0) + ((product >> (FLOAT_SIGNIFICAND_BITS + 2)) != 0) +
+                     ((product >> (FLOAT_SIGNIFICAND_BITS + 3)) != 0);
+      uint32_t rest = product & ((1UL << drop) - 1);
+      uint32_t half = 1UL << (drop - 1);
+      product >>= drop;
+      if (rest > half || (rest == half && (product & 1))) {
+        ++product;
+      }
+      shift -= drop;
+    }
+    uint8_t digit = (shift < 32) ? uint8_t(product >> shift) : 0;
+    *cursor++ = char('0' + digit);
+    significand = (shift < 32) ? product - (uint32_t(digit) << shift) : product;
+  }
+
+  *cursor = '\0';
+  return uint8_t(cursor - text);
+}
+
+uint8_t FixedFormat::formatUnsigned(char* text, uint32_t value) {
+
+  // Digits counted first, then written backwards in place
+  uint8_t length = 1;
+  for (uint32_t limit = 10; value >= limit && length < 10; limit *= 10) {
+    ++length;
+  }
+  char* cursor = text + length;
+  *cursor = '\0';
+
+  while (value >= DIGIT_GROUP) {
+    uint32_t high = value / DIGIT_GROUP;
+    cursor = putDigits(cursor, uint16_t(value - high * DIGIT_GROUP), DIGIT_GROUP_SIZE);
+    value = high;
+  }
+  // Leading group without zeros
+  uint16_t group = uint16_t(value);
+  do {
+    uint16_t tenth = uint16_t((group * TENTH_MULTIPLIER) >> TENTH_SHIFT);
+    *--cursor = char('0' + (group - tenth * 10));
+    group = tenth;
+  } while (group);
+  return length;
+}
+
+// Count digits of value (below 10^count), zeros included, written backwards
+// from end -- Return the first one
+char* FixedFormat::putDigits(char* end, uint16_t value, uint8_t count) {
+
+  while (count-- > 0) {
+    uint16_t tenth = uint16_t((value * TENTH_MULTIPLIER) >> TENTH_SHIFT);
+    *--end = char('0' + (value - tenth * 10));
+    value = tenth;
+  }
+  return end;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Row assembly
+//
+void RowBuffer::add(char c) {
+  if (length >= size) {
+    flush();
+  }
+  buffer[length++] = c;
+}
+
+void RowBuffer::add(const char* text) {
+  while (*text) {
+    add(*text++);
+  }
+}
+
+void RowBuffer::add(const __FlashStringHelper* text) {
+  const char* cursor = reinterpret_cast<const char*>(text);
+  char c;
+  while ((c = pgm_read_byte(cursor++)) != '\0') {
+    add(c);
+  }
+}
+
+void RowBuffer::addNumber(float value, uint8_t decimals) {
+
+  // Formatted in place, with room for the terminator
+  if (size - length < FIXED_TEXT_SIZE) {
+    flush();
+  }
+  length += FixedFormat::format(buffer + length, value, decimals);
+}
+
+// One write of the whole row
+void RowBuffer::flush() {
+  if (length) {
+    output->write(reinterpret_cast<const uint8_t*>(buffer), length);
+    length = 0;
+  }
+}
+//------------------------------------------------------------------------------
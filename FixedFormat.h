@@ -0,0 +1,62 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _FIXED_FORMAT_H_
+#define _FIXED_FORMAT_H_
+
+#include "HAL.h"
+
+// Longest formatted number: sign, 10 integer digits, point, decimals and '\0'
+#define FIXED_MAX_DECIMALS 6
+#define FIXED_TEXT_SIZE    (13 + FIXED_MAX_DECIMALS)
+
+
+/*----------------------------------------------------------------------------
+ *  Class FixedFormat
+ *  Float to text with a fixed number of decimals, byte for byte the text of
+ *  the SdFat ostream: the same rounding is added in float, and the stream's
+ *  float multiply by 10 of each decimal is reproduced in integers (rounded
+ *  to nearest, ties to even). One float add where the stream takes a
+ *  multiply, a conversion and a subtract per decimal
+ */
+class FixedFormat {
+
+  public:
+    // Return the length, text terminated by '\0' (FIXED_TEXT_SIZE at most)
+    static uint8_t format(char* text, float value, uint8_t decimals);
+    static uint8_t formatUnsigned(char* text, uint32_t value);
+
+  private:
+    static char* putDigits(char* end, uint16_t value, uint8_t count);
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class RowBuffer
+ *  Text assembled in a caller buffer and written at once to the output when
+ *  flushed, or when the next piece does not fit
+ */
+class RowBuffer {
+
+  public:
+    RowBuffer(Print* output, char* buffer, uint8_t size) {
+      this->output = output;
+      this->buffer = buffer;
+      this->size = size;
+      length = 0;
+    }
+
+    void add(char c);
+    void add(const char* text);
+    void add(const __FlashStringHelper* text);
+    void addNumber(float value, uint8_t decimals);
+    void flush();
+
+  private:
+    Print* output;
+    char* buffer;
+    uint8_t size, length;
+};
+
+
+#endif // _FIXED_FORMAT_H_
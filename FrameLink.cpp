@@ -0,0 +1,100 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class FrameLink
+ *  Framing of binary transfers over a serial port
+ */
+
+#include "FrameLink.h"
+
+
+//==============================================================================
+// CRC16 CCITT, bitwise (no table in flash)
+//
+uint16_t FrameLink::crc16(uint16_t crc, const uint8_t* data, uint16_t size) {
+  while (size--) {
+    crc ^= uint16_t(*data++) << 8;
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+void FrameLink::writeCRC(uint16_t value) {
+  port->write(uint8_t(value));
+  port->write(uint8_t(value >> 8));
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Frames: the CRC covers every byte after the start byte
+//
+void FrameLink::beginFrame(uint8_t type, uint16_t sequence, uint32_t offset, uint16_t length) {
+
+  uint8_t header[FRAME_HEADER_SIZE] = {
+    FRAME_START, type,
+    uint8_t(sequence), uint8_t(sequence >> 8),
+    uint8_t(offset), uint8_t(offset >> 8), uint8_t(offset >> 16), uint8_t(offset >> 24),
+    uint8_t(length), uint8_t(length >> 8)
+  };
+
+  crc = crc16(0xFFFF, header + 1, FRAME_HEADER_SIZE - 1);
+  port->write(header, FRAME_HEADER_SIZE);
+}
+
+void FrameLink::writePayload(const uint8_t* data, uint16_t size) {
+  crc = crc16(crc, data, size);
+  port->write(data, size);
+}
+
+void FrameLink::endFrame() {
+  writeCRC(crc);
+}
+
+// Invalid CRC: the receiver discards the frame and asks for it again
+void FrameLink::abortFrame() {
+  writeCRC(~crc);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Replies of the receiver
+//
+void FrameLink::sendReply(uint8_t type, uint16_t sequence) {
+  uint8_t reply[FRAME_REPLY_SIZE - 2] = { FRAME_START, type, uint8_t(sequence), uint8_t(sequence >> 8) };
+  port->write(reply, sizeof(reply));
+  writeCRC(crc16(0xFFFF, reply + 1, sizeof(reply) - 1));
+}
+
+// Read the bytes waiting, without blocking, skipping noise -- Return a valid
+// reply was completed
+bool FrameLink::pollReply(uint8_t* type, uint16_t* sequence) {
+
+  while (port->available()) {
+
+    uint8_t value = uint8_t(port->read());
+    if (received == 0 && value != FRAME_START) {
+      continue;
+    }
+    reply[received++] = value;
+    if (received < FRAME_REPLY_SIZE) {
+      continue;
+    }
+
+    received = 0;
+    uint16_t checksum = reply[4] | (uint16_t(reply[5]) << 8);
+    if (crc16(0xFFFF, reply + 1, 3) == checksum) {
+      *type = reply[1];
+      *sequence = reply[2] | (uint16_t(reply[3]) << 8);
+      return true;
+    }
+  }
+
+  return false;
+}
+//------------------------------------------------------------------------------
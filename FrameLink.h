@@ -0,0 +1,64 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _FRAME_LINK_H_
+#define _FRAME_LINK_H_
+
+#include "HAL.h"
+
+// Frame: start, type, sequence(u16), offset(u32), length(u16), payload, CRC16
+// Reply: start, type, sequence(u16), CRC16 -- all fields little endian
+#define FRAME_START       0xA5
+#define FRAME_HEADER_SIZE 10
+#define FRAME_REPLY_SIZE  6
+#define FRAME_MAX_PAYLOAD 512
+
+// Frame types
+#define FRAME_DATA  'D'  // Payload of the file at offset
+#define FRAME_END   'E'  // Transfer complete, offset holds the file size
+#define FRAME_ERROR 'X'  // File not found or offset past its end
+
+// Reply types
+#define FRAME_ACK  'K'   // Every frame up to sequence received
+#define FRAME_NACK 'N'   // Resend from sequence
+
+
+/*----------------------------------------------------------------------------
+ *  Class FrameLink
+ *  Framing and CRC16 (CCITT, 0xFFFF initial value) of binary transfers over
+ *  a serial port. Payloads are written in pieces, so no frame sized buffer
+ *  is needed
+ */
+class FrameLink {
+
+  public:
+    FrameLink(Stream* linkPort=NULL) {
+      setPort(linkPort);
+    }
+
+    void setPort(Stream* linkPort) {
+      port = linkPort;
+      crc = 0;
+      received = 0;
+    }
+
+    void beginFrame(uint8_t type, uint16_t sequence, uint32_t offset, uint16_t length);
+    void writePayload(const uint8_t* data, uint16_t size);
+    void endFrame();
+    void abortFrame();
+    void sendReply(uint8_t type, uint16_t sequence);
+    bool pollReply(uint8_t* type, uint16_t* sequence);
+
+    static uint16_t crc16(uint16_t crc, const uint8_t* data, uint16_t size);
+
+  private:
+    void writeCRC(uint16_t value);
+
+    Stream* port;
+    uint16_t crc;
+    uint8_t reply[FRAME_REPLY_SIZE];
+    uint8_t received;
+};
+
+
+#endif // _FRAME_LINK_H_
@@ -0,0 +1,30 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+
+/*----------------------------------------------------------------------------
+ *  Hardware abstraction layer
+ *  Every access to the hardware goes through one of these seams:
+ *
+ *    HalADC        - analog acquisition (signal channels and internal reference)
+ *    HalClock      - millis/micros/delay
+ *    HalRTC        - real time clock, returning HalDateTime objects
+ *    HalStorage    - SD Card block storage, returning HalFile objects
+ *    HalSoftSerial - software serial port used by the bluetooth module
+ *
+ *  The AVR backend maps the seams to the Arduino core and libraries, with no
+ *  runtime cost. The host backend (folder "host", ignored by the Arduino IDE)
+ *  implements them on Linux, to build and profile the same classes off board.
+ */
+
+#ifdef ARDUINO
+#include "HAL_AVR.h"
+#else
+#include "host/HAL_Host.h"
+#endif
+
+
+#endif // _HAL_H_
@@ -0,0 +1,105 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the AVR hardware abstraction layer
+ *  Timer1 triggered ADC acquisition feeding a ping-pong sample buffer
+ */
+
+#ifdef ARDUINO
+
+#include "HAL.h"
+
+SampleBuffer* volatile HalADC::continuousBuffer = 0;
+
+
+//==============================================================================
+// Conversion complete: store the sample and select the next channel. The new
+// MUX value is latched by the next Timer1 trigger, so channels never mix up
+//
+ISR(ADC_vect) {
+  uint16_t value = ADCL;  // Must read ADCL first - it then locks ADCH
+  value |= ADCH << 8;
+
+  uint8_t nextPin = HalADC::continuousBuffer->push(value);
+  if (nextPin == SAMPLE_REFERENCE_PIN) {
+    HalADC::selectReference();
+  }
+  else {
+    HalADC::selectPin(nextPin);
+  }
+
+  // Compare match B flag must be cleared to allow the next auto trigger
+  TIFR1 = _BV(OCF1B);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Start Timer1 in CTC mode and the ADC in auto trigger mode
+//
+void HalADC::startContinuous(SampleBuffer* buffer, uint16_t pairRate) {
+
+  uint8_t sreg = SREG;
+  cli();
+
+  buffer->reset();
+  continuousBuffer = buffer;
+  uint32_t conversionRate = uint32_t(buffer->getConversionsPerPair()) * pairRate;
+
+  // Timer1 CTC at the conversion rate (one conversion per channel), clamped
+  // to the range of the timer and of the ADC. The slow rates take the
+  // prescaler of 8, so the period fits OCR1A
+  if (conversionRate < HAL_ADC_MIN_CONVERSION_RATE) {
+    conversionRate = HAL_ADC_MIN_CONVERSION_RATE;
+  }
+  else if (conversionRate > HAL_ADC_MAX_CONVERSION_RATE) {
+    conversionRate = HAL_ADC_MAX_CONVERSION_RATE;
+  }
+  uint32_t ticks = F_CPU / conversionRate;
+  uint8_t clockSelect = _BV(CS10);
+  if (ticks > HAL_TIMER_MAX_TICKS) {
+    ticks = F_CPU / 8 / conversionRate;
+    clockSelect = _BV(CS11);
+  }
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  OCR1A = uint16_t(ticks - 1);
+  OCR1B = OCR1A;
+  TIFR1 = _BV(OCF1B);
+
+  // First conversion on the current channel of the first block
+  ADCSRB = _BV(ADTS2) | _BV(ADTS0);  // Trigger source: Timer1 compare match B
+  selectPin(buffer->getBlockCurrentPin());
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | _BV(ADPS2) | _BV(ADPS1);
+  if (conversionRate <= HAL_ADC_SLOW_CLOCK_MAX_CONVERSION_RATE) {
+    ADCSRA |= _BV(ADPS0);
+  }
+
+  TCCR1B = _BV(WGM12) | clockSelect;  // CTC with OCR1A as TOP
+
+  SREG = sreg;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Stop triggering and restore the ADC as configured by the Arduino core
+//
+void HalADC::stopContinuous() {
+
+  uint8_t sreg = SREG;
+  cli();
+
+  TCCR1B = 0;
+  ADCSRA = _BV(ADEN) | _BV(ADIF) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  ADCSRB = 0;
+  continuousBuffer = 0;
+
+  SREG = sreg;
+}
+//------------------------------------------------------------------------------
+
+#endif // ARDUINO
@@ -0,0 +1,143 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HAL_AVR_H_
+#define _HAL_AVR_H_
+
+#include <SPI.h>
+#include <SdFat.h>
+#include <Wire.h>
+#include <RTClib.h>
+#include <NeoSWSerial.h>
+
+#include "Arduino.h"
+#include "SampleBuffer.h"
+
+// Fastest ADC clock (prescaler 128) converts in 13.5 clocks = 108us, so
+// above this conversion rate (two or three per pair) the prescaler is lowered
+// to 64 (250kHz ADC clock)
+#define HAL_ADC_SLOW_CLOCK_MAX_CONVERSION_RATE 9000
+
+// Timer1 triggers a conversion every 1 to 65536 clocks: down to F_CPU / 65536
+// conversions/s (244 at 16MHz) with no prescaler, 8 times less with the
+// prescaler of 8. The 250kHz ADC clock converts at most about 18500/s
+#define HAL_TIMER_MAX_TICKS         65536UL
+#define HAL_ADC_MIN_CONVERSION_RATE (F_CPU / (8 * HAL_TIMER_MAX_TICKS) + 1)
+#define HAL_ADC_MAX_CONVERSION_RATE 18500UL
+
+// Internal 1.1V reference (bandgap) on the multiplexer, and the conversions
+// of a sequential reading of it: about 0.4 to 1.7 ms, where a fixed 2 ms
+// settling delay was used
+#ifdef MUX5
+#define HAL_ADC_BANDGAP_MUX           (_BV(MUX4) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1))  // ATmega2560
+#else
+#define HAL_ADC_BANDGAP_MUX           (_BV(MUX3) | _BV(MUX2) | _BV(MUX1))
+#endif
+#define HAL_REFERENCE_MIN_CONVERSIONS 4
+#define HAL_REFERENCE_MAX_CONVERSIONS 16
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalADC
+ *  Analog acquisition through the ATmega328P ADC (or the ATmega2560 one,
+ *  A8 to A15 selected with MUX5)
+ */
+class HalADC {
+  public:
+    static void begin(uint8_t pin) { pinMode(pin, INPUT); }
+    static uint16_t read(uint8_t pin) { return analogRead(pin); }
+    static uint32_t timestamp() { return ::micros(); } // Time base of the conversions
+
+    // Convert the internal 1.1V reference with Vcc as the ADC reference. The
+    // bandgap and the sample and hold settle in a few conversions, repeated
+    // until two in a row agree. The multiplexer is then left on the next
+    // signal pin, which is tracked before its first conversion
+    static uint16_t readInternalReference(uint8_t nextPin) {
+      uint16_t value = 0, previous;
+
+      selectReference();
+      for (uint8_t conversion = 1; conversion <= HAL_REFERENCE_MAX_CONVERSIONS; ++conversion) {
+        previous = value;
+        ADCSRA |= _BV(ADSC); // Start conversion
+        while (bit_is_set(ADCSRA, ADSC)); // Measuring
+        value = ADCL; // Must read ADCL first - it then locks ADCH
+        value |= ADCH << 8;
+        if (conversion >= HAL_REFERENCE_MIN_CONVERSIONS && value == previous) {
+          break;
+        }
+      }
+
+      selectPin(nextPin);
+      return value;
+    }
+
+    // Multiplexer on an analog pin, or on the internal reference
+    static void selectPin(uint8_t pin) {
+      uint8_t channel = pin - A0;
+#ifdef MUX5
+      ADCSRB = (ADCSRB & ~_BV(MUX5)) | ((channel & 0x08) ? _BV(MUX5) : 0);
+#endif
+      ADMUX = _BV(REFS0) | (channel & 0x07);
+    }
+    static void selectReference() {
+#ifdef MUX5
+      ADCSRB &= ~_BV(MUX5);
+#endif
+      ADMUX = _BV(REFS0) | HAL_ADC_BANDGAP_MUX;
+    }
+
+    // Continuous acquisition: Timer1 auto-triggers conversions at twice the
+    // pair rate and the ADC interrupt stores them alternately in the buffer
+    static void startContinuous(SampleBuffer* buffer, uint16_t pairRate);
+    static void stopContinuous();
+    static bool isContinuous() { return (continuousBuffer != 0); }
+    static void poll() {}
+
+    static SampleBuffer* volatile continuousBuffer;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalClock
+ *  System tick counters
+ */
+class HalClock {
+  public:
+    static uint32_t millis() { return ::millis(); }
+    static uint32_t micros() { return ::micros(); }
+    static void delay(uint32_t ms) { ::delay(ms); }
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalRTC
+ *  DS3231 real time clock over I2C
+ */
+class HalRTC {
+  public:
+    void begin() {
+      Wire.begin();
+      rtc.begin();
+    }
+    DateTime now() { return rtc.now(); }
+
+    // 1 Hz square wave on the SQW pin (open drain), falling as each second turns
+    void beginSquareWave(uint8_t pin, void (*handler)()) {
+      rtc.writeSqwPinMode(DS3231_SquareWave1Hz);
+      pinMode(pin, INPUT_PULLUP);
+      attachInterrupt(digitalPinToInterrupt(pin), handler, FALLING);
+    }
+
+  private:
+    DS3231 rtc;
+};
+
+
+// Storage, date and serial types are used as provided by the libraries
+typedef DateTime HalDateTime;
+typedef SdFat HalStorage;
+typedef File HalFile;
+typedef NeoSWSerial HalSoftSerial;
+
+
+#endif // _HAL_AVR_H_
@@ -0,0 +1,182 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class Harmonics
+ *  Harmonic analysis of the voltage and current samples
+ */
+
+#include "Harmonics.h"
+
+
+// One period of sin() in HARMONIC_SINE_STEPS steps, Q14
+static const int16_t SINE_TABLE[HARMONIC_SINE_STEPS] PROGMEM = {
+  0, 201, 402, 603, 804, 1005, 1205, 1406, 1606, 1806, 2006, 2205, 2404, 2603, 2801, 2999,
+  3196, 3393, 3590, 3786, 3981, 4176, 4370, 4563, 4756, 4948, 5139, 5330, 5520, 5708, 5897, 6084,
+  6270, 6455, 6639, 6823, 7005, 7186, 7366, 7545, 7723, 7900, 8076, 8250, 8423, 8595, 8765, 8935,
+  9102, 9269, 9434, 9598, 9760, 9921, 10080, 10238, 10394, 10549, 10702, 10853, 11003, 11151, 11297, 11442,
+  11585, 11727, 11866, 12004, 12140, 12274, 12406, 12537, 12665, 12792, 12916, 13039, 13160, 13279, 13395, 13510,
+  13623, 13733, 13842, 13949, 14053, 14155, 14256, 14354, 14449, 14543, 14635, 14724, 14811, 14896, 14978, 15059,
+  15137, 15213, 15286, 15357, 15426, 15493, 15557, 15619, 15679, 15736, 15791, 15843, 15893, 15941, 15986, 16029,
+  16069, 16107, 16143, 16176, 16207, 16235, 16261, 16284, 16305, 16324, 16340, 16353, 16364, 16373, 16379, 16383,
+  16384, 16383, 16379, 16373, 16364, 16353, 16340, 16324, 16305, 16284, 16261, 16235, 16207, 16176, 16143, 16107,
+  16069, 16029, 15986, 15941, 15893, 15843, 15791, 15736, 15679, 15619, 15557, 15493, 15426, 15357, 15286, 15213,
+  15137, 15059, 14978, 14896, 14811, 14724, 14635, 14543, 14449, 14354, 14256, 14155, 14053, 13949, 13842, 13733,
+  13623, 13510, 13395, 13279, 13160, 13039, 12916, 12792, 12665, 12537, 12406, 12274, 12140, 12004, 11866, 11727,
+  11585, 11442, 11297, 11151, 11003, 10853, 10702, 10549, 10394, 10238, 10080, 9921, 9760, 9598, 9434, 9269,
+  9102, 8935, 8765, 8595, 8423, 8250, 8076, 7900, 7723, 7545, 7366, 7186, 7005, 6823, 6639, 6455,
+  6270, 6084, 5897, 5708, 5520, 5330, 5139, 4948, 4756, 4563, 4370, 4176, 3981, 3786, 3590, 3393,
+  3196, 2999, 2801, 2603, 2404, 2205, 2006, 1806, 1606, 1406, 1205, 1005, 804, 603, 402, 201,
+  0, -201, -402, -603, -804, -1005, -1205, -1406, -1606, -1806, -2006, -2205, -2404, -2603, -2801, -2999,
+  -3196, -3393, -3590, -3786, -3981, -4176, -4370, -4563, -4756, -4948, -5139, -5330, -5520, -5708, -5897, -6084,
+  -6270, -6455, -6639, -6823, -7005, -7186, -7366, -7545, -7723, -7900, -8076, -8250, -8423, -8595, -8765, -8935,
+  -9102, -9269, -9434, -9598, -9760, -9921, -10080, -10238, -10394, -10549, -10702, -10853, -11003, -11151, -11297, -11442,
+  -11585, -11727, -11866, -12004, -12140, -12274, -12406, -12537, -12665, -12792, -12916, -13039, -13160, -13279, -13395, -13510,
+  -13623, -13733, -13842, -13949, -14053, -14155, -14256, -14354, -14449, -14543, -14635, -14724, -14811, -14896, -14978, -15059,
+  -15137, -15213, -15286, -15357, -15426, -15493, -15557, -15619, -15679, -15736, -15791, -15843, -15893, -15941, -15986, -16029,
+  -16069, -16107, -16143, -16176, -16207, -16235, -16261, -16284, -16305, -16324, -16340, -16353, -16364, -16373, -16379, -16383,
+  -16384, -16383, -16379, -16373, -16364, -16353, -16340, -16324, -16305, -16284, -16261, -16235, -16207, -16176, -16143, -16107,
+  -16069, -16029, -15986, -15941, -15893, -15843, -15791, -15736, -15679, -15619, -15557, -15493, -15426, -15357, -15286, -15213,
+  -15137, -15059, -14978, -14896, -14811, -14724, -14635, -14543, -14449, -14354, -14256, -14155, -14053, -13949, -13842, -13733,
+  -13623, -13510, -13395, -13279, -13160, -13039, -12916, -12792, -12665, -12537, -12406, -12274, -12140, -12004, -11866, -11727,
+  -11585, -11442, -11297, -11151, -11003, -10853, -10702, -10549, -10394, -10238, -10080, -9921, -9760, -9598, -9434, -9269,
+  -9102, -8935, -8765, -8595, -8423, -8250, -8076, -7900, -7723, -7545, -7366, -7186, -7005, -6823, -6639, -6455,
+  -6270, -6084, -5897, -5708, -5520, -5330, -5139, -4948, -4756, -4563, -4370, -4176, -3981, -3786, -3590, -3393,
+  -3196, -2999, -2801, -2603, -2404, -2205, -2006, -1806, -1606, -1406, -1205, -1005, -804, -603, -402, -201
+};
+
+static inline int16_t sine(uint16_t index) {
+  return int16_t(pgm_read_word(&SINE_TABLE[index & (HARMONIC_SINE_STEPS - 1)]));
+}
+
+
+//==============================================================================
+// Clear the results
+//
+void Harmonics::begin() {
+  phase = 0;
+  phaseStep = 0;
+  zeroCurrentCode = 0;
+  zeroVoltageCode = 0;
+  windowCounter = 0;
+  memset(window, 0, sizeof(window));
+  memset(sumCurrentHarmonic, 0, sizeof(sumCurrentHarmonic));
+  memset(sumVoltageHarmonic, 0, sizeof(sumVoltageHarmonic));
+  memset(currentHarmonic, 0, sizeof(currentHarmonic));
+  memset(voltageHarmonic, 0, sizeof(voltageHarmonic));
+  currentTHD = 0;
+  voltageTHD = 0;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Discard the window sums and restart the phase at the fundamental frequency
+//
+void Harmonics::startWindow(float fundamental, float pairRate, int16_t zeroCurrent, int16_t zeroVoltage) {
+
+  // Phase of the fundamental advanced per pair, as a fraction of 2^32
+  phaseStep = (pairRate > 0) ? uint32_t(4294967296.0 * fundamental / pairRate) : 0;
+  phase = 0;
+  zeroCurrentCode = zeroCurrent;
+  zeroVoltageCode = zeroVoltage;
+  memset(window, 0, sizeof(window));
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Correlate consecutive sample pairs with every harmonic order. The phase of
+// order h is h times the fundamental phase, built by repeated addition. The
+// int32 partial sums hold 128 pairs (1023 * 16384 * 128 < 2^31)
+//
+void Harmonics::accumulate(const uint16_t (*pairs)[2], uint8_t count) {
+
+  PartialCorrelation partial[HARMONIC_ORDERS];
+  memset(partial, 0, sizeof(partial));
+
+  for (uint8_t pairIndex = 0; pairIndex < count; ++pairIndex) {
+
+    int16_t current = int16_t(pairs[pairIndex][0]) - zeroCurrentCode;
+    int16_t voltage = int16_t(pairs[pairIndex][1]) - zeroVoltageCode;
+    uint16_t fundamentalPhase = uint16_t(phase >> 16);
+    uint16_t harmonicPhase = 0;
+
+    for (uint8_t order = 0; order < HARMONIC_ORDERS; ++order) {
+      harmonicPhase += fundamentalPhase;
+      uint16_t index = (harmonicPhase + HARMONIC_PHASE_ROUNDING) >> HARMONIC_PHASE_SHIFT;
+      int16_t sinValue = sine(index);
+      int16_t cosValue = sine(index + HARMONIC_SINE_STEPS / 4);
+
+      partial[order].currentRe += int32_t(current) * cosValue;
+      partial[order].currentIm += int32_t(current) * sinValue;
+      partial[order].voltageRe += int32_t(voltage) * cosValue;
+      partial[order].voltageIm += int32_t(voltage) * sinValue;
+    }
+    phase += phaseStep;
+  }
+
+  for (uint8_t order = 0; order < HARMONIC_ORDERS; ++order) {
+    window[order].currentRe += partial[order].currentRe;
+    window[order].currentIm += partial[order].currentIm;
+    window[order].voltageRe += partial[order].voltageRe;
+    window[order].voltageIm += partial[order].voltageIm;
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// RMS value of each order in the window: sqrt(2) * |X| / n, scaled from ADC
+// codes to amperes and volts
+//
+void Harmonics::closeWindow(uint16_t sampleCount, float currentScale, float voltageScale) {
+
+  if (sampleCount == 0) {
+    return;
+  }
+
+  float factor = sqrt(2.0) / (HARMONIC_SINE_ONE * sampleCount);
+
+  for (uint8_t order = 0; order < HARMONIC_ORDERS; ++order) {
+    const Correlation& sums = window[order];
+    sumCurrentHarmonic[order] += sqrt(sums.currentRe * sums.currentRe + sums.currentIm * sums.currentIm) * factor * currentScale;
+    sumVoltageHarmonic[order] += sqrt(sums.voltageRe * sums.voltageRe + sums.voltageIm * sums.voltageIm) * factor * voltageScale;
+  }
+  ++windowCounter;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Average the orders through the windows of the reading, and the distortion
+//
+void Harmonics::calculateAverage() {
+
+  if (windowCounter == 0) {
+    return;
+  }
+
+  for (uint8_t order = 0; order < HARMONIC_ORDERS; ++order) {
+    currentHarmonic[order] = sumCurrentHarmonic[order] / windowCounter;
+    voltageHarmonic[order] = sumVoltageHarmonic[order] / windowCounter;
+    sumCurrentHarmonic[order] = 0;
+    sumVoltageHarmonic[order] = 0;
+  }
+  windowCounter = 0;
+
+  currentTHD = calculateTHD(currentHarmonic);
+  voltageTHD = calculateTHD(voltageHarmonic);
+}
+
+// sqrt(sum of the squared orders 2 and above) / fundamental
+float Harmonics::calculateTHD(const float* harmonic) {
+
+  float sumSqrHarmonics = 0;
+  for (uint8_t order = 1; order < HARMONIC_ORDERS; ++order) {
+    sumSqrHarmonics += harmonic[order] * harmonic[order];
+  }
+  return (harmonic[0] > 0) ? 100 * sqrt(sumSqrHarmonics) / harmonic[0] : 0;
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,72 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HARMONICS_H_
+#define _HARMONICS_H_
+
+#include "HAL.h"
+
+// Harmonic orders analysed (1 = fundamental). Each order costs 16 bytes of
+// RAM for the window sums plus 16 bytes for the averages and results
+#define HARMONIC_ORDERS 15
+
+// Fundamental assumed until a cycle synchronized window measures it
+#define NOMINAL_LINE_FREQUENCY 60.0
+
+// Sine table in flash: 512 entries (1kB) in Q14 (16384 = 1.0). The phase
+// resolution of 0.7 degrees limits the THD floor of a pure sine to about 0.1%
+#define HARMONIC_SINE_STEPS     512
+#define HARMONIC_SINE_ONE       16384.0
+#define HARMONIC_PHASE_SHIFT    7     // 16 bit phase to table index
+#define HARMONIC_PHASE_ROUNDING 0x40
+
+
+/*----------------------------------------------------------------------------
+ *  Class Harmonics
+ *  Voltage and current harmonics by direct correlation of each sample pair
+ *  with the sine and cosine of every harmonic order. Phases come from an
+ *  accumulator stepped at the fundamental frequency and a table in flash, so
+ *  the sample loop has integer multiplies only. Windows closed on the zero
+ *  crossings hold a whole number of cycles, which keeps the orders apart
+ */
+class Harmonics {
+
+  public:
+    Harmonics() {}
+
+    void begin();
+    void startWindow(float fundamental, float pairRate, int16_t zeroCurrentCode, int16_t zeroVoltageCode);
+    void accumulate(const uint16_t (*pairs)[2], uint8_t count); // At most 128 pairs per call
+    void closeWindow(uint16_t sampleCount, float currentScale, float voltageScale);
+    void calculateAverage();
+
+    // RMS value of an order (1 to HARMONIC_ORDERS), in A and V
+    float getCurrentHarmonic(uint8_t order) const { return currentHarmonic[order - 1]; }
+    float getVoltageHarmonic(uint8_t order) const { return voltageHarmonic[order - 1]; }
+
+    // Total harmonic distortion, in % of the fundamental
+    float getCurrentTHD() const { return currentTHD; }
+    float getVoltageTHD() const { return voltageTHD; }
+
+  private:
+    struct Correlation {
+      float currentRe, currentIm, voltageRe, voltageIm;
+    };
+    struct PartialCorrelation {
+      int32_t currentRe, currentIm, voltageRe, voltageIm;
+    };
+
+    static float calculateTHD(const float* harmonic);
+
+    uint32_t phase, phaseStep;
+    int16_t zeroCurrentCode, zeroVoltageCode;
+    uint16_t windowCounter;
+
+    Correlation window[HARMONIC_ORDERS];
+    float sumCurrentHarmonic[HARMONIC_ORDERS], sumVoltageHarmonic[HARMONIC_ORDERS];
+    float currentHarmonic[HARMONIC_ORDERS], voltageHarmonic[HARMONIC_ORDERS];
+    float currentTHD, voltageTHD;
+};
+
+
+#endif // _HARMONICS_H_
@@ -9,21 +9,43 @@
  */
 
 #include "Measure.h"
+#include "WaveformStream.h"
 
 
 //==============================================================================
 // SETUP of aquisition input pins and variable initial values
 //
-void Measure::begin(uint16_t samplesPerWindow=5000, // Sampling rate
-                    uint16_t numWindows=1            // Number of windows to average sampled RMS values
+void Measure::begin(uint16_t samplesPerWindow, // Sampling rate
+                    uint16_t numWindows,       // Number of windows to average sampled RMS values
+                    uint16_t pairRate          // Sample pairs per second of continuous acquisition (0: sequential analogRead)
                    ) {
 
-  pinMode(STANDARD_CURRENT_PIN, INPUT);
-  pinMode(AMPLIFIED_CURRENT_PIN, INPUT);
-  pinMode(VOLTAGE_PIN, INPUT);
+  // Continuous acquisition needs a sample buffer
+  prepare(samplesPerWindow, numWindows, samples ? pairRate : 0);
+
+  // Start the interrupt driven acquisition, if requested
+  if (isContinuous()) {
+    samples->setNumPhases(1);
+    samples->setChannels(dualRange ? STANDARD_CURRENT_PIN : currentPin, VOLTAGE_PIN);
+    if (dualRange) {
+      samples->setDualRange(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, saturationLow, saturationHigh);
+    }
+    HalADC::startContinuous(samples, PAIR_RATE);
+  }
+  readingStartTime = HalClock::millis();
+}
+
+// Pins, sums, Vcc and zero values, without starting the acquisition (a
+// PhaseSet starts it for all its phases)
+void Measure::prepare(uint16_t samplesPerWindow, uint16_t numWindows, uint16_t pairRate) {
+
+  HalADC::begin(STANDARD_CURRENT_PIN);
+  HalADC::begin(AMPLIFIED_CURRENT_PIN);
+  HalADC::begin(VOLTAGE_PIN);
 
   SAMPLES_PER_WINDOW = samplesPerWindow;
   NUM_WINDOWS = numWindows;
+  PAIR_RATE = pairRate;
 
   vccRef = 0.0;
   sumSqrCurrent = 0;
@@ -33,46 +55,168 @@ void Measure::begin(uint16_t samplesPerWindow=5000, // Sampling rate
   zeroVoltage = 0;
   sumZeroCurrent = 0;
   sumZeroVoltage = 0;
+  zeroStandard = 0;
+  zeroStandardCode = 0;
+  sumZeroStandard = 0;
+  sumStandardCurrent = 0;
+  standardSamples = 0;
+  standardZeroCount = 0;
+  intSumStandardCurrent = 0;
+  intSumStandardSqrCurrent = 0;
+  intSumStandardInstPower = 0;
   sumCurrent = 0;
   sumVoltage = 0;
   sumRealPower = 0;
   sumApparentPower = 0;
   sumPowerFactor = 0;
-
-  // Calibrate the analog read reference value
-  calibrateVccRef();
+  sampleCount = 0;
+  windowCounter = 0;
+  discardedBlocks = 0;
+  intSumCurrent = 0;
+  intSumVoltage = 0;
+  intSumSqrCurrent = 0;
+  intSumSqrVoltage = 0;
+  intSumInstPower = 0;
+  readingReady = false;
+  windowClosed = false;
+  lastDroppedBlocks = 0;
+  synchronized = false;
+  crossingArmed = false;
+  cycleCount = 0;
+  synchronizedWindows = 0;
+  previousVoltage = 0;
+  lastVoltageCode = NO_PREVIOUS_VOLTAGE;
+  setVoltageAlignment(1);
+  startFraction = 0;
+  windowPairRate = PAIR_RATE;
+  windowFrequency = 0;
+  lineFrequency = 0;
+  sumLineFrequency = 0;
+
+  // Initial analog read reference value, filtered from then on
+  uint32_t vccMicros = HalClock::micros();
+  float sumVccRef = 0;
+  for (uint8_t reading = 0; reading < VCC_BEGIN_READINGS; ++reading) {
+    sumVccRef += INTERNAL_VREF_VALUE * 1024 / HalADC::readInternalReference(currentPin);
+  }
+  vccRef = sumVccRef / VCC_BEGIN_READINGS;
+  vccDrifting = false;
+  vccCalibrations = 0;
+  vccSavedMicros = 0;
+  lastVccSavedMicros = 0;
+  lastVccCalibration = HalClock::millis();
+  addPhaseTime(PHASE_VCC, HalClock::micros() - vccMicros);
   
   // Calculate initial zero value for each measuring entry
+  uint32_t startMicros = HalADC::timestamp();
   for (uint16_t sampleIndex = 0; sampleIndex < SAMPLES_PER_WINDOW; ++sampleIndex) {
-    sumZeroCurrent += float(analogRead(currentPin));
-    sumZeroVoltage += float(analogRead(VOLTAGE_PIN));
+    if (dualRange) {
+      sumZeroStandard += float(HalADC::read(STANDARD_CURRENT_PIN));
+      ++standardZeroCount;
+    }
+    sumZeroCurrent += float(HalADC::read(currentPin));
+    sumZeroVoltage += float(HalADC::read(VOLTAGE_PIN));
   }
+  if (!isContinuous()) {
+    windowPairRate = 1e6 * SAMPLES_PER_WINDOW / (HalADC::timestamp() - startMicros);
+  }
+  sampleCount = SAMPLES_PER_WINDOW;
   calculateZeroValues();
+  sampleCount = 0;
+
+  if (harmonics) {
+    harmonics->begin();
+    startHarmonicsWindow();
+  }
+  if (events) {
+    events->begin(PAIR_RATE);
+    calibrateEvents();
+  }
+  readingStartTime = HalClock::millis();
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Dual range current: both current channels are converted for every pair and
+// the amplified code is kept unless it is within the saturation limits. The
+// samples stay in the amplified scale, so the range never changes
+//
+void Measure::setDualRange(uint16_t saturationLow, uint16_t saturationHigh) {
+  dualRange = true;
+  currentPin = AMPLIFIED_CURRENT_PIN;
+  this->saturationLow = saturationLow;
+  this->saturationHigh = saturationHigh;
+}
+
+// Interpolation of the voltage to the current instant. The voltage follows
+// the current by a conversion, of 2 per pair of a phase and 2 * phases pairs:
+// 1 / (2 * phases) of the pair period. Dual range (one phase, 3 conversions
+// per pair) the amplified current follows the voltage by 1/3 of the period,
+// extrapolated from the previous voltage, and the standard one precedes it by 1/3
+void Measure::setVoltageAlignment(uint8_t phases) {
+  if (dualRange) {
+    alignScale = 3;
+    alignWeight = 4;
+    alignPreviousWeight = -1;
+    standardAlignWeight = 2;
+    standardAlignPreviousWeight = 1;
+    return;
+  }
+  alignScale = 2 * phases;
+  alignWeight = 2 * phases - 1;
+  alignPreviousWeight = 1;
+  standardAlignWeight = alignWeight;
+  standardAlignPreviousWeight = alignPreviousWeight;
+}
+
+// Sequential acquisition of one pair, in the order of the continuous one
+inline void Measure::readPair(uint16_t* pair) {
+
+  if (!dualRange) {
+    pair[0] = HalADC::read(currentPin);
+    pair[1] = HalADC::read(VOLTAGE_PIN);
+    return;
+  }
+
+  uint16_t standardCode = HalADC::read(STANDARD_CURRENT_PIN);
+  sumZeroStandard += float(standardCode);
+  ++standardZeroCount;
+  pair[1] = HalADC::read(VOLTAGE_PIN);
+  pair[0] = SampleBuffer::selectCurrent(standardCode, HalADC::read(AMPLIFIED_CURRENT_PIN), saturationLow, saturationHigh);
 }
 //------------------------------------------------------------------------------
 
 
 //==============================================================================
-// Vref calibration precision test
+// Vcc reference calibration
 //
+
+// Sequential acquisition: bandgap read between two windows
 void Measure::calibrateVccRef() {
 
-  float maxVccRef;
-  long temp;
+  uint32_t startMicros = HalClock::micros();
+  applyVccReading(HalADC::readInternalReference(currentPin));
+  uint32_t elapsed = HalClock::micros() - startMicros;
 
-  // Set the reference to Vcc and the measurement to the internal 1.1V reference
-  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+  vccSavedMicros += VCC_LEGACY_MICROS - int32_t(elapsed);
+  addPhaseTime(PHASE_VCC, elapsed);
+}
 
-  delay(2); // Wait for Vref to settle
-  ADCSRA |= _BV(ADSC); // Start conversion
-  while (bit_is_set(ADCSRA, ADSC)); // Measuring
-  temp = ADCL; // Must read ADCL first - it then locks ADCH
-  temp |= ADCH << 8;
+// Low pass filter of the readings, and drift detection
+void Measure::applyVccReading(uint16_t referenceCode) {
 
-  maxVccRef = INTERNAL_VREF_VALUE * 1024 / temp;
-  if (maxVccRef > vccRef) {
-    vccRef = maxVccRef;
-  }
+  float difference = INTERNAL_VREF_VALUE * 1024 / referenceCode - vccRef;
+  float threshold = vccDrifting ? VCC_DRIFT_THRESHOLD / 2 : VCC_DRIFT_THRESHOLD;
+
+  vccDrifting = (difference > threshold || difference < -threshold);
+  vccRef += difference * VCC_FILTER_WEIGHT;
+  lastVccCalibration = HalClock::millis();
+  ++vccCalibrations;
+}
+
+bool Measure::isVccCalibrationDue() const {
+  return vccDrifting || HalClock::millis() - lastVccCalibration >= vccCalibrationPeriod;
 }
 //------------------------------------------------------------------------------
 
@@ -81,56 +225,553 @@ void Measure::calibrateVccRef() {
 // Calculate the zero to be used as next sample DC value
 //
 void Measure::calculateZeroValues() {
-  zeroCurrent = sumZeroCurrent / SAMPLES_PER_WINDOW;
-  zeroVoltage = sumZeroVoltage / SAMPLES_PER_WINDOW;
+
+  if (!dualRange) {
+    zeroCurrent = sumZeroCurrent / sampleCount;
+  }
+  else {
+    // Standard zero: mean of all its conversions. Amplified zero: the one
+    // that makes the mean current of the whole window zero, the standard
+    // samples counted with their own zero (scaled to the amplified range)
+    uint16_t amplifiedSamples = sampleCount - standardSamples;
+    if (uint32_t(amplifiedSamples) * 100 >= uint32_t(sampleCount) * DUAL_RANGE_MIN_AMPLIFIED_SHARE) {
+      zeroCurrent = (sumZeroCurrent + sumStandardCurrent * scale.gain) / amplifiedSamples;
+    }
+    if (standardZeroCount) {
+      zeroStandard = sumZeroStandard / standardZeroCount;
+    }
+    zeroStandardCode = int16_t(zeroStandard + 0.5);
+    standardShare = uint8_t(uint32_t(standardSamples) * 100 / sampleCount);
+    sumZeroStandard = 0;
+    sumStandardCurrent = 0;
+    standardZeroCount = 0;
+    standardSamples = 0;
+  }
+  zeroVoltage = sumZeroVoltage / sampleCount;
+  zeroCurrentCode = int16_t(zeroCurrent + 0.5);
+  zeroVoltageCode = int16_t(zeroVoltage + 0.5);
   sumZeroCurrent = 0;
   sumZeroVoltage = 0;
 }
 //------------------------------------------------------------------------------
 
 
+//==============================================================================
+// Accumulation of one sample pair
+//
+inline void Measure::accumulateSample(uint16_t currentCode, uint16_t voltageCode, uint16_t previousVoltageCode) {
+
+  float current;
+  float voltage = float(voltageCode);
+  float previous = float(previousVoltageCode) - zeroVoltage;
+  int8_t weight = alignWeight, previousWeight = alignPreviousWeight;
+
+  sumZeroVoltage += voltage;
+
+  // Remove the DC value of the signals, using the previous sample as reference.
+  // Dual range: standard samples are scaled to the amplified range
+  if (currentCode & SAMPLE_STANDARD_RANGE) {
+    current = float(currentCode & SAMPLE_CODE_MASK) - zeroStandard;
+    sumStandardCurrent += current;
+    ++standardSamples;
+    current *= scale.gain;
+    weight = standardAlignWeight;
+    previousWeight = standardAlignPreviousWeight;
+  }
+  else {
+    current = float(currentCode);
+    sumZeroCurrent += current;
+    current -= zeroCurrent;
+  }
+  voltage -= zeroVoltage;
+
+  // Calculation of the real power by integration of the voltage and current
+  // product, the voltage taken at the instant of the current
+  sumSqrCurrent += current * current;
+  sumSqrVoltage += voltage * voltage;
+  sumInstPower += (weight * voltage + previousWeight * previous) * current / alignScale;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Integer kernel: accumulation of one pair of DC-removed samples in int32
+//
+inline void Measure::accumulateInteger(IntegerSums* partial, uint16_t currentCode, uint16_t voltageCode, uint16_t previousVoltageCode) {
+
+  int16_t voltage = int16_t(voltageCode) - zeroVoltageCode;
+  int16_t previous = int16_t(previousVoltageCode) - zeroVoltageCode;
+
+  partial->voltage += voltage;
+  partial->sqrVoltage += int32_t(voltage) * voltage;
+
+  // Dual range: standard samples are summed apart, in their own range. The
+  // power sums take the voltage at the current instant, times alignScale
+  if (currentCode & SAMPLE_STANDARD_RANGE) {
+    int16_t current = int16_t(currentCode & SAMPLE_CODE_MASK) - zeroStandardCode;
+    int16_t aligned = voltage * standardAlignWeight + previous * standardAlignPreviousWeight;
+    partial->standardCurrent += current;
+    partial->standardSqrCurrent += int32_t(current) * current;
+    partial->standardInstPower += int32_t(aligned) * current;
+    ++partial->standardCount;
+    return;
+  }
+
+  int16_t current = int16_t(currentCode) - zeroCurrentCode;
+  int16_t aligned = voltage * alignWeight + previous * alignPreviousWeight;
+  partial->current += current;
+  partial->sqrCurrent += int32_t(current) * current;
+  partial->instPower += int32_t(aligned) * current;
+}
+
+// Fold the int32 partial sums into the int64 window totals
+void Measure::foldIntegerSums(IntegerSums* partial) {
+  intSumCurrent += partial->current;
+  intSumVoltage += partial->voltage;
+  intSumSqrCurrent += partial->sqrCurrent;
+  intSumSqrVoltage += partial->sqrVoltage;
+  intSumInstPower += partial->instPower;
+  intSumStandardCurrent += partial->standardCurrent;
+  intSumStandardSqrCurrent += partial->standardSqrCurrent;
+  intSumStandardInstPower += partial->standardInstPower;
+  standardSamples += partial->standardCount;
+  memset(partial, 0, sizeof(IntegerSums));
+}
+
+// Move the window totals to the float sums, once per window. The residual DC
+// left by the rounded zero is removed exactly: sum((x - mean)^2) = sum(x^2) - sum(x)^2 / n
+void Measure::applyIntegerSums() {
+
+  float n = sampleCount;
+  float perSample = 1.0 / n;
+
+  // Dual range: the standard sums join the amplified ones times the gain,
+  // and the DC left by both rounded zeros is removed together
+  float sumCurrentCodes = intSumCurrent;
+  float sqrCurrentCodes = intSumSqrCurrent;
+  float instPowerCodes = float(intSumInstPower) / alignScale;
+  if (standardSamples) {
+    sumCurrentCodes += float(intSumStandardCurrent) * scale.gain;
+    sqrCurrentCodes += float(intSumStandardSqrCurrent) * scale.gain * scale.gain;
+    instPowerCodes += float(intSumStandardInstPower) * scale.gain / alignScale;
+    sumStandardCurrent = intSumStandardCurrent + (zeroStandardCode - zeroStandard) * standardSamples;
+  }
+
+  sumZeroCurrent = float(zeroCurrentCode) * (sampleCount - standardSamples) + intSumCurrent;
+  sumZeroVoltage = float(zeroVoltageCode) * n + intSumVoltage;
+  sumSqrCurrent = sqrCurrentCodes - sumCurrentCodes * sumCurrentCodes * perSample;
+  sumSqrVoltage = float(intSumSqrVoltage) - float(intSumVoltage) * intSumVoltage * perSample;
+  sumInstPower = instPowerCodes - sumCurrentCodes * intSumVoltage * perSample;
+
+  intSumStandardCurrent = 0;
+  intSumStandardSqrCurrent = 0;
+  intSumStandardInstPower = 0;
+  intSumCurrent = 0;
+  intSumVoltage = 0;
+  intSumSqrCurrent = 0;
+  intSumSqrVoltage = 0;
+  intSumInstPower = 0;
+}
+//------------------------------------------------------------------------------
+
+
 //==============================================================================
 // Samples acquisition
 //
 void Measure::acquireSamples() {
 
-  float current, voltage;
+  uint32_t startMicros = HalClock::micros();
+  uint32_t firstConversion = HalADC::timestamp();
+  uint16_t pair[1][2];
+  uint16_t previousVoltageCode = NO_PREVIOUS_VOLTAGE;
+
+  if (kernel == KERNEL_INTEGER) {
+    IntegerSums partial;
+    memset(&partial, 0, sizeof(partial));
+    for (uint16_t sampleIndex = 0; sampleIndex < SAMPLES_PER_WINDOW; ++sampleIndex) {
+      readPair(pair[0]);
+      accumulateInteger(&partial, pair[0][0], pair[0][1], sampleIndex ? previousVoltageCode : pair[0][1]);
+      previousVoltageCode = pair[0][1];
+      if ((sampleIndex + 1) % INTEGER_KERNEL_CHUNK_PAIRS == 0) {
+        foldIntegerSums(&partial);
+      }
+      if (harmonics) {
+        accumulateHarmonics(pair, 1);
+      }
+    }
+    foldIntegerSums(&partial);
+  }
+  else {
+    for (uint16_t sampleIndex = 0; sampleIndex < SAMPLES_PER_WINDOW; ++sampleIndex) {
+      readPair(pair[0]);
+      accumulateSample(pair[0][0], pair[0][1], sampleIndex ? previousVoltageCode : pair[0][1]);
+      previousVoltageCode = pair[0][1];
+      if (harmonics) {
+        accumulateHarmonics(pair, 1);
+      }
+    }
+  }
 
-  for (uint16_t sampleIndex = 0; sampleIndex < SAMPLES_PER_WINDOW; ++sampleIndex) {
+  // Pair rate of sequential conversions, for the phase step of the harmonics
+  windowPairRate = 1e6 * SAMPLES_PER_WINDOW / (HalADC::timestamp() - firstConversion);
+  sampleCount = SAMPLES_PER_WINDOW;
+  kernelMicros += HalClock::micros() - startMicros;
+  addPhaseTime(PHASE_ACQUIRE, HalClock::micros() - startMicros);
+}
+//------------------------------------------------------------------------------
 
-    current = float(analogRead(currentPin));
-    voltage = float(analogRead(VOLTAGE_PIN));
 
-    sumZeroCurrent += current;
-    sumZeroVoltage += voltage;
+//==============================================================================
+// Accumulate consecutive sample pairs with the selected kernel, after the
+// voltage of the pair before them
+//
+void Measure::accumulatePairs(const uint16_t (*pairs)[2], uint8_t count, uint16_t previousVoltageCode) {
+
+  uint32_t startMicros = HalClock::micros();
+
+  if (kernel == KERNEL_INTEGER) {
+    IntegerSums partial;
+    memset(&partial, 0, sizeof(partial));
+    for (uint8_t pairIndex = 0; pairIndex < count; ++pairIndex) {
+      accumulateInteger(&partial, pairs[pairIndex][0], pairs[pairIndex][1], previousVoltageCode);
+      previousVoltageCode = pairs[pairIndex][1];
+    }
+    foldIntegerSums(&partial);
+  }
+  else {
+    for (uint8_t pairIndex = 0; pairIndex < count; ++pairIndex) {
+      accumulateSample(pairs[pairIndex][0], pairs[pairIndex][1], previousVoltageCode);
+      previousVoltageCode = pairs[pairIndex][1];
+    }
+  }
 
-    // Remove the DC value of the signals, using the previous sample as reference
-    current -= zeroCurrent;
-    voltage -= zeroVoltage;
+  if (harmonics) {
+    accumulateHarmonics(pairs, count);
+  }
+  if (events) {
+    events->accumulate(pairs, count);
+  }
+
+  sampleCount += count;
+  kernelMicros += HalClock::micros() - startMicros;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Harmonics of the pairs. Dual range: standard currents are passed scaled to
+// the amplified range, a few pairs at a time so that the int32 correlation
+// sums of the harmonics hold them (16 pairs of 512 * gain codes, gain <= 16)
+//
+void Measure::accumulateHarmonics(const uint16_t (*pairs)[2], uint8_t count) {
+
+  if (!dualRange) {
+    harmonics->accumulate(pairs, count);
+    return;
+  }
 
-    // Calculation of the real power by integration of the voltage and current product
-    sumSqrCurrent += current * current;
-    sumSqrVoltage += voltage * voltage;
-    sumInstPower += voltage * current;
+  const uint8_t CHUNK_PAIRS = 16;
+  uint16_t converted[CHUNK_PAIRS][2];
+  int16_t gain = int16_t(scale.gain);
+
+  for (uint8_t first = 0; first < count; first += CHUNK_PAIRS) {
+    uint8_t chunk = (count - first < CHUNK_PAIRS) ? count - first : CHUNK_PAIRS;
+    for (uint8_t pairIndex = 0; pairIndex < chunk; ++pairIndex) {
+      uint16_t currentCode = pairs[first + pairIndex][0];
+      if (currentCode & SAMPLE_STANDARD_RANGE) {
+        int16_t current = int16_t(currentCode & SAMPLE_CODE_MASK) - zeroStandardCode;
+        currentCode = uint16_t(zeroCurrentCode + current * gain);
+      }
+      converted[pairIndex][0] = currentCode;
+      converted[pairIndex][1] = pairs[first + pairIndex][1];
+    }
+    harmonics->accumulate(converted, chunk);
   }
 }
 //------------------------------------------------------------------------------
 
 
+//==============================================================================
+// Positive going zero crossing of the DC-removed voltage, with hysteresis.
+// The crossing instant is interpolated between the previous and the present
+// sample, as a fraction of the pair period -- Return crossing detected
+//
+inline bool Measure::detectZeroCrossing(uint16_t voltageCode, float* fraction) {
+
+  int16_t voltage = int16_t(voltageCode) - zeroVoltageCode;
+  bool crossing = false;
+
+  if (voltage < -ZERO_CROSSING_HYSTERESIS) {
+    crossingArmed = true;
+  }
+  else if (crossingArmed && voltage >= 0) {
+    crossingArmed = false;
+    crossing = true;
+    *fraction = float(-previousVoltage) / (voltage - previousVoltage);
+  }
+
+  previousVoltage = voltage;
+  return crossing;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Accumulate a block of samples, closing the windows it completes
+//
+void Measure::consumeBlock(const SampleBlock* block) {
+
+  // Dual range: every standard conversion of the block counts for its zero
+  if (dualRange && isContinuous()) {
+    sumZeroStandard += block->standardSum;
+    standardZeroCount += SAMPLE_BLOCK_PAIRS;
+  }
+  consumePairs(block->samples, SAMPLE_BLOCK_PAIRS, block->currentPins[0]);
+}
+
+// Consecutive pairs sampled with the given current channel (a block, or the
+// pairs of this phase in a PhaseSet block)
+void Measure::consumePairs(const uint16_t (*pairs)[2], uint8_t count, uint8_t pairsCurrentPin) {
+
+  // Blocks sampled before a range change would be scaled with the wrong gain
+  if (!isPinInRange(pairsCurrentPin)) {
+    ++discardedBlocks;
+    synchronized = false;
+    lastVoltageCode = NO_PREVIOUS_VOLTAGE;
+    if (events) {
+      events->restart();
+    }
+    return;
+  }
+
+  // Voltage of the pair before the first one, kept for the next pairs
+  uint16_t previousVoltageCode = (lastVoltageCode == NO_PREVIOUS_VOLTAGE) ? pairs[0][1] : lastVoltageCode;
+  lastVoltageCode = pairs[count - 1][1];
+
+  if (!isCycleSynchronized()) {
+    accumulatePairs(pairs, count, previousVoltageCode);
+    if (sampleCount >= SAMPLES_PER_WINDOW) {
+      closeWindow();
+    }
+    return;
+  }
+
+  // Cycle synchronized windows: split the block at the zero crossings
+  uint8_t start = 0;
+  float fraction;
+
+  for (uint8_t pairIndex = 0; pairIndex < count; ++pairIndex) {
+
+    if (!detectZeroCrossing(pairs[pairIndex][1], &fraction)) {
+      continue;
+    }
+
+    // First crossing: the window starts here, samples before it are dropped
+    if (!synchronized) {
+      resetWindowSums();
+      synchronized = true;
+      cycleCount = 0;
+      startFraction = fraction;
+      start = pairIndex;
+      continue;
+    }
+
+    if (++cycleCount < CYCLES_PER_WINDOW) {
+      continue;
+    }
+
+    // Window covers exactly CYCLES_PER_WINDOW cycles: close it at this crossing
+    accumulatePairs(pairs + start, pairIndex - start, start ? pairs[start - 1][1] : previousVoltageCode);
+    windowFrequency = CYCLES_PER_WINDOW * windowPairRate / (sampleCount + fraction - startFraction);
+    sumLineFrequency += windowFrequency;
+    ++synchronizedWindows;
+    closeWindow();
+
+    // Sequential acquisition pauses between windows, and a range change
+    // invalidates the rest of the block: restart on the next crossing
+    if (!isContinuous() || !isPinInRange(pairsCurrentPin)) {
+      synchronized = false;
+      return;
+    }
+
+    cycleCount = 0;
+    startFraction = fraction;
+    start = pairIndex;
+  }
+
+  accumulatePairs(pairs + start, count - start, start ? pairs[start - 1][1] : previousVoltageCode);
+
+  // No crossings (voltage absent): fall back to fixed length windows
+  if (sampleCount >= SAMPLES_PER_WINDOW) {
+    closeWindow();
+    synchronized = false;
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Sequential acquisition of one cycle synchronized window, through sample blocks
+//
+void Measure::acquireSynchronizedWindow() {
+
+  SampleBlock block;
+  uint32_t fillMicros = 0, fillPairs = 0;
+  uint32_t phaseMicros = HalClock::micros(), startCalculation = calculationMicros;
+
+  block.currentPins[0] = currentPin;
+  lastVoltageCode = NO_PREVIOUS_VOLTAGE;
+  synchronized = false;
+  crossingArmed = false;
+  windowClosed = false;
+
+  while (!windowClosed) {
+    uint32_t startMicros = HalADC::timestamp();
+    for (uint8_t pairIndex = 0; pairIndex < SAMPLE_BLOCK_PAIRS; ++pairIndex) {
+      readPair(block.samples[pairIndex]);
+    }
+
+    // Pair rate of sequential conversions, measured for the frequency estimate
+    fillMicros += HalADC::timestamp() - startMicros;
+    fillPairs += SAMPLE_BLOCK_PAIRS;
+    windowPairRate = fillMicros ? 1e6 * fillPairs / fillMicros : 0;
+
+    consumeBlock(&block);
+  }
+  addPhaseTime(PHASE_ACQUIRE, HalClock::micros() - phaseMicros - (calculationMicros - startCalculation));
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Discard the sums of the window being accumulated
+//
+void Measure::resetWindowSums() {
+  sumSqrCurrent = 0;
+  sumSqrVoltage = 0;
+  sumInstPower = 0;
+  sumZeroCurrent = 0;
+  sumZeroVoltage = 0;
+  sumZeroStandard = 0;
+  sumStandardCurrent = 0;
+  standardSamples = 0;
+  standardZeroCount = 0;
+  intSumCurrent = 0;
+  intSumVoltage = 0;
+  intSumSqrCurrent = 0;
+  intSumSqrVoltage = 0;
+  intSumInstPower = 0;
+  intSumStandardCurrent = 0;
+  intSumStandardSqrCurrent = 0;
+  intSumStandardInstPower = 0;
+  sampleCount = 0;
+
+  if (harmonics) {
+    startHarmonicsWindow();
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Restart the harmonic sums, at the last measured line frequency
+//
+void Measure::startHarmonicsWindow() {
+  float fundamental = (windowFrequency > 0) ? windowFrequency : NOMINAL_LINE_FREQUENCY;
+  harmonics->startWindow(fundamental, windowPairRate, zeroCurrentCode, zeroVoltageCode);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Zeros and scale of the next window to the event detector, after the range
+// of the window is chosen
+//
+void Measure::calibrateEvents() {
+  events->setCalibration(zeroCurrentCode, zeroVoltageCode, zeroStandardCode, int16_t(scale.gain), getCurrentPerCode(), getVoltagePerCode());
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Calculate the window values, and the average when the reading is complete
+//
+void Measure::closeWindow() {
+
+  uint32_t startMicros = HalClock::micros();
+
+  // Harmonics are scaled with the current range of the window, before it changes
+  if (harmonics) {
+    harmonics->closeWindow(sampleCount, getCurrentPerCode(), getVoltagePerCode());
+  }
+
+  if (kernel == KERNEL_INTEGER) {
+    applyIntegerSums();
+  }
+  calculateZeroValues();
+  calculateRMSAndPowerValues();
+  windowClosed = true;
+
+  if (harmonics) {
+    startHarmonicsWindow();
+  }
+  if (events) {
+    calibrateEvents();
+  }
+
+  if (++windowCounter >= NUM_WINDOWS) {
+    windowCounter = 0;
+    completeReading();
+  }
+
+  // Continuous acquisition: the bandgap is converted between two blocks
+  if (isContinuous() && samples && isVccCalibrationDue()) {
+    samples->requestReference();
+  }
+
+  uint32_t elapsed = HalClock::micros() - startMicros;
+  calculationMicros += elapsed;
+  addPhaseTime(PHASE_CALCULATE, elapsed);
+}
+
+// Average of the windows of the reading
+void Measure::completeReading() {
+
+  sTime = readingStartTime;
+  eTime = HalClock::millis();
+  readingStartTime = eTime;
+  lastKernelMicros = kernelMicros;
+  kernelMicros = 0;
+  lastVccSavedMicros = vccSavedMicros;
+  vccSavedMicros = 0;
+
+  lineFrequency = synchronizedWindows ? sumLineFrequency / synchronizedWindows : 0;
+  sumLineFrequency = 0;
+  synchronizedWindows = 0;
+
+  calculateAverageRMSAndPowerValues();
+  if (harmonics) {
+    harmonics->calculateAverage();
+  }
+  readingReady = true;
+}
+//------------------------------------------------------------------------------
+
+
 //==============================================================================
 // Calculate the RMS value of voltage and current, and the power consumption
 //
 void Measure::calculateRMSAndPowerValues() {
 
-  // Remove the current gain (squared because is being removed after the squared sum of each sample)
-  if (currentPin == AMPLIFIED_CURRENT_PIN) {
-    sumSqrCurrent /= (CURRENT_GAIN * CURRENT_GAIN);
-    sumInstPower /= CURRENT_GAIN;
-  }
+  // The factors of the window already hold the sensor constants and the gain
+  // of the amplified channel: one division by the sample count is left
+  float perSample = 1.0 / sampleCount;
+  float currentPerCode = getCurrentPerCode();
+  float voltagePerCode = getVoltagePerCode();
 
-  currentRMS = sqrt(sumSqrCurrent / SAMPLES_PER_WINDOW) * (VOLTS_PER_UNITY * vccRef) / SENSOR_SENSIBILITY;
-  voltageRMS = sqrt(sumSqrVoltage / SAMPLES_PER_WINDOW) * (VOLTS_PER_UNITY * vccRef) / VOLTAGE_MEASURING_RATIO;
-  realPower = sumInstPower * (VOLTS_PER_UNITY * vccRef) * (VOLTS_PER_UNITY * vccRef) / (SENSOR_SENSIBILITY * VOLTAGE_MEASURING_RATIO * SAMPLES_PER_WINDOW);
+  currentRMS = sqrt(sumSqrCurrent * perSample) * currentPerCode;
+  voltageRMS = sqrt(sumSqrVoltage * perSample) * voltagePerCode;
+  realPower = sumInstPower * perSample * currentPerCode * voltagePerCode;
   apparentPower = voltageRMS * currentRMS;
   powerFactor = realPower / apparentPower;
 
@@ -144,14 +785,22 @@ void Measure::calculateRMSAndPowerValues() {
   sumSqrCurrent = 0;
   sumSqrVoltage = 0;
   sumInstPower = 0;
+  sampleCount = 0;
 
-  // Alternate the sampling pin if the current value is too low
-  if (currentRMS < CURRENT_ENTRY_SHIFT_VALUE) {
+  // Alternate the sampling pin if the current value is too low (dual range
+  // selects the channel of each sample instead)
+  if (dualRange) {
+    return;
+  }
+  if (currentRMS < scale.rangeShift) {
     currentPin = AMPLIFIED_CURRENT_PIN;
   }
   else {
     currentPin = STANDARD_CURRENT_PIN;
   }
+  if (samples) {
+    samples->setCurrentPin(currentPin);
+  }
 }
 //-----------------------------------------------------------------------------
 
@@ -161,11 +810,12 @@ void Measure::calculateRMSAndPowerValues() {
 //
 void Measure::calculateAverageRMSAndPowerValues() {
 
-  currentRMS = sumCurrent / NUM_WINDOWS;
-  voltageRMS = sumVoltage / NUM_WINDOWS;
-  realPower = sumRealPower / NUM_WINDOWS;
-  apparentPower = sumApparentPower / NUM_WINDOWS;
-  powerFactor = sumPowerFactor / NUM_WINDOWS;
+  float perWindow = 1.0 / NUM_WINDOWS;
+  currentRMS = sumCurrent * perWindow;
+  voltageRMS = sumVoltage * perWindow;
+  realPower = sumRealPower * perWindow;
+  apparentPower = sumApparentPower * perWindow;
+  powerFactor = sumPowerFactor * perWindow;
 
   sumCurrent = 0;
   sumVoltage = 0;
@@ -180,18 +830,81 @@ void Measure::calculateAverageRMSAndPowerValues() {
 // Sampling of the signals and calculation of RMS values
 //
 void Measure::acquireAndCalculate() {
-  sTime = millis();
+
+  // Continuous acquisition keeps sampling: wait for the reading to complete
+  if (isContinuous()) {
+    while (!update());
+    return;
+  }
+
+  readingStartTime = HalClock::millis();
 
   // Repeats the sample reading and calculation to store only the average value
-  for (uint16_t windowCounter = 0; windowCounter < NUM_WINDOWS; ++windowCounter) {
-    calibrateVccRef();
-    acquireSamples();
-    calculateZeroValues();
-    calculateRMSAndPowerValues();
+  while (!readingReady) {
+    if (isVccCalibrationDue()) {
+      calibrateVccRef();
+    }
+    else {
+      vccSavedMicros += VCC_LEGACY_MICROS;
+    }
+    if (isCycleSynchronized()) {
+      acquireSynchronizedWindow();
+    }
+    else {
+      acquireSamples();
+      closeWindow();
+    }
   }
+  readingReady = false;
+}
+//------------------------------------------------------------------------------
 
-  eTime = millis();
 
-  calculateAverageRMSAndPowerValues();
+//==============================================================================
+// Consume the sample blocks completed by the continuous acquisition, without
+// blocking -- Return a new average reading is available
+//
+// The Vcc reference is converted by the interrupt between two blocks, when
+// requested at the close of a window
+//
+bool Measure::update() {
+
+  if (!isContinuous()) {
+    acquireAndCalculate();
+    return true;
+  }
+
+  HalADC::poll();
+
+  const SampleBlock* block;
+  while ((block = samples->front()) != NULL) {
+
+    // Dropped blocks and reference conversions break the sample sequence:
+    // resynchronize on the next crossing
+    if (samples->getDroppedBlocks() != lastDroppedBlocks) {
+      lastDroppedBlocks = samples->getDroppedBlocks();
+      restartSynchronization();
+    }
+    if (block->afterReference) {
+      applyVccReading(samples->getReferenceCode());
+      restartSynchronization();
+    }
+    if (stream && stream->isActive()) {
+      stream->sendBlock(block, lastDroppedBlocks);
+    }
+
+    uint32_t startMicros = HalClock::micros(), startCalculation = calculationMicros;
+    consumeBlock(block);
+    addPhaseTime(PHASE_ACQUIRE, HalClock::micros() - startMicros - (calculationMicros - startCalculation));
+    samples->pop();
+
+    if (readingReady) {
+      readingReady = false;
+      return true;
+    }
+    HalADC::poll();
+  }
+
+  return false;
 }
 //------------------------------------------------------------------------------
@@ -5,13 +5,76 @@
 #ifndef _MEASURE_H_
 #define _MEASURE_H_
 
-#include "Arduino.h"
+#include "HAL.h"
+#include "Harmonics.h"
+#include "PhaseStats.h"
+#include "PowerEvents.h"
 
 
 // Arduino DAC sensibility --- Is multiplied by VccRef, which is the 5V reference used by ADC
 #define VOLTS_PER_UNITY 1.0/1024
 #define INTERNAL_VREF_VALUE 1.1034
 
+// Vcc calibration: the bandgap is converted at begin (averaged readings), then
+// every period (ms), or at every window while a reading differs from the
+// filtered value by more than the threshold (V, about two codes), until it is
+// within half of it. Each reading moves the filtered value by the weight
+#define VCC_CALIBRATION_PERIOD 60000
+#define VCC_DRIFT_THRESHOLD    0.05
+#define VCC_FILTER_WEIGHT      0.25
+#define VCC_BEGIN_READINGS     4
+
+// Former calibration at every window: 2 ms settling delay and one conversion.
+// Windows not calibrated count it as saved time
+#define VCC_LEGACY_MICROS 2110
+
+// Accumulation kernels of the RMS and power sums
+#define KERNEL_FLOAT   0  // Float samples and sums
+#define KERNEL_INTEGER 1  // Int16 samples, int32 partial sums folded into int64
+
+// Pairs accumulated in int32 before folding (the aligned voltage is up to 6
+// times a code: 6 * 1023^2 * 256 < 2^31)
+#define INTEGER_KERNEL_CHUNK_PAIRS 256
+
+// Dual range current: the amplified channel zero is estimated only from
+// windows where it was kept for at least this share (%) of the samples
+#define DUAL_RANGE_MIN_AMPLIFIED_SHARE 50
+
+// Voltage (ADC codes below zero) that arms the positive going zero crossing detector
+#define ZERO_CROSSING_HYSTERESIS 8
+
+// The voltage of a pair is converted one conversion after (dual range: the
+// amplified current one before) the current. For the power sum it is moved to
+// the instant of the current, between the voltage of the pair and of the
+// previous one. No previous pair after a gap in the sequence: the pair's own
+#define NO_PREVIOUS_VOLTAGE 0xFFFF
+
+class WaveformStream;
+
+
+/*----------------------------------------------------------------------------
+ *  Struct MeasureScale
+ *  Sensor constants folded into the factors of the window calculation, in
+ *  units per ADC code and per volt of Vcc. The runtime constructor of Measure
+ *  computes them once; a SensorProfile computes them at compile time
+ */
+struct MeasureScale {
+  float current;          // A per code of the standard channel
+  float amplifiedCurrent; // A per code of the amplified channel
+  float voltage;          // V per code
+  float gain;             // Current gain of the amplified channel
+  float rangeShift;       // RMS current (A) below which the amplified channel is used
+
+  static constexpr MeasureScale make(uint8_t maxCurrentValue, uint8_t currentGain, float sensorSensibility, float voltageMeasuringRatio) {
+    return MeasureScale{ float(VOLTS_PER_UNITY / sensorSensibility),
+                         float(VOLTS_PER_UNITY / (sensorSensibility * currentGain)),
+                         float(VOLTS_PER_UNITY / voltageMeasuringRatio),
+                         float(currentGain),
+                         float(maxCurrentValue / currentGain) };
+  }
+};
+
+
 /*----------------------------------------------------------------------------
  *  Class Measure
  *  Sampling of current and voltage signals, calculation of RMS values
@@ -25,56 +88,175 @@ class Measure {
             uint8_t currentGain,        // Current gain of amplified current pin
             float sensorSensibility,    // ACS712 current sensor specification (5A:0.185 | 20A:0.100 | 30A:0.066)
             float voltageMeasuringRatio // RMS AC grid voltage = 127 Volts (5V arduino / -Vp to +Vp AC grid voltage)
-           ) {
+           ) : Measure(standardCurrentPin, amplifiedCurrentPin, voltagePin,
+                       MeasureScale::make(maxCurrentValue, currentGain, sensorSensibility, voltageMeasuringRatio)) {}
+
+    // Sensor constants already folded (see SensorProfile.h)
+    Measure(uint8_t standardCurrentPin, uint8_t amplifiedCurrentPin, uint8_t voltagePin, const MeasureScale& sensorScale) {
 
       STANDARD_CURRENT_PIN = standardCurrentPin;
       AMPLIFIED_CURRENT_PIN = amplifiedCurrentPin;
       VOLTAGE_PIN = voltagePin;
-      CURRENT_GAIN = currentGain;
-      CURRENT_ENTRY_SHIFT_VALUE = maxCurrentValue / currentGain;
-      SENSOR_SENSIBILITY = sensorSensibility;
-      VOLTAGE_MEASURING_RATIO = voltageMeasuringRatio;
+      scale = sensorScale;
 
       currentPin = standardCurrentPin;
 
       sTime = 0;
       eTime = 0;
+      PAIR_RATE = 0;
+      CYCLES_PER_WINDOW = 0;
+      kernel = KERNEL_FLOAT;
+      kernelMicros = 0;
+      lastKernelMicros = 0;
+      harmonics = NULL;
+      stats = NULL;
+      stream = NULL;
+      events = NULL;
+      calculationMicros = 0;
+      vccCalibrationPeriod = VCC_CALIBRATION_PERIOD;
+      samples = NULL;
+      dualRange = false;
+      standardShare = 0;
     }
 
-    void begin(uint16_t samplesPerWindow=5000, uint16_t numWindows=1);
+    void begin(uint16_t samplesPerWindow=5000, uint16_t numWindows=1, uint16_t pairRate=0);
     void acquireAndCalculate();
+    bool update();
+    bool isContinuous() const { return (PAIR_RATE != 0); }
+    void setSampleBuffer(SampleBuffer* buffer) { samples = buffer; } // NULL: sequential acquisition only
+    void setKernel(uint8_t accumulationKernel) { kernel = accumulationKernel; }
+    void setCyclesPerWindow(uint8_t cyclesPerWindow) { CYCLES_PER_WINDOW = cyclesPerWindow; } // 0: fixed sample count
+    bool isCycleSynchronized() const { return (CYCLES_PER_WINDOW != 0); }
+    void setHarmonics(Harmonics* engine) { harmonics = engine; } // NULL: no harmonic analysis
+    Harmonics* getHarmonics() const { return harmonics; }
+    void setStats(PhaseStats* phaseStats) { stats = phaseStats; } // NULL: phases not timed
+    void setStream(WaveformStream* waveformStream) { stream = waveformStream; } // NULL: raw blocks not streamed
+    void setEvents(PowerEvents* detector) { events = detector; } // NULL: no event detection (continuous acquisition only)
+    PowerEvents* getEvents() const { return events; }
+    void setVccCalibrationPeriod(uint32_t period) { vccCalibrationPeriod = period; } // ms, 0: every window
+    void setDualRange(uint16_t saturationLow=SAMPLE_SATURATION_MARGIN, uint16_t saturationHigh=1023-SAMPLE_SATURATION_MARGIN); // Before begin
+    bool isDualRange() const { return dualRange; }
+    uint8_t getKernel() const { return kernel; }
     bool isAmplified() const { return (currentPin == AMPLIFIED_CURRENT_PIN); }
+    uint8_t getStandardCurrentPin() const { return STANDARD_CURRENT_PIN; }
+    uint8_t getAmplifiedCurrentPin() const { return AMPLIFIED_CURRENT_PIN; }
+    uint8_t getVoltagePin() const { return VOLTAGE_PIN; }
+    uint16_t getPairRate() const { return PAIR_RATE; }
     float getZeroVoltage() const { return zeroVoltage * VOLTS_PER_UNITY * vccRef; }
     float getZeroCurrent() const { return zeroCurrent * VOLTS_PER_UNITY * vccRef; }
+    float getZeroStandardCurrent() const { return zeroStandard * VOLTS_PER_UNITY * vccRef; } // Dual range
+    uint8_t getStandardShare() const { return standardShare; } // Dual range: % of the last window taken from the standard channel
     float getVccRef() const { return vccRef; }
+    const MeasureScale& getScale() const { return scale; }
+    uint16_t getVccCalibrations() const { return vccCalibrations; }
+    int32_t getVccSavedMicros() const { return lastVccSavedMicros; } // Last reading, against a calibration per window
     float getVoltageRMS() const { return voltageRMS; } 
     float getCurrentRMS() const { return currentRMS; }
     float getRealPower() const { return realPower; }
     float getApparentPower() const { return apparentPower; }
     float getPowerFactor() const { return powerFactor; }
+    float getLineFrequency() const { return lineFrequency; } // 0 without cycle synchronized windows
     float getLastPeriod() const { return float(eTime - sTime)/1000; }
+    uint16_t getDroppedBlocks() const { return samples ? samples->getDroppedBlocks() : 0; }
+    uint16_t getDiscardedBlocks() const { return discardedBlocks; }
+    uint32_t getKernelMicros() const { return lastKernelMicros; } // Accumulation time of the last reading (harmonics and events included)
 
   private:
+    friend class PhaseSet;
+
+    struct IntegerSums {
+      int32_t current, voltage, sqrCurrent, sqrVoltage, instPower;
+      int32_t standardCurrent, standardSqrCurrent, standardInstPower; // Dual range: samples of the standard channel
+      uint16_t standardCount;
+    };
+
+    void prepare(uint16_t samplesPerWindow, uint16_t numWindows, uint16_t pairRate);
     void calibrateVccRef();
+    void applyVccReading(uint16_t referenceCode);
+    bool isVccCalibrationDue() const;
+    void readPair(uint16_t* pair);
     void acquireSamples();
+    void setVoltageAlignment(uint8_t phases);
+    void accumulateSample(uint16_t currentCode, uint16_t voltageCode, uint16_t previousVoltageCode);
+    void accumulateInteger(IntegerSums* partial, uint16_t currentCode, uint16_t voltageCode, uint16_t previousVoltageCode);
+    void foldIntegerSums(IntegerSums* partial);
+    void applyIntegerSums();
+    void accumulatePairs(const uint16_t (*pairs)[2], uint8_t count, uint16_t previousVoltageCode);
+    void accumulateHarmonics(const uint16_t (*pairs)[2], uint8_t count);
+    bool isPinInRange(uint8_t pairsCurrentPin) const { return dualRange || pairsCurrentPin == currentPin; }
+    void consumeBlock(const SampleBlock* block);
+    void consumePairs(const uint16_t (*pairs)[2], uint8_t count, uint8_t pairsCurrentPin);
+    void restartSynchronization() { synchronized = false; crossingArmed = false; lastVoltageCode = NO_PREVIOUS_VOLTAGE; if (events) { events->restart(); } }
+    void acquireSynchronizedWindow();
+    bool detectZeroCrossing(uint16_t voltageCode, float* fraction);
+    void resetWindowSums();
+    void startHarmonicsWindow();
+    void calibrateEvents();
+    void closeWindow();
+    void completeReading();
     void calculateZeroValues();
     void calculateRMSAndPowerValues();
     void calculateAverageRMSAndPowerValues();
+    void addPhaseTime(uint8_t phase, uint32_t micros) { if (stats) { stats->add(phase, micros); } }
+    float getCurrentPerCode() const { return (isAmplified() ? scale.amplifiedCurrent : scale.current) * vccRef; }
+    float getVoltagePerCode() const { return scale.voltage * vccRef; }
 
-    uint32_t sTime, eTime;
+    uint32_t sTime, eTime, readingStartTime;
     uint8_t currentPin;
+    bool readingReady, windowClosed;
+
+    SampleBuffer* samples;
+    uint16_t sampleCount, windowCounter, discardedBlocks, lastDroppedBlocks;
+
+    bool synchronized, crossingArmed;
+    uint8_t cycleCount, synchronizedWindows;
+    int16_t previousVoltage;
+    uint16_t lastVoltageCode;
+
+    // Voltage at the current instant = (weight * voltage + previous weight *
+    // previous voltage) / scale, for amplified (or single range) and standard samples
+    int8_t alignWeight, alignPreviousWeight, standardAlignWeight, standardAlignPreviousWeight;
+    uint8_t alignScale;
+    float startFraction, windowPairRate;
+    float windowFrequency, lineFrequency, sumLineFrequency;
 
     float vccRef;
+    bool vccDrifting;
+    uint16_t vccCalibrations;
+    uint32_t vccCalibrationPeriod, lastVccCalibration;
+    int32_t vccSavedMicros, lastVccSavedMicros;
     float sumSqrCurrent, sumSqrVoltage, sumInstPower;
     float zeroCurrent, zeroVoltage;
     float sumZeroCurrent, sumZeroVoltage;
+
+    bool dualRange;
+    uint8_t standardShare;
+    uint16_t saturationLow, saturationHigh;
+    uint16_t standardSamples, standardZeroCount;
+    float zeroStandard, sumZeroStandard, sumStandardCurrent;
+    int16_t zeroStandardCode;
+    int32_t intSumStandardCurrent;
+    int64_t intSumStandardSqrCurrent, intSumStandardInstPower;
+
     float currentRMS, voltageRMS, realPower, apparentPower, powerFactor;
     float sumCurrent, sumVoltage, sumRealPower, sumApparentPower, sumPowerFactor;
 
+    uint8_t kernel;
+    uint32_t kernelMicros, lastKernelMicros;
+    int16_t zeroCurrentCode, zeroVoltageCode;
+    int32_t intSumCurrent, intSumVoltage;
+    int64_t intSumSqrCurrent, intSumSqrVoltage, intSumInstPower;
+
+    Harmonics* harmonics;
+    PhaseStats* stats;
+    WaveformStream* stream;
+    PowerEvents* events;
+    uint32_t calculationMicros; // Window calculations, left out of the acquisition phase
+
     uint8_t STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN;
-    uint16_t SAMPLES_PER_WINDOW, NUM_WINDOWS;
-    float SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO;
-    float CURRENT_GAIN, CURRENT_ENTRY_SHIFT_VALUE;
+    uint16_t SAMPLES_PER_WINDOW, NUM_WINDOWS, PAIR_RATE;
+    uint8_t CYCLES_PER_WINDOW;
+    MeasureScale scale;
 };
 
 
@@ -0,0 +1,150 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class PhaseSet
+ *  Interleaved continuous acquisition of several phases
+ */
+
+#include "PhaseSet.h"
+#include "WaveformStream.h"
+
+
+//==============================================================================
+// SETUP of the phases and start of the interleaved acquisition. Each phase
+// has pairRate pairs per second, the ADC converts 2 * phases * pairRate
+//
+void PhaseSet::begin(uint16_t samplesPerWindow, uint16_t numWindows, uint16_t pairRate) {
+
+  samples->setNumPhases(numPhases);
+  for (uint8_t phase = 0; phase < numPhases; ++phase) {
+    phases[phase]->prepare(samplesPerWindow, numWindows, pairRate);
+    phases[phase]->setVoltageAlignment(numPhases);
+    samples->setChannels(phases[phase]->currentPin, phases[phase]->VOLTAGE_PIN, phase);
+  }
+
+  lastDroppedBlocks = 0;
+  readyPhases = 0;
+  referencePending = false;
+  HalADC::startContinuous(samples, uint16_t(pairRate * numPhases));
+  for (uint8_t phase = 0; phase < numPhases; ++phase) {
+    phases[phase]->readingStartTime = HalClock::millis();
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Consume the completed blocks, without blocking -- Return every phase has a
+// new average reading
+//
+bool PhaseSet::update() {
+
+  HalADC::poll();
+
+  const SampleBlock* block;
+  while ((block = samples->front()) != NULL) {
+
+    // Dropped blocks and reference conversions break the sequence of every phase.
+    // The phases share the ADC, so they all take the same Vcc readings
+    bool restart = false;
+    if (samples->getDroppedBlocks() != lastDroppedBlocks) {
+      lastDroppedBlocks = samples->getDroppedBlocks();
+      restart = true;
+    }
+    if (block->afterReference) {
+      referencePending = false;
+      restart = true;
+    }
+    for (uint8_t phase = 0; phase < numPhases; ++phase) {
+      if (block->afterReference) {
+        phases[phase]->applyVccReading(samples->getReferenceCode());
+      }
+      if (restart) {
+        phases[phase]->restartSynchronization();
+      }
+    }
+    if (stream && stream->isActive()) {
+      stream->sendBlock(block, lastDroppedBlocks);
+    }
+
+    uint32_t startMicros = HalClock::micros(), startCalculation = phases[0]->calculationMicros;
+    consumeBlock(block);
+    phases[0]->addPhaseTime(PHASE_ACQUIRE, HalClock::micros() - startMicros - (phases[0]->calculationMicros - startCalculation));
+    samples->pop();
+
+    // Range changes of each phase, and the Vcc schedule of the first one
+    for (uint8_t phase = 0; phase < numPhases; ++phase) {
+      samples->setCurrentPin(phases[phase]->currentPin, phase);
+      if (phases[phase]->readingReady) {
+        phases[phase]->readingReady = false;
+        readyPhases |= 1 << phase;
+      }
+    }
+    if (!referencePending && phases[0]->isVccCalibrationDue()) {
+      samples->requestReference();
+      referencePending = true;
+    }
+
+    if (readyPhases == (1 << numPhases) - 1) {
+      readyPhases = 0;
+      return true;
+    }
+    HalADC::poll();
+  }
+
+  return false;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Split a block into the pairs of each phase
+//
+void PhaseSet::consumeBlock(const SampleBlock* block) {
+
+  if (numPhases == 1) {
+    phases[0]->consumePairs(block->samples, SAMPLE_BLOCK_PAIRS, block->currentPins[0]);
+    return;
+  }
+
+  uint16_t pairs[(SAMPLE_BLOCK_PAIRS + 1) / 2][2];
+  for (uint8_t phase = 0; phase < numPhases; ++phase) {
+    uint8_t count = 0;
+    uint8_t first = (phase + numPhases - block->firstPhase) % numPhases;
+    for (uint8_t pairIndex = first; pairIndex < SAMPLE_BLOCK_PAIRS; pairIndex += numPhases) {
+      pairs[count][0] = block->samples[pairIndex][0];
+      pairs[count][1] = block->samples[pairIndex][1];
+      ++count;
+    }
+    phases[phase]->consumePairs(pairs, count, block->currentPins[phase]);
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Three phase (or two phase) totals
+//
+float PhaseSet::getRealPower() const {
+  float power = 0;
+  for (uint8_t phase = 0; phase < numPhases; ++phase) {
+    power += phases[phase]->getRealPower();
+  }
+  return power;
+}
+
+float PhaseSet::getApparentPower() const {
+  float power = 0;
+  for (uint8_t phase = 0; phase < numPhases; ++phase) {
+    power += phases[phase]->getApparentPower();
+  }
+  return power;
+}
+
+float PhaseSet::getPowerFactor() const {
+  float apparentPower = getApparentPower();
+  return (apparentPower > 0) ? getRealPower() / apparentPower : 0;
+}
+//------------------------------------------------------------------------------
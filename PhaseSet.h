@@ -0,0 +1,57 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _PHASE_SET_H_
+#define _PHASE_SET_H_
+
+#include "HAL.h"
+#include "Measure.h"
+
+
+/*----------------------------------------------------------------------------
+ *  Class PhaseSet
+ *  Up to SAMPLE_MAX_PHASES Measure objects (one per phase, each with its own
+ *  pins and sensors) sampled by one continuous acquisition: the pairs of the
+ *  phases are interleaved in the blocks, and each phase gets its own pairs
+ *  with its own windows, zero crossings and range. Totals are the sums of
+ *  the phases (arithmetic apparent power). Dual range current is not
+ *  available for the phases of a set
+ */
+class PhaseSet {
+
+  public:
+    PhaseSet() {
+      numPhases = 0;
+      samples = NULL;
+      stream = NULL;
+    }
+
+    void addPhase(Measure* measure) { if (numPhases < SAMPLE_MAX_PHASES) { phases[numPhases++] = measure; } }
+    void setSampleBuffer(SampleBuffer* buffer) { samples = buffer; }
+    void setStream(WaveformStream* waveformStream) { stream = waveformStream; } // NULL: raw blocks not streamed
+    void begin(uint16_t samplesPerWindow, uint16_t numWindows, uint16_t pairRate); // Pairs per second of each phase
+    bool update();
+
+    uint8_t getNumPhases() const { return numPhases; }
+    Measure* getPhase(uint8_t phase) const { return phases[phase]; }
+    float getRealPower() const;
+    float getApparentPower() const;
+    float getPowerFactor() const;
+    float getLineFrequency() const { return phases[0]->getLineFrequency(); }
+    float getLastPeriod() const { return phases[0]->getLastPeriod(); }
+    uint16_t getDroppedBlocks() const { return samples->getDroppedBlocks(); }
+
+  private:
+    void consumeBlock(const SampleBlock* block);
+
+    Measure* phases[SAMPLE_MAX_PHASES];
+    uint8_t numPhases;
+    SampleBuffer* samples;
+    WaveformStream* stream;
+    uint16_t lastDroppedBlocks;
+    uint8_t readyPhases;       // Bit per phase with a reading completed since the last one of the set
+    bool referencePending;
+};
+
+
+#endif // _PHASE_SET_H_
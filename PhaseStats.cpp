@@ -0,0 +1,56 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class PhaseStats
+ *  Duration statistics of the loop phases
+ */
+
+#include "PhaseStats.h"
+
+// Phase names in flash, in the order of the PHASE_ defines
+static const char PHASE_NAMES[NUM_PHASES][10] PROGMEM = {
+  "vcc", "acquire", "calculate", "rtc", "format", "sdOpen", "sdWrite", "sdClose", "command"
+};
+
+
+//==============================================================================
+// Account one run of a phase
+//
+void PhaseStats::add(uint8_t phase, uint32_t micros) {
+
+  Phase* stats = &phases[phase];
+  if (stats->count == 0 || micros < stats->min) {
+    stats->min = micros;
+  }
+  if (micros > stats->max) {
+    stats->max = micros;
+  }
+  stats->sum += micros;
+  ++stats->count;
+}
+
+void PhaseStats::reset() {
+  memset(phases, 0, sizeof(phases));
+}
+
+const __FlashStringHelper* PhaseStats::getName(uint8_t phase) {
+  return reinterpret_cast<const __FlashStringHelper*>(PHASE_NAMES[phase]);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// One PHASE_STATS_HEADER row per phase, after the prefix (e.g. date and time)
+//
+void PhaseStats::print(ArduinoOutStream* cout, const char* prefix) {
+  for (uint8_t phase = 0; phase < NUM_PHASES; ++phase) {
+    if (prefix) {
+      *cout << prefix;
+    }
+    *cout << getName(phase) << ';' << getCount(phase) << ';' << getMin(phase) << ';';
+    *cout << getMean(phase) << ';' << getMax(phase) << endl;
+  }
+}
+//------------------------------------------------------------------------------
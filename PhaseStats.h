@@ -0,0 +1,54 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _PHASE_STATS_H_
+#define _PHASE_STATS_H_
+
+#include "HAL.h"
+
+// Phases timed, in us
+#define PHASE_VCC       0  // Vcc calibration
+#define PHASE_ACQUIRE   1  // Sampling and accumulation of a block (or sequential window)
+#define PHASE_CALCULATE 2  // RMS and power of a window
+#define PHASE_RTC       3  // RTC read and date/time formatting
+#define PHASE_FORMAT    4  // Record formatting, into the SD cache
+#define PHASE_SD_OPEN   5
+#define PHASE_SD_WRITE  6  // Sync of the cached block to the card
+#define PHASE_SD_CLOSE  7
+#define PHASE_COMMAND   8  // Step of a request
+#define NUM_PHASES      9
+
+#define PHASE_STATS_HEADER "phase;count;min(us);mean(us);max(us)"
+
+
+/*----------------------------------------------------------------------------
+ *  Class PhaseStats
+ *  Count, minimum, mean and maximum duration of each phase of the loop.
+ *  Each phase costs 20 bytes of RAM
+ */
+class PhaseStats {
+
+  public:
+    PhaseStats() { reset(); }
+
+    void add(uint8_t phase, uint32_t micros);
+    void reset();
+    void print(ArduinoOutStream* cout, const char* prefix=NULL);
+
+    uint32_t getCount(uint8_t phase) const { return phases[phase].count; }
+    uint32_t getMin(uint8_t phase) const { return phases[phase].count ? phases[phase].min : 0; }
+    uint32_t getMax(uint8_t phase) const { return phases[phase].max; }
+    uint32_t getMean(uint8_t phase) const { return phases[phase].count ? uint32_t(phases[phase].sum / phases[phase].count) : 0; }
+    static const __FlashStringHelper* getName(uint8_t phase);
+
+  private:
+    struct Phase {
+      uint32_t count, min, max;
+      uint64_t sum;
+    };
+
+    Phase phases[NUM_PHASES];
+};
+
+
+#endif // _PHASE_STATS_H_
@@ -0,0 +1,255 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class PowerEvents
+ *  Power quality events detected on the half-cycle RMS values
+ */
+
+#include "PowerEvents.h"
+
+// Event names in flash, in the order of the EVENT_ defines
+static const char EVENT_NAMES[5][13] PROGMEM = {
+  "none", "sag", "swell", "interruption", "inrush"
+};
+
+
+static inline float square(float value) {
+  return value * value;
+}
+
+
+//==============================================================================
+// Limits and calibration
+//
+void PowerEvents::setNominalVoltage(float volts, float sagLimit, float swellLimit, float interruptionLimit) {
+  nominalVoltage = volts;
+  this->sagLimit = sagLimit;
+  this->swellLimit = swellLimit;
+  this->interruptionLimit = interruptionLimit;
+}
+
+// Half-cycles close on the crossings, between half and one and a half of the
+// nominal half-cycle (an interruption has no crossings)
+void PowerEvents::begin(uint16_t pairsPerSecond) {
+  pairRate = pairsPerSecond;
+  uint16_t nominalPairs = uint16_t(pairRate / (2 * NOMINAL_LINE_FREQUENCY) + 0.5);
+  minHalfCyclePairs = nominalPairs / 2;
+  maxHalfCyclePairs = nominalPairs + nominalPairs / 2;
+  resetHalfCycle();
+}
+
+// Limits converted to squared codes with the scale of the window, so the
+// half-cycles compare their sums without a square root
+void PowerEvents::setCalibration(int16_t zeroCurrentCode, int16_t zeroVoltageCode, int16_t zeroStandardCode, int16_t gain, float currentPerCode, float voltagePerCode) {
+
+  live.zeroCurrent = zeroCurrentCode;
+  live.zeroVoltage = zeroVoltageCode;
+  live.zeroStandard = zeroStandardCode;
+  live.gain = gain;
+  live.currentPerCode = currentPerCode;
+  live.voltagePerCode = voltagePerCode;
+
+  float nominalCodes = nominalVoltage / voltagePerCode;
+  float hysteresisCodes = nominalCodes * EVENT_HYSTERESIS;
+  float inrushCodes = inrushCurrent / currentPerCode;
+
+  sagLevel = square(nominalCodes * sagLimit);
+  swellLevel = square(nominalCodes * swellLimit);
+  interruptionLevel = square(nominalCodes * interruptionLimit);
+  inrushLevel = square(inrushCodes);
+  sagEndLevel = square(nominalCodes * sagLimit + hysteresisCodes);
+  swellEndLevel = square(nominalCodes * swellLimit - hysteresisCodes);
+  inrushEndLevel = square(inrushCodes * (1 - EVENT_HYSTERESIS));
+  calibrated = true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Per pair: squared codes into the half-cycle sums, raw codes into the ring
+//
+void PowerEvents::accumulate(const uint16_t (*pairs)[2], uint8_t count) {
+
+  if (!calibrated || !pairRate) {
+    return;
+  }
+
+  for (uint8_t pairIndex = 0; pairIndex < count; ++pairIndex) {
+
+    uint16_t currentCode = pairs[pairIndex][0];
+    int16_t voltage = int16_t(pairs[pairIndex][1]) - live.zeroVoltage;
+
+    // The ring stops once the capture of an event is complete
+    if (captureState != CAPTURE_HELD) {
+      capture[ringIndex][0] = currentCode;
+      capture[ringIndex][1] = pairs[pairIndex][1];
+      if (++ringIndex == EVENT_CAPTURE_PAIRS) {
+        ringIndex = 0;
+      }
+      if (captureState == CAPTURE_TRIGGERED && --postTriggerPairs == 0) {
+        captureState = CAPTURE_HELD;
+      }
+    }
+
+    // Dual range: standard samples summed apart, scaled by the gain per half-cycle
+    if (currentCode & SAMPLE_STANDARD_RANGE) {
+      int16_t current = int16_t(currentCode & SAMPLE_CODE_MASK) - live.zeroStandard;
+      sumSqrStandard += int32_t(current) * current;
+    }
+    else {
+      int16_t current = int16_t(currentCode) - live.zeroCurrent;
+      sumSqrCurrent += int32_t(current) * current;
+    }
+    sumSqrVoltage += int32_t(voltage) * voltage;
+    ++halfCyclePairs;
+
+    // The half-cycle ends when the voltage passes to the other polarity
+    if (positive ? (voltage < -EVENT_CROSSING_HYSTERESIS) : (voltage > EVENT_CROSSING_HYSTERESIS)) {
+      positive = !positive;
+      if (halfCyclePairs >= minHalfCyclePairs) {
+        closeHalfCycle();
+      }
+    }
+    else if (halfCyclePairs >= maxHalfCyclePairs) {
+      closeHalfCycle();
+    }
+  }
+}
+
+void PowerEvents::resetHalfCycle() {
+  halfCyclePairs = 0;
+  sumSqrCurrent = 0;
+  sumSqrStandard = 0;
+  sumSqrVoltage = 0;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Half-cycle RMS values against the limits: start, extend or end the event
+//
+void PowerEvents::closeHalfCycle() {
+
+  float perPair = 1.0 / halfCyclePairs;
+  float sqrVoltage = sumSqrVoltage * perPair;
+  float sqrCurrent = (float(sumSqrCurrent) + float(sumSqrStandard) * live.gain * live.gain) * perPair;
+  bool inrush = (inrushCurrent > 0 && sqrCurrent > inrushLevel);
+
+  uint8_t type = EVENT_NONE;
+  if (sqrVoltage < interruptionLevel) {
+    type = EVENT_INTERRUPTION;
+  }
+  else if (sqrVoltage < sagLevel) {
+    type = EVENT_SAG;
+  }
+  else if (sqrVoltage > swellLevel) {
+    type = EVENT_SWELL;
+  }
+  else if (inrush) {
+    type = EVENT_INRUSH;
+  }
+
+  if (eventType == EVENT_NONE) {
+    if (type != EVENT_NONE) {
+      startEvent(type);
+    }
+  }
+  else if (sqrVoltage >= sagEndLevel && sqrVoltage <= swellEndLevel && (inrushCurrent == 0 || sqrCurrent <= inrushEndLevel)) {
+    endEvent();
+  }
+  else if (type == EVENT_INTERRUPTION) {
+    eventType = EVENT_INTERRUPTION;
+  }
+
+  if (eventType != EVENT_NONE) {
+    eventPairs += halfCyclePairs;
+    if (sqrVoltage < minSqrVoltage) {
+      minSqrVoltage = sqrVoltage;
+    }
+    if (sqrVoltage > maxSqrVoltage) {
+      maxSqrVoltage = sqrVoltage;
+    }
+    if (sqrCurrent > maxSqrCurrent) {
+      maxSqrCurrent = sqrCurrent;
+    }
+  }
+  resetHalfCycle();
+}
+
+// The capture is triggered if it is free: the ring already holds the
+// half-cycle that started the event
+void PowerEvents::startEvent(uint8_t type) {
+
+  eventType = type;
+  eventStartMillis = HalClock::millis() - uint32_t(halfCyclePairs) * 1000 / pairRate;
+  eventPairs = 0;
+  minSqrVoltage = 1e30;
+  maxSqrVoltage = 0;
+  maxSqrCurrent = 0;
+  ++eventCount;
+
+  eventCaptured = (captureState == CAPTURE_ARMED);
+  if (eventCaptured) {
+    captured = live;
+    postTriggerPairs = EVENT_CAPTURE_PAIRS - EVENT_PRETRIGGER_PAIRS;
+    captureState = CAPTURE_TRIGGERED;
+  }
+}
+
+void PowerEvents::endEvent() {
+
+  if (recordPending) {
+    ++missedEvents;
+    if (eventCaptured) {
+      captureState = CAPTURE_ARMED;
+    }
+  }
+  else {
+    record.type = eventType;
+    record.captured = eventCaptured;
+    record.startMillis = eventStartMillis;
+    record.durationMillis = eventPairs * 1000.0 / pairRate;
+    record.minVoltage = sqrt(minSqrVoltage) * live.voltagePerCode;
+    record.maxVoltage = sqrt(maxSqrVoltage) * live.voltagePerCode;
+    record.maxCurrent = sqrt(maxSqrCurrent) * live.currentPerCode;
+    recordPending = true;
+  }
+  eventType = EVENT_NONE;
+}
+
+// Record written: the capture is free again, unless another event holds it
+void PowerEvents::release() {
+  if (record.captured) {
+    captureState = CAPTURE_ARMED;
+  }
+  recordPending = false;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Captured waveform, with the zeros and scale of the trigger
+//
+const uint16_t* PowerEvents::capturedPair(uint8_t pairIndex) const {
+  uint16_t index = ringIndex + pairIndex;
+  return capture[(index < EVENT_CAPTURE_PAIRS) ? index : index - EVENT_CAPTURE_PAIRS];
+}
+
+float PowerEvents::getCapturedCurrent(uint8_t pairIndex) const {
+  uint16_t currentCode = capturedPair(pairIndex)[0];
+  if (currentCode & SAMPLE_STANDARD_RANGE) {
+    return (int16_t(currentCode & SAMPLE_CODE_MASK) - captured.zeroStandard) * captured.gain * captured.currentPerCode;
+  }
+  return (int16_t(currentCode) - captured.zeroCurrent) * captured.currentPerCode;
+}
+
+float PowerEvents::getCapturedVoltage(uint8_t pairIndex) const {
+  return (int16_t(capturedPair(pairIndex)[1]) - captured.zeroVoltage) * captured.voltagePerCode;
+}
+
+const __FlashStringHelper* PowerEvents::getName(uint8_t type) {
+  return reinterpret_cast<const __FlashStringHelper*>(EVENT_NAMES[type]);
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,137 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _POWER_EVENTS_H_
+#define _POWER_EVENTS_H_
+
+#include "HAL.h"
+#include "Harmonics.h"  // NOMINAL_LINE_FREQUENCY
+
+// Waveform of an event: raw pairs kept in a ring (4 bytes each) and frozen
+// once this many pairs follow the half-cycle that triggered. At 4000 pairs/s
+// the 96 pairs hold 24 ms, 12 of them before the trigger
+#define EVENT_CAPTURE_PAIRS    96
+#define EVENT_PRETRIGGER_PAIRS 48
+
+// Limits of the half-cycle RMS voltage, in fractions of the nominal voltage.
+// An event ends on the first half-cycle back inside every limit by the
+// hysteresis (a fraction of the nominal voltage, or of the inrush current)
+#define EVENT_NOMINAL_VOLTAGE    127.0
+#define EVENT_SAG_LIMIT          0.90
+#define EVENT_SWELL_LIMIT        1.10
+#define EVENT_INTERRUPTION_LIMIT 0.10
+#define EVENT_HYSTERESIS         0.02
+
+// Voltage (ADC codes past the zero) that changes the polarity of the half-cycle
+#define EVENT_CROSSING_HYSTERESIS 8
+
+// Event types
+#define EVENT_NONE         0
+#define EVENT_SAG          1
+#define EVENT_SWELL        2
+#define EVENT_INTERRUPTION 3  // A sag that falls below the interruption limit
+#define EVENT_INRUSH       4  // Current above the inrush limit, voltage inside its limits
+
+
+/*----------------------------------------------------------------------------
+ *  Struct PowerEvent
+ *  A completed event: extremes of the half-cycle RMS values while it lasted
+ */
+struct PowerEvent {
+  uint8_t type;
+  bool captured;          // The capture holds its waveform
+  uint32_t startMillis;   // HalClock::millis() at the start of the first half-cycle
+  float durationMillis;
+  float minVoltage, maxVoltage, maxCurrent;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class PowerEvents
+ *  Sags, swells, interruptions and inrush currents of the continuous
+ *  acquisition. Each pair adds its squared codes to integer half-cycle sums
+ *  and goes to the ring: the limits are compared in squared codes once per
+ *  half-cycle, so the per pair cost does not depend on the state. One event
+ *  is kept until it is written; the next ones are counted as missed
+ */
+class PowerEvents {
+
+  public:
+    PowerEvents() {
+      setNominalVoltage(EVENT_NOMINAL_VOLTAGE);
+      inrushCurrent = 0;
+      calibrated = false;
+      eventCount = 0;
+      missedEvents = 0;
+      recordPending = false;
+      captureState = CAPTURE_ARMED;
+      ringIndex = 0;
+      eventType = EVENT_NONE;
+      pairRate = 0;
+    }
+
+    // Limits: fractions of the nominal voltage (V). Inrush: half-cycle RMS
+    // current (A), 0: not detected
+    void setNominalVoltage(float volts, float sagLimit=EVENT_SAG_LIMIT, float swellLimit=EVENT_SWELL_LIMIT, float interruptionLimit=EVENT_INTERRUPTION_LIMIT);
+    void setInrushCurrent(float amps) { inrushCurrent = amps; }
+
+    // Called by Measure: pair rate at begin, zeros and scale at every window
+    void begin(uint16_t pairsPerSecond);
+    void setCalibration(int16_t zeroCurrentCode, int16_t zeroVoltageCode, int16_t zeroStandardCode, int16_t gain, float currentPerCode, float voltagePerCode);
+    void restart() { resetHalfCycle(); }  // Pairs lost: the half-cycle starts again
+    void accumulate(const uint16_t (*pairs)[2], uint8_t count);
+
+    // Completed event, with its waveform when captured: written, then released
+    bool isRecordPending() const { return recordPending && (!record.captured || captureState == CAPTURE_HELD); }
+    const PowerEvent& getRecord() const { return record; }
+    void release();
+    uint16_t getPairRate() const { return pairRate; }
+    float getCapturedCurrent(uint8_t pairIndex) const;  // A, from the oldest pair
+    float getCapturedVoltage(uint8_t pairIndex) const;  // V
+
+    uint16_t getEventCount() const { return eventCount; }
+    uint16_t getMissedEvents() const { return missedEvents; }
+    static const __FlashStringHelper* getName(uint8_t type);
+
+  private:
+    enum { CAPTURE_ARMED, CAPTURE_TRIGGERED, CAPTURE_HELD };
+
+    struct Calibration {
+      int16_t zeroCurrent, zeroVoltage, zeroStandard, gain;
+      float currentPerCode, voltagePerCode;
+    };
+
+    void resetHalfCycle();
+    void closeHalfCycle();
+    void startEvent(uint8_t type);
+    void endEvent();
+    const uint16_t* capturedPair(uint8_t pairIndex) const;
+
+    // Limits
+    float nominalVoltage, sagLimit, swellLimit, interruptionLimit, inrushCurrent;
+    bool calibrated;
+    Calibration live, captured;
+    float sagLevel, swellLevel, interruptionLevel, inrushLevel;  // Squared codes
+    float sagEndLevel, swellEndLevel, inrushEndLevel;
+
+    // Half-cycle sums
+    uint16_t pairRate, minHalfCyclePairs, maxHalfCyclePairs, halfCyclePairs;
+    bool positive;
+    int32_t sumSqrCurrent, sumSqrStandard, sumSqrVoltage;
+
+    // Event in progress and the one waiting to be written
+    uint8_t eventType;
+    bool eventCaptured;
+    uint32_t eventStartMillis, eventPairs;
+    float minSqrVoltage, maxSqrVoltage, maxSqrCurrent;
+    PowerEvent record;
+    bool recordPending;
+    uint16_t eventCount, missedEvents;
+
+    // Ring of raw pairs (current code with the standard range flag, voltage code)
+    uint16_t capture[EVENT_CAPTURE_PAIRS][2];
+    uint8_t ringIndex, captureState, postTriggerPairs;
+};
+
+
+#endif // _POWER_EVENTS_H_
@@ -0,0 +1,214 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _SAMPLE_BUFFER_H_
+#define _SAMPLE_BUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// Sample pairs (current, voltage) per block --- two blocks are kept in RAM (max 127)
+#define SAMPLE_BLOCK_PAIRS 32
+
+// Phases interleaved pair by pair in the blocks (PhaseSet)
+#define SAMPLE_MAX_PHASES 3
+
+// Pseudo pin of the internal 1.1V reference, converted on request between two
+// blocks: the conversions in a row let the bandgap and the sample and hold
+// settle, only the last one is kept
+#define SAMPLE_REFERENCE_PIN   0xFF
+#define SAMPLE_REFERENCE_SLOTS 8
+
+// Dual range current: the standard channel, the voltage and the amplified
+// channel are converted for each pair (the voltage in the middle keeps the
+// skew of both currents at one conversion), and one current code is kept:
+// the amplified one unless it is within the saturation margin of the rails,
+// else the standard one, flagged
+#define SAMPLE_STANDARD_RANGE    0x8000
+#define SAMPLE_CODE_MASK         0x03FF
+#define SAMPLE_SATURATION_MARGIN 16    // Default limits, codes from the rails
+
+
+/*----------------------------------------------------------------------------
+ *  Struct SampleBlock
+ *  Block of interleaved current/voltage raw ADC codes
+ */
+struct SampleBlock {
+  uint16_t samples[SAMPLE_BLOCK_PAIRS][2];  // [pair][0: current, 1: voltage]
+  uint8_t currentPins[SAMPLE_MAX_PHASES];   // Current channel of each phase for the whole block (dual range: standard)
+  uint8_t firstPhase;                       // Phase of the first pair, the next pairs in phase order
+  bool afterReference;                      // Reference conversions just before the block
+  uint16_t standardSum;                     // Dual range: sum of all standard conversions of the block
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class SampleBuffer
+ *  Ping-pong pair of sample blocks. The ADC interrupt fills one block while
+ *  the main loop consumes the other. When a block completes and the consumer
+ *  still holds the previous one, the new block is dropped and counted.
+ *  With several phases the pairs of the phases follow each other, each
+ *  phase with its own current and voltage channels
+ */
+class SampleBuffer {
+
+  public:
+    SampleBuffer() {
+      memset((void*)channels, 0, sizeof(channels));
+      numPhases = 1;
+      dualRange = false;
+      reset();
+    }
+
+    void reset() {
+      fillBlock = 0;
+      fillIndex = 0;
+      readyBlock = -1;
+      droppedBlocks = 0;
+      completedBlocks = 0;
+      referenceRequested = false;
+      referenceSlots = 0;
+      dualStep = 0;
+      fillPhase = 0;
+      for (uint8_t phase = 0; phase < SAMPLE_MAX_PHASES; ++phase) {
+        blocks[0].currentPins[phase] = channels[phase][0];
+      }
+      blocks[0].firstPhase = 0;
+      blocks[0].afterReference = false;
+      blocks[0].standardSum = 0;
+    }
+
+    void setChannels(uint8_t currentPin, uint8_t voltagePin, uint8_t phase=0) {
+      channels[phase][0] = currentPin;
+      channels[phase][1] = voltagePin;
+    }
+    void setNumPhases(uint8_t phases) { numPhases = phases; } // Before the acquisition starts
+    uint8_t getNumPhases() const { return numPhases; }
+
+    // Current channel change takes effect at the next block boundary
+    void setCurrentPin(uint8_t currentPin, uint8_t phase=0) { channels[phase][0] = currentPin; }
+    uint8_t getBlockCurrentPin() const { return blocks[fillBlock].currentPins[fillPhase]; }
+
+    // Dual range: three conversions per pair (standard, voltage, amplified),
+    // the amplified code kept while it is within [low, high]
+    void setDualRange(uint8_t standardPin, uint8_t amplifiedPin, uint16_t low, uint16_t high) {
+      channels[0][0] = standardPin;
+      this->amplifiedPin = amplifiedPin;
+      saturationLow = low;
+      saturationHigh = high;
+      dualRange = true;
+    }
+    uint8_t getConversionsPerPair() const { return dualRange ? 3 : 2; }
+    static uint16_t selectCurrent(uint16_t standardCode, uint16_t amplifiedCode, uint16_t low, uint16_t high) {
+      if (amplifiedCode < low || amplifiedCode > high) {
+        return standardCode | SAMPLE_STANDARD_RANGE;
+      }
+      return amplifiedCode;
+    }
+
+    // Internal reference conversions at the next block boundary; the block
+    // after them is flagged, as the sample sequence has a gap there
+    void requestReference() { referenceRequested = true; }
+    uint16_t getReferenceCode() const { return referenceCode; }
+
+    // Producer (interrupt context): store a conversion, return the pin of the next one
+    uint8_t push(uint16_t value) {
+
+      uint8_t block = fillBlock;
+      uint8_t index = fillIndex;
+      uint8_t phase = fillPhase;
+
+      if (referenceSlots) {
+        if (--referenceSlots) {
+          return SAMPLE_REFERENCE_PIN;
+        }
+        referenceCode = value;
+        return blocks[block].currentPins[phase];
+      }
+
+      // Dual range: the standard and voltage conversions wait for the
+      // amplified one, then the pair is stored
+      if (dualRange) {
+        if (dualStep == 0) {
+          standardCode = value;
+          blocks[block].standardSum += value;
+          dualStep = 1;
+          return channels[0][1];
+        }
+        if (dualStep == 1) {
+          voltageCode = value;
+          dualStep = 2;
+          return amplifiedPin;
+        }
+        dualStep = 0;
+        blocks[block].samples[index >> 1][0] = selectCurrent(standardCode, value, saturationLow, saturationHigh);
+        value = voltageCode;
+        ++index;
+      }
+
+      blocks[block].samples[index >> 1][index & 1] = value;
+
+      // Pair complete: the next one is of the next phase
+      if ((index & 1) && ++phase >= numPhases) {
+        phase = 0;
+      }
+      fillPhase = phase;
+
+      if (++index < 2 * SAMPLE_BLOCK_PAIRS) {
+        fillIndex = index;
+        return (index & 1) ? channels[phase][1] : blocks[block].currentPins[phase];
+      }
+
+      // Block complete: hand it over, or drop it if the consumer is behind
+      if (readyBlock < 0) {
+        readyBlock = block;
+        block ^= 1;
+        fillBlock = block;
+        ++completedBlocks;
+      }
+      else {
+        ++droppedBlocks;
+      }
+      fillIndex = 0;
+      for (uint8_t blockPhase = 0; blockPhase < numPhases; ++blockPhase) {
+        blocks[block].currentPins[blockPhase] = channels[blockPhase][0];
+      }
+      blocks[block].firstPhase = phase;
+      blocks[block].afterReference = referenceRequested;
+      blocks[block].standardSum = 0;
+      if (referenceRequested) {
+        referenceRequested = false;
+        referenceSlots = SAMPLE_REFERENCE_SLOTS;
+        return SAMPLE_REFERENCE_PIN;
+      }
+      return channels[phase][0];
+    }
+
+    // Consumer (main loop): oldest completed block, or NULL
+    const SampleBlock* front() const {
+      int8_t block = readyBlock;
+      return (block < 0) ? 0 : (const SampleBlock*)&blocks[block];
+    }
+    void pop() { readyBlock = -1; }
+
+    uint16_t getDroppedBlocks() const { return droppedBlocks; }
+    uint32_t getCompletedBlocks() const { return completedBlocks; }
+
+  private:
+    volatile SampleBlock blocks[2];
+    volatile uint8_t channels[SAMPLE_MAX_PHASES][2];
+    volatile uint8_t numPhases;
+    volatile uint8_t fillBlock, fillIndex, fillPhase;
+    volatile int8_t readyBlock;
+    volatile uint16_t droppedBlocks;
+    volatile uint32_t completedBlocks;
+    volatile bool referenceRequested;
+    volatile uint8_t referenceSlots;
+    volatile uint16_t referenceCode;
+    volatile bool dualRange;
+    volatile uint8_t amplifiedPin, dualStep;
+    volatile uint16_t saturationLow, saturationHigh, standardCode, voltageCode;
+};
+
+
+#endif // _SAMPLE_BUFFER_H_
@@ -0,0 +1,113 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class Scheduler
+ *  Cooperative task scheduler
+ */
+
+#include "Scheduler.h"
+
+
+//==============================================================================
+// Register a task, due at the first pass -- Return task index, -1 when the
+// table is full
+//
+int8_t Scheduler::addTask(TaskFunction function, uint16_t period, uint8_t priority, uint16_t deadline) {
+
+  if (numTasks >= maxTasks) {
+    return -1;
+  }
+
+  SchedulerTask* task = &tasks[numTasks];
+  task->function = function;
+  task->period = period;
+  task->deadline = deadline;
+  task->priority = priority;
+  task->due = HalClock::millis();
+  task->triggered = false;
+
+  // Keep the order by priority, tasks of the same priority as registered
+  uint8_t position = numTasks;
+  while (position > 0 && tasks[tasks[position - 1].order].priority > priority) {
+    tasks[position].order = tasks[position - 1].order;
+    --position;
+  }
+  tasks[position].order = numTasks;
+
+  ++numTasks;
+  resetStats();
+  return int8_t(numTasks - 1);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Make a task due at the next pass, even out of its period
+//
+void Scheduler::trigger(uint8_t task) {
+
+  if (task >= numTasks || tasks[task].triggered) {
+    return;
+  }
+  uint32_t now = HalClock::millis();
+  if (tasks[task].period == TASK_TRIGGERED || int32_t(now - tasks[task].due) < 0) {
+    tasks[task].due = now;
+  }
+  tasks[task].triggered = true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// One pass over the due tasks
+//
+void Scheduler::run() {
+
+  for (uint8_t i = 0; i < numTasks; ++i) {
+
+    SchedulerTask* task = &tasks[tasks[i].order];
+    uint32_t now = HalClock::millis();
+    if (!task->triggered && (task->period == TASK_TRIGGERED || int32_t(now - task->due) < 0)) {
+      continue;
+    }
+
+    uint32_t lateness = now - task->due;
+    if (task->deadline && lateness > task->deadline) {
+      ++task->misses;
+    }
+    if (lateness > task->maxLateness) {
+      task->maxLateness = (lateness < 0xFFFF) ? uint16_t(lateness) : 0xFFFF;
+    }
+    task->triggered = false;
+    task->due = (task->period == TASK_TRIGGERED) ? now : now + task->period;
+
+    uint32_t startMicros = HalClock::micros();
+    bool busy = task->function();
+    uint32_t elapsed = HalClock::micros() - startMicros;
+    if (elapsed > task->maxMicros) {
+      task->maxMicros = elapsed;
+    }
+    ++task->runs;
+
+    if (busy) {
+      return;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Clear the run counters and the worst cases of all tasks
+//
+void Scheduler::resetStats() {
+  for (uint8_t i = 0; i < numTasks; ++i) {
+    tasks[i].runs = 0;
+    tasks[i].maxMicros = 0;
+    tasks[i].misses = 0;
+    tasks[i].maxLateness = 0;
+  }
+}
+//------------------------------------------------------------------------------
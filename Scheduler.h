@@ -0,0 +1,64 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include "HAL.h"
+
+// Task periods (ms) with a special meaning
+#define TASK_POLLED    0       // Due at every pass
+#define TASK_TRIGGERED 0xFFFF  // Due only when triggered
+
+// Task function -- Return work was done: the pass ends there, so the tasks
+// of higher priority are checked again before the next ones run
+typedef bool (*TaskFunction)();
+
+// Entry of the task table, 25 bytes of RAM on the board. The table belongs to
+// the sketch, sized to the tasks it registers
+struct SchedulerTask {
+  TaskFunction function;
+  uint16_t period, deadline;
+  uint32_t due;
+  uint32_t runs, maxMicros;
+  uint16_t misses, maxLateness;
+  uint8_t priority;
+  bool triggered;
+  uint8_t order;  // Index of the task at this place in priority order
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class Scheduler
+ *  Cooperative scheduler: each pass runs the due tasks in priority order
+ *  (0 is the highest) until one of them reports work done. A task that
+ *  starts later than its deadline after becoming due counts a miss; for a
+ *  polled task the lateness is the time since the previous pass
+ */
+class Scheduler {
+
+  public:
+    Scheduler(SchedulerTask* table, uint8_t size) {
+      tasks = table;
+      maxTasks = size;
+      numTasks = 0;
+    }
+
+    int8_t addTask(TaskFunction function, uint16_t period, uint8_t priority, uint16_t deadline=0);
+    void trigger(uint8_t task);
+    void run();
+    void resetStats();
+
+    uint8_t getNumTasks() const { return numTasks; }
+    uint32_t getRuns(uint8_t task) const { return tasks[task].runs; }
+    uint16_t getMisses(uint8_t task) const { return tasks[task].misses; }
+    uint16_t getMaxLateness(uint8_t task) const { return tasks[task].maxLateness; } // ms
+    uint32_t getMaxMicros(uint8_t task) const { return tasks[task].maxMicros; }     // Longest run
+
+  private:
+    SchedulerTask* tasks;
+    uint8_t maxTasks, numTasks;
+};
+
+
+#endif // _SCHEDULER_H_
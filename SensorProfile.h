@@ -0,0 +1,72 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _SENSOR_PROFILE_H_
+#define _SENSOR_PROFILE_H_
+
+#include "Measure.h"
+
+
+// ACS712 current sensors: rated current (A) and sensibility (V/A)
+struct ACS712_5A {
+  static constexpr uint8_t MAX_CURRENT = 5;
+  static constexpr float SENSIBILITY = 0.185;
+};
+
+struct ACS712_20A {
+  static constexpr uint8_t MAX_CURRENT = 20;
+  static constexpr float SENSIBILITY = 0.100;
+};
+
+struct ACS712_30A {
+  static constexpr uint8_t MAX_CURRENT = 30;
+  static constexpr float SENSIBILITY = 0.066;
+};
+
+// Voltage measuring ratio as a fraction (5V arduino / -Vp to +Vp AC grid
+// voltage: VoltageRatio<5, 680>)
+template <uint16_t NUMERATOR, uint16_t DENOMINATOR>
+struct VoltageRatio {
+  static_assert(NUMERATOR > 0 && DENOMINATOR > 0, "The voltage ratio needs a numerator and a denominator");
+  static constexpr float RATIO = float(NUMERATOR) / DENOMINATOR;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Struct SensorProfile
+ *  Current sensor, current gain and voltage ratio of a board, known at
+ *  compile time: the scale factors of Measure are computed by the compiler
+ */
+template <class CurrentSensor, uint8_t CURRENT_GAIN, class VoltageSensor>
+struct SensorProfile {
+  static_assert(CURRENT_GAIN >= 1, "The current gain must be at least 1");
+  static_assert(CurrentSensor::MAX_CURRENT >= CURRENT_GAIN, "The range shift current would be zero");
+
+  static constexpr MeasureScale scale() {
+    return MeasureScale::make(CurrentSensor::MAX_CURRENT, CURRENT_GAIN, CurrentSensor::SENSIBILITY, VoltageSensor::RATIO);
+  }
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class ProfiledMeasure
+ *  Measure with the sensors of a SensorProfile. The scale is a constant
+ *  expression, so the board carries neither the divisions of the runtime
+ *  constructor nor the sensor parameters; the window calculation is the same
+ */
+template <class Profile>
+class ProfiledMeasure : public Measure {
+
+  public:
+    ProfiledMeasure(uint8_t standardCurrentPin, uint8_t amplifiedCurrentPin, uint8_t voltagePin)
+      : Measure(standardCurrentPin, amplifiedCurrentPin, voltagePin, SCALE) {}
+
+  private:
+    static constexpr MeasureScale SCALE = Profile::scale();
+};
+
+template <class Profile>
+constexpr MeasureScale ProfiledMeasure<Profile>::SCALE;
+
+
+#endif // _SENSOR_PROFILE_H_
@@ -1,4 +1,3 @@
-
 // Code by Marcelo Soares and Douglas Quintanilha
 // Released to the public domain
 
@@ -10,32 +9,217 @@
 
 #include "TimeCounter.h"
 
+volatile uint8_t TimeCounter::pendingTicks = 0;
+volatile uint32_t TimeCounter::tickMillis = 0;
+
+static const uint8_t DAYS_IN_MONTH[12] PROGMEM = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+// Two digit field of a formatted string
+static void putTwoDigits(char* text, uint8_t value) {
+  text[0] = char('0' + value / 10);
+  text[1] = char('0' + value % 10);
+}
+
 
 //==============================================================================
 // SETUP of the class object
 //
+
+// DS3231 SQW output wired to an interrupt pin (2 or 3 on the UNO): its falling
+// edges count the seconds between the resyncs
+void TimeCounter::setSquareWave(uint8_t pin) {
+  squarePin = pin;
+  squareWave = true;
+}
+
 void TimeCounter::begin() {
-  Wire.begin();
+
   rtc.begin();
+  if (resyncInterval == TIME_RESYNC_ALWAYS) {
+    updateDateTime();
+    return;
+  }
+
+  // Wait for the RTC to turn a second (at most 1 s, during setup), so the
+  // millis() count starts in phase with it
+  HalDateTime dt = rtc.now();
+  uint32_t firstTime = dt.unixtime();
+  uint32_t startMillis = HalClock::millis();
+  while (dt.unixtime() == firstTime && HalClock::millis() - startMillis < 1100) {
+    dt = rtc.now();
+  }
+  setDateTime(dt);
+  secondStart = lastResync = HalClock::millis();
+
+  if (squareWave) {
+    pendingTicks = 0;
+    rtc.beginSquareWave(squarePin, onSecondTick);
+  }
   updateDateTime();
 }
 //------------------------------------------------------------------------------
 
 
 //==============================================================================
-// Update DateTime object and formatted strings -- Return day has changed
+// Update date, time and formatted strings -- Return day has changed
 //
 bool TimeCounter::updateDateTime() {
 
-  dt = rtc.now();
-  sprintf(nowTime, HOUR_FORMAT, int(dt.hour()), int(dt.minute()), int(dt.second()));
+  if (resyncInterval == TIME_RESYNC_ALWAYS) {
+    setDateTime(rtc.now());
+  }
+  else {
+    countSeconds();
+    if (HalClock::millis() - lastResync >= resyncInterval) {
+      resync();
+    }
+  }
 
-  if (presentDay != int(dt.day())) {
-    presentDay = int(dt.day());
-    sprintf(today, DATE_FORMAT, presentDay, int(dt.month()), int(dt.year()));
+  if (presentDay != day) {
+    presentDay = day;
     return true;
   }
-
   return false;
 }
+
+uint16_t TimeCounter::getMilliseconds() const {
+  if (resyncInterval == TIME_RESYNC_ALWAYS) {
+    return 0;
+  }
+  uint32_t elapsed = HalClock::millis() - secondStart;
+  return (elapsed < 1000) ? uint16_t(elapsed) : 999;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Seconds elapsed since the last update, from the SQW ticks or from millis()
+//
+void TimeCounter::countSeconds() {
+
+  if (squareWave) {
+    noInterrupts();
+    uint8_t ticks = pendingTicks;
+    uint32_t lastTick = tickMillis;
+    pendingTicks = 0;
+    interrupts();
+    if (ticks) {
+      secondStart = lastTick;
+      advance(ticks);
+    }
+    return;
+  }
+
+  uint32_t elapsed = HalClock::millis() - secondStart;
+  if (elapsed >= 1000) {
+    uint32_t seconds = elapsed / 1000;
+    secondStart += seconds * 1000;
+    advance(seconds);
+  }
+}
+
+// SQW falling edge: the DS3231 has just turned a second
+void TimeCounter::onSecondTick() {
+  ++pendingTicks;
+  tickMillis = HalClock::millis();
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Compare the counted time with the RTC and correct it. Time ahead by less
+// than a second is held at the start of the present second, so the printed
+// seconds never go back; any other difference is taken from the RTC
+//
+void TimeCounter::resync() {
+
+  HalDateTime dt = rtc.now();
+  uint32_t rtcTime = dt.unixtime();
+  uint32_t now = HalClock::millis();
+
+  if (squareWave) {
+    // The ticks keep the phase; a tick during the read leaves the check to
+    // the next update
+    if (pendingTicks) {
+      return;
+    }
+    if (rtcTime != unixTime) {
+      setDateTime(dt);
+    }
+  }
+  else if (rtcTime + 1 == unixTime) {
+    secondStart = now;
+  }
+  else if (rtcTime != unixTime) {
+    setDateTime(dt);
+    secondStart = now;
+  }
+  lastResync = now;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Fields and strings
+//
+
+// Whole date and time, formatted again
+void TimeCounter::setDateTime(const HalDateTime& dt) {
+
+  unixTime = dt.unixtime();
+  year = dt.year();
+  month = dt.month();
+  day = dt.day();
+  hour = dt.hour();
+  minute = dt.minute();
+  second = dt.second();
+  sprintf(nowTime, HOUR_FORMAT, int(hour), int(minute), int(second));
+  sprintf(today, DATE_FORMAT, int(day), int(month), int(year));
+}
+
+// Seconds forward, carried into the fields that change and only their digits
+void TimeCounter::advance(uint32_t seconds) {
+
+  if (seconds >= TIME_MAX_CARRY) {
+    setDateTime(HalDateTime(unixTime + seconds));
+    return;
+  }
+
+  unixTime += seconds;
+  second += seconds;
+  if (second < 60) {
+    putTwoDigits(nowTime + 6, second);
+    return;
+  }
+  second -= 60;
+  putTwoDigits(nowTime + 6, second);
+
+  if (++minute < 60) {
+    putTwoDigits(nowTime + 3, minute);
+    return;
+  }
+  minute = 0;
+  putTwoDigits(nowTime + 3, minute);
+
+  if (++hour < 24) {
+    putTwoDigits(nowTime, hour);
+    return;
+  }
+  hour = 0;
+  putTwoDigits(nowTime, hour);
+
+  // Next day (leap years as RTClib, 2000 to 2099)
+  uint8_t monthDays = pgm_read_byte(&DAYS_IN_MONTH[month - 1]);
+  if (month == 2 && year % 4 == 0) {
+    ++monthDays;
+  }
+  if (++day > monthDays) {
+    day = 1;
+    if (++month > 12) {
+      month = 1;
+      ++year;
+    }
+  }
+  sprintf(today, DATE_FORMAT, int(day), int(month), int(year));
+}
 //------------------------------------------------------------------------------
\ No newline at end of file
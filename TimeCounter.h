@@ -1,46 +1,74 @@
-
 // Code by Marcelo Soares and Douglas Quintanilha
 // Released to the public domain
 
 #ifndef _TIME_COUNTER_H_
 #define _TIME_COUNTER_H_
 
-#include <Wire.h>
-#include <RTClib.h>
-#include <SdFat.h>
-
-#include "Arduino.h"
+#include "HAL.h"
 
 // Date and Time formatting strings
 #define DATE_FORMAT "%02d/%02d/%4d"
 #define HOUR_FORMAT "%02d:%02d:%02d"
 
+// RTC resync interval (ms) that reads the RTC at every update, as before the
+// cache. Any other interval reads it at begin and then once per interval, the
+// seconds in between counted by millis() (or by the SQW ticks)
+#define TIME_RESYNC_ALWAYS 0
+
+// Larger steps are converted from the unix time instead of carried field by
+// field (once a minute updates keep the carry path)
+#define TIME_MAX_CARRY 60
+
 
 /*----------------------------------------------------------------------------
  *  Class TimeCounter
- *  Date and time counter and formatter
+ *  Date and time counter and formatter. With a resync interval the DS3231
+ *  is read only at begin and every interval: the time advances from millis()
+ *  or from the 1 Hz SQW interrupt, and the formatted strings get only the
+ *  fields that changed
  */
 class TimeCounter {
 
   public:
     TimeCounter() {
       presentDay = 0;
+      resyncInterval = TIME_RESYNC_ALWAYS;
+      squareWave = false;
     }
 
+    void setResyncInterval(uint32_t interval) { resyncInterval = interval; }
+    void setSquareWave(uint8_t pin);  // Before begin
     void begin();
     bool updateDateTime();
-    uint8_t getSeconds() const { return dt.second(); }
-    uint8_t getMinutes() const { return dt.minute(); }
-    uint8_t getHour() const { return dt.hour(); }
-    uint8_t getDay() const { return dt.day(); }
-    uint8_t getMonth() const { return dt.month(); }
-    uint16_t getYear() const { return dt.year(); }
-    char* getDate() const { return today; }
-    char* getTime() const { return nowTime; }
+    uint8_t getSeconds() const { return second; }
+    uint8_t getMinutes() const { return minute; }
+    uint8_t getHour() const { return hour; }
+    uint8_t getDay() const { return day; }
+    uint8_t getMonth() const { return month; }
+    uint16_t getYear() const { return year; }
+    uint32_t getUnixTime() const { return unixTime; }
+    uint16_t getMilliseconds() const;  // Into the present second, cached mode only
+    const char* getDate() const { return today; }
+    const char* getTime() const { return nowTime; }
 
   private:
-    DS3231 rtc;
-    DateTime dt;
+    void countSeconds();
+    void resync();
+    void setDateTime(const HalDateTime& dt);
+    void advance(uint32_t seconds);
+    static void onSecondTick();
+
+    HalRTC rtc;
+    uint32_t resyncInterval, lastResync;
+    uint32_t secondStart;   // millis() at the start of the present second
+    uint32_t unixTime;
+    uint16_t year;
+    uint8_t month, day, hour, minute, second;
+    uint8_t squarePin;
+    bool squareWave;
+
+    static volatile uint8_t pendingTicks;
+    static volatile uint32_t tickMillis;
 
     uint8_t presentDay;
     char today[11];    // Format DD/MM/YYYY
@@ -0,0 +1,121 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class WaveformStream
+ *  Framed raw sample blocks over a serial port
+ */
+
+#include "WaveformStream.h"
+
+
+//==============================================================================
+// Start the stream of one measure, or of the phases of a set, with the
+// information frame
+//
+void WaveformStream::begin(Stream* streamPort, Measure* measure) {
+
+  numPhases = 0;
+  addPhase(measure);
+  flags = measure->isDualRange() ? STREAM_DUAL_RANGE : 0;
+  gain = uint8_t(measure->getScale().gain);
+  pairRate = measure->getPairRate();
+  start(streamPort);
+}
+
+void WaveformStream::begin(Stream* streamPort, PhaseSet* phaseSet) {
+
+  numPhases = 0;
+  for (uint8_t phase = 0; phase < phaseSet->getNumPhases(); ++phase) {
+    addPhase(phaseSet->getPhase(phase));
+  }
+  flags = 0;
+  gain = uint8_t(phaseSet->getPhase(0)->getScale().gain);
+  pairRate = phaseSet->getPhase(0)->getPairRate();
+  start(streamPort);
+}
+
+void WaveformStream::addPhase(Measure* measure) {
+  pins[numPhases][0] = measure->getStandardCurrentPin() - A0;
+  pins[numPhases][1] = measure->getAmplifiedCurrentPin() - A0;
+  pins[numPhases][2] = measure->getVoltagePin() - A0;
+  ++numPhases;
+}
+
+void WaveformStream::start(Stream* streamPort) {
+  link.setPort(streamPort);
+  port = streamPort;
+  sequence = 0;
+  skippedBlocks = 0;
+  sentBlocks = 0;
+  active = true;
+  sendInfo();
+}
+
+void WaveformStream::sendInfo() {
+
+  uint8_t info[6] = { STREAM_VERSION, numPhases, flags, gain, uint8_t(pairRate), uint8_t(pairRate >> 8) };
+
+  link.beginFrame(FRAME_STREAM_INFO, sequence, 0, sizeof(info) + 3 * numPhases);
+  link.writePayload(info, sizeof(info));
+  link.writePayload(pins[0], 3 * numPhases);
+  link.endFrame();
+}
+
+// End frame, so the receiver knows the stream is complete
+void WaveformStream::end() {
+  if (active) {
+    link.beginFrame(FRAME_END, sequence, sentBlocks, 0);
+    link.endFrame();
+    active = false;
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Frame of a sample block, before the measurement consumes it. The codes are
+// packed to 10 bits: 3 bytes per pair, about 100 bytes per block
+//
+void WaveformStream::sendBlock(const SampleBlock* block, uint16_t droppedBlocks) {
+
+  // The port is still sending the previous frame: skip this one, the
+  // receiver sees the gap in the sequence
+  int space = port->availableForWrite();
+  if (space > 0 && space < STREAM_MIN_TX_ROOM) {
+    ++sequence;
+    ++skippedBlocks;
+    return;
+  }
+
+  if (sequence % STREAM_INFO_INTERVAL == 0 && sequence != 0) {
+    sendInfo();
+  }
+
+  uint8_t header[1 + SAMPLE_MAX_PHASES];
+  header[0] = (block->afterReference ? STREAM_AFTER_REFERENCE : 0) | (block->firstPhase << 1);
+  for (uint8_t phase = 0; phase < numPhases; ++phase) {
+    header[1 + phase] = block->currentPins[phase] - A0;
+  }
+
+  link.beginFrame(FRAME_WAVEFORM, sequence++, droppedBlocks, 1 + numPhases + SAMPLE_BLOCK_PAIRS * STREAM_PAIR_SIZE);
+  link.writePayload(header, 1 + numPhases);
+
+  // Pairs packed in pieces, so the frame needs no block sized buffer
+  uint8_t packed[8 * STREAM_PAIR_SIZE];
+  for (uint8_t first = 0; first < SAMPLE_BLOCK_PAIRS; first += 8) {
+    uint8_t* cursor = packed;
+    for (uint8_t pairIndex = first; pairIndex < first + 8; ++pairIndex) {
+      uint16_t current = block->samples[pairIndex][0];
+      uint16_t voltage = block->samples[pairIndex][1];
+      *cursor++ = uint8_t(current);
+      *cursor++ = uint8_t(voltage);
+      *cursor++ = ((current >> 8) & 0x03) | ((voltage >> 6) & 0x0C) | ((current & SAMPLE_STANDARD_RANGE) ? STREAM_STANDARD_RANGE : 0);
+    }
+    link.writePayload(packed, sizeof(packed));
+  }
+  link.endFrame();
+  ++sentBlocks;
+}
+//------------------------------------------------------------------------------
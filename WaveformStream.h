@@ -0,0 +1,82 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _WAVEFORM_STREAM_H_
+#define _WAVEFORM_STREAM_H_
+
+#include "HAL.h"
+#include "FrameLink.h"
+#include "PhaseSet.h"
+
+// USB serial rate of the stream. The 16 MHz UART is exact at 1 and 2 Mbaud;
+// at 1 Mbaud the transmit interrupt leaves time to the sampling one
+#define STREAM_BAUD_RATE 1000000
+
+// A block is skipped (a gap in the sequence) when the previous frame still
+// holds more of the transmit buffer than this
+#define STREAM_MIN_TX_ROOM 32
+
+#define STREAM_VERSION 1
+
+// The information frame is sent again every this many blocks: the receiver
+// changes its rate after the reply line, and may lose the first frames
+#define STREAM_INFO_INTERVAL 64
+
+// Frame types: the stream information, then one frame per sample block and
+// an end frame (FRAME_END: sequence of the next block, offset holds the
+// frames sent)
+#define FRAME_STREAM_INFO 'I'  // Payload: version, phases, flags, gain, pair rate (u16), pins of each phase
+#define FRAME_WAVEFORM    'W'  // Sequence: block count. Offset: blocks dropped by the acquisition
+
+// Flags of the information frame
+#define STREAM_DUAL_RANGE 0x01
+
+// Waveform frame payload: flags (bit 0: after reference conversions, bits
+// 1-2: phase of the first pair), the current channel of each phase, then
+// the pairs, 3 bytes each: current and voltage low bytes, then both high
+// bits (current in bits 0-1, voltage in 2-3) and the standard range flag (bit 4)
+#define STREAM_AFTER_REFERENCE 0x01
+#define STREAM_PAIR_SIZE       3
+#define STREAM_STANDARD_RANGE  0x10
+
+
+/*----------------------------------------------------------------------------
+ *  Class WaveformStream
+ *  Raw sample blocks of the continuous acquisition, framed with CRC16 as
+ *  they are consumed by the measurement. Channels are sent as pin - A0, the
+ *  columns of a waveform fixture
+ */
+class WaveformStream {
+
+  public:
+    WaveformStream() {
+      active = false;
+      numPhases = 0;
+    }
+
+    void begin(Stream* streamPort, Measure* measure);
+    void begin(Stream* streamPort, PhaseSet* phaseSet);
+    void end();
+    bool isActive() const { return active; }
+    void sendBlock(const SampleBlock* block, uint16_t droppedBlocks);
+
+    uint32_t getSentBlocks() const { return sentBlocks; }
+    uint16_t getSkippedBlocks() const { return skippedBlocks; }
+
+  private:
+    void addPhase(Measure* measure);
+    void start(Stream* streamPort);
+    void sendInfo();
+
+    FrameLink link;
+    Stream* port;
+    bool active;
+    uint8_t numPhases, flags, gain;
+    uint16_t pairRate;
+    uint8_t pins[SAMPLE_MAX_PHASES][3];  // Standard, amplified and voltage channels of each phase
+    uint16_t sequence, skippedBlocks;
+    uint32_t sentBlocks;
+};
+
+
+#endif // _WAVEFORM_STREAM_H_
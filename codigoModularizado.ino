@@ -9,14 +9,44 @@
 #include <RTClib.h>
 
 #include "Measure.h"
+#include "PhaseSet.h"
+#include "SensorProfile.h"
+#include "WaveformStream.h"
+#include "PowerEvents.h"
+#include "EnergySummary.h"
+#include "FrameLink.h"
+#include "DeltaLog.h"
 #include "Communicate.h"
 #include "FileSystem.h"
 #include "TimeCounter.h"
 #include "LED.h"
+#include "Scheduler.h"
+#include "FixedFormat.h"
 
 
 #define SAMPLES_PER_WINDOW 5000
 #define NUM_WINDOWS        5
+#define SAMPLE_PAIR_RATE   0     // Sequential analogRead (4000: interrupt driven acquisition at that pair rate)
+#define ACCUMULATION_KERNEL KERNEL_FLOAT  // KERNEL_INTEGER: window sums in integers, fewer cycles per pair
+#define CYCLES_PER_WINDOW  0     // Windows of SAMPLES_PER_WINDOW samples (12: closed on voltage zero crossings)
+#define HARMONIC_ANALYSIS  0     // Harmonics and THD columns in the files (1: about 500 bytes more of RAM)
+#define PERSISTENT_LOG     false // Day file opened, appended and closed per reading (true: kept open, synced by block and by LOG_SYNC_INTERVAL)
+#define LOG_FORMAT         LOG_FORMAT_CSV  // LOG_FORMAT_BINARY: 22 byte records, see BinaryLog.h
+#define PREALLOCATE_LOG    0     // Day files created as one contiguous extent of READINGS_PER_DAY records (persistent log, stalls the rollover)
+#define TIMING_STATS       0     // Duration of each loop phase, option S (1: about 180 bytes more of RAM)
+#define STATS_LOG_PERIOD   0     // Phase statistics appended to STATS_FILE every period (ms, 0: never)
+#define RTC_RESYNC_INTERVAL TIME_RESYNC_ALWAYS // RTC read at every update (60000: once a minute, seconds counted in between)
+#define RTC_SQW_PIN        0     // DS3231 SQW wired to pin 2 or 3 counts the seconds (0: millis() counts them)
+#define DUAL_RANGE_CURRENT 0     // Both current pins converted, range chosen per sample (1: 3 conversions per pair)
+#define PHASES             1     // Phases of one board (2 or 3: Mega, continuous acquisition, SAMPLE_PAIR_RATE per phase)
+#define WAVEFORM_STREAM    0     // Option O streams the raw samples at STREAM_BAUD_RATE (1: continuous acquisition only)
+#define COMPILE_TIME_SENSORS 0   // Scale factors of the sensors computed by the Measure constructor (1: folded by the compiler)
+#define POWER_EVENTS       0     // Sags, swells, interruptions and inrush of the first phase to EVENTS_FILE (1: about 500 bytes more of RAM)
+#define NOMINAL_VOLTAGE    127.0 // Reference of the sag, swell and interruption limits (V)
+#define INRUSH_CURRENT     15.0  // Half-cycle RMS current that starts an inrush event (A, 0: not detected)
+#define ENERGY_SUMMARY     0     // Hourly and daily energy, demand and extremes to a month file, option E (about 230 bytes of RAM)
+#define BLOCK_TRANSFER     0     // Framed, resumable file transfer, option B (1: about 11 bytes more of RAM)
+#define DELTA_TRANSFER     0     // File transfer compressed row to row, option X (1: about 54 bytes more of RAM)
 
 #define STANDARD_CURRENT_PIN    A0
 #define AMPLIFIED_CURRENT_PIN   A1
@@ -26,14 +56,97 @@
 #define MAX_CURRENT_VALUE       20
 #define CURRENT_GAIN            10
 
+// Second and third phases, same sensors (PHASES > 1)
+#define PHASE2_STANDARD_CURRENT_PIN  A3
+#define PHASE2_AMPLIFIED_CURRENT_PIN A4
+#define PHASE2_VOLTAGE_PIN           A5
+#define PHASE3_STANDARD_CURRENT_PIN  A6
+#define PHASE3_AMPLIFIED_CURRENT_PIN A7
+#define PHASE3_VOLTAGE_PIN           A8
+
+// Sensors above as a compile-time profile (COMPILE_TIME_SENSORS)
+struct BoardSensors {
+  static constexpr MeasureScale scale() {
+    return MeasureScale::make(MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+  }
+};
+
+#if COMPILE_TIME_SENSORS
+#define PHASE_MEASURE(name, standardPin, amplifiedPin, voltagePin) \
+  ProfiledMeasure<BoardSensors> name(standardPin, amplifiedPin, voltagePin)
+#else
+#define PHASE_MEASURE(name, standardPin, amplifiedPin, voltagePin) \
+  Measure name(standardPin, amplifiedPin, voltagePin, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO)
+#endif
+
 #define BLUETOOTH_STATE_PIN 5
 #define BLUETOOTH_TX_PIN    6
 #define BLUETOOTH_RX_PIN    7
 #define EMERGENCY_LED_PIN   8
 
-// File name format 'YYYY.MM.DD.csv'
+// File name format 'YYYY.MM.DD.csv' ('YYYY.MM.DD.bin' for binary records)
+#if LOG_FORMAT == LOG_FORMAT_BINARY
+#define FILE_NAME_FORMAT "%4d.%02d.%02d.bin"
+#else
 #define FILE_NAME_FORMAT "%4d.%02d.%02d.csv"
+#endif
 #define AUTOCONFIG_FILE  "autoconfig.txt"
+#define STATS_FILE       "stats.csv"
+#define EVENTS_FILE      "events.csv"
+#define SUMMARY_NAME_FORMAT "%4d.%02d.sum"  // Summary file of a month 'YYYY.MM.sum'
+
+#if PHASES > 1 && !SAMPLE_PAIR_RATE
+#error "Phase sets need the continuous acquisition (SAMPLE_PAIR_RATE)"
+#endif
+#if WAVEFORM_STREAM && !SAMPLE_PAIR_RATE
+#error "The waveform stream needs the continuous acquisition (SAMPLE_PAIR_RATE)"
+#endif
+#if POWER_EVENTS && !SAMPLE_PAIR_RATE
+#error "Power quality events need the continuous acquisition (SAMPLE_PAIR_RATE)"
+#endif
+#if PREALLOCATE_LOG && !PERSISTENT_LOG
+#error "Preallocated day files need the persistent log (PERSISTENT_LOG)"
+#endif
+static_assert(!SAMPLE_PAIR_RATE ||
+              (SAMPLE_PAIR_RATE * PHASES * (DUAL_RANGE_CURRENT ? 3UL : 2UL) >= HAL_ADC_MIN_CONVERSION_RATE &&
+               SAMPLE_PAIR_RATE * PHASES * (DUAL_RANGE_CURRENT ? 3UL : 2UL) <= HAL_ADC_MAX_CONVERSION_RATE),
+              "SAMPLE_PAIR_RATE is out of the conversion rates of Timer1 and the ADC");
+
+// Readings of a day, the extent of a preallocated day file. A reading takes
+// its windows of cycles at the nominal frequency, of pairs at the sampling
+// rate, or of sequential pairs (two analogRead, about 224 us). The extent is
+// allocated and erased at the day rollover, in the record task: with a
+// reading a second it is 8.3 MB of CSV (1.9 MB binary), and the FAT search
+// and the erase of the card take from tens to hundreds of ms, far past
+// MEASURE_DEADLINE. The blocks dropped meanwhile discard the window of the
+// first reading of the day
+#if CYCLES_PER_WINDOW
+#define READING_MILLIS (NUM_WINDOWS * CYCLES_PER_WINDOW * 1000UL / 60)
+#elif SAMPLE_PAIR_RATE
+#define READING_MILLIS (NUM_WINDOWS * uint32_t(SAMPLES_PER_WINDOW) * 1000UL / SAMPLE_PAIR_RATE)
+#else
+#define READING_MILLIS (NUM_WINDOWS * uint32_t(SAMPLES_PER_WINDOW) * 224UL / 1000)
+#endif
+#define READINGS_PER_DAY (86400000UL / READING_MILLIS)
+
+// Task periods and deadlines (ms). The measurement must consume each block
+// before the next one fills (SAMPLE_BLOCK_PAIRS / SAMPLE_PAIR_RATE of each phase)
+#if SAMPLE_PAIR_RATE
+#define MEASURE_DEADLINE (SAMPLE_BLOCK_PAIRS * 1000UL / (SAMPLE_PAIR_RATE * PHASES))
+#define MEASURE_PRIORITY 0
+#else
+#define MEASURE_DEADLINE 0  // Sequential acquisition: the reading blocks anyway
+#define MEASURE_PRIORITY 8  // and ends every pass, so it runs after the other tasks
+#endif
+#define CLOCK_UPDATE_PERIOD 1000
+#define RECORD_DEADLINE   1000
+#define FLUSH_DEADLINE    1000
+#define LED_STATUS_PERIOD 250
+
+// Tasks registered by setup(), the size of the scheduler table
+#define SCHEDULER_TASKS (6 + (POWER_EVENTS ? 1 : 0) + ((TIMING_STATS && STATS_LOG_PERIOD) ? 1 : 0))
+
+#define MONITOR_DECIMALS 3
 
 
 //==============================================================================
@@ -44,12 +157,62 @@ ArduinoOutStream cout(Serial);
 
 LED led(EMERGENCY_LED_PIN);
 Communicate communicate(BLUETOOTH_STATE_PIN, BLUETOOTH_TX_PIN, BLUETOOTH_RX_PIN, &cout);
-Measure measure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+PHASE_MEASURE(measure, STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN);
+#if SAMPLE_PAIR_RATE
+SampleBuffer sampleBuffer;
+#endif
+#if PHASES > 1
+PHASE_MEASURE(phase2, PHASE2_STANDARD_CURRENT_PIN, PHASE2_AMPLIFIED_CURRENT_PIN, PHASE2_VOLTAGE_PIN);
+#endif
+#if PHASES > 2
+PHASE_MEASURE(phase3, PHASE3_STANDARD_CURRENT_PIN, PHASE3_AMPLIFIED_CURRENT_PIN, PHASE3_VOLTAGE_PIN);
+#endif
+#if PHASES > 1
+PhaseSet phaseSet;
+#endif
 FileSystem fileSystem;
+SchedulerTask schedulerTasks[SCHEDULER_TASKS];
+Scheduler scheduler(schedulerTasks, SCHEDULER_TASKS);
+#if HARMONIC_ANALYSIS
+Harmonics harmonics;
+#endif
+#if TIMING_STATS
+PhaseStats phaseStats;
+#endif
+#if WAVEFORM_STREAM
+WaveformStream waveformStream;
+#endif
+#if POWER_EVENTS
+PowerEvents powerEvents;
+#endif
+#if ENERGY_SUMMARY
+EnergySummary energySummary;
+#endif
+#if BLOCK_TRANSFER
+FrameLink transferLink;
+#endif
+#if DELTA_TRANSFER
+DeltaLog deltaLog;
+#endif
 
 char fileName[15];
 bool monitoring = false;
 
+// Request being handled: each loop() pass advances it one bounded step, so
+// the measurement and the recording go on during prompts and transfers
+#define COMMAND_IDLE     0
+#define COMMAND_PROMPT   1  // Waiting for the answer to a prompt
+#define COMMAND_TRANSFER 2  // Sending a file, a piece per pass
+#define COMMAND_STREAM   3  // Sending the raw sample blocks, until a char is received
+
+uint8_t commandState = COMMAND_IDLE;
+uint8_t commandStep = 0;       // Prompt answered next, within the request
+char commandArgument[20];      // File or folder of the request: fileName keeps recording
+uint32_t queryFrom = 0;        // Option Q: start of the range
+
+// Tasks triggered by a reading
+int8_t clockTaskId, recordTaskId;
+
 
 //==============================================================================
 // Declare reset function @ address 0 --- Reset Arduino via software
@@ -62,8 +225,9 @@ void(* resetFunc) (void) = 0;
 //
 void haltOnError(const __FlashStringHelper* errorMessage) {
   
-  // Register the error date and time
+  // Register the error date and time, keeping what was already logged
   timeCounter.updateDateTime();
+  fileSystem.closeLog(false);
 
   // Await user handshake
   while (!communicate.isDeviceConnected()) {
@@ -83,20 +247,74 @@ void haltOnError(const __FlashStringHelper* errorMessage) {
 //==============================================================================
 // Print function to show the calculated RMS and Power values 
 //
+
+// Monitored value with MONITOR_DECIMALS, as the stream prints it but without
+// float operations per digit. One buffer: a single call per statement
+const char* fixedText(float value) {
+  static char text[FIXED_TEXT_SIZE];
+  FixedFormat::format(text, value, MONITOR_DECIMALS);
+  return text;
+}
+
 inline void printAverageValues() {
   
-  if (!communicate.isDeviceConnected() or !monitoring) {
+  if (!communicate.isDeviceConnected() or !monitoring or commandState == COMMAND_STREAM) {
     return;
   }
   
-  cout << ' ' << timeCounter.getDate() << ' ' << timeCounter.getTime() << setprecision(3) << F(" (sample of ") << measure.getLastPeriod() << F(" s)") << endl;
-  cout << F("  |  VccRef: ") << measure.getVccRef() << F(" V") << endl;
-  cout << F("  |  Current: ") << measure.getCurrentRMS() << F(" A ") << F("(zero = ") << measure.getZeroCurrent() << F(" V");
-  measure.isAmplified() ? cout << F(", amplified)") << endl : cout << F(", not amplified)") << endl;
-  cout << F("  |  Voltage: ") << measure.getVoltageRMS()  << F(" V ") << F("(zero = ") << measure.getZeroVoltage() << F(" V)") << endl;
-  cout << F("  |  Real power: ") << measure.getRealPower() << F(" Watts") << endl;
-  cout << F("  |  Apparent power: ") << measure.getApparentPower() << F(" VA") << endl;
-  cout << F("  |  Power factor: ") << measure.getPowerFactor() << endl << endl;
+  cout << ' ' << timeCounter.getDate() << ' ' << timeCounter.getTime() << F(" (sample of ") << fixedText(measure.getLastPeriod()) << F(" s)") << endl;
+  cout << F("  |  VccRef: ") << fixedText(measure.getVccRef()) << F(" V (") << measure.getVccCalibrations();
+  cout << F(" calibrations, ") << measure.getVccSavedMicros() << F(" us saved per reading)") << endl;
+  cout << F("  |  Current: ") << fixedText(measure.getCurrentRMS()) << F(" A ");
+  cout << F("(zero = ") << fixedText(measure.getZeroCurrent()) << F(" V");
+  if (measure.isDualRange()) {
+    cout << F(", standard zero = ") << fixedText(measure.getZeroStandardCurrent());
+    cout << F(" V, dual range: ") << int(measure.getStandardShare()) << F("% standard)") << endl;
+  }
+  else {
+    measure.isAmplified() ? cout << F(", amplified)") << endl : cout << F(", not amplified)") << endl;
+  }
+  cout << F("  |  Voltage: ") << fixedText(measure.getVoltageRMS())  << F(" V ");
+  cout << F("(zero = ") << fixedText(measure.getZeroVoltage()) << F(" V)") << endl;
+  cout << F("  |  Real power: ") << fixedText(measure.getRealPower()) << F(" Watts") << endl;
+  cout << F("  |  Apparent power: ") << fixedText(measure.getApparentPower()) << F(" VA") << endl;
+  cout << F("  |  Power factor: ") << fixedText(measure.getPowerFactor()) << endl;
+  cout << F("  |  Line frequency: ") << fixedText(measure.getLineFrequency()) << F(" Hz") << endl;
+  if (measure.getHarmonics()) {
+    cout << F("  |  THD: ") << fixedText(measure.getHarmonics()->getVoltageTHD()) << F(" % (voltage), ");
+    cout << fixedText(measure.getHarmonics()->getCurrentTHD()) << F(" % (current)") << endl;
+  }
+#if PHASES > 1
+  for (uint8_t phase = 1; phase < PHASES; ++phase) {
+    Measure* load = phaseSet.getPhase(phase);
+    cout << F("  |  Phase ") << int(phase + 1) << F(": ") << fixedText(load->getCurrentRMS()) << F(" A, ");
+    cout << fixedText(load->getVoltageRMS()) << F(" V, ");
+    cout << fixedText(load->getRealPower()) << F(" W, PF ");
+    cout << fixedText(load->getPowerFactor()) << endl;
+  }
+  cout << F("  |  Total: ") << fixedText(phaseSet.getRealPower()) << F(" W, ");
+  cout << fixedText(phaseSet.getApparentPower()) << F(" VA, PF ");
+  cout << fixedText(phaseSet.getPowerFactor()) << endl;
+#endif
+  cout << F("  |  Kernel: ") << measure.getKernelMicros() << F(" us (");
+  cout << measure.getKernelMicros() * (F_CPU / 1000000) / (uint32_t(SAMPLES_PER_WINDOW) * NUM_WINDOWS) << F(" cycles/pair)") << endl;
+  cout << F("  |  Record: ") << fileSystem.getLastRecordMicros() << F(" us (max ") << fileSystem.getMaxRecordMicros() << F(" us)") << endl;
+#if PHASES > 1
+  cout << F("  |  Dropped blocks: ") << phaseSet.getDroppedBlocks() << endl;
+#else
+  cout << F("  |  Dropped blocks: ") << measure.getDroppedBlocks() << endl;
+#endif
+#if POWER_EVENTS
+  cout << F("  |  Power events: ") << powerEvents.getEventCount() << F(" (") << powerEvents.getMissedEvents() << F(" missed)") << endl;
+#endif
+
+  // Tasks, as registered: measure, clock, record, flush, LED, requests, events
+  for (uint8_t task = 0; task < scheduler.getNumTasks(); ++task) {
+    cout << F("  |  Task ") << int(task) << F(": ") << scheduler.getRuns(task) << F(" runs, ");
+    cout << scheduler.getMisses(task) << F(" misses, late ") << scheduler.getMaxLateness(task) << F(" ms, ");
+    cout << F("max ") << scheduler.getMaxMicros(task) << F(" us") << endl;
+  }
+  cout << endl;
 }
 //------------------------------------------------------------------------------
 
@@ -121,18 +339,15 @@ void resetFileName() {
 //==============================================================================
 // Configure active directory to store measure files
 //
-void configureDirectory() {
-
-  cout << F("Enter folder name: ");
-  char* dir = new char[20];
-  strcpy(dir, communicate.waitForInput());
-
+void createDirectory(char* dir) {
   if (!fileSystem.makeDir(dir)) {
     haltOnError(F("Create folder failed!"));
   }
+}
 
-  cout << F("Configure autoreset to this session? (Y/N) ");
-  if (!strcmp(communicate.waitForInput(), "Y")) {
+void enterDirectory(char* dir, bool autoreset) {
+
+  if (autoreset) {
     if (!fileSystem.saveActiveSession(dir, AUTOCONFIG_FILE)) {
       haltOnError(F("Could not create autoconfig file!"));
     }
@@ -142,38 +357,197 @@ void configureDirectory() {
   if (!fileSystem.changeDir(dir)) {
     haltOnError(F("CHDIR to folder failed!"));
   }
-  delete[] dir;
+}
+
+// Blocking version, for the setup
+void configureDirectory() {
+
+  cout << F("Enter folder name: ");
+  strncpy(commandArgument, communicate.waitForInput(), sizeof(commandArgument) - 1);
+  commandArgument[sizeof(commandArgument) - 1] = '\0';
+  createDirectory(commandArgument);
+
+  cout << F("Configure autoreset to this session? (Y/N) ");
+  enterDirectory(commandArgument, !strcmp(communicate.waitForInput(), "Y"));
 }
 //------------------------------------------------------------------------------
 
 
 //==============================================================================
-// Checks wether data should be transmitted via bluetooth to anorther connected device
+// Request handling steps
 //
-inline void checkAndTransmitData() {
 
-  if (!communicate.isDeviceConnected() or !communicate.getRequest()) {
-    return;
+// Sends an "END" message to close transmission and listen to the next request
+void endRequest() {
+
+  cout << F("END") << endl << endl;
+
+  commandState = COMMAND_IDLE;
+  communicate.resetRequest();
+  communicate.clearSerialBuffer();
+  communicate.bluetoothListen();
+}
+
+// Ask for an input: the answer is read by the following passes, chars
+// received before the prompt are discarded
+void prompt(const __FlashStringHelper* message, uint8_t step) {
+  cout << message;
+  communicate.clearSerialBuffer();
+  communicate.clearInput();
+  commandState = COMMAND_PROMPT;
+  commandStep = step;
+}
+
+// Start sending a file, or end the request if it can not be opened
+void startTransfer(char* name) {
+  strncpy(commandArgument, name, sizeof(commandArgument) - 1);
+  commandArgument[sizeof(commandArgument) - 1] = '\0';
+  commandState = fileSystem.beginTransfer(commandArgument, &cout) ? COMMAND_TRANSFER : COMMAND_IDLE;
+}
+
+// Option O: the rest of the session goes at the stream rate, the frames
+// follow the reply line
+void startStream() {
+#if WAVEFORM_STREAM
+  cout << F("Streaming at ") << uint32_t(STREAM_BAUD_RATE) << F(" baud") << endl;
+  communicate.setSerialBaudRate(STREAM_BAUD_RATE);
+  communicate.clearSerialBuffer();
+#if PHASES > 1
+  waveformStream.begin(&Serial, &phaseSet);
+#else
+  waveformStream.begin(&Serial, &measure);
+#endif
+  commandState = COMMAND_STREAM;
+#endif
+}
+
+// End frame of the stream, back at the rate of the prompts
+void endStream() {
+#if WAVEFORM_STREAM
+  if (waveformStream.isActive()) {
+    waveformStream.end();
+    communicate.setSerialBaudRate(0);
   }
+#endif
+}
 
-  // Stop bluetooth from listening interrupts;
-  communicate.bluetoothIgnore();
+// Option Q: unix time of the RTC, or seconds before the present time ("-3600")
+uint32_t parseQueryTime(char* input) {
+  if (input[0] == '-') {
+    timeCounter.updateDateTime();
+    return timeCounter.getUnixTime() - strtoul(input + 1, NULL, 10);
+  }
+  return strtoul(input, NULL, 10);
+}
 
-  // Evaluate the option requested
-  switch (communicate.getRequest()) {
+// Option E: the hours of a day ("YYYY.MM.DD"), the days of a month
+// ("YYYY.MM") or the hours of the present day ("."), after a checkpoint of
+// the records in progress
+bool startSummaryTransfer(char* input) {
+#if ENERGY_SUMMARY
+  timeCounter.updateDateTime();
+  fileSystem.recordSummary(SUMMARY_NAME_FORMAT, &energySummary);
+  uint16_t year = timeCounter.getYear();
+  uint8_t month = timeCounter.getMonth();
+  uint8_t day = timeCounter.getDay();
+  if (strcmp(input, ".")) {
+    char* end;
+    year = strtoul(input, &end, 10);
+    month = (*end == '.') ? strtoul(end + 1, &end, 10) : 0;
+    day = (*end == '.') ? strtoul(end + 1, &end, 10) : 0;
+    if (*end || month < 1 || month > 12) {
+      return false;
+    }
+  }
+  return fileSystem.beginSummaryTransfer(SUMMARY_NAME_FORMAT, year, month, day, &cout);
+#else
+  return false;
+#endif
+}
+
+// Option A: days of the present month, "." for every day up to today, "5"
+// for one day or "5-12" for a range
+bool startExport(char* input) {
+
+  timeCounter.updateDateTime();
+  uint8_t firstDay = 1, lastDay = timeCounter.getDay();
+  if (strcmp(input, ".")) {
+    char* end;
+    firstDay = strtoul(input, &end, 10);
+    lastDay = (*end == '-') ? strtoul(end + 1, &end, 10) : firstDay;
+    if (*end || firstDay < 1 || lastDay > 31) {
+      return false;
+    }
+  }
+  HalDateTime first(timeCounter.getYear(), timeCounter.getMonth(), firstDay);
+  HalDateTime last(timeCounter.getYear(), timeCounter.getMonth(), lastDay);
+  return fileSystem.beginExport(FILE_NAME_FORMAT, first.unixtime(), last.unixtime(), &cout);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Evaluate a new request. Requests that take input or send files go on in
+// the following passes through continueRequest()
+//
+void startRequest(char request) {
+
+  commandState = COMMAND_IDLE;
+  switch (request) {
 
     // Option F: transfer last active (F)ile
     case 'F':
-      fileSystem.transferFile(fileName, &cout, &communicate);
+      startTransfer(fileName);
       break;
 
-    // Option A: transfer (A)ll month files
+    // Option A: transfer (A)ll month files, or some days, as one stream with a manifest
     case 'A':
-      timeCounter.updateDateTime();
-      for (uint8_t dayCounter = 1; dayCounter <= timeCounter.getDay(); ++dayCounter) {
-        sprintf(fileName, FILE_NAME_FORMAT, timeCounter.getYear(), timeCounter.getMonth(), dayCounter);
-        fileSystem.transferFile(fileName, &cout, &communicate);
+      prompt(F("Days: "), 0);
+      break;
+
+    // Option Q: (Q)uery the records of a time range, from the day files and their index
+    case 'Q':
+      prompt(F("From: "), 0);
+      break;
+
+    // Option E: (E)nergy summary, hourly and daily records of the month file
+    case 'E':
+#if ENERGY_SUMMARY
+      prompt(F("Date: "), 0);
+#else
+      cout << F("Energy summary disabled (ENERGY_SUMMARY)") << endl;
+#endif
+      break;
+
+    // Option B: (B)lock transfer of a file ('.' for the active file), framed with CRC, resumable
+    case 'B':
+#if BLOCK_TRANSFER
+      prompt(F("File: "), 0);
+#else
+      cout << F("Block transfer disabled (BLOCK_TRANSFER)") << endl;
+#endif
+      break;
+
+    // Option X: file transfer compressed row to row ('.' for the active file), see DeltaLog.h
+    case 'X':
+#if DELTA_TRANSFER
+      prompt(F("File: "), 0);
+#else
+      cout << F("Compressed transfer disabled (DELTA_TRANSFER)") << endl;
+#endif
+      break;
+
+    // Option O: (O)scilloscope, raw samples streamed in frames, over the USB serial
+    case 'O':
+#if WAVEFORM_STREAM
+      if (communicate.getCommPort() != &Serial) {
+        cout << F("Waveform stream needs the USB serial") << endl;
+        break;
       }
+      startStream();
+#else
+      cout << F("Waveform stream disabled (WAVEFORM_STREAM)") << endl;
+#endif
       break;
 
     // Option L: (L)ist all files in SD Card
@@ -186,36 +560,138 @@ inline void checkAndTransmitData() {
       fileSystem.printFreeSpace(&cout);
       break;
 
+    // Option S: print timing (S)tatistics of the loop phases
+    case 'S':
+#if TIMING_STATS
+      cout << PHASE_STATS_HEADER << endl;
+      phaseStats.print(&cout);
+#else
+      cout << F("Timing statistics disabled (TIMING_STATS)") << endl;
+#endif
+      break;
+
+    // Option Z: (Z)ero the timing statistics
+    case 'Z':
+#if TIMING_STATS
+      phaseStats.reset();
+#endif
+      scheduler.resetStats();
+      cout << F("Statistics reset!") << endl;
+      break;
+
     // Option C: (C)hange active directory
     case 'C':
-      configureDirectory();
+      prompt(F("Enter folder name: "), 0);
       break;
 
     // Option M: turn (M)onitoring of reading results on/off
     case 'M':
       monitoring = !monitoring;
+      scheduler.resetStats();
       cout << F("Monitoring ");
       (monitoring) ? cout << F("ON!") << endl : cout << F("OFF!") << endl;
       break;
 
     // Option D: (D)elete autoconfig file
     case 'D':
-      cout << F("Confirm delete? (Y/N) ");
-      if (strcmp(communicate.waitForInput(), "Y")) {
-        cout << F("Canceled!") << endl;
-        break;
+      prompt(F("Confirm delete? (Y/N) "), 0);
+      break;
+
+    // Option W: (W)ipe all files in SD Card
+    case 'W':
+      prompt(F("Confirm wipe? (Y/N) "), 0);
+      break;
+
+    // Option R: (R)eset device
+    case 'R':
+      fileSystem.closeLog(false);
+      resetFunc();
+      break;
+
+    // Option not recognized
+    default:
+      cout << F("Option '") << request << F("' invalid!") << endl;
+  }
+
+  if (commandState == COMMAND_IDLE) {
+    endRequest();
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Answer to the prompt of the request being handled
+//
+void answerPrompt(char request, char* input) {
+
+  commandState = COMMAND_IDLE;
+  switch (request) {
+
+#if BLOCK_TRANSFER
+    case 'B':
+      if (commandStep == 0) {
+        strncpy(commandArgument, strcmp(input, ".") ? input : fileName, LOG_NAME_SIZE - 1);
+        commandArgument[LOG_NAME_SIZE - 1] = '\0';
+        prompt(F("Offset: "), 1);
+        return;
       }
-      if (!fileSystem.deleteAutoconfigFile(AUTOCONFIG_FILE)) {
-        cout << F("Could not delete autoconfig file!") << endl;
-        break;
-      }      
-      cout << F("Autoconfig file deleted!") << endl;
+      cout << endl;
+      if (fileSystem.beginFrameTransfer(commandArgument, strtoul(input, NULL, 10), &communicate, &transferLink)) {
+        commandState = COMMAND_TRANSFER;
+        return;
+      }
+      cout << endl << F("Transfer incomplete!") << endl;
+      break;
+#endif
+
+#if DELTA_TRANSFER
+    case 'X':
+      strncpy(commandArgument, strcmp(input, ".") ? input : fileName, LOG_NAME_SIZE - 1);
+      commandArgument[LOG_NAME_SIZE - 1] = '\0';
+      cout << endl;
+      if (fileSystem.beginDeltaTransfer(commandArgument, &deltaLog)) {
+        commandState = COMMAND_TRANSFER;
+        return;
+      }
+      cout << F("Transfer incomplete!") << endl;
+      break;
+#endif
+
+    case 'Q':
+      if (commandStep == 0) {
+        queryFrom = parseQueryTime(input);
+        prompt(F("To: "), 1);
+        return;
+      }
+      cout << endl;
+      if (fileSystem.beginQuery(FILE_NAME_FORMAT, queryFrom, parseQueryTime(input), &cout)) {
+        commandState = COMMAND_TRANSFER;
+        return;
+      }
+      cout << F("Invalid range!") << endl;
+      break;
+
+    case 'A':
+      cout << endl;
+      if (startExport(input)) {
+        commandState = COMMAND_TRANSFER;
+        return;
+      }
+      cout << F("Invalid range!") << endl;
+      break;
+
+    case 'E':
+      cout << endl;
+      if (startSummaryTransfer(input)) {
+        commandState = COMMAND_TRANSFER;
+        return;
+      }
+      cout << F("No summary!") << endl;
       break;
 
-    // Option X: (W)ipe all files in SD Card
     case 'W':
-      cout << F("Confirm wipe? (Y/N) ");
-      if (strcmp(communicate.waitForInput(), "Y")) {
+      if (strcmp(input, "Y")) {
         cout << F("Wipe canceled!") << endl;
         break;
       }
@@ -223,29 +699,219 @@ inline void checkAndTransmitData() {
         haltOnError(F("Wipe failed!"));
       }
       cout << F("SD Card successfully wiped!") << endl;
-      configureDirectory();
+
+      // Then configure the directory, as option C
+      Communicate::request = 'C';
+      prompt(F("Enter folder name: "), 0);
+      return;
+
+    case 'C':
+      if (commandStep == 0) {
+        strncpy(commandArgument, input, sizeof(commandArgument) - 1);
+        commandArgument[sizeof(commandArgument) - 1] = '\0';
+        createDirectory(commandArgument);
+        prompt(F("Configure autoreset to this session? (Y/N) "), 1);
+        return;
+      }
+      enterDirectory(commandArgument, !strcmp(input, "Y"));
       break;
 
-    // Option R: (R)eset device
-    case 'R':
-      resetFunc();
+    case 'D':
+      if (strcmp(input, "Y")) {
+        cout << F("Canceled!") << endl;
+        break;
+      }
+      if (!fileSystem.deleteAutoconfigFile(AUTOCONFIG_FILE)) {
+        cout << F("Could not delete autoconfig file!") << endl;
+        break;
+      }
+      cout << F("Autoconfig file deleted!") << endl;
       break;
+  }
 
-    // Option not recognized
-    default:
-      cout << F("Option '") << communicate.getRequest() << F("' invalid!") << endl;
+  endRequest();
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// One bounded step of the request being handled
+//
+void continueRequest() {
+
+  // A request without its device is dropped
+  if (!communicate.isDeviceConnected()) {
+    fileSystem.endTransfer();
+    endStream();
+    endRequest();
+    return;
   }
 
-  // Sends an "END" message to close transmission
-  cout << F("END") << endl << endl;
+  // Any char stops the stream
+  if (commandState == COMMAND_STREAM) {
+    if (Serial.available()) {
+      endStream();
+      endRequest();
+    }
+    return;
+  }
 
-  communicate.resetRequest();
-  communicate.clearSerialBuffer();
-  communicate.bluetoothListen();
+  if (commandState == COMMAND_PROMPT) {
+    char* input = communicate.pollInput();
+    if (input) {
+      answerPrompt(communicate.getRequest(), input);
+    }
+    return;
+  }
+
+  uint8_t status = fileSystem.continueTransfer(&communicate);
+  if (status == TRANSFER_ACTIVE) {
+    return;
+  }
+  if (communicate.getRequest() == 'B' && status != TRANSFER_DONE) {
+    cout << endl << F("Transfer incomplete!") << endl;
+  }
+  endRequest();
 }
 //------------------------------------------------------------------------------
 
 
+//==============================================================================
+// Checks wether data should be transmitted via bluetooth to anorther connected device
+//
+inline void checkAndTransmitData() {
+
+  if (commandState != COMMAND_IDLE) {
+    continueRequest();
+    return;
+  }
+
+  if (!communicate.isDeviceConnected() or !communicate.getRequest()) {
+    return;
+  }
+
+  // Stop bluetooth from listening interrupts;
+  communicate.bluetoothIgnore();
+  startRequest(communicate.getRequest());
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Tasks of the scheduler, from the highest priority
+//
+
+// Consume the sample blocks; a complete reading triggers the clock and the record
+bool measureTask() {
+#if PHASES > 1
+  if (!phaseSet.update()) {
+#else
+  if (!measure.update()) {
+#endif
+    return false;
+  }
+  scheduler.trigger(clockTaskId);
+  scheduler.trigger(recordTaskId);
+  return true;
+}
+
+// Advance date, time and file name (the RTC is read at RTC_RESYNC_INTERVAL)
+bool clockTask() {
+#if TIMING_STATS
+  uint32_t startMicros = micros();
+#endif
+  updateDateTimeAndFileName();
+#if TIMING_STATS
+  phaseStats.add(PHASE_RTC, micros() - startMicros);
+#endif
+  return true;
+}
+
+#if ENERGY_SUMMARY
+// Add the reading to the hour and day records, written when an hour ends and
+// every SUMMARY_CHECKPOINT_PERIOD
+void updateSummary() {
+#if PHASES > 1
+  PhaseSet* reading = &phaseSet;
+#else
+  Measure* reading = &measure;
+#endif
+  uint32_t time = timeCounter.getUnixTime();
+  if (!energySummary.add(time, reading)) {
+    fileSystem.recordSummary(SUMMARY_NAME_FORMAT, &energySummary);
+    energySummary.add(time, reading);
+  }
+  else if (energySummary.isCheckpointDue(time)) {
+    fileSystem.recordSummary(SUMMARY_NAME_FORMAT, &energySummary);
+  }
+}
+#endif
+
+bool recordTask() {
+  printAverageValues();
+#if PHASES > 1
+  if (!fileSystem.recordValues(fileName, &phaseSet)) {
+#else
+  if (!fileSystem.recordValues(fileName, &measure)) {
+#endif
+    haltOnError(F("Could not open/create file to write!"));
+  }
+#if ENERGY_SUMMARY
+  updateSummary();
+#endif
+  return true;
+}
+
+// Write the cached rows of the persistent log to the card
+bool flushTask() {
+  fileSystem.syncLog();
+  return true;
+}
+
+// LED lit while a request is handled
+bool ledTask() {
+  (commandState == COMMAND_IDLE) ? led.setOff() : led.setOn();
+  return false;
+}
+
+bool requestTask() {
+#if TIMING_STATS
+  bool active = (commandState != COMMAND_IDLE || communicate.getRequest());
+  uint32_t startMicros = micros();
+#endif
+  checkAndTransmitData();
+#if TIMING_STATS
+  if (active) {
+    phaseStats.add(PHASE_COMMAND, micros() - startMicros);
+  }
+#endif
+  return false;
+}
+
+#if POWER_EVENTS
+// Write a step of the pending power quality event: the measurement runs
+// between the steps
+bool eventTask() {
+  if (!powerEvents.isRecordPending()) {
+    return false;
+  }
+  char eventsName[] = EVENTS_FILE;
+  fileSystem.recordEvent(eventsName, &powerEvents);
+  return true;
+}
+#endif
+
+#if TIMING_STATS && STATS_LOG_PERIOD
+// Append the phase statistics to the side file of the active directory
+bool statsTask() {
+  char statsName[] = STATS_FILE;
+  fileSystem.recordStats(statsName, &phaseStats);
+  return true;
+}
+#endif
+//------------------------------------------------------------------------------
+
+
 //==============================================================================
 // Initialization of the code
 //
@@ -253,8 +919,54 @@ void setup() {
 
   //Initialize the objects
   communicate.begin();
+  timeCounter.setResyncInterval(RTC_RESYNC_INTERVAL);
+#if RTC_SQW_PIN
+  timeCounter.setSquareWave(RTC_SQW_PIN);
+#endif
   timeCounter.begin();
-  measure.begin(SAMPLES_PER_WINDOW, NUM_WINDOWS);
+  measure.setKernel(ACCUMULATION_KERNEL);
+  measure.setCyclesPerWindow(CYCLES_PER_WINDOW);
+#if DUAL_RANGE_CURRENT
+  measure.setDualRange();
+#endif
+#if TIMING_STATS
+  measure.setStats(&phaseStats);
+  fileSystem.setStats(&phaseStats);
+#endif
+#if HARMONIC_ANALYSIS
+  measure.setHarmonics(&harmonics);
+  fileSystem.setHarmonicColumns(true);
+#endif
+#if POWER_EVENTS
+  powerEvents.setNominalVoltage(NOMINAL_VOLTAGE);
+  powerEvents.setInrushCurrent(INRUSH_CURRENT);
+  measure.setEvents(&powerEvents);
+#endif
+#if PHASES > 1
+  phaseSet.addPhase(&measure);
+  phaseSet.addPhase(&phase2);
+#if PHASES > 2
+  phaseSet.addPhase(&phase3);
+#endif
+  for (uint8_t phase = 1; phase < PHASES; ++phase) {
+    phaseSet.getPhase(phase)->setKernel(ACCUMULATION_KERNEL);
+    phaseSet.getPhase(phase)->setCyclesPerWindow(CYCLES_PER_WINDOW);
+  }
+  phaseSet.setSampleBuffer(&sampleBuffer);
+#if WAVEFORM_STREAM
+  phaseSet.setStream(&waveformStream);
+#endif
+  phaseSet.begin(SAMPLES_PER_WINDOW, NUM_WINDOWS, SAMPLE_PAIR_RATE);
+  fileSystem.setPhaseColumns(PHASES);
+#else
+#if SAMPLE_PAIR_RATE
+  measure.setSampleBuffer(&sampleBuffer);
+#endif
+#if WAVEFORM_STREAM
+  measure.setStream(&waveformStream);
+#endif
+  measure.begin(SAMPLES_PER_WINDOW, NUM_WINDOWS, SAMPLE_PAIR_RATE);
+#endif
   led.begin(true);
 
   communicate.isDeviceConnected();
@@ -263,6 +975,11 @@ void setup() {
   if (!fileSystem.begin()) {
     haltOnError(F("File System initialization failed!"));
   }
+  fileSystem.setPersistentLog(PERSISTENT_LOG, 0); // Interval sync by flushTask
+  fileSystem.setLogFormat(LOG_FORMAT);
+#if PREALLOCATE_LOG
+  fileSystem.setPreallocation(READINGS_PER_DAY);
+#endif
 
   // Define the actual dateTime and filename
   resetFileName();
@@ -274,27 +991,38 @@ void setup() {
     communicate.clearSerialBuffer();
     configureDirectory();
   }
+#if ENERGY_SUMMARY
+  // The summary goes on from the records of the present hour and day
+  timeCounter.updateDateTime();
+  fileSystem.restoreSummary(SUMMARY_NAME_FORMAT, &energySummary, timeCounter.getUnixTime());
+#endif
 
   cout << F("Setup complete...\n") << endl;
   communicate.clearSerialBuffer();
   communicate.bluetoothListen();
   led.setOff();
+
+  scheduler.addTask(measureTask, TASK_POLLED, MEASURE_PRIORITY, MEASURE_DEADLINE);
+  clockTaskId = scheduler.addTask(clockTask, CLOCK_UPDATE_PERIOD, 1, CLOCK_UPDATE_PERIOD);
+  recordTaskId = scheduler.addTask(recordTask, TASK_TRIGGERED, 2, RECORD_DEADLINE);
+  scheduler.addTask(flushTask, LOG_SYNC_INTERVAL, 3, FLUSH_DEADLINE);
+  scheduler.addTask(ledTask, LED_STATUS_PERIOD, 4);
+  scheduler.addTask(requestTask, TASK_POLLED, 5);
+#if POWER_EVENTS
+  scheduler.addTask(eventTask, TASK_POLLED, 6);
+#endif
+#if TIMING_STATS && STATS_LOG_PERIOD
+  scheduler.addTask(statsTask, STATS_LOG_PERIOD, 7);
+#endif
 }
 //------------------------------------------------------------------------------
 
 
 //==============================================================================
-// Reading and continuos recording of measures
+// Reading and continuos recording of measures, run by the scheduler
+// With continuous acquisition, sampling goes on while values are recorded
 //
 void loop() {
-  measure.acquireAndCalculate();
-  updateDateTimeAndFileName();
-  printAverageValues();
-
-  if (!fileSystem.recordValues(fileName, &measure)) {
-    haltOnError(F("Could not open/create file to write!"));
-  }
-
-  checkAndTransmitData();
+  scheduler.run();
 }
 //------------------------------------------------------------------------------
\ No newline at end of file
@@ -0,0 +1,114 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+/*----------------------------------------------------------------------------
+ *  Host replacement of the Arduino core
+ *  Only the subset used by the project classes is provided
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+// Arduino UNO clock, for cycle counts computed from micros()
+#define F_CPU 16000000UL
+
+// Arduino UNO pin numbering
+#define LED_BUILTIN 13
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define NUM_DIGITAL_PINS 20
+
+// Analog pins past A5, as on the Mega (phase sets), numbered after A5
+#define A6  20
+#define A7  21
+#define A8  22
+#define A9  23
+#define A10 24
+#define A11 25
+
+// Flash strings live in RAM on the host
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+#define PSTR(string_literal) (string_literal)
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#define pgm_read_float(address) (*(const float*)(address))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();  // Runs the emulated interrupts (soft serial, ADC, RTC SQW)
+
+// Emulated interrupts run inside yield(), never in the middle of the code
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+void serialEvent();
+
+
+/*----------------------------------------------------------------------------
+ *  Class Print / Stream
+ *  Byte oriented output and input
+ */
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while (size-- && write(*buffer++)) {
+        ++n;
+      }
+      return n;
+    }
+    size_t write(const char* str) { return write(reinterpret_cast<const uint8_t*>(str), strlen(str)); }
+    size_t print(const char* str) { return write(str); }
+    size_t print(const __FlashStringHelper* str) { return write(reinterpret_cast<const char*>(str)); }
+    size_t print(char value) { return write(uint8_t(value)); }
+    size_t println(const char* str) { return write(str) + write('\n'); }
+    size_t println(const __FlashStringHelper* str) { return print(str) + write('\n'); }
+    virtual int availableForWrite() { return 0; } // Unknown
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+#include "HostSerial.h"
+
+
+#endif // _HOST_ARDUINO_H_
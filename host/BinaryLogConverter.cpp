@@ -0,0 +1,77 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Binary log converter
+ *  Converts day files written with LOG_FORMAT_BINARY back to the CSV layout
+ *  of DATA_HEADER, with one header line for all the files given
+ *
+ *  Usage: medicao-bin2csv file.bin [file.bin ...] > readings.csv
+ */
+
+#include "../FileSystem.h"
+#include "../TimeCounter.h"
+#include "../BinaryLog.h"
+
+
+static bool convertFile(const char* path, FILE* out) {
+
+  FILE* in = fopen(path, "rb");
+  if (!in) {
+    fprintf(stderr, "%s: could not open\n", path);
+    return false;
+  }
+
+  uint8_t buffer[256];
+  BinaryLogScales scales;
+  if (fread(buffer, 1, BINARY_LOG_HEADER_SIZE, in) != BINARY_LOG_HEADER_SIZE || !BinaryLog::decodeHeader(buffer, &scales)) {
+    fprintf(stderr, "%s: not a binary log of version %d\n", path, BINARY_LOG_VERSION);
+    fclose(in);
+    return false;
+  }
+
+  // Newer headers and records may be longer: skip the fields not known here
+  fseek(in, scales.headerSize, SEEK_SET);
+
+  uint32_t records = 0;
+  while (fread(buffer, 1, scales.recordSize, in) == scales.recordSize) {
+    BinaryLogRecord record;
+    BinaryLog::decodeRecord(buffer, &scales, &record);
+
+    HalDateTime dt(record.timestamp);
+    char date[11], time[9];
+    snprintf(date, sizeof(date), DATE_FORMAT, int(dt.day()), int(dt.month()), int(dt.year()));
+    snprintf(time, sizeof(time), HOUR_FORMAT, int(dt.hour()), int(dt.minute()), int(dt.second()));
+
+    fprintf(out, "%s" COMMA "%s" COMMA "%.4f" COMMA "%.4f" COMMA "%.4f" COMMA "%.4f" COMMA "%.4f" COMMA "%.4f" COMMA "%.4f\n",
+            date, time, record.current, record.voltage, record.realPower, record.apparentPower,
+            record.powerFactor, record.windowTime, record.lineFrequency);
+    ++records;
+  }
+
+  // A record cut by a power loss is left out
+  if (!feof(in) || ftell(in) != long(scales.headerSize + records * scales.recordSize)) {
+    fprintf(stderr, "%s: incomplete record at the end ignored\n", path);
+  }
+  fclose(in);
+  return true;
+}
+
+
+int main(int argc, char** argv) {
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s file.bin [file.bin ...] > readings.csv\n", argv[0]);
+    return 2;
+  }
+
+  printf("%s\n", DATA_HEADER);
+  int status = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (!convertFile(argv[i], stdout)) {
+      status = 1;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,190 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Compressed transfer benchmark
+ *  Sends a day file with the plain transfer (option F) and the compressed
+ *  one (option X), step by step as the sketch does, then decodes the
+ *  compressed stream and checks it against the plain one. Prints the bytes,
+ *  steps and the time of each at the line rate
+ *
+ *  Usage: medicao-bench-delta [-s sdRoot] [-b] [-r baudRate] file
+ *         -b: the file is a binary log
+ *
+ *  The transfers go over the bluetooth port, TRANSFER_STEP_SIZE bytes per
+ *  step. The line time counts 10 bits per byte: the transfer steps are
+ *  polled, so a transfer of the board goes as fast as its serial line
+ */
+
+#include <unistd.h>
+
+#include "../FileSystem.h"
+#include "../Communicate.h"
+#include "../TimeCounter.h"
+
+#define BENCH_STATE_PIN 5  // Bluetooth state, driven high
+
+TimeCounter timeCounter;
+
+
+/*----------------------------------------------------------------------------
+ *  Class BufferPrint
+ *  Print to memory
+ */
+class BufferPrint : public Print {
+
+  public:
+    BufferPrint() { data = NULL; size = 0; capacity = 0; }
+    ~BufferPrint() { free(data); }
+    size_t write(uint8_t value) {
+      if (size == capacity) {
+        capacity = capacity ? 2 * capacity : 4096;
+        data = (uint8_t*)realloc(data, capacity);
+      }
+      data[size++] = value;
+      return 1;
+    }
+    using Print::write;
+
+    uint8_t* data;
+    size_t size, capacity;
+};
+
+
+// Transfer to an output file, as the bluetooth device -- Return the transfer
+// is done
+static bool runTransfer(FileSystem* fileSystem, char* fileName, const char* outputPath, bool compressed,
+                        uint32_t* steps, uint32_t* elapsed) {
+
+  ArduinoOutStream cout(Serial);
+  setenv(HOST_BLUETOOTH_ENV, outputPath, 1);
+  Communicate communicate(BENCH_STATE_PIN, 0, 0, &cout);
+  communicate.begin();
+  digitalWrite(BENCH_STATE_PIN, HIGH);
+  if (!communicate.isDeviceConnected()) {
+    return false;
+  }
+
+  DeltaLog deltaLog;
+  uint32_t startMicros = micros();
+  if (!(compressed ? fileSystem->beginDeltaTransfer(fileName, &deltaLog) : fileSystem->beginTransfer(fileName, &cout))) {
+    return false;
+  }
+  uint8_t status;
+  *steps = 0;
+  do {
+    status = fileSystem->continueTransfer(&communicate);
+    ++*steps;
+  } while (status == TRANSFER_ACTIVE);
+  *elapsed = micros() - startMicros;
+  return (status == TRANSFER_DONE);
+}
+
+// Whole file in memory -- Return NULL if it can not be read
+static uint8_t* readFile(const char* path, size_t* size) {
+
+  FILE* in = fopen(path, "rb");
+  if (!in) {
+    return NULL;
+  }
+  fseek(in, 0, SEEK_END);
+  *size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  uint8_t* data = (uint8_t*)malloc(*size + 1);
+  if (data && fread(data, 1, *size, in) != *size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(in);
+  return data;
+}
+
+// The compressed stream decoded as the plain transfer sends it
+static bool decodeStream(const uint8_t* data, size_t size, BufferPrint* output) {
+
+  DeltaLog deltaLog;
+  if (size < DELTA_LOG_HEADER_SIZE || !deltaLog.decodeHeader(data)) {
+    return false;
+  }
+  size_t used = DELTA_LOG_HEADER_SIZE;
+  if (deltaLog.getFormat() == LOG_FORMAT_BINARY && used < size && data[used] != DELTA_TAG_END) {
+    output->write(data + used, BINARY_LOG_HEADER_SIZE);
+    used += BINARY_LOG_HEADER_SIZE;
+  }
+  uint16_t count;
+  while (used < size && (count = deltaLog.decodeRow(data + used, (size - used > 0xFFFF) ? 0xFFFF : uint16_t(size - used), output)) > 0) {
+    used += count;
+  }
+  return (used == size - 1 && data[used] == DELTA_TAG_END);
+}
+
+
+int main(int argc, char** argv) {
+
+  const char* sdRoot = NULL;
+  uint8_t logFormat = LOG_FORMAT_CSV;
+  uint32_t baudRate = 9600;
+
+  int option;
+  while ((option = getopt(argc, argv, "s:br:")) != -1) {
+    switch (option) {
+      case 's': sdRoot = optarg; break;
+      case 'b': logFormat = LOG_FORMAT_BINARY; break;
+      case 'r': baudRate = strtoul(optarg, NULL, 10); break;
+      default:
+        optind = argc;
+    }
+  }
+  if (optind != argc - 1 || baudRate == 0) {
+    fprintf(stderr, "Usage: %s [-s sdRoot] [-b] [-r baudRate] file\n", argv[0]);
+    return 2;
+  }
+  if (sdRoot) {
+    setenv(HOST_SD_ROOT_ENV, sdRoot, 1);
+  }
+
+  FileSystem fileSystem;
+  fileSystem.setLogFormat(logFormat);
+  timeCounter.begin();
+  if (!fileSystem.begin()) {
+    fprintf(stderr, "File System initialization failed!\n");
+    return 1;
+  }
+
+  char plainPath[] = "/tmp/medicao-bench-plainXXXXXX";
+  char deltaPath[] = "/tmp/medicao-bench-deltaXXXXXX";
+  close(mkstemp(plainPath));
+  close(mkstemp(deltaPath));
+
+  uint32_t plainSteps, deltaSteps, plainMicros, deltaMicros;
+  bool done = runTransfer(&fileSystem, argv[optind], plainPath, false, &plainSteps, &plainMicros) &&
+              runTransfer(&fileSystem, argv[optind], deltaPath, true, &deltaSteps, &deltaMicros);
+  size_t plainSize = 0, deltaSize = 0;
+  uint8_t* plain = readFile(plainPath, &plainSize);
+  uint8_t* delta = readFile(deltaPath, &deltaSize);
+  unlink(plainPath);
+  unlink(deltaPath);
+  if (!done || !plain || !delta) {
+    fprintf(stderr, "%s: transfer failed\n", argv[optind]);
+    return 1;
+  }
+  // A binary record cut by a reset is not in the compressed stream
+  size_t expected = plainSize;
+  if (logFormat == LOG_FORMAT_BINARY && plainSize > BINARY_LOG_HEADER_SIZE) {
+    expected -= (plainSize - BINARY_LOG_HEADER_SIZE) % BINARY_LOG_RECORD_SIZE;
+  }
+  BufferPrint decoded;
+  bool same = decodeStream(delta, deltaSize, &decoded) &&
+              decoded.size == expected && memcmp(decoded.data, plain, expected) == 0;
+  free(plain);
+  free(delta);
+
+  printf("transfer        bytes    steps  host(ms)  line(s) @%lu\n", (unsigned long)baudRate);
+  printf("plain    %12lu %8lu %9.1f %8.1f\n", (unsigned long)plainSize, (unsigned long)plainSteps,
+         plainMicros / 1000.0, 10.0 * plainSize / baudRate);
+  printf("delta    %12lu %8lu %9.1f %8.1f\n", (unsigned long)deltaSize, (unsigned long)deltaSteps,
+         deltaMicros / 1000.0, 10.0 * deltaSize / baudRate);
+  printf("ratio    %12.2f  decoded %s\n", double(plainSize) / deltaSize, same ? "identical" : "DIFFERENT");
+  return same ? 0 : 1;
+}
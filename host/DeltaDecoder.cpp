@@ -0,0 +1,126 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Compressed transfer decoder
+ *  Decodes the stream of the 'X' command of the sketch (see DeltaLog.h)
+ *  back to the day file as sent by the plain transfer: the CSV header and
+ *  rows, or the binary header and records. The device output before the
+ *  stream header (prompts) is skipped
+ *
+ *  Usage: medicao-undelta [-o output] [capture]
+ *         capture and output default to stdin and stdout
+ */
+
+#include <unistd.h>
+
+#include "../DeltaLog.h"
+#include "../FileSystem.h"
+
+
+/*----------------------------------------------------------------------------
+ *  Class FilePrint
+ *  Print to a stdio file
+ */
+class FilePrint : public Print {
+
+  public:
+    explicit FilePrint(FILE* file) { out = file; }
+    size_t write(uint8_t value) { return (fputc(value, out) == EOF) ? 0 : 1; }
+    size_t write(const uint8_t* buffer, size_t size) { return fwrite(buffer, 1, size, out); }
+    using Print::write;
+
+  private:
+    FILE* out;
+};
+
+
+// Whole capture in memory -- Return its size, data NULL on failure
+static uint8_t* readCapture(FILE* in, size_t* size) {
+
+  size_t capacity = 1 << 16;
+  uint8_t* data = (uint8_t*)malloc(capacity);
+  *size = 0;
+  size_t count;
+  while (data && (count = fread(data + *size, 1, capacity - *size, in)) > 0) {
+    *size += count;
+    if (*size == capacity) {
+      capacity *= 2;
+      data = (uint8_t*)realloc(data, capacity);
+    }
+  }
+  return data;
+}
+
+
+int main(int argc, char** argv) {
+
+  const char* outputPath = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "o:")) != -1) {
+    switch (option) {
+      case 'o': outputPath = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-o output] [capture]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  FILE* in = (optind < argc) ? fopen(argv[optind], "rb") : stdin;
+  if (!in) {
+    fprintf(stderr, "%s: could not open\n", argv[optind]);
+    return 1;
+  }
+  size_t size;
+  uint8_t* data = readCapture(in, &size);
+  if (in != stdin) {
+    fclose(in);
+  }
+
+  // Stream header, after whatever the device printed before it
+  DeltaLog deltaLog;
+  size_t used = 0;
+  while (used + DELTA_LOG_HEADER_SIZE <= size && !deltaLog.decodeHeader(data + used)) {
+    ++used;
+  }
+  if (!data || used + DELTA_LOG_HEADER_SIZE > size) {
+    fprintf(stderr, "No stream of version %d found\n", DELTA_LOG_VERSION);
+    return 1;
+  }
+  used += DELTA_LOG_HEADER_SIZE;
+
+  FILE* out = outputPath ? fopen(outputPath, "wb") : stdout;
+  if (!out) {
+    fprintf(stderr, "%s: could not create\n", outputPath);
+    return 1;
+  }
+  FilePrint output(out);
+
+  // The binary header goes as it is, unless the file had none
+  if (deltaLog.getFormat() == LOG_FORMAT_BINARY && used < size && data[used] != DELTA_TAG_END) {
+    if (used + BINARY_LOG_HEADER_SIZE > size) {
+      fprintf(stderr, "Stream cut in the binary header\n");
+      return 1;
+    }
+    output.write(data + used, BINARY_LOG_HEADER_SIZE);
+    used += BINARY_LOG_HEADER_SIZE;
+  }
+
+  uint32_t rows = 0;
+  uint16_t count;
+  while ((count = deltaLog.decodeRow(data + used, (size - used > 0xFFFF) ? 0xFFFF : uint16_t(size - used), &output)) > 0) {
+    used += count;
+    ++rows;
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  bool ended = (used < size && data[used] == DELTA_TAG_END);
+  fprintf(stderr, "%u rows, %lu bytes of stream%s\n", rows, (unsigned long)(used + (ended ? 1 : 0)),
+          ended ? "" : " (cut, no end tag)");
+  free(data);
+  return ended ? 0 : 1;
+}
@@ -0,0 +1,241 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  CSV row formatting benchmark
+ *  Formats the same rows with the float stream output (as the records were
+ *  written before) and with FixedFormat into a RowBuffer, and compares the
+ *  time per row. The text must be the stream's byte for byte: for the rows,
+ *  for NaN, infinities and limits, and for random floats of every magnitude
+ *  with every number of decimals
+ *
+ *  Usage: medicao-bench-format [-n rows] [-v values] [-x] [-d decimals]
+ *    -x: check every float from 0 to 4E9 (about 1.1 billion) with -d decimals
+ *
+ *  The host has a float unit, so the gain shown is a lower bound: on the
+ *  board each digit of the stream costs a soft float multiply and subtract.
+ *  There, the format phase of the TIMING_STATS table shows the time per row
+ */
+
+#include <math.h>
+#include <unistd.h>
+#include <string>
+
+#include "../FixedFormat.h"
+#include "../FileSystem.h"
+
+
+#define ROW_VALUES 7
+#define DATE_TEXT  "16/10/2026"
+#define TIME_TEXT  "22:54:51"
+
+// Output kept in memory, or only counted
+class TextSink : public Print {
+  public:
+    TextSink(bool keep) { this->keep = keep; count = 0; }
+    size_t write(uint8_t value) {
+      if (keep) {
+        text += char(value);
+      }
+      ++count;
+      return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) {
+      if (keep) {
+        text.append(reinterpret_cast<const char*>(buffer), size);
+      }
+      count += size;
+      return size;
+    }
+    std::string text;
+    uint64_t count;
+    bool keep;
+};
+
+static uint32_t randomState = 12345;
+
+static uint32_t nextRandom() {
+  randomState = randomState * 1664525UL + 1013904223UL;
+  return randomState;
+}
+
+static float randomValue(float low, float high) {
+  return low + (high - low) * float(nextRandom() >> 8) / 16777216.0f;
+}
+
+// Readings in the ranges of the meter, in the DATA_HEADER order
+static void randomRow(float* values) {
+  values[0] = randomValue(0, 20);
+  values[1] = randomValue(100, 140);
+  values[2] = randomValue(-100, 2800);
+  values[3] = randomValue(0, 2800);
+  values[4] = randomValue(-1, 1);
+  values[5] = randomValue(1.2, 1.3);
+  values[6] = randomValue(59.9, 60.1);
+}
+
+static void streamRow(Print* output, const float* values) {
+  ArduinoOutStream stream(*output);
+  stream << DATE_TEXT << COMMA << TIME_TEXT << COMMA << setprecision(CSV_DECIMALS);
+  for (uint8_t i = 0; i < ROW_VALUES; ++i) {
+    stream << values[i] << (i + 1 < ROW_VALUES ? COMMA : "");
+  }
+  stream << endl;
+}
+
+static void bufferRow(Print* output, const float* values) {
+  char buffer[CSV_ROW_SIZE];
+  RowBuffer row(output, buffer, sizeof(buffer));
+  row.add(DATE_TEXT);
+  row.add(COMMA);
+  row.add(TIME_TEXT);
+  row.add(COMMA);
+  for (uint8_t i = 0; i < ROW_VALUES; ++i) {
+    row.addNumber(values[i], CSV_DECIMALS);
+    if (i + 1 < ROW_VALUES) {
+      row.add(COMMA);
+    }
+  }
+  row.add('\n');
+  row.flush();
+}
+
+// FixedFormat against the stream -- Return they are the same
+static bool sameText(float value, uint8_t decimals) {
+
+  TextSink sink(true);
+  ArduinoOutStream stream(sink);
+  char text[FIXED_TEXT_SIZE];
+
+  stream << setprecision(decimals) << value;
+  FixedFormat::format(text, value, decimals);
+  if (sink.text != text) {
+    printf("MISMATCH %.9g with %u decimals: stream '%s', fixed '%s'\n", value, decimals, sink.text.c_str(), text);
+    return false;
+  }
+  return true;
+}
+
+// Values the bit decoding must not reach, limits and carries
+static uint32_t checkSpecialValues() {
+
+  static const float values[] = {
+    NAN, -NAN, INFINITY, -INFINITY, 0.0f, -0.0f, 4.0E9f, -4.0E9f, 4.0000005E9f, 0.5f, 0.99999994f,
+    9.99995f, 9.999995f, 0.00005f, 1.0E-45f, 16777215.0f, 16777216.5f, 2147483648.0f, 0.0f / 0.0f
+  };
+  uint32_t mismatches = 0;
+  for (uint8_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    for (uint8_t decimals = 0; decimals <= FIXED_MAX_DECIMALS; ++decimals) {
+      if (!sameText(values[i], decimals)) {
+        ++mismatches;
+      }
+    }
+  }
+  return mismatches;
+}
+
+static uint32_t checkRandomValues(uint32_t values) {
+
+  uint32_t mismatches = 0;
+  for (uint32_t i = 0; i < values; ++i) {
+    // Any sign, mantissa and exponent up to 2^33 (past "BIG FLT")
+    uint32_t bits = nextRandom();
+    bits = (bits & 0x807FFFFFUL) | (uint32_t(nextRandom() % 161) << 23);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    for (uint8_t decimals = 0; decimals <= FIXED_MAX_DECIMALS; ++decimals) {
+      if (!sameText(value, decimals) && ++mismatches > 10) {
+        return mismatches;
+      }
+    }
+  }
+  return mismatches;
+}
+
+static uint32_t checkAllValues(uint8_t decimals) {
+
+  uint32_t mismatches = 0;
+  for (uint32_t bits = 0; ; ++bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    if (value > 4.0E9) {
+      break;
+    }
+    if (!sameText(value, decimals) && ++mismatches > 10) {
+      break;
+    }
+  }
+  return mismatches;
+}
+
+
+int main(int argc, char** argv) {
+
+  uint32_t rows = 200000;
+  uint32_t values = 200000;
+  bool allValues = false;
+  uint8_t decimals = CSV_DECIMALS;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:v:xd:")) != -1) {
+    switch (option) {
+      case 'n': rows = strtoul(optarg, NULL, 10); break;
+      case 'v': values = strtoul(optarg, NULL, 10); break;
+      case 'x': allValues = true; break;
+      case 'd': decimals = strtoul(optarg, NULL, 10); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n rows] [-v values] [-x] [-d decimals]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (rows == 0 || decimals > FIXED_MAX_DECIMALS) {
+    fprintf(stderr, "Rows must be positive and decimals at most %u\n", FIXED_MAX_DECIMALS);
+    return 2;
+  }
+
+  // Same rows, byte by byte
+  float (*table)[ROW_VALUES] = new float[rows][ROW_VALUES];
+  for (uint32_t i = 0; i < rows; ++i) {
+    randomRow(table[i]);
+  }
+  TextSink streamText(true), bufferText(true);
+  for (uint32_t i = 0; i < rows && i < 1000; ++i) {
+    streamRow(&streamText, table[i]);
+    bufferRow(&bufferText, table[i]);
+  }
+  bool sameRows = streamText.text == bufferText.text;
+
+  // Time per row, output only counted
+  TextSink streamSink(false), bufferSink(false);
+  uint32_t startMicros = micros();
+  for (uint32_t i = 0; i < rows; ++i) {
+    streamRow(&streamSink, table[i]);
+  }
+  uint32_t streamMicros = micros() - startMicros;
+  startMicros = micros();
+  for (uint32_t i = 0; i < rows; ++i) {
+    bufferRow(&bufferSink, table[i]);
+  }
+  uint32_t bufferMicros = micros() - startMicros;
+  delete[] table;
+
+  printf("row: %s", bufferText.text.substr(0, bufferText.text.find('\n') + 1).c_str());
+  printf("stream     %9.1f ns/row, %llu bytes\n", 1000.0 * streamMicros / rows, (unsigned long long)streamSink.count);
+  printf("row buffer %9.1f ns/row, %llu bytes (%.1fx)\n", 1000.0 * bufferMicros / rows, (unsigned long long)bufferSink.count,
+         bufferMicros ? double(streamMicros) / bufferMicros : 0);
+  printf("rows %s\n", sameRows ? "identical" : "DIFFER");
+
+  uint32_t mismatches = checkSpecialValues();
+  printf("special values: %u mismatches\n", mismatches);
+  uint32_t randomMismatches = checkRandomValues(values);
+  printf("%u random values, 0 to %u decimals: %u mismatches\n", values, FIXED_MAX_DECIMALS, randomMismatches);
+  mismatches += randomMismatches;
+  if (allValues) {
+    uint32_t allMismatches = checkAllValues(decimals);
+    printf("every float up to 4E9, %u decimals: %u mismatches\n", decimals, allMismatches);
+    mismatches += allMismatches;
+  }
+
+  return (sameRows && mismatches == 0) ? 0 : 1;
+}
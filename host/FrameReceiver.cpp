@@ -0,0 +1,196 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Framed file receiver
+ *  Requests a file with the 'B' command of the sketch and writes it to a
+ *  local file. An existing local file is resumed from its size, so a
+ *  dropped link only costs the frames not yet received
+ *
+ *  Usage: medicao-receive -p device [-o output] [-f] file
+ *         file '.' is the active file of the device, -f restarts from zero
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../FrameLink.h"
+
+#define RECEIVE_TIMEOUT 5000  // ms without any byte from the device
+#define REQUEST_TIMEOUT 1000  // ms for the device to answer the command
+#define REQUEST_RETRIES 5
+
+
+static HostSerialPort port(NULL);
+
+
+// Next byte from the device, or -1 after the timeout
+static int readByte(uint32_t timeout) {
+  uint32_t startTime = millis();
+  while (!port.available()) {
+    if (millis() - startTime >= timeout) {
+      return -1;
+    }
+    delayMicroseconds(200);
+  }
+  return port.read();
+}
+
+// Skip the device output up to a prompt -- Return prompt seen
+static bool waitFor(const char* text, uint32_t timeout=RECEIVE_TIMEOUT) {
+  size_t matched = 0;
+  while (text[matched]) {
+    int value = readByte(timeout);
+    if (value < 0) {
+      return false;
+    }
+    matched = (value == text[matched]) ? matched + 1 : (value == text[0] ? 1 : 0);
+  }
+  return true;
+}
+
+static void sendLine(const char* text) {
+  port.write(text);
+  port.write('\n');
+}
+
+
+int main(int argc, char** argv) {
+
+  const char* device = NULL;
+  const char* outputPath = NULL;
+  bool restart = false;
+
+  int option;
+  while ((option = getopt(argc, argv, "p:o:f")) != -1) {
+    switch (option) {
+      case 'p': device = optarg; break;
+      case 'o': outputPath = optarg; break;
+      case 'f': restart = true; break;
+      default: device = NULL; optind = argc + 1; break;
+    }
+  }
+  if (!device || optind != argc - 1) {
+    fprintf(stderr, "Usage: %s -p device [-o output] [-f] file\n", argv[0]);
+    return 2;
+  }
+  const char* fileName = argv[optind];
+  if (!outputPath) {
+    outputPath = strcmp(fileName, ".") ? fileName : "active.dat";
+  }
+
+  if (!port.open(device)) {
+    fprintf(stderr, "Could not open '%s'\n", device);
+    return 1;
+  }
+  FILE* output = fopen(outputPath, restart ? "wb" : "ab");
+  if (!output) {
+    fprintf(stderr, "Could not open '%s'\n", outputPath);
+    return 1;
+  }
+  fseek(output, 0, SEEK_END);
+  uint32_t offset = ftell(output);
+  uint32_t startOffset = offset;
+
+  // Request: command, file name and offset, each after its prompt
+  char offsetText[12];
+  snprintf(offsetText, sizeof(offsetText), "%u", offset);
+  // The command is lost if the device is busy or still starting: repeat it
+  bool answered = false;
+  for (uint8_t retry = 0; retry < REQUEST_RETRIES && !answered; ++retry) {
+    port.write('B');
+    answered = waitFor("File: ", REQUEST_TIMEOUT);
+  }
+  if (!answered || (sendLine(fileName), !waitFor("Offset: "))) {
+    fprintf(stderr, "Device did not answer the request\n");
+    return 1;
+  }
+  sendLine(offsetText);
+
+  FrameLink link(&port);
+  uint8_t frame[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + 2];
+  uint16_t expected = 0;
+  bool nacked = false, complete = false;
+  uint32_t startTime = millis(), badFrames = 0;
+
+  for (;;) {
+    int value = readByte(RECEIVE_TIMEOUT);
+    if (value < 0) {
+      break;
+    }
+    if (value != FRAME_START) {
+      continue;
+    }
+
+    // Header, then payload and CRC
+    frame[0] = uint8_t(value);
+    bool timedOut = false;
+    for (uint16_t i = 1; i < FRAME_HEADER_SIZE && !timedOut; ++i) {
+      value = readByte(RECEIVE_TIMEOUT);
+      frame[i] = uint8_t(value);
+      timedOut = (value < 0);
+    }
+    uint16_t length = frame[8] | (uint16_t(frame[9]) << 8);
+    if (timedOut || length > FRAME_MAX_PAYLOAD) {
+      continue;
+    }
+    for (uint16_t i = 0; i < length + 2 && !timedOut; ++i) {
+      value = readByte(RECEIVE_TIMEOUT);
+      frame[FRAME_HEADER_SIZE + i] = uint8_t(value);
+      timedOut = (value < 0);
+    }
+    if (timedOut) {
+      break;
+    }
+
+    uint8_t type = frame[1];
+    uint16_t sequence = frame[2] | (uint16_t(frame[3]) << 8);
+    uint32_t frameOffset = frame[4] | (uint32_t(frame[5]) << 8) | (uint32_t(frame[6]) << 16) | (uint32_t(frame[7]) << 24);
+    uint16_t checksum = frame[FRAME_HEADER_SIZE + length] | (uint16_t(frame[FRAME_HEADER_SIZE + length + 1]) << 8);
+
+    // Damaged or out of order: ask once for the expected frame, the device
+    // resends from there and the frames already in flight are dropped
+    bool valid = (FrameLink::crc16(0xFFFF, frame + 1, FRAME_HEADER_SIZE - 1 + length) == checksum);
+    if (!valid) {
+      ++badFrames;
+    }
+    if (!valid || (type == FRAME_DATA && sequence != expected)) {
+      if (valid && type == FRAME_DATA && uint16_t(expected - sequence) < 0x8000) {
+        link.sendReply(FRAME_ACK, expected - 1);  // Resent duplicate
+      }
+      else if (!nacked) {
+        link.sendReply(FRAME_NACK, expected);
+        nacked = true;
+      }
+      continue;
+    }
+
+    if (type == FRAME_ERROR) {
+      fprintf(stderr, "Device could not send '%s' from offset %u\n", fileName, frameOffset);
+      return 1;
+    }
+    if (type == FRAME_END) {
+      complete = (frameOffset == offset);
+      break;
+    }
+    if (type == FRAME_DATA && frameOffset == offset) {
+      fwrite(frame + FRAME_HEADER_SIZE, 1, length, output);
+      offset += length;
+      link.sendReply(FRAME_ACK, expected++);
+      nacked = false;
+    }
+  }
+  fclose(output);
+
+  waitFor("END");
+  float seconds = (millis() - startTime) / 1000.0;
+  fprintf(stderr, "%s: %u bytes received (%u to %u), %u bad frames, %.1f s, %.0f bytes/s\n",
+          outputPath, offset - startOffset, startOffset, offset, badFrames, seconds,
+          seconds > 0 ? (offset - startOffset) / seconds : 0);
+  if (!complete) {
+    fprintf(stderr, "Transfer interrupted: run again to resume from offset %u\n", offset);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,27 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HAL_HOST_H_
+#define _HAL_HOST_H_
+
+#include "Arduino.h"
+#include "HostADC.h"
+#include "HostRTC.h"
+#include "HostSerial.h"
+#include "HostStorage.h"
+#include "HostStream.h"
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalClock
+ *  Monotonic host clock, counted from program start
+ */
+class HalClock {
+  public:
+    static uint32_t millis() { return ::millis(); }
+    static uint32_t micros() { return ::micros(); }
+    static void delay(uint32_t ms) { ::delay(ms); }
+};
+
+
+#endif // _HAL_HOST_H_
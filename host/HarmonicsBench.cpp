@@ -0,0 +1,149 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Harmonic analysis benchmark
+ *  Runs Measure with and without the harmonic engine over a distorted load
+ *  and compares the accumulation time per sample pair with the sampling
+ *  budget, and the orders found with the ones synthesized
+ *
+ *  Usage: medicao-bench-harmonics [-n readings] [-r pairRate] [-c cyclesPerWindow]
+ *
+ *  Host times only show the relative cost: on the board, the kernel time with
+ *  the engine is printed by the monitoring output ('M') of the sketch
+ */
+
+#include <unistd.h>
+
+#include "../Measure.h"
+
+
+#define SAMPLES_PER_WINDOW 5000
+#define NUM_WINDOWS        5
+
+#define STANDARD_CURRENT_PIN    A0
+#define AMPLIFIED_CURRENT_PIN   A1
+#define VOLTAGE_PIN             A2
+#define SENSOR_SENSIBILITY      0.100
+#define VOLTAGE_MEASURING_RATIO 5.0/680
+#define MAX_CURRENT_VALUE       20
+#define CURRENT_GAIN            10
+
+// Distorted load: orders as a fraction of the fundamental
+#define VOLTAGE_RMS 127.0
+#define CURRENT_RMS 5.0
+
+struct Order {
+  uint8_t order;
+  float voltage, current;
+};
+
+static const Order ORDERS[] = {
+  { 3, 0.030, 0.300 },
+  { 5, 0.020, 0.150 },
+  { 7, 0.000, 0.050 },
+  { 9, 0.000, 0.030 },
+};
+static const uint8_t NUM_ORDERS = sizeof(ORDERS) / sizeof(ORDERS[0]);
+
+
+static double runMeasure(Harmonics* harmonics, uint16_t pairRate, uint8_t cyclesPerWindow, uint32_t readings) {
+
+  SampleBuffer sampleBuffer;
+  Measure measure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+  uint64_t kernelMicros = 0;
+
+  measure.setKernel(KERNEL_INTEGER);
+  measure.setSampleBuffer(&sampleBuffer);
+  measure.setCyclesPerWindow(cyclesPerWindow);
+  measure.setHarmonics(harmonics);
+  measure.begin(SAMPLES_PER_WINDOW, NUM_WINDOWS, pairRate);
+
+  uint32_t firstConversion = HalADC::getConversionCount();
+  for (uint32_t reading = 0; reading < readings; ++reading) {
+    measure.acquireAndCalculate();
+    kernelMicros += measure.getKernelMicros();
+  }
+  HalADC::stopContinuous();
+
+  uint32_t pairs = (HalADC::getConversionCount() - firstConversion) / 2;
+  return pairs ? 1000.0 * kernelMicros / pairs : 0;
+}
+
+
+static float expectedTHD(bool current) {
+  float sumSqr = 0;
+  for (uint8_t i = 0; i < NUM_ORDERS; ++i) {
+    float fraction = current ? ORDERS[i].current : ORDERS[i].voltage;
+    sumSqr += fraction * fraction;
+  }
+  return 100 * sqrt(sumSqr);
+}
+
+
+int main(int argc, char** argv) {
+
+  uint32_t readings = 10;
+  uint16_t pairRate = 4000;
+  uint8_t cyclesPerWindow = 12;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:r:c:")) != -1) {
+    switch (option) {
+      case 'n': readings = strtoul(optarg, NULL, 10); break;
+      case 'r': pairRate = strtoul(optarg, NULL, 10); break;
+      case 'c': cyclesPerWindow = strtoul(optarg, NULL, 10); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n readings] [-r pairRate] [-c cyclesPerWindow]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (pairRate == 0) {
+    fprintf(stderr, "Pair rate must be positive\n");
+    return 2;
+  }
+
+  SyntheticWaveform synthetic;
+  float currentVolts = CURRENT_RMS * SENSOR_SENSIBILITY;
+  float voltageVolts = VOLTAGE_RMS * VOLTAGE_MEASURING_RATIO;
+  synthetic.setSignal(STANDARD_CURRENT_PIN - A0, 2.5, currentVolts, -30);
+  synthetic.setSignal(AMPLIFIED_CURRENT_PIN - A0, 2.5, currentVolts * CURRENT_GAIN, -30);
+  synthetic.setSignal(VOLTAGE_PIN - A0, 2.5, voltageVolts);
+  for (uint8_t i = 0; i < NUM_ORDERS; ++i) {
+    synthetic.addHarmonic(STANDARD_CURRENT_PIN - A0, ORDERS[i].order, ORDERS[i].current * currentVolts, 15.0 * i);
+    synthetic.addHarmonic(AMPLIFIED_CURRENT_PIN - A0, ORDERS[i].order, ORDERS[i].current * currentVolts * CURRENT_GAIN, 15.0 * i);
+    if (ORDERS[i].voltage > 0) {
+      synthetic.addHarmonic(VOLTAGE_PIN - A0, ORDERS[i].order, ORDERS[i].voltage * voltageVolts);
+    }
+  }
+  synthetic.setNoise(0.5);
+  HalADC::setWaveform(&synthetic);
+
+  Harmonics harmonics;
+  double withoutEngine = runMeasure(NULL, pairRate, cyclesPerWindow, readings);
+  double withEngine = runMeasure(&harmonics, pairRate, cyclesPerWindow, readings);
+  double budget = 1e9 / pairRate;
+
+  printf("pair rate %u/s, %u cycles per window, budget %.0f ns/pair\n", pairRate, cyclesPerWindow, budget);
+  printf("kernel             %9.2f ns/pair\n", withoutEngine);
+  printf("kernel + harmonics %9.2f ns/pair (%.2f%% of the budget)\n", withEngine, 100 * withEngine / budget);
+  printf("harmonics only     %9.2f ns/pair, %u orders\n\n", withEngine - withoutEngine, HARMONIC_ORDERS);
+
+  printf("order   voltage(V)  expected   current(A)  expected\n");
+  for (uint8_t order = 1; order <= HARMONIC_ORDERS; ++order) {
+    float voltage = (order == 1) ? VOLTAGE_RMS : 0;
+    float current = (order == 1) ? CURRENT_RMS : 0;
+    for (uint8_t i = 0; i < NUM_ORDERS; ++i) {
+      if (ORDERS[i].order == order) {
+        voltage = ORDERS[i].voltage * VOLTAGE_RMS;
+        current = ORDERS[i].current * CURRENT_RMS;
+      }
+    }
+    printf("%5u   %10.4f  %8.4f   %10.4f  %8.4f\n", order,
+           harmonics.getVoltageHarmonic(order), voltage, harmonics.getCurrentHarmonic(order), current);
+  }
+  printf("THD(%%)  %10.4f  %8.4f   %10.4f  %8.4f\n",
+         harmonics.getVoltageTHD(), expectedTHD(false), harmonics.getCurrentTHD(), expectedTHD(true));
+  return 0;
+}
@@ -0,0 +1,240 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the host ADC backend
+ *  Synthetic and recorded waveform sources
+ */
+
+#include "HostADC.h"
+
+HostWaveform* HalADC::waveform = NULL;
+float HalADC::supplyVoltage = 5.0;
+uint16_t HalADC::conversionMicros = HOST_ADC_CONVERSION_MICROS;
+uint32_t HalADC::sampleMicros = 0;
+uint32_t HalADC::conversionCount = 0;
+
+SampleBuffer* HalADC::continuousBuffer = NULL;
+uint8_t HalADC::nextPin = 0;
+uint32_t HalADC::periodNanos = 0;
+uint32_t HalADC::startMicros = 0;
+uint32_t HalADC::emulatedConversions = 0;
+bool HalADC::realTime = false;
+
+
+//==============================================================================
+// Conversions
+//
+uint16_t HalADC::read(uint8_t pin) {
+
+  uint8_t channel = (pin >= A0) ? pin - A0 : pin;
+  uint16_t code = waveform ? waveform->sample(channel, sampleMicros) : 512;
+
+  sampleMicros += conversionMicros;
+  ++conversionCount;
+  return code;
+}
+
+uint16_t HalADC::readInternalReference(uint8_t nextPin) {
+  (void)nextPin;
+  ++conversionCount;
+  return referenceCode();
+}
+
+uint16_t HalADC::referenceCode() {
+  return uint16_t(HOST_INTERNAL_VREF * 1024 / supplyVoltage + 0.5);
+}
+
+int analogRead(uint8_t pin) {
+  return HalADC::read(pin);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Continuous acquisition emulation (timer triggered conversions)
+//
+void HalADC::startContinuous(SampleBuffer* buffer, uint16_t pairRate) {
+  buffer->reset();
+  continuousBuffer = buffer;
+  nextPin = buffer->getBlockCurrentPin();
+  periodNanos = 1000000000UL / (uint32_t(buffer->getConversionsPerPair()) * pairRate);
+  startMicros = micros();
+  emulatedConversions = 0;
+}
+
+void HalADC::poll() {
+
+  if (!continuousBuffer) {
+    return;
+  }
+
+  uint32_t due;
+  if (realTime) {
+    due = uint32_t(uint64_t(micros() - startMicros) * 1000 / periodNanos);
+  }
+  else {
+    due = continuousBuffer->front() ? emulatedConversions : emulatedConversions + 2 * SAMPLE_BLOCK_PAIRS;
+  }
+
+  while (emulatedConversions < due) {
+    uint32_t tMicros = uint32_t(uint64_t(emulatedConversions) * periodNanos / 1000);
+    uint16_t code;
+    if (nextPin == SAMPLE_REFERENCE_PIN) {
+      code = referenceCode();
+    }
+    else {
+      uint8_t channel = (nextPin >= A0) ? nextPin - A0 : nextPin;
+      code = waveform ? waveform->sample(channel, tMicros) : 512;
+    }
+    nextPin = continuousBuffer->push(code);
+    ++emulatedConversions;
+    ++conversionCount;
+
+    // Fast mode stops as soon as a block is handed over
+    if (!realTime && continuousBuffer->front()) {
+      break;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Synthetic waveform
+//
+SyntheticWaveform::SyntheticWaveform(float lineFrequency, float vcc) {
+  LINE_FREQUENCY = lineFrequency;
+  CODES_PER_VOLT = 1024 / vcc;
+  for (uint8_t channel = 0; channel < HOST_ADC_CHANNELS; ++channel) {
+    offset[channel] = 512;
+    numComponents[channel] = 0;
+  }
+  noise = 0;
+  seed = 12345;
+  numSteps = 0;
+}
+
+void SyntheticWaveform::setSignal(uint8_t channel, float offsetVolts, float rms, float phase) {
+  offset[channel] = offsetVolts * CODES_PER_VOLT;
+  numComponents[channel] = 0;
+  addHarmonic(channel, 1, rms, phase);
+}
+
+void SyntheticWaveform::addHarmonic(uint8_t channel, uint8_t order, float rms, float phase) {
+  if (numComponents[channel] >= HOST_ADC_MAX_HARMONICS) {
+    return;
+  }
+  Component& component = components[channel][numComponents[channel]++];
+  component.order = order;
+  component.amplitude = rms * sqrt(2.0) * CODES_PER_VOLT;
+  component.phase = phase * M_PI / 180;
+}
+
+void SyntheticWaveform::addStep(uint8_t channel, uint32_t startMicros, uint32_t durationMicros, float factor) {
+  if (numSteps >= HOST_ADC_MAX_STEPS) {
+    return;
+  }
+  Step& step = steps[numSteps++];
+  step.channel = channel;
+  step.startMicros = startMicros;
+  step.durationMicros = durationMicros;
+  step.factor = factor;
+}
+
+uint16_t SyntheticWaveform::sample(uint8_t channel, uint32_t tMicros) {
+
+  if (channel >= HOST_ADC_CHANNELS) {
+    return 0;
+  }
+
+  double angle = 2 * M_PI * LINE_FREQUENCY * (tMicros * 1e-6);
+  double value = 0;
+  for (uint8_t i = 0; i < numComponents[channel]; ++i) {
+    const Component& component = components[channel][i];
+    value += component.amplitude * sin(component.order * angle + component.phase);
+  }
+  for (uint8_t i = 0; i < numSteps; ++i) {
+    if (steps[i].channel == channel && tMicros - steps[i].startMicros < steps[i].durationMicros) {
+      value *= steps[i].factor;
+    }
+  }
+  value += offset[channel];
+
+  // Deterministic triangular noise, so runs are reproducible
+  if (noise > 0) {
+    seed = seed * 1103515245 + 12345;
+    double u1 = ((seed >> 16) & 0x7FFF) / 32768.0;
+    seed = seed * 1103515245 + 12345;
+    double u2 = ((seed >> 16) & 0x7FFF) / 32768.0;
+    value += (u1 + u2 - 1) * noise * sqrt(6.0);
+  }
+
+  value = floor(value + 0.5);
+  return uint16_t(value < 0 ? 0 : (value > 1023 ? 1023 : value));
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Recorded waveform fixture
+//
+bool RecordedWaveform::load(const char* path) {
+
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+
+  char line[256];
+  codes.clear();
+  numChannels = 0;
+  voltageLagMicros = 0;
+
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#') {
+      unsigned long period, lag;
+      if (sscanf(line, "# period_us %lu", &period) == 1 && period > 0) {
+        periodMicros = period;
+      }
+      if (sscanf(line, "# voltage_lag_us %lu", &lag) == 1) {
+        voltageLagMicros = lag;
+      }
+      continue;
+    }
+
+    uint8_t channels = 0;
+    char* cursor = line;
+    char* end;
+    for (long code = strtol(cursor, &end, 10); end != cursor; code = strtol(cursor, &end, 10)) {
+      codes.push_back(uint16_t(code));
+      cursor = end;
+      ++channels;
+    }
+
+    if (channels == 0) {
+      continue;
+    }
+    if (numChannels == 0) {
+      numChannels = channels;
+    }
+    else if (channels != numChannels) {
+      fclose(file);
+      codes.clear();
+      return false;
+    }
+  }
+
+  fclose(file);
+  return (getNumFrames() > 0);
+}
+
+uint16_t RecordedWaveform::sample(uint8_t channel, uint32_t tMicros) {
+  if (channel >= numChannels) {
+    return 0;
+  }
+  uint32_t frame = (tMicros / periodMicros) % getNumFrames();
+  return codes[frame * numChannels + channel];
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,145 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HOST_ADC_H_
+#define _HOST_ADC_H_
+
+#include <vector>
+
+#include "Arduino.h"
+#include "../SampleBuffer.h"
+
+#define HOST_ADC_CHANNELS          12
+#define HOST_ADC_MAX_HARMONICS     8
+#define HOST_ADC_MAX_STEPS         8
+#define HOST_ADC_CONVERSION_MICROS 112  // analogRead duration on a 16MHz UNO
+#define HOST_INTERNAL_VREF         1.1034
+
+// Conversion rates of the continuous acquisition of the board (see HAL_AVR.h)
+#define HAL_ADC_MIN_CONVERSION_RATE (F_CPU / (8 * 65536UL) + 1)
+#define HAL_ADC_MAX_CONVERSION_RATE 18500UL
+
+
+/*----------------------------------------------------------------------------
+ *  Class HostWaveform
+ *  Signal source of the host ADC: raw code of a channel at a given time
+ */
+class HostWaveform {
+  public:
+    virtual ~HostWaveform() {}
+    virtual uint16_t sample(uint8_t channel, uint32_t tMicros) = 0;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class SyntheticWaveform
+ *  Sum of sinusoids (fundamental and harmonics) over a DC level, per channel.
+ *  Steps scale the sinusoids of a channel for a while (sags, swells,
+ *  interruptions, inrush currents)
+ */
+class SyntheticWaveform : public HostWaveform {
+
+  public:
+    SyntheticWaveform(float lineFrequency=60.0, float vcc=5.0);
+
+    // Levels in volts at the ADC pin, phases in degrees
+    void setSignal(uint8_t channel, float offset, float rms, float phase=0);
+    void addHarmonic(uint8_t channel, uint8_t order, float rms, float phase=0);
+    void setNoise(float rmsCodes) { noise = rmsCodes; }
+    void addStep(uint8_t channel, uint32_t startMicros, uint32_t durationMicros, float factor);
+    uint16_t sample(uint8_t channel, uint32_t tMicros);
+
+  private:
+    struct Component {
+      uint8_t order;
+      float amplitude, phase;
+    };
+    struct Step {
+      uint8_t channel;
+      uint32_t startMicros, durationMicros;
+      float factor;
+    };
+
+    float LINE_FREQUENCY, CODES_PER_VOLT;
+    float offset[HOST_ADC_CHANNELS];
+    Component components[HOST_ADC_CHANNELS][HOST_ADC_MAX_HARMONICS];
+    uint8_t numComponents[HOST_ADC_CHANNELS];
+    Step steps[HOST_ADC_MAX_STEPS];
+    uint8_t numSteps;
+    float noise;
+    uint32_t seed;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class RecordedWaveform
+ *  Playback of a waveform fixture file, looped. Text format:
+ *
+ *    # medicao-potencia waveform v1
+ *    # period_us 208
+ *    # voltage_lag_us 104                (captured: voltage converted later)
+ *    <code A0> <code A1> <code A2> ...   (one line per sampling instant)
+ */
+class RecordedWaveform : public HostWaveform {
+
+  public:
+    RecordedWaveform() { periodMicros = HOST_ADC_CONVERSION_MICROS * 2; voltageLagMicros = 0; numChannels = 0; }
+
+    bool load(const char* path);
+    uint32_t getPeriodMicros() const { return periodMicros; }
+    uint32_t getVoltageLagMicros() const { return voltageLagMicros; }  // After the currents of its line
+    uint32_t getNumFrames() const { return numChannels ? codes.size() / numChannels : 0; }
+    uint8_t getNumChannels() const { return numChannels; }
+    uint16_t sample(uint8_t channel, uint32_t tMicros);
+
+  private:
+    uint32_t periodMicros, voltageLagMicros;
+    uint8_t numChannels;
+    std::vector<uint16_t> codes;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalADC
+ *  Host ADC: each conversion advances a virtual sampling clock by the
+ *  conversion time and reads the configured waveform at that instant.
+ *  Continuous acquisition has no interrupt: poll() runs the conversions,
+ *  either up to the elapsed wall time (real time) or until a block is ready
+ */
+class HalADC {
+
+  public:
+    static void begin(uint8_t pin) { (void)pin; }
+    static uint16_t read(uint8_t pin);
+    static uint16_t readInternalReference(uint8_t nextPin);
+    static uint32_t timestamp() { return sampleMicros; } // Virtual sampling clock
+
+    static void startContinuous(SampleBuffer* buffer, uint16_t pairRate);
+    static void stopContinuous() { continuousBuffer = NULL; }
+    static bool isContinuous() { return (continuousBuffer != NULL); }
+    static void poll();
+
+    // Host configuration and inspection
+    static void setWaveform(HostWaveform* source) { waveform = source; }
+    static void setVcc(float vcc) { supplyVoltage = vcc; }
+    static void setConversionMicros(uint16_t us) { conversionMicros = us; }
+    static uint32_t getSampleMicros() { return sampleMicros; }
+    static uint32_t getConversionCount() { return conversionCount; }
+    static void setRealTime(bool enable) { realTime = enable; }
+
+  private:
+    static uint16_t referenceCode();
+
+    static HostWaveform* waveform;
+    static float supplyVoltage;
+    static uint16_t conversionMicros;
+    static uint32_t sampleMicros, conversionCount;
+
+    static SampleBuffer* continuousBuffer;
+    static uint8_t nextPin;
+    static uint32_t periodNanos, startMicros, emulatedConversions;
+    static bool realTime;
+};
+
+
+#endif // _HOST_ADC_H_
@@ -0,0 +1,86 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the host Arduino core
+ *  Time base and digital pins
+ */
+
+#include <time.h>
+
+#include "Arduino.h"
+#include "HostADC.h"
+#include "HostRTC.h"
+
+static uint8_t pinLevels[NUM_DIGITAL_PINS];
+
+
+//==============================================================================
+// Time counted from the first call, as the board counts from reset
+//
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint64_t startMicros = monotonicMicros();
+
+uint32_t micros() {
+  return uint32_t(monotonicMicros() - startMicros);
+}
+
+uint32_t millis() {
+  return uint32_t((monotonicMicros() - startMicros) / 1000);
+}
+
+// As on the board, waiting keeps the interrupts running
+void delay(uint32_t ms) {
+  uint32_t startMicros = micros();
+  while (micros() - startMicros < ms * 1000) {
+    yield();
+    delayMicroseconds(100);
+  }
+}
+
+void delayMicroseconds(uint32_t us) {
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000L;
+  nanosleep(&ts, NULL);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Digital pins keep the last written level (inputs can be driven by the host)
+//
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < NUM_DIGITAL_PINS && mode == INPUT_PULLUP) {
+    pinLevels[pin] = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < NUM_DIGITAL_PINS) {
+    pinLevels[pin] = value ? HIGH : LOW;
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return (pin < NUM_DIGITAL_PINS) ? pinLevels[pin] : LOW;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Emulated interrupts: soft serial reception, timer triggered conversions
+// and the RTC square wave
+//
+void yield() {
+  HalSoftSerial::pollListener();
+  HalADC::poll();
+  HalRTC::poll();
+}
+//------------------------------------------------------------------------------
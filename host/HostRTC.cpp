@@ -0,0 +1,90 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the host RTC backend
+ *  Date and time in UTC, as the DS3231 keeps no time zone
+ */
+
+#include <time.h>
+
+#include "HostRTC.h"
+
+uint32_t HalRTC::fixedTime = 0;
+HalRTC* HalRTC::squareWaveClock = NULL;
+void (*HalRTC::squareWaveHandler)() = NULL;
+uint32_t HalRTC::lastTickTime = 0;
+
+
+//==============================================================================
+// Date and time conversion
+//
+HalDateTime::HalDateTime(uint32_t unixTime) {
+  time_t t = unixTime;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  yOff = tm.tm_year - 100;
+  m = tm.tm_mon + 1;
+  d = tm.tm_mday;
+  hh = tm.tm_hour;
+  mm = tm.tm_min;
+  ss = tm.tm_sec;
+  seconds = unixTime;
+}
+
+HalDateTime::HalDateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_year = year - 1900;
+  tm.tm_mon = month - 1;
+  tm.tm_mday = day;
+  tm.tm_hour = hour;
+  tm.tm_min = minute;
+  tm.tm_sec = second;
+  *this = HalDateTime(uint32_t(timegm(&tm)));
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Clock reading and adjustment
+//
+HalDateTime HalRTC::now() {
+  if (fixedTime) {
+    return HalDateTime(fixedTime);
+  }
+  return HalDateTime(uint32_t(time(NULL) + offset));
+}
+
+void HalRTC::adjust(const HalDateTime& dt) {
+  if (fixedTime) {
+    fixedTime = dt.unixtime();
+    return;
+  }
+  offset = int32_t(dt.unixtime() - uint32_t(time(NULL)));
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// SQW emulation, polled by yield()
+//
+void HalRTC::beginSquareWave(uint8_t pin, void (*handler)()) {
+  (void)pin;
+  squareWaveClock = this;
+  lastTickTime = now().unixtime();
+  squareWaveHandler = handler;
+}
+
+void HalRTC::poll() {
+  if (!squareWaveHandler) {
+    return;
+  }
+  uint32_t time = squareWaveClock->now().unixtime();
+  if (time != lastTickTime) {
+    lastTickTime = time;
+    squareWaveHandler();
+  }
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,63 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HOST_RTC_H_
+#define _HOST_RTC_H_
+
+#include "Arduino.h"
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalDateTime
+ *  Broken down local date and time (RTClib DateTime accessors)
+ */
+class HalDateTime {
+
+  public:
+    HalDateTime(uint32_t unixTime=946684800);
+    HalDateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour=0, uint8_t minute=0, uint8_t second=0);
+
+    uint16_t year() const { return yOff + 2000; }
+    uint8_t month() const { return m; }
+    uint8_t day() const { return d; }
+    uint8_t hour() const { return hh; }
+    uint8_t minute() const { return mm; }
+    uint8_t second() const { return ss; }
+    uint32_t unixtime() const { return seconds; }
+
+  private:
+    uint8_t yOff, m, d, hh, mm, ss;
+    uint32_t seconds;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalRTC
+ *  Host clock: system time, optionally shifted or frozen for reproducible runs
+ */
+class HalRTC {
+
+  public:
+    HalRTC() { offset = 0; }
+
+    void begin() {}
+    HalDateTime now();
+    void adjust(const HalDateTime& dt);
+
+    // SQW emulation: the handler runs from yield() as each second turns
+    void beginSquareWave(uint8_t pin, void (*handler)());
+    static void poll();
+
+    static void setFixedTime(uint32_t unixTime) { fixedTime = unixTime; }
+    static void advanceFixedTime(uint32_t seconds) { fixedTime += seconds; }
+
+  private:
+    int32_t offset;
+    static uint32_t fixedTime;  // 0 follows the system clock
+    static HalRTC* squareWaveClock;
+    static void (*squareWaveHandler)();
+    static uint32_t lastTickTime;
+};
+
+
+#endif // _HOST_RTC_H_
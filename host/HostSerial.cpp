@@ -0,0 +1,163 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the class HostSerialPort
+ *  Serial stream backed by file descriptors (stdio, pipe or pty)
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "HostSerial.h"
+
+// USB serial: stdin/stdout unless MEDICAO_SERIAL names a device
+HardwareSerial Serial(HOST_SERIAL_ENV);
+HalSoftSerial* HalSoftSerial::listener = NULL;
+
+
+//==============================================================================
+// Open the port device named by the environment, falling back to stdio for USB
+//
+void HostSerialPort::begin(uint32_t baudRate) {
+
+  (void)baudRate;
+  if (isOpen()) {
+    return;
+  }
+
+  const char* device = getenv(DEVICE_ENV);
+  if (device && *device) {
+    open(device);
+  }
+  else if (this == &Serial) {
+    inFd = STDIN_FILENO;
+    outFd = STDOUT_FILENO;
+  }
+}
+
+bool HostSerialPort::open(const char* device) {
+  end();
+  inFd = ::open(device, O_RDWR | O_NOCTTY);
+  outFd = inFd;
+
+  // Terminals pass bytes unchanged, as an UART does
+  struct termios settings;
+  if (inFd >= 0 && isatty(inFd) && tcgetattr(inFd, &settings) == 0) {
+    cfmakeraw(&settings);
+    tcsetattr(inFd, TCSANOW, &settings);
+  }
+  return isOpen();
+}
+
+// Line rate of a terminal device, once the pending output is sent -- Return
+// the rate is supported (anything that is not a terminal has none)
+bool HostSerialPort::setBaudRate(uint32_t baudRate) {
+
+  static const struct { uint32_t rate; speed_t speed; } SPEEDS[] = {
+    { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 }, { 500000, B500000 },
+    { 1000000, B1000000 }, { 2000000, B2000000 }
+  };
+
+  if (outFd < 0 || !isatty(outFd)) {
+    return true;
+  }
+  for (size_t i = 0; i < sizeof(SPEEDS) / sizeof(SPEEDS[0]); ++i) {
+    struct termios settings;
+    if (SPEEDS[i].rate == baudRate && tcgetattr(outFd, &settings) == 0) {
+      tcdrain(outFd);
+      cfsetspeed(&settings, SPEEDS[i].speed);
+      return (tcsetattr(outFd, TCSANOW, &settings) == 0);
+    }
+  }
+  return false;
+}
+
+void HostSerialPort::end() {
+  if (inFd > STDERR_FILENO) {
+    ::close(inFd);
+  }
+  inFd = -1;
+  outFd = -1;
+  head = 0;
+  tail = 0;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Move any pending input to the receive buffer, without blocking
+//
+void HostSerialPort::fill() {
+
+  if (inFd < 0 || head != tail) {
+    return;
+  }
+
+  struct pollfd pfd = { inFd, POLLIN, 0 };
+  if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) {
+    return;
+  }
+
+  ssize_t n = ::read(inFd, rxBuffer, sizeof(rxBuffer));
+  head = 0;
+  tail = (n > 0) ? uint8_t(n) : 0;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Stream interface
+//
+int HostSerialPort::available() {
+  fill();
+  return tail - head;
+}
+
+int HostSerialPort::read() {
+  fill();
+  return (head == tail) ? -1 : rxBuffer[head++];
+}
+
+int HostSerialPort::peek() {
+  fill();
+  return (head == tail) ? -1 : rxBuffer[head];
+}
+
+size_t HostSerialPort::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t HostSerialPort::write(const uint8_t* buffer, size_t size) {
+
+  if (outFd < 0) {
+    return size; // Disconnected port discards the output, as the hardware does
+  }
+
+  size_t sent = 0;
+  while (sent < size) {
+    ssize_t n = ::write(outFd, buffer + sent, size - sent);
+    if (n <= 0) {
+      break;
+    }
+    sent += n;
+  }
+  bytesWritten += sent;
+  return sent;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Deliver received chars to the attached handler (emulated interrupt)
+//
+void HalSoftSerial::poll() {
+  while (isr && available()) {
+    isr(uint8_t(read()));
+  }
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,89 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HOST_SERIAL_H_
+#define _HOST_SERIAL_H_
+
+#include "Arduino.h"
+
+// Environment variables naming the device (pty, fifo or file) of each port
+#define HOST_SERIAL_ENV    "MEDICAO_SERIAL"
+#define HOST_BLUETOOTH_ENV "MEDICAO_BLUETOOTH"
+
+#define HOST_SERIAL_BUFFER_SIZE 64
+
+
+/*----------------------------------------------------------------------------
+ *  Class HostSerialPort
+ *  Serial stream backed by file descriptors (stdio, pipe or pty)
+ */
+class HostSerialPort : public Stream {
+
+  public:
+    HostSerialPort(const char* deviceEnv) {
+      DEVICE_ENV = deviceEnv;
+      inFd = -1;
+      outFd = -1;
+      head = 0;
+      tail = 0;
+      bytesWritten = 0;
+    }
+
+    void begin(uint32_t baudRate=9600);
+    bool open(const char* device);
+    bool setBaudRate(uint32_t baudRate);  // Terminal devices; pipes and files ignore it
+    void end();
+    bool isOpen() const { return (inFd >= 0 || outFd >= 0); }
+    uint32_t getBytesWritten() const { return bytesWritten; }
+
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t value);
+    size_t write(const uint8_t* buffer, size_t size);
+    using Print::write;
+    int availableForWrite() { return HOST_SERIAL_BUFFER_SIZE; }  // Writes do not wait for the baud rate
+    operator bool() const { return true; }
+
+  protected:
+    void fill();
+
+    const char* DEVICE_ENV;
+    int inFd, outFd;
+    uint8_t rxBuffer[HOST_SERIAL_BUFFER_SIZE];
+    uint8_t head, tail;
+    uint32_t bytesWritten;
+};
+
+typedef HostSerialPort HardwareSerial;
+extern HardwareSerial Serial;
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalSoftSerial
+ *  Host replacement of NeoSWSerial: received chars go to the attached
+ *  handler when poll() is called, emulating the pin change interrupt
+ */
+class HalSoftSerial : public HostSerialPort {
+
+  public:
+    HalSoftSerial(uint8_t receivePin, uint8_t transmitPin) : HostSerialPort(HOST_BLUETOOTH_ENV) {
+      (void)receivePin;
+      (void)transmitPin;
+      isr = NULL;
+    }
+
+    void begin(uint32_t baudRate=9600) { HostSerialPort::begin(baudRate); listener = this; }
+    void attachInterrupt(void (*handler)(uint8_t)) { isr = handler; }
+    void detachInterrupt() { isr = NULL; }
+    int availableForWrite() { return 0; }  // As NeoSWSerial, that does not tell
+    void poll();
+    static void pollListener() { if (listener) { listener->poll(); } }
+
+  private:
+    void (*isr)(uint8_t);
+    static HalSoftSerial* listener;  // NeoSWSerial listens on one port at a time
+};
+
+
+#endif // _HOST_SERIAL_H_
@@ -0,0 +1,442 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the host storage backend
+ *  A directory plays the FAT volume of the SD Card
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "HostStorage.h"
+
+void (*HalFile::dateTimeHandler)(uint16_t* date, uint16_t* time) = NULL;
+const char* HalFile::volumeRoot = "";
+
+
+//==============================================================================
+// HalFile byte and block access
+//
+int HalFile::read() {
+  uint8_t value;
+  return (read(&value, 1) == 1) ? value : -1;
+}
+
+int HalFile::read(void* buffer, size_t nbyte) {
+  if (!fp) {
+    return -1;
+  }
+  size_t n = fread(buffer, 1, nbyte, fp);
+  pos += n;
+  return int(n);
+}
+
+int HalFile::peek() {
+  if (!fp) {
+    return -1;
+  }
+  int value = fgetc(fp);
+  if (value >= 0) {
+    ungetc(value, fp);
+  }
+  return value;
+}
+
+size_t HalFile::write(const uint8_t* buffer, size_t nbyte) {
+  if (!fp) {
+    return 0;
+  }
+  size_t n = fwrite(buffer, 1, nbyte, fp);
+  pos += n;
+  if (pos > size) {
+    size = pos;
+  }
+  modified = true;
+  return n;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Flush the cache and stamp the modification date through the FAT callback
+//
+bool HalFile::sync() {
+
+  if (!fp) {
+    return directory;
+  }
+  if (fflush(fp) != 0) {
+    return false;
+  }
+
+  if (modified && dateTimeHandler) {
+    uint16_t date, time;
+    dateTimeHandler(&date, &time);
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = (date >> 9) + 80;
+    tm.tm_mon = ((date >> 5) & 0x0F) - 1;
+    tm.tm_mday = date & 0x1F;
+    tm.tm_hour = time >> 11;
+    tm.tm_min = (time >> 5) & 0x3F;
+    tm.tm_sec = (time & 0x1F) * 2;
+    tm.tm_isdst = -1;
+
+    struct timeval times[2];
+    times[0].tv_sec = times[1].tv_sec = mktime(&tm);
+    times[0].tv_usec = times[1].tv_usec = 0;
+    utimes(path, times);
+  }
+
+  modified = false;
+  return true;
+}
+
+bool HalFile::close() {
+  bool synced = sync();
+  if (fp) {
+    fclose(fp);
+    fp = NULL;
+  }
+  directory = false;
+  return synced;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Positioning and size
+//
+bool HalFile::seekSet(uint32_t position) {
+  if (!fp || position > size || fseek(fp, position, SEEK_SET) != 0) {
+    return false;
+  }
+  pos = position;
+  return true;
+}
+
+bool HalFile::truncate(uint32_t length) {
+  if (!fp || fflush(fp) != 0 || ftruncate(fileno(fp), length) != 0) {
+    return false;
+  }
+  size = length;
+  if (pos > size) {
+    seekSet(size);
+  }
+  modified = true;
+  return true;
+}
+
+// New file of the given length in the directory, as one extent: the host
+// file is zero filled, the contents of an erased card
+bool HalFile::createContiguous(HalFile* dirFile, const char* name, uint32_t length) {
+
+  char hostPath[HOST_PATH_SIZE];
+  struct stat info;
+
+  if (name[0] == '/') {
+    snprintf(hostPath, sizeof(hostPath), "%s%s", volumeRoot, name);
+  }
+  else {
+    snprintf(hostPath, sizeof(hostPath), "%s%s/%s", volumeRoot, strcmp(dirFile->path, "/") ? dirFile->path : "", name);
+  }
+  if (isOpen() || stat(hostPath, &info) == 0) {
+    return false;
+  }
+
+  fp = fopen(hostPath, "w+b");
+  if (!fp) {
+    return false;
+  }
+  if (ftruncate(fileno(fp), length) != 0) {
+    fclose(fp);
+    fp = NULL;
+    ::unlink(hostPath);
+    return false;
+  }
+  setvbuf(fp, NULL, _IOFBF, 512);
+  strcpy(path, hostPath);
+  pos = 0;
+  size = length;
+  modified = true;
+  return true;
+}
+
+// Blocks of the extent, numbered from the start of the file
+bool HalFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
+  if (!fp) {
+    return false;
+  }
+  *bgnBlock = 0;
+  *endBlock = size ? (size - 1) / 512 : 0;
+  return true;
+}
+
+bool HalFile::getName(char* name, size_t nameSize) const {
+  const char* base = strrchr(path, '/');
+  base = (base && base[1]) ? base + 1 : path;
+  if (strlen(base) >= nameSize) {
+    return false;
+  }
+  strcpy(name, base);
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Volume information from the file system holding the root directory
+//
+uint32_t HostVolume::freeClusterCount() {
+  struct statvfs info;
+  if (statvfs(root, &info) != 0) {
+    return 0;
+  }
+  return uint32_t(uint64_t(info.f_bavail) * info.f_frsize / (512UL * blocksPerCluster()));
+}
+
+uint32_t HostCard::cardSize() {
+  struct statvfs info;
+  if (statvfs(root, &info) != 0) {
+    return 0;
+  }
+  return uint32_t(uint64_t(info.f_blocks) * info.f_frsize / 512);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Mount the directory named by the environment (or ./sdcard)
+//
+bool HalStorage::begin() {
+  const char* rootPath = getenv(HOST_SD_ROOT_ENV);
+  return begin((rootPath && *rootPath) ? rootPath : HOST_SD_ROOT_DEFAULT);
+}
+
+bool HalStorage::begin(const char* rootPath) {
+
+  if (strlen(rootPath) >= sizeof(root) / 2) {
+    return false;
+  }
+  if (::mkdir(rootPath, 0777) != 0 && errno != EEXIST) {
+    return false;
+  }
+
+  strcpy(root, rootPath);
+  HalFile::volumeRoot = root;
+  strcpy(cwd.path, "/");
+  cwd.directory = true;
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Map a volume path (absolute or relative to the working directory) to the host
+//
+void HalStorage::resolve(const char* path, char* hostPath) const {
+  if (path[0] == '/') {
+    snprintf(hostPath, HOST_PATH_SIZE, "%s%s", root, path);
+  }
+  else if (!strcmp(cwd.path, "/")) {
+    snprintf(hostPath, HOST_PATH_SIZE, "%s/%s", root, path);
+  }
+  else {
+    snprintf(hostPath, HOST_PATH_SIZE, "%s%s/%s", root, cwd.path, path);
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Open a file with SdFat flags
+//
+HalFile HalStorage::open(const char* path, uint8_t oflag) {
+
+  HalFile file;
+  char hostPath[HOST_PATH_SIZE];
+  struct stat info;
+
+  resolve(path, hostPath);
+  bool found = (stat(hostPath, &info) == 0);
+
+  if (found && S_ISDIR(info.st_mode)) {
+    return file;
+  }
+  if ((!found && !(oflag & O_CREAT)) || (found && (oflag & O_CREAT) && (oflag & O_EXCL))) {
+    return file;
+  }
+
+  const char* mode = "rb";
+  if (oflag & O_WRITE) {
+    mode = (!found || (oflag & O_TRUNC)) ? "w+b" : ((oflag & O_APPEND) ? "a+b" : "r+b");
+  }
+
+  file.fp = fopen(hostPath, mode);
+  if (!file.fp) {
+    return file;
+  }
+  setvbuf(file.fp, NULL, _IOFBF, 512);
+
+  strcpy(file.path, hostPath);
+  file.size = (found && !(oflag & O_TRUNC)) ? uint32_t(info.st_size) : 0;
+  file.modified = !found;
+  if (oflag & O_AT_END) {
+    file.seekSet(file.size);
+  }
+  return file;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Directory management
+//
+bool HalStorage::exists(const char* path) {
+  char hostPath[HOST_PATH_SIZE];
+  struct stat info;
+  resolve(path, hostPath);
+  return (stat(hostPath, &info) == 0);
+}
+
+bool HalStorage::mkdir(const char* path) {
+  char hostPath[HOST_PATH_SIZE];
+  resolve(path, hostPath);
+  return (::mkdir(hostPath, 0777) == 0);
+}
+
+bool HalStorage::remove(const char* path) {
+  char hostPath[HOST_PATH_SIZE];
+  resolve(path, hostPath);
+  return (::unlink(hostPath) == 0);
+}
+
+bool HalStorage::rename(const char* oldPath, const char* newPath) {
+  char oldHostPath[HOST_PATH_SIZE], newHostPath[HOST_PATH_SIZE];
+  resolve(oldPath, oldHostPath);
+  resolve(newPath, newHostPath);
+  return (::rename(oldHostPath, newHostPath) == 0);
+}
+
+bool HalStorage::chdir(const char* path) {
+
+  char hostPath[HOST_PATH_SIZE];
+  struct stat info;
+
+  resolve(path, hostPath);
+  if (stat(hostPath, &info) != 0 || !S_ISDIR(info.st_mode)) {
+    return false;
+  }
+
+  // Keep the volume path, normalized without trailing slash
+  const char* volumePath = hostPath + strlen(root);
+  size_t len = strlen(volumePath);
+  while (len > 1 && volumePath[len - 1] == '/') {
+    --len;
+  }
+  if (len == 0) {
+    strcpy(cwd.path, "/");
+  }
+  else {
+    memcpy(cwd.path, volumePath, len);
+    cwd.path[len] = '\0';
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// List the volume tree
+//
+void HalStorage::lsDir(Print* pr, const char* hostPath, uint8_t flags, uint8_t indent) {
+
+  DIR* dir = opendir(hostPath);
+  if (!dir) {
+    return;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    char childPath[HOST_PATH_SIZE];
+    struct stat info;
+    snprintf(childPath, sizeof(childPath), "%s/%s", hostPath, entry->d_name);
+    if (stat(childPath, &info) != 0) {
+      continue;
+    }
+
+    char line[HOST_PATH_SIZE + 48];
+    char* p = line;
+    for (uint8_t i = 0; i < indent; ++i) {
+      *p++ = ' ';
+    }
+    if (flags & LS_DATE) {
+      p += strftime(p, 21, "%Y-%m-%d %H:%M ", localtime(&info.st_mtime));
+    }
+    if ((flags & LS_SIZE) && !S_ISDIR(info.st_mode)) {
+      p += sprintf(p, "%10lu ", (unsigned long)info.st_size);
+    }
+    sprintf(p, "%s%s\n", entry->d_name, S_ISDIR(info.st_mode) ? "/" : "");
+    pr->write(line);
+
+    if ((flags & LS_R) && S_ISDIR(info.st_mode)) {
+      lsDir(pr, childPath, flags, indent + 2);
+    }
+  }
+  closedir(dir);
+}
+
+void HalStorage::ls(Print* pr, uint8_t flags) {
+  char hostPath[HOST_PATH_SIZE];
+  resolve(".", hostPath);
+  lsDir(pr, hostPath, flags, 0);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Remove every file and folder of the volume
+//
+static bool removeTree(const char* hostPath, bool removeSelf) {
+
+  DIR* dir = opendir(hostPath);
+  if (!dir) {
+    return (unlink(hostPath) == 0);
+  }
+
+  bool ok = true;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+      continue;
+    }
+    char childPath[HOST_PATH_SIZE];
+    snprintf(childPath, sizeof(childPath), "%s/%s", hostPath, entry->d_name);
+    ok = removeTree(childPath, true) && ok;
+  }
+  closedir(dir);
+
+  return (removeSelf ? (rmdir(hostPath) == 0) && ok : ok);
+}
+
+bool HalStorage::wipe(Print* pr) {
+  bool ok = removeTree(root, false);
+  strcpy(cwd.path, "/");
+  if (pr) {
+    pr->write(ok ? "Wipe done\n" : "Wipe failed\n");
+  }
+  return ok;
+}
+//------------------------------------------------------------------------------
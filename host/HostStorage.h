@@ -0,0 +1,171 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HOST_STORAGE_H_
+#define _HOST_STORAGE_H_
+
+#include "Arduino.h"
+
+// Environment variable naming the directory that plays the SD Card root
+#define HOST_SD_ROOT_ENV     "MEDICAO_SD_ROOT"
+#define HOST_SD_ROOT_DEFAULT "sdcard"
+#define HOST_PATH_SIZE       256
+
+// SdFat open flags
+#undef O_RDONLY
+#undef O_WRONLY
+#undef O_RDWR
+#undef O_APPEND
+#undef O_SYNC
+#undef O_TRUNC
+#undef O_CREAT
+#undef O_EXCL
+#undef O_ACCMODE
+#define O_READ   0X01
+#define O_RDONLY O_READ
+#define O_WRITE  0X02
+#define O_WRONLY O_WRITE
+#define O_RDWR   (O_READ | O_WRITE)
+#define O_ACCMODE (O_READ | O_WRITE)
+#define O_APPEND 0X04
+#define O_SYNC   0X08
+#define O_TRUNC  0X10
+#define O_AT_END 0X20
+#define O_CREAT  0X40
+#define O_EXCL   0X80
+
+// SdFat ls() flags
+#define LS_DATE 1
+#define LS_SIZE 2
+#define LS_R    4
+
+// FAT directory entry date and time fields
+inline uint16_t FAT_DATE(uint16_t year, uint8_t month, uint8_t day) {
+  return (year - 1980) << 9 | month << 5 | day;
+}
+inline uint16_t FAT_TIME(uint8_t hour, uint8_t minute, uint8_t second) {
+  return hour << 11 | minute << 5 | second >> 1;
+}
+
+// SdFat busy wait hook
+struct SysCall {
+  static void yield() { ::yield(); }
+  static void halt() { abort(); }
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalFile
+ *  Host file with SdFat File semantics (512 byte write cache, written to
+ *  the directory entry on sync or close)
+ */
+class HalFile : public Stream {
+
+  public:
+    HalFile() {
+      fp = NULL;
+      pos = 0;
+      size = 0;
+      modified = false;
+      directory = false;
+      path[0] = '\0';
+    }
+
+    operator bool() const { return isOpen(); }
+    bool isOpen() const { return (fp != NULL || directory); }
+    bool isDir() const { return directory; }
+
+    int available() { return isOpen() ? int(size - pos) : 0; }
+    int read();
+    int read(void* buffer, size_t nbyte);
+    int peek();
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const uint8_t* buffer, size_t size);
+    using Print::write;
+    void flush() { sync(); }
+
+    bool sync();
+    bool close();
+    bool seekSet(uint32_t position);
+    bool seekEnd(int32_t offset=0) { return seekSet(size + offset); }
+    bool truncate(uint32_t length);
+    bool createContiguous(HalFile* dirFile, const char* name, uint32_t length);
+    bool contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
+    uint32_t curPosition() const { return pos; }
+    uint32_t fileSize() const { return size; }
+    bool getName(char* name, size_t nameSize) const;
+
+    static void dateTimeCallback(void (*dateTime)(uint16_t* date, uint16_t* time)) { dateTimeHandler = dateTime; }
+
+  private:
+    friend class HalStorage;
+
+    FILE* fp;
+    uint32_t pos, size;
+    bool modified, directory;
+    char path[HOST_PATH_SIZE];
+
+    static void (*dateTimeHandler)(uint16_t* date, uint16_t* time);
+    static const char* volumeRoot;  // Host directory of the mounted volume
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class HostVolume / HostCard
+ *  Space information of the directory backing the SD Card
+ */
+class HostVolume {
+  public:
+    uint32_t freeClusterCount();
+    uint8_t blocksPerCluster() const { return 64; }
+    const char* root;
+};
+
+class HostCard {
+  public:
+    uint32_t cardSize();
+    bool erase(uint32_t firstBlock, uint32_t lastBlock) { (void)firstBlock; (void)lastBlock; return true; } // Extents are created zero filled
+    const char* root;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class HalStorage
+ *  Host replacement of SdFat: a directory plays the FAT volume
+ */
+class HalStorage {
+
+  public:
+    HalStorage() {
+      root[0] = '\0';
+      cwd.directory = true;
+      vol_.root = root;
+      card_.root = root;
+    }
+
+    bool begin();
+    bool begin(const char* rootPath);
+    HalFile open(const char* path, uint8_t oflag=O_RDONLY);
+    bool exists(const char* path);
+    bool mkdir(const char* path);
+    bool remove(const char* path);
+    bool rename(const char* oldPath, const char* newPath);
+    bool chdir(const char* path);
+    HalFile* vwd() { return &cwd; }
+    void ls(Print* pr, uint8_t flags=0);
+    bool wipe(Print* pr=NULL);
+    HostVolume* vol() { return &vol_; }
+    HostCard* card() { return &card_; }
+
+  private:
+    void resolve(const char* path, char* hostPath) const;
+    void lsDir(Print* pr, const char* hostPath, uint8_t flags, uint8_t indent);
+
+    char root[HOST_PATH_SIZE];
+    HalFile cwd;  // path holds the volume path of the working directory
+    HostVolume vol_;
+    HostCard card_;
+};
+
+
+#endif // _HOST_STORAGE_H_
@@ -0,0 +1,148 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Implementation of the host formatted streams
+ *  Same number formatting rules as the SdFat ostream
+ */
+
+#include "HostStream.h"
+
+
+//==============================================================================
+// Integer output
+//
+void ostream::putNum(unsigned long n) {
+  char buf[24];
+  char* str = buf + sizeof(buf) - 1;
+  *str = '\0';
+  do {
+    *--str = char('0' + n % 10);
+    n /= 10;
+  } while (n);
+  putstr(str);
+}
+
+void ostream::putNum(long n) {
+  if (n < 0) {
+    putch('-');
+    putNum((unsigned long)(-(n + 1)) + 1);
+    return;
+  }
+  putNum((unsigned long)n);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Fixed point float output with 'precision' decimal digits (SdFat algorithm)
+//
+void ostream::putDouble(float n) {
+
+  uint8_t nd = precision();
+  float round = 0.5;
+
+  // NaN converts to no integer part
+  if (n != n) {
+    putstr("nan");
+    return;
+  }
+  if (n < 0.0) {
+    putch('-');
+    n = -n;
+  }
+
+  // check for larger than uint32_t
+  if (n > 4.0E9) {
+    putstr("BIG FLT");
+    return;
+  }
+
+  // round up and separate int and fraction parts
+  for (uint8_t i = 0; i < nd; ++i) {
+    round *= 0.1f;
+  }
+  n += round;
+  uint32_t intPart = n;
+  float fractionPart = n - intPart;
+
+  putNum((unsigned long)intPart);
+  if (nd) {
+    putch('.');
+  }
+
+  // output fraction
+  while (nd-- > 0) {
+    fractionPart *= 10.0f;
+    int digit = static_cast<int>(fractionPart);
+    putch(char(digit + '0'));
+    fractionPart -= digit;
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Read a line: wait for the first char and stop after 10 ms without input
+//
+void ArduinoInStream::readline() {
+
+  size_t i = 0;
+  uint32_t t;
+
+  m_line[0] = '\0';
+  while (!m_hw->available()) {
+    delay(1);
+  }
+
+  while (true) {
+    t = millis();
+    while (!m_hw->available()) {
+      if ((millis() - t) > 10) {
+        m_pos = 0;
+        m_fail = false;
+        return;
+      }
+    }
+    if (i >= (m_size - 1)) {
+      m_fail = true;
+      return;
+    }
+    m_line[i++] = char(m_hw->read());
+    m_line[i] = '\0';
+  }
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Extract the next whitespace delimited token (target may alias the buffer)
+//
+ArduinoInStream& ArduinoInStream::operator>> (char* str) {
+
+  if (m_fail) {
+    return *this;
+  }
+
+  size_t len = strlen(m_line);
+  while (m_pos < len && isspace(uint8_t(m_line[m_pos]))) {
+    ++m_pos;
+  }
+
+  size_t start = m_pos;
+  while (m_pos < len && !isspace(uint8_t(m_line[m_pos]))) {
+    ++m_pos;
+  }
+
+  if (m_pos == start) {
+    m_fail = true;
+    str[0] = '\0';
+    return *this;
+  }
+
+  memmove(str, m_line + start, m_pos - start);
+  str[m_pos - start] = '\0';
+  return *this;
+}
+//------------------------------------------------------------------------------
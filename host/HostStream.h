@@ -0,0 +1,121 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+#ifndef _HOST_STREAM_H_
+#define _HOST_STREAM_H_
+
+#include "Arduino.h"
+
+
+/*----------------------------------------------------------------------------
+ *  Class ostream
+ *  Host replacement of the SdFat formatted output stream. Floats are
+ *  printed with the same algorithm (and the same 32 bit precision, as AVR
+ *  double is a float) so host output is byte identical to the board
+ */
+class ostream {
+
+  public:
+    ostream() { precision_ = 2; }
+    virtual ~ostream() {}
+
+    uint8_t precision() const { return precision_; }
+    uint8_t precision(uint8_t n) { uint8_t r = precision_; precision_ = n; return r; }
+
+    ostream& put(char ch) { putch(ch); return *this; }
+    ostream& flush() { flushOut(); return *this; }
+
+    ostream& operator<< (ostream& (*pf)(ostream&)) { return pf(*this); }
+    ostream& operator<< (const char* arg) { putstr(arg); return *this; }
+    ostream& operator<< (const __FlashStringHelper* arg) { putstr(reinterpret_cast<const char*>(arg)); return *this; }
+    ostream& operator<< (char arg) { putch(arg); return *this; }
+    ostream& operator<< (signed char arg) { putch(char(arg)); return *this; }
+    ostream& operator<< (unsigned char arg) { putch(char(arg)); return *this; }
+    ostream& operator<< (bool arg) { putch(arg ? '1' : '0'); return *this; }
+    ostream& operator<< (short arg) { putNum(long(arg)); return *this; }
+    ostream& operator<< (unsigned short arg) { putNum((unsigned long)arg); return *this; }
+    ostream& operator<< (int arg) { putNum(long(arg)); return *this; }
+    ostream& operator<< (unsigned int arg) { putNum((unsigned long)arg); return *this; }
+    ostream& operator<< (long arg) { putNum(arg); return *this; }
+    ostream& operator<< (unsigned long arg) { putNum(arg); return *this; }
+    ostream& operator<< (double arg) { putDouble(float(arg)); return *this; }
+    ostream& operator<< (float arg) { putDouble(arg); return *this; }
+
+  protected:
+    virtual void putch(char c) = 0;
+    virtual void putstr(const char* str) = 0;
+    virtual void flushOut() {}
+
+  private:
+    void putNum(long n);
+    void putNum(unsigned long n);
+    void putDouble(float n);
+
+    uint8_t precision_;
+};
+
+inline ostream& endl(ostream& os) {
+  os.put('\n');
+  return os;
+}
+
+struct setprecision {
+  explicit setprecision(unsigned int arg) : p(arg) {}
+  unsigned int p;
+};
+
+inline ostream& operator<< (ostream& os, const setprecision& arg) {
+  os.precision(arg.p);
+  return os;
+}
+
+
+/*----------------------------------------------------------------------------
+ *  Class ArduinoOutStream
+ *  Formatted output to any Print object (serial port or file)
+ */
+class ArduinoOutStream : public ostream {
+
+  public:
+    explicit ArduinoOutStream(Print& pr) : m_pr(&pr) {}
+
+  protected:
+    void putch(char c) { m_pr->write(uint8_t(c)); }
+    void putstr(const char* str) { m_pr->write(str); }
+    void flushOut() { m_pr->flush(); }
+
+  private:
+    Print* m_pr;
+};
+
+
+/*----------------------------------------------------------------------------
+ *  Class ArduinoInStream
+ *  Line input from a Stream and token extraction
+ */
+class ArduinoInStream {
+
+  public:
+    ArduinoInStream(Stream& hws, char* buf, size_t size) {
+      m_hw = &hws;
+      m_line = buf;
+      m_size = size;
+      m_line[0] = '\0';
+      m_pos = 0;
+      m_fail = false;
+    }
+
+    void readline();
+    ArduinoInStream& operator>> (char* str);
+    operator bool() const { return !m_fail; }
+    bool operator!() const { return m_fail; }
+
+  private:
+    Stream* m_hw;
+    char* m_line;
+    size_t m_size, m_pos;
+    bool m_fail;
+};
+
+
+#endif // _HOST_STREAM_H_
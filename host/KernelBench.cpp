@@ -0,0 +1,197 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Accumulation kernel benchmark
+ *  Runs the float and the integer kernels of Measure over the same sample
+ *  blocks and compares time per sample pair and results. The integer kernel
+ *  also runs with the sensors as a compile-time profile (ProfiledMeasure),
+ *  and with the power quality event detector
+ *
+ *  Usage: medicao-bench-kernel [-n readings] [-R repeats] [-w waveform.txt]
+ *
+ *  The conversions of a first pass are recorded and every run replays them,
+ *  read through a volatile pointer, so all kernels get the same samples and
+ *  none can be computed ahead. Each kernel runs repeats times; the minimum
+ *  and the median time per pair are shown
+ *
+ *  Host times only rank the kernels: the host has an FPU. On the board, the
+ *  same comparison is printed by the monitoring output ('M') of the sketch
+ */
+
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "../Measure.h"
+#include "../SensorProfile.h"
+
+
+#define SAMPLES_PER_WINDOW 5000
+#define NUM_WINDOWS        5
+#define SAMPLE_PAIR_RATE   4000
+
+#define STANDARD_CURRENT_PIN    A0
+#define AMPLIFIED_CURRENT_PIN   A1
+#define VOLTAGE_PIN             A2
+#define SENSOR_SENSIBILITY      0.100
+#define VOLTAGE_MEASURING_RATIO 5.0/680
+#define MAX_CURRENT_VALUE       20
+#define CURRENT_GAIN            10
+
+// The same sensors, as a compile-time profile
+typedef SensorProfile<ACS712_20A, CURRENT_GAIN, VoltageRatio<5, 680> > BenchSensors;
+
+
+/*----------------------------------------------------------------------------
+ *  Class ReplayWaveform
+ *  Conversions of a source waveform, recorded in the order asked and then
+ *  replayed from the start of each run
+ */
+class ReplayWaveform : public HostWaveform {
+
+  public:
+    explicit ReplayWaveform(HostWaveform* source) { this->source = source; next = 0; recording = true; }
+    void replay() { next = 0; recording = false; }
+    uint16_t sample(uint8_t channel, uint32_t tMicros) {
+      if (recording || next >= codes.size()) {
+        codes.push_back(source->sample(channel, tMicros));
+      }
+      const volatile uint16_t* replayed = codes.data();
+      return replayed[next++];
+    }
+
+  private:
+    HostWaveform* source;
+    std::vector<uint16_t> codes;
+    size_t next;
+    bool recording;
+};
+
+
+static ReplayWaveform* replay = NULL;
+
+struct KernelResult {
+  float currentRMS, voltageRMS, realPower, powerFactor;
+  double nsPerPair, minNsPerPair;
+};
+
+
+static KernelResult runKernel(Measure& measure, uint8_t kernel, uint32_t readings) {
+
+  SampleBuffer sampleBuffer;
+  KernelResult result;
+  uint64_t kernelMicros = 0, pairs = 0;
+
+  if (replay) {
+    replay->replay();
+  }
+
+  measure.setKernel(kernel);
+  measure.setSampleBuffer(&sampleBuffer);
+  measure.begin(SAMPLES_PER_WINDOW, NUM_WINDOWS, SAMPLE_PAIR_RATE);
+
+  for (uint32_t reading = 0; reading < readings; ++reading) {
+    measure.acquireAndCalculate();
+    kernelMicros += measure.getKernelMicros();
+    pairs += (SAMPLES_PER_WINDOW + SAMPLE_BLOCK_PAIRS - 1) / SAMPLE_BLOCK_PAIRS * SAMPLE_BLOCK_PAIRS * NUM_WINDOWS;
+  }
+  HalADC::stopContinuous();
+
+  result.currentRMS = measure.getCurrentRMS();
+  result.voltageRMS = measure.getVoltageRMS();
+  result.realPower = measure.getRealPower();
+  result.powerFactor = measure.getPowerFactor();
+  result.nsPerPair = pairs ? 1000.0 * kernelMicros / pairs : 0;
+  result.minNsPerPair = result.nsPerPair;
+  return result;
+}
+
+// Repeated runs: the median and the minimum time, the values of the last run
+static KernelResult repeatKernel(Measure& measure, uint8_t kernel, uint32_t readings, uint32_t repeats) {
+
+  std::vector<double> times;
+  KernelResult result;
+  for (uint32_t repeat = 0; repeat < repeats; ++repeat) {
+    result = runKernel(measure, kernel, readings);
+    times.push_back(result.nsPerPair);
+  }
+  std::sort(times.begin(), times.end());
+  result.minNsPerPair = times.front();
+  result.nsPerPair = times[times.size() / 2];
+  return result;
+}
+
+static void printKernel(const char* name, const KernelResult& result) {
+  printf("%-7s %9.2f %9.2f   %10.4f  %10.4f  %12.4f  %11.5f\n", name, result.minNsPerPair, result.nsPerPair,
+         result.currentRMS, result.voltageRMS, result.realPower, result.powerFactor);
+}
+
+
+int main(int argc, char** argv) {
+
+  uint32_t readings = 20;
+  uint32_t repeats = 9;
+  const char* waveformPath = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:R:w:")) != -1) {
+    switch (option) {
+      case 'n': readings = strtoul(optarg, NULL, 10); break;
+      case 'R': repeats = strtoul(optarg, NULL, 10); break;
+      case 'w': waveformPath = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-n readings] [-R repeats] [-w waveform.txt]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (readings == 0 || repeats == 0) {
+    fprintf(stderr, "Readings and repeats must be positive\n");
+    return 2;
+  }
+
+  SyntheticWaveform synthetic;
+  RecordedWaveform recorded;
+  if (waveformPath) {
+    if (!recorded.load(waveformPath)) {
+      fprintf(stderr, "Could not load waveform '%s'\n", waveformPath);
+      return 1;
+    }
+  }
+  else {
+    synthetic.setSignal(STANDARD_CURRENT_PIN - A0, 2.5, 5.0 * SENSOR_SENSIBILITY, -30);
+    synthetic.setSignal(AMPLIFIED_CURRENT_PIN - A0, 2.5, 5.0 * SENSOR_SENSIBILITY * CURRENT_GAIN, -30);
+    synthetic.setSignal(VOLTAGE_PIN - A0, 2.5, 127.0 * VOLTAGE_MEASURING_RATIO);
+    synthetic.setNoise(0.5);
+  }
+  ReplayWaveform replayWaveform(waveformPath ? static_cast<HostWaveform*>(&recorded) : &synthetic);
+  HalADC::setWaveform(&replayWaveform);
+
+  Measure floatMeasure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+  Measure integerMeasure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+  ProfiledMeasure<BenchSensors> profiledMeasure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN);
+
+  // Recording pass, also the warm up
+  runKernel(floatMeasure, KERNEL_FLOAT, readings);
+  replay = &replayWaveform;
+
+  KernelResult floatKernel = repeatKernel(floatMeasure, KERNEL_FLOAT, readings, repeats);
+  KernelResult integerKernel = repeatKernel(integerMeasure, KERNEL_INTEGER, readings, repeats);
+  KernelResult profiledKernel = repeatKernel(profiledMeasure, KERNEL_INTEGER, readings, repeats);
+
+  Measure eventsMeasure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+  PowerEvents powerEvents;
+  eventsMeasure.setEvents(&powerEvents);
+  KernelResult eventsKernel = repeatKernel(eventsMeasure, KERNEL_INTEGER, readings, repeats);
+
+  printf("%u readings, %u runs per kernel\n", readings, repeats);
+  printf("kernel    ns/pair   (median)  current(A)  voltage(V)  realPower(W)  powerFactor\n");
+  printKernel("float", floatKernel);
+  printKernel("integer", integerKernel);
+  printKernel("profile", profiledKernel);
+  printKernel("events", eventsKernel);
+  printf("speedup %9.2fx %8.2fx\n", integerKernel.minNsPerPair > 0 ? floatKernel.minNsPerPair / integerKernel.minNsPerPair : 0,
+         integerKernel.nsPerPair > 0 ? floatKernel.nsPerPair / integerKernel.nsPerPair : 0);
+  return 0;
+}
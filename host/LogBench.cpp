@@ -0,0 +1,100 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Record logging benchmark
+ *  Writes the same reading repeatedly with the file opened and closed per
+ *  record and with the persistent log, and compares records/s and the worst
+ *  case latency of FileSystem::recordValues
+ *
+ *  Usage: medicao-bench-log [-n records] [-s sdRoot] [-i syncInterval(ms)]
+ *
+ *  The host file system hides the FAT and directory writes of the card, so
+ *  the ratio between the modes is a lower bound of the gain on the board
+ */
+
+#include <unistd.h>
+
+#include "../Measure.h"
+#include "../FileSystem.h"
+#include "../TimeCounter.h"
+
+
+#define STANDARD_CURRENT_PIN    A0
+#define AMPLIFIED_CURRENT_PIN   A1
+#define VOLTAGE_PIN             A2
+#define SENSOR_SENSIBILITY      0.100
+#define VOLTAGE_MEASURING_RATIO 5.0/680
+#define MAX_CURRENT_VALUE       20
+#define CURRENT_GAIN            10
+
+
+TimeCounter timeCounter;
+
+
+static void runLog(FileSystem* fileSystem, Measure* measure, char* fileName, bool persistentLog, uint32_t syncInterval, uint32_t records) {
+
+  fileSystem->setPersistentLog(persistentLog, syncInterval);
+  fileSystem->resetRecordStats();
+
+  uint32_t startMicros = micros();
+  for (uint32_t record = 0; record < records; ++record) {
+    if (!fileSystem->recordValues(fileName, measure)) {
+      fprintf(stderr, "Could not open/create file to write!\n");
+      exit(1);
+    }
+  }
+  fileSystem->closeLog();
+  uint32_t elapsed = micros() - startMicros;
+
+  printf("%-12s %12.0f %12u %12.2f\n", persistentLog ? "persistent" : "open/close",
+         elapsed ? 1e6 * records / elapsed : 0, fileSystem->getMaxRecordMicros(),
+         records ? double(elapsed) / records : 0);
+}
+
+
+int main(int argc, char** argv) {
+
+  uint32_t records = 2000;
+  uint32_t syncInterval = LOG_SYNC_INTERVAL;
+  const char* sdRoot = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:s:i:")) != -1) {
+    switch (option) {
+      case 'n': records = strtoul(optarg, NULL, 10); break;
+      case 's': sdRoot = optarg; break;
+      case 'i': syncInterval = strtoul(optarg, NULL, 10); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n records] [-s sdRoot] [-i syncInterval(ms)]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (sdRoot) {
+    setenv(HOST_SD_ROOT_ENV, sdRoot, 1);
+  }
+
+  SyntheticWaveform synthetic;
+  synthetic.setSignal(STANDARD_CURRENT_PIN - A0, 2.5, 5.0 * SENSOR_SENSIBILITY, -30);
+  synthetic.setSignal(VOLTAGE_PIN - A0, 2.5, 127.0 * VOLTAGE_MEASURING_RATIO);
+  HalADC::setWaveform(&synthetic);
+
+  Measure measure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+  measure.begin(1000, 1);
+  measure.acquireAndCalculate();
+
+  FileSystem fileSystem;
+  char folder[] = "bench";
+  char fileName[] = "log.csv";
+  timeCounter.begin();
+  if (!fileSystem.begin() || !fileSystem.makeDir(folder) || !fileSystem.changeDir(folder)) {
+    fprintf(stderr, "File System initialization failed!\n");
+    return 1;
+  }
+
+  printf("mode              records/s   worst(us)  mean(us)\n");
+  runLog(&fileSystem, &measure, fileName, false, syncInterval, records);
+  runLog(&fileSystem, &measure, fileName, true, syncInterval, records);
+  return 0;
+}
@@ -0,0 +1,6 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+// Host stand-in of the NeoSWSerial library header included by the sketch: the
+// host HAL provides the types the project uses
+#include "HAL_Host.h"
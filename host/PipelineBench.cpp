@@ -0,0 +1,384 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Measurement pipeline benchmark
+ *  Plays waveform fixtures through Measure (continuous acquisition, windows,
+ *  RMS and power) and FileSystem::recordValues, and reports the time per
+ *  sample pair, the records/s and the error of each reading against the
+ *  reference values of the load
+ *
+ *  Usage: medicao-bench-pipeline [-n readings] [-p samplesPerWindow] [-W numWindows]
+ *                                [-r pairRate] [-c cyclesPerWindow] [-f] [-R records]
+ *                                [-s sdRoot] [-g fixtureDir] [-e maxError(%)]
+ *                                [-t maxNsPerPair] [-w fixture.txt]...
+ *
+ *  The synthetic loads (resistive, inductive, non-linear and low current)
+ *  are written as fixture files of one second, with their analytic RMS,
+ *  power and power factor as reference. Fixtures given with -w (recorded
+ *  waveforms: A0 standard current, A1 amplified current, A2 voltage) are
+ *  referenced by the same values computed in double precision from their
+ *  codes, which must hold whole cycles (captured ones: the voltage aligned to
+ *  the current by the lag of their header)
+ *
+ *  The exit status is 1 when an error is above maxError (default 1%, for the
+ *  power factor maxError/100) or a kernel time above maxNsPerPair, so speed
+ *  and accuracy regressions can be checked by scripts. Fixtures are exact for
+ *  pair rates with whole microsecond conversions (2000, 2500, 4000, 5000)
+ */
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../Measure.h"
+#include "../FileSystem.h"
+#include "../TimeCounter.h"
+
+
+#define STANDARD_CURRENT_PIN    A0
+#define AMPLIFIED_CURRENT_PIN   A1
+#define VOLTAGE_PIN             A2
+#define SENSOR_SENSIBILITY      0.100
+#define VOLTAGE_MEASURING_RATIO 5.0/680
+#define MAX_CURRENT_VALUE       20
+#define CURRENT_GAIN            10
+
+#define FIXTURE_VCC       5.0
+#define FIXTURE_SECONDS   1      // Whole cycles of the line frequency
+#define FIXTURE_NOISE     0.5    // ADC codes RMS
+#define FIXTURE_CHANNELS  3
+#define MAX_COMPONENTS    4
+
+
+TimeCounter timeCounter;
+
+
+// Synthetic loads: voltage and current as sums of harmonics (RMS, degrees)
+struct Component {
+  uint8_t order;
+  float rms, phase;
+};
+
+struct Load {
+  const char* name;
+  Component voltage[MAX_COMPONENTS];
+  Component current[MAX_COMPONENTS];
+};
+
+static const Load LOADS[] = {
+  { "resistive",   { { 1, 127.0, 0 } },                 { { 1, 5.0, 0 } } },
+  { "inductive",   { { 1, 127.0, 0 } },                 { { 1, 5.0, -36.87 } } },
+  { "non-linear",  { { 1, 127.0, 0 }, { 5, 3.81, 0 } }, { { 1, 3.0, -10 }, { 3, 2.4, 180 }, { 5, 1.8, 30 }, { 7, 1.2, 200 } } },
+  { "low-current", { { 1, 127.0, 0 } },                 { { 1, 0.3, -20 } } },
+};
+static const uint8_t NUM_LOADS = sizeof(LOADS) / sizeof(LOADS[0]);
+
+
+struct Reference {
+  double currentRMS, voltageRMS, realPower, powerFactor;
+};
+
+struct Result {
+  double currentRMS, voltageRMS, realPower, powerFactor;
+  double kernelNs, pipelineNs;
+  double csvRecords, binaryRecords;
+};
+
+
+//==============================================================================
+// References
+//
+static Reference analyticReference(const Load& load) {
+
+  Reference reference = { 0, 0, 0, 0 };
+  for (uint8_t v = 0; v < MAX_COMPONENTS && load.voltage[v].order; ++v) {
+    reference.voltageRMS += load.voltage[v].rms * load.voltage[v].rms;
+    for (uint8_t i = 0; i < MAX_COMPONENTS && load.current[i].order; ++i) {
+      if (load.current[i].order == load.voltage[v].order) {
+        reference.realPower += load.voltage[v].rms * load.current[i].rms * cos((load.voltage[v].phase - load.current[i].phase) * M_PI / 180);
+      }
+    }
+  }
+  for (uint8_t i = 0; i < MAX_COMPONENTS && load.current[i].order; ++i) {
+    reference.currentRMS += load.current[i].rms * load.current[i].rms;
+  }
+  reference.voltageRMS = sqrt(reference.voltageRMS);
+  reference.currentRMS = sqrt(reference.currentRMS);
+  reference.powerFactor = reference.realPower / (reference.voltageRMS * reference.currentRMS);
+  return reference;
+}
+
+// Reference of a recorded fixture, from its standard current and voltage codes.
+// The voltage of a captured line is interpolated back to the instant of the
+// current, by its lag, as Measure does
+static bool fixtureReference(const char* path, Reference* reference) {
+
+  RecordedWaveform fixture;
+  if (!fixture.load(path) || fixture.getNumChannels() < FIXTURE_CHANNELS) {
+    return false;
+  }
+
+  uint32_t frames = fixture.getNumFrames();
+  uint32_t period = fixture.getPeriodMicros();
+  double sumCurrent = 0, sumVoltage = 0;
+  for (uint32_t frame = 0; frame < frames; ++frame) {
+    sumCurrent += fixture.sample(STANDARD_CURRENT_PIN - A0, frame * period);
+    sumVoltage += fixture.sample(VOLTAGE_PIN - A0, frame * period);
+  }
+  double meanCurrent = sumCurrent / frames, meanVoltage = sumVoltage / frames;
+
+  double lag = double(fixture.getVoltageLagMicros()) / period;
+  double sumSqrCurrent = 0, sumSqrVoltage = 0, sumPower = 0;
+  for (uint32_t frame = 0; frame < frames; ++frame) {
+    double current = fixture.sample(STANDARD_CURRENT_PIN - A0, frame * period) - meanCurrent;
+    double voltage = fixture.sample(VOLTAGE_PIN - A0, frame * period) - meanVoltage;
+    double previous = fixture.sample(VOLTAGE_PIN - A0, (frame + frames - 1) * period) - meanVoltage;
+    sumSqrCurrent += current * current;
+    sumSqrVoltage += voltage * voltage;
+    sumPower += current * (voltage - lag * (voltage - previous));
+  }
+
+  double voltsPerCode = FIXTURE_VCC / 1024;
+  double currentScale = voltsPerCode / SENSOR_SENSIBILITY;
+  double voltageScale = voltsPerCode / (VOLTAGE_MEASURING_RATIO);
+  reference->currentRMS = sqrt(sumSqrCurrent / frames) * currentScale;
+  reference->voltageRMS = sqrt(sumSqrVoltage / frames) * voltageScale;
+  reference->realPower = sumPower / frames * currentScale * voltageScale;
+  reference->powerFactor = reference->realPower / (reference->currentRMS * reference->voltageRMS);
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Fixture file of a synthetic load, sampled at the conversion period
+//
+static bool writeFixture(const Load& load, const char* path, uint32_t periodMicros) {
+
+  SyntheticWaveform synthetic(60.0, FIXTURE_VCC);
+  const Component* current = load.current;
+  const Component* voltage = load.voltage;
+
+  synthetic.setSignal(STANDARD_CURRENT_PIN - A0, 2.5, current[0].rms * SENSOR_SENSIBILITY, current[0].phase);
+  synthetic.setSignal(AMPLIFIED_CURRENT_PIN - A0, 2.5, current[0].rms * SENSOR_SENSIBILITY * CURRENT_GAIN, current[0].phase);
+  synthetic.setSignal(VOLTAGE_PIN - A0, 2.5, voltage[0].rms * VOLTAGE_MEASURING_RATIO, voltage[0].phase);
+  for (uint8_t i = 1; i < MAX_COMPONENTS && current[i].order; ++i) {
+    synthetic.addHarmonic(STANDARD_CURRENT_PIN - A0, current[i].order, current[i].rms * SENSOR_SENSIBILITY, current[i].phase);
+    synthetic.addHarmonic(AMPLIFIED_CURRENT_PIN - A0, current[i].order, current[i].rms * SENSOR_SENSIBILITY * CURRENT_GAIN, current[i].phase);
+  }
+  for (uint8_t v = 1; v < MAX_COMPONENTS && voltage[v].order; ++v) {
+    synthetic.addHarmonic(VOLTAGE_PIN - A0, voltage[v].order, voltage[v].rms * VOLTAGE_MEASURING_RATIO, voltage[v].phase);
+  }
+  synthetic.setNoise(FIXTURE_NOISE);
+
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    return false;
+  }
+  fprintf(file, "# medicao-potencia waveform v1\n");
+  fprintf(file, "# period_us %u\n", periodMicros);
+  fprintf(file, "# load %s\n", load.name);
+  uint32_t frames = FIXTURE_SECONDS * 1000000UL / periodMicros;
+  for (uint32_t frame = 0; frame < frames; ++frame) {
+    uint32_t t = frame * periodMicros;
+    fprintf(file, "%u %u %u\n", synthetic.sample(0, t), synthetic.sample(1, t), synthetic.sample(2, t));
+  }
+  return (fclose(file) == 0);
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Readings of a fixture, then records of the last one in both formats
+//
+struct Settings {
+  uint32_t readings, records;
+  uint16_t samplesPerWindow, numWindows, pairRate;
+  uint8_t cyclesPerWindow, kernel;
+};
+
+static double recordRate(FileSystem* fileSystem, Measure* measure, uint8_t format, uint32_t records) {
+
+  char fileName[LOG_NAME_SIZE];
+  sprintf(fileName, "bench.%s", format == LOG_FORMAT_BINARY ? "bin" : "csv");
+  fileSystem->setLogFormat(format);
+  fileSystem->setPersistentLog(true);
+
+  uint32_t startMicros = micros();
+  for (uint32_t record = 0; record < records; ++record) {
+    if (!fileSystem->recordValues(fileName, measure)) {
+      fprintf(stderr, "Could not open/create file to write!\n");
+      exit(1);
+    }
+  }
+  fileSystem->closeLog();
+  uint32_t elapsed = micros() - startMicros;
+  return elapsed ? 1e6 * records / elapsed : 0;
+}
+
+static bool runFixture(const char* path, const Settings& settings, FileSystem* fileSystem, Result* result) {
+
+  RecordedWaveform fixture;
+  if (!fixture.load(path)) {
+    fprintf(stderr, "Could not load waveform '%s'\n", path);
+    return false;
+  }
+  HalADC::setWaveform(&fixture);
+  HalADC::setVcc(FIXTURE_VCC);
+
+  SampleBuffer sampleBuffer;
+  Measure measure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+  measure.setKernel(settings.kernel);
+  measure.setSampleBuffer(&sampleBuffer);
+  measure.setCyclesPerWindow(settings.cyclesPerWindow);
+  measure.begin(settings.samplesPerWindow, settings.numWindows, settings.pairRate);
+
+  // The first reading selects the current range
+  measure.acquireAndCalculate();
+
+  uint64_t kernelMicros = 0, pipelineMicros = 0;
+  uint32_t firstConversion = HalADC::getConversionCount();
+  memset(result, 0, sizeof(*result));
+  for (uint32_t reading = 0; reading < settings.readings; ++reading) {
+    uint32_t startMicros = micros();
+    measure.acquireAndCalculate();
+    pipelineMicros += micros() - startMicros;
+    kernelMicros += measure.getKernelMicros();
+
+    result->currentRMS += measure.getCurrentRMS();
+    result->voltageRMS += measure.getVoltageRMS();
+    result->realPower += measure.getRealPower();
+    result->powerFactor += measure.getPowerFactor();
+  }
+  HalADC::stopContinuous();
+
+  uint32_t pairs = (HalADC::getConversionCount() - firstConversion) / 2;
+  result->currentRMS /= settings.readings;
+  result->voltageRMS /= settings.readings;
+  result->realPower /= settings.readings;
+  result->powerFactor /= settings.readings;
+  result->kernelNs = pairs ? 1000.0 * kernelMicros / pairs : 0;
+  result->pipelineNs = pairs ? 1000.0 * pipelineMicros / pairs : 0;
+
+  result->csvRecords = recordRate(fileSystem, &measure, LOG_FORMAT_CSV, settings.records);
+  result->binaryRecords = recordRate(fileSystem, &measure, LOG_FORMAT_BINARY, settings.records);
+  return true;
+}
+//------------------------------------------------------------------------------
+
+
+//==============================================================================
+// Report line -- Return within the limits
+//
+static double relativeError(double value, double reference) {
+  return reference ? 100 * (value - reference) / reference : 0;
+}
+
+static bool report(const char* name, const Result& result, const Reference& reference, float maxError, float maxNsPerPair) {
+
+  double currentError = relativeError(result.currentRMS, reference.currentRMS);
+  double voltageError = relativeError(result.voltageRMS, reference.voltageRMS);
+  double powerError = relativeError(result.realPower, reference.realPower);
+  double powerFactorError = result.powerFactor - reference.powerFactor;
+
+  bool pass = fabs(currentError) <= maxError && fabs(voltageError) <= maxError &&
+              fabs(powerError) <= maxError && fabs(powerFactorError) <= maxError / 100 &&
+              (maxNsPerPair <= 0 || result.kernelNs <= maxNsPerPair);
+
+  printf("%-14s %9.2f %9.2f %10.0f %10.0f %8.3f %8.3f %8.3f %9.5f  %s\n", name,
+         result.kernelNs, result.pipelineNs, result.csvRecords, result.binaryRecords,
+         currentError, voltageError, powerError, powerFactorError, pass ? "ok" : "FAIL");
+  return pass;
+}
+//------------------------------------------------------------------------------
+
+
+int main(int argc, char** argv) {
+
+  Settings settings = { 5, 2000, 5000, 5, 4000, 12, KERNEL_INTEGER };
+  const char* sdRoot = NULL;
+  const char* fixtureDir = "fixtures";
+  float maxError = 1.0, maxNsPerPair = 0;
+  const char* recorded[16];
+  uint8_t numRecorded = 0;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:p:W:r:c:fR:s:g:e:t:w:")) != -1) {
+    switch (option) {
+      case 'n': settings.readings = strtoul(optarg, NULL, 10); break;
+      case 'p': settings.samplesPerWindow = strtoul(optarg, NULL, 10); break;
+      case 'W': settings.numWindows = strtoul(optarg, NULL, 10); break;
+      case 'r': settings.pairRate = strtoul(optarg, NULL, 10); break;
+      case 'c': settings.cyclesPerWindow = strtoul(optarg, NULL, 10); break;
+      case 'f': settings.kernel = KERNEL_FLOAT; break;
+      case 'R': settings.records = strtoul(optarg, NULL, 10); break;
+      case 's': sdRoot = optarg; break;
+      case 'g': fixtureDir = optarg; break;
+      case 'e': maxError = atof(optarg); break;
+      case 't': maxNsPerPair = atof(optarg); break;
+      case 'w':
+        if (numRecorded < sizeof(recorded) / sizeof(recorded[0])) {
+          recorded[numRecorded++] = optarg;
+        }
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n readings] [-p samplesPerWindow] [-W numWindows] [-r pairRate] [-c cyclesPerWindow] [-f]"
+                        " [-R records] [-s sdRoot] [-g fixtureDir] [-e maxError(%%)] [-t maxNsPerPair] [-w fixture.txt]...\n", argv[0]);
+        return 2;
+    }
+  }
+  if (settings.pairRate == 0 || settings.readings == 0 || settings.numWindows == 0) {
+    fprintf(stderr, "Pair rate, readings and windows must be positive\n");
+    return 2;
+  }
+  if (sdRoot) {
+    setenv(HOST_SD_ROOT_ENV, sdRoot, 1);
+  }
+
+  FileSystem fileSystem;
+  char folder[] = "bench";
+  timeCounter.begin();
+  if (!fileSystem.begin() || !fileSystem.makeDir(folder) || !fileSystem.changeDir(folder)) {
+    fprintf(stderr, "File System initialization failed!\n");
+    return 1;
+  }
+  mkdir(fixtureDir, 0755);
+
+  uint32_t periodMicros = 1000000UL / (2UL * settings.pairRate);
+  printf("pair rate %u/s, %u samples or %u cycles per window, %u windows, %s kernel, %u readings\n",
+         settings.pairRate, settings.samplesPerWindow, settings.cyclesPerWindow, settings.numWindows,
+         settings.kernel == KERNEL_FLOAT ? "float" : "integer", settings.readings);
+  printf("load           kernel    pipeline   csv        binary     errors (%%)                  PF\n");
+  printf("               (ns/pair) (ns/pair)  (rec/s)    (rec/s)    current  voltage  power    (diff)\n");
+
+  bool pass = true;
+  Result result;
+  for (uint8_t i = 0; i < NUM_LOADS; ++i) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.txt", fixtureDir, LOADS[i].name);
+    if (!writeFixture(LOADS[i], path, periodMicros)) {
+      fprintf(stderr, "Could not write fixture '%s'\n", path);
+      return 1;
+    }
+    if (!runFixture(path, settings, &fileSystem, &result)) {
+      return 1;
+    }
+    pass &= report(LOADS[i].name, result, analyticReference(LOADS[i]), maxError, maxNsPerPair);
+  }
+
+  for (uint8_t i = 0; i < numRecorded; ++i) {
+    Reference reference;
+    if (!fixtureReference(recorded[i], &reference)) {
+      fprintf(stderr, "Fixture '%s' needs %u channels\n", recorded[i], FIXTURE_CHANNELS);
+      return 1;
+    }
+    if (!runFixture(recorded[i], settings, &fileSystem, &result)) {
+      return 1;
+    }
+    const char* name = strrchr(recorded[i], '/');
+    pass &= report(name ? name + 1 : recorded[i], result, reference, maxError, maxNsPerPair);
+  }
+
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Host build of the sketch
+ *  setup() and loop() of codigoModularizado.ino over the host HAL, with the
+ *  ADC sampling in real time and the ports on the devices of the environment
+ *
+ *  Environment: MEDICAO_SERIAL, MEDICAO_BLUETOOTH (port devices, e.g. a pty),
+ *  MEDICAO_SD_ROOT (SD Card directory), MEDICAO_WAVEFORM (fixture file,
+ *  synthetic load when not set)
+ */
+
+#include <unistd.h>
+
+#include "../codigoModularizado.ino"
+
+#define HOST_WAVEFORM_ENV "MEDICAO_WAVEFORM"
+
+static char** programArguments;
+
+
+// Software reset: the board jumps to address 0, the host restarts the program
+static void hostReset() {
+  fprintf(stderr, "Reset\n");
+  execv("/proc/self/exe", programArguments);
+  exit(1);
+}
+
+
+int main(int argc, char** argv) {
+
+  (void)argc;
+  programArguments = argv;
+  resetFunc = hostReset;
+
+  SyntheticWaveform synthetic;
+  RecordedWaveform recorded;
+  const char* waveformPath = getenv(HOST_WAVEFORM_ENV);
+  if (waveformPath && *waveformPath) {
+    if (!recorded.load(waveformPath)) {
+      fprintf(stderr, "Could not load waveform '%s'\n", waveformPath);
+      return 1;
+    }
+    HalADC::setWaveform(&recorded);
+  }
+  else {
+    synthetic.setSignal(STANDARD_CURRENT_PIN - A0, 2.5, 5.0 * SENSOR_SENSIBILITY, -30);
+    synthetic.setSignal(AMPLIFIED_CURRENT_PIN - A0, 2.5, 5.0 * SENSOR_SENSIBILITY * CURRENT_GAIN, -30);
+    synthetic.setSignal(VOLTAGE_PIN - A0, 2.5, 127.0 * VOLTAGE_MEASURING_RATIO);
+    synthetic.setNoise(0.5);
+    HalADC::setWaveform(&synthetic);
+  }
+  HalADC::setRealTime(true);
+
+  // The Bluetooth module reports a connection on its state pin
+  const char* bluetooth = getenv(HOST_BLUETOOTH_ENV);
+  digitalWrite(BLUETOOTH_STATE_PIN, (bluetooth && *bluetooth) ? HIGH : LOW);
+
+  setup();
+  for (;;) {
+    loop();
+
+    // The core calls serialEvent() between loop() calls when data is waiting
+    if (Serial.available()) {
+      serialEvent();
+    }
+    yield();
+  }
+}
@@ -0,0 +1,321 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Waveform stream capture
+ *  Starts the raw sample stream with the 'O' command of the sketch, follows
+ *  it at the stream rate and writes the pairs of one phase as a waveform
+ *  fixture (standard current, amplified current and voltage columns, as the
+ *  benchmarks take them)
+ *
+ *  Usage: medicao-capture -p device [-o fixture.txt] [-s seconds] [-P phase]
+ *
+ *  Each pair has one current code: the channel not sampled is derived from
+ *  it, through the gain and the mean of each channel over the capture.
+ *  Breaks in the sample sequence (blocks skipped by the link or dropped by
+ *  the acquisition, reference conversions) are comment lines of the fixture
+ */
+
+#include <unistd.h>
+
+#include <vector>
+
+#include "../WaveformStream.h"
+
+#define RECEIVE_TIMEOUT 2000  // ms without any byte from the device
+#define REQUEST_TIMEOUT 1000  // ms for the device to answer the command
+#define REQUEST_RETRIES 5
+#define CONTROL_BAUD_RATE 9600
+
+
+static HostSerialPort port(NULL);
+
+struct CapturedPair {
+  uint16_t current, voltage;
+  bool standard;     // Current code of the standard channel
+};
+
+struct CaptureGap {
+  size_t pair;       // Pairs before the gap
+  uint16_t lostBlocks;
+  bool reference;    // Reference conversions only
+};
+
+
+// Next byte from the device, or -1 after the timeout
+static int readByte(uint32_t timeout) {
+  uint32_t startTime = millis();
+  while (!port.available()) {
+    if (millis() - startTime >= timeout) {
+      return -1;
+    }
+    delayMicroseconds(200);
+  }
+  return port.read();
+}
+
+// Skip the device output up to a text -- Return text seen
+static bool waitFor(const char* text, uint32_t timeout=RECEIVE_TIMEOUT) {
+  size_t matched = 0;
+  while (text[matched]) {
+    int value = readByte(timeout);
+    if (value < 0) {
+      return false;
+    }
+    matched = (value == text[matched]) ? matched + 1 : (value == text[0] ? 1 : 0);
+  }
+  return true;
+}
+
+// Next frame with a valid CRC -- Return its payload length, -1 on timeout
+static int readFrame(uint8_t* frame, uint32_t* badFrames) {
+
+  for (;;) {
+    int value = readByte(RECEIVE_TIMEOUT);
+    if (value < 0) {
+      return -1;
+    }
+    if (value != FRAME_START) {
+      continue;
+    }
+
+    frame[0] = uint8_t(value);
+    for (uint16_t i = 1; i < FRAME_HEADER_SIZE; ++i) {
+      if ((value = readByte(RECEIVE_TIMEOUT)) < 0) {
+        return -1;
+      }
+      frame[i] = uint8_t(value);
+    }
+    uint16_t length = frame[8] | (uint16_t(frame[9]) << 8);
+    if (length > FRAME_MAX_PAYLOAD) {
+      ++*badFrames;
+      continue;
+    }
+    for (uint16_t i = 0; i < length + 2; ++i) {
+      if ((value = readByte(RECEIVE_TIMEOUT)) < 0) {
+        return -1;
+      }
+      frame[FRAME_HEADER_SIZE + i] = uint8_t(value);
+    }
+
+    uint16_t checksum = frame[FRAME_HEADER_SIZE + length] | (uint16_t(frame[FRAME_HEADER_SIZE + length + 1]) << 8);
+    if (FrameLink::crc16(0xFFFF, frame + 1, FRAME_HEADER_SIZE - 1 + length) == checksum) {
+      return length;
+    }
+    ++*badFrames;
+  }
+}
+
+static uint16_t clampCode(double code) {
+  return (code < 0) ? 0 : (code > 1023) ? 1023 : uint16_t(code + 0.5);
+}
+
+
+int main(int argc, char** argv) {
+
+  const char* device = NULL;
+  const char* outputPath = "capture.txt";
+  double seconds = 2;
+  uint8_t selectedPhase = 1;
+
+  int option;
+  while ((option = getopt(argc, argv, "p:o:s:P:")) != -1) {
+    switch (option) {
+      case 'p': device = optarg; break;
+      case 'o': outputPath = optarg; break;
+      case 's': seconds = atof(optarg); break;
+      case 'P': selectedPhase = uint8_t(atoi(optarg)); break;
+      default: device = NULL; optind = argc + 1; break;
+    }
+  }
+  if (!device || optind != argc || seconds <= 0 || selectedPhase < 1 || selectedPhase > SAMPLE_MAX_PHASES) {
+    fprintf(stderr, "Usage: %s -p device [-o fixture.txt] [-s seconds] [-P phase]\n", argv[0]);
+    return 2;
+  }
+
+  if (!port.open(device) || !port.setBaudRate(CONTROL_BAUD_RATE)) {
+    fprintf(stderr, "Could not open '%s'\n", device);
+    return 1;
+  }
+
+  // Command, then the reply line with the stream rate. The command is lost
+  // if the device is busy or still starting: repeat it
+  bool answered = false;
+  for (uint8_t retry = 0; retry < REQUEST_RETRIES && !answered; ++retry) {
+    port.write('O');
+    answered = waitFor("Streaming at ", REQUEST_TIMEOUT);
+  }
+  if (!answered) {
+    fprintf(stderr, "Device did not start the stream (continuous acquisition and USB serial needed)\n");
+    return 1;
+  }
+  uint32_t baudRate = 0;
+  for (int value = readByte(REQUEST_TIMEOUT); value >= '0' && value <= '9'; value = readByte(REQUEST_TIMEOUT)) {
+    baudRate = baudRate * 10 + (value - '0');
+  }
+  waitFor("\n", REQUEST_TIMEOUT);
+  if (!port.setBaudRate(baudRate)) {
+    fprintf(stderr, "Stream rate %u not supported\n", baudRate);
+    port.write('x');
+    return 1;
+  }
+
+  uint8_t frame[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + 2];
+  uint8_t numPhases = 0, gain = 1, channels[SAMPLE_MAX_PHASES][3];
+  bool dualRange = false;
+  uint16_t pairRate = 0, expected = 0, lastDropped = 0;
+  uint32_t badFrames = 0, frames = 0, skippedBlocks = 0, droppedBlocks = 0, referenceGaps = 0;
+  uint32_t sentBlocks = 0, targetPairs = 0;
+  bool started = false, complete = false, stopping = false;
+  std::vector<CapturedPair> pairs;
+  std::vector<CaptureGap> gaps;
+
+  for (;;) {
+    int length = readFrame(frame, &badFrames);
+    if (length < 0) {
+      break;
+    }
+    uint8_t type = frame[1];
+    uint16_t sequence = frame[2] | (uint16_t(frame[3]) << 8);
+    uint32_t offset = frame[4] | (uint32_t(frame[5]) << 8) | (uint32_t(frame[6]) << 16) | (uint32_t(frame[7]) << 24);
+    const uint8_t* payload = frame + FRAME_HEADER_SIZE;
+
+    if (type == FRAME_END) {
+      sentBlocks = offset;
+      complete = true;
+      break;
+    }
+
+    // The information frame comes first and then again every STREAM_INFO_INTERVAL blocks
+    if (type == FRAME_STREAM_INFO) {
+      if (payload[0] != STREAM_VERSION || payload[1] < selectedPhase || payload[1] > SAMPLE_MAX_PHASES) {
+        fprintf(stderr, "Stream version %u with %u phases: phase %u not available\n", payload[0], payload[1], selectedPhase);
+        port.write('x');
+        return 1;
+      }
+      numPhases = payload[1];
+      dualRange = (payload[2] & STREAM_DUAL_RANGE);
+      gain = payload[3] ? payload[3] : 1;
+      pairRate = payload[4] | (uint16_t(payload[5]) << 8);
+      memcpy(channels, payload + 6, 3 * numPhases);
+      targetPairs = uint32_t(seconds * pairRate);
+      continue;
+    }
+    if (type != FRAME_WAVEFORM || numPhases == 0 || length != 1 + numPhases + SAMPLE_BLOCK_PAIRS * STREAM_PAIR_SIZE) {
+      continue;
+    }
+
+    // Breaks of the sequence: blocks the link skipped (or lost), blocks the
+    // acquisition dropped, reference conversions before the block
+    uint16_t lost = started ? uint16_t(sequence - expected) : 0;
+    uint16_t dropped = started ? uint16_t(offset - lastDropped) : 0;
+    bool reference = started && (payload[0] & STREAM_AFTER_REFERENCE);
+    if (lost || dropped || reference) {
+      CaptureGap gap = { pairs.size(), uint16_t(lost + dropped), !lost && !dropped };
+      gaps.push_back(gap);
+      skippedBlocks += lost;
+      droppedBlocks += dropped;
+      referenceGaps += (!lost && !dropped);
+    }
+    started = true;
+    expected = sequence + 1;
+    lastDropped = uint16_t(offset);
+    ++frames;
+
+    // Pairs of the selected phase
+    uint8_t firstPhase = (payload[0] >> 1) & 0x03;
+    const uint8_t* blockChannels = payload + 1;
+    const uint8_t* packed = payload + 1 + numPhases;
+    for (uint8_t pairIndex = 0; pairIndex < SAMPLE_BLOCK_PAIRS && !stopping; ++pairIndex, packed += STREAM_PAIR_SIZE) {
+      uint8_t phase = (firstPhase + pairIndex) % numPhases;
+      if (phase != selectedPhase - 1) {
+        continue;
+      }
+      CapturedPair pair;
+      pair.current = packed[0] | (uint16_t(packed[2] & 0x03) << 8);
+      pair.voltage = packed[1] | (uint16_t(packed[2] & 0x0C) << 6);
+      pair.standard = dualRange ? (packed[2] & STREAM_STANDARD_RANGE) : (blockChannels[phase] == channels[phase][0]);
+      pairs.push_back(pair);
+    }
+
+    if (!stopping && pairs.size() >= targetPairs) {
+      port.write('x');  // Any char stops the stream
+      stopping = true;
+    }
+  }
+
+  port.setBaudRate(CONTROL_BAUD_RATE);
+  waitFor("END", REQUEST_TIMEOUT);
+
+  if (pairs.empty()) {
+    fprintf(stderr, "No samples received (%u bad frames)\n", badFrames);
+    return 1;
+  }
+  if (pairs.size() > targetPairs) {
+    pairs.resize(targetPairs);
+  }
+
+  // Mean code of each current channel: the channel not sampled in a pair is
+  // derived from the other one around these means
+  double sum[2] = { 0, 0 };
+  uint32_t count[2] = { 0, 0 };
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    sum[pairs[i].standard] += pairs[i].current;
+    ++count[pairs[i].standard];
+  }
+  double meanAmplified = count[0] ? sum[0] / count[0] : sum[1] / count[1];
+  double meanStandard = count[1] ? sum[1] / count[1] : meanAmplified;
+
+  FILE* output = fopen(outputPath, "w");
+  if (!output) {
+    fprintf(stderr, "Could not open '%s'\n", outputPath);
+    return 1;
+  }
+  // The voltage of a pair is converted after its current: by one conversion
+  // of the 2 * phases of a pair period, or 1/3 of the period after the
+  // standard current with dual range
+  uint32_t periodMicros = pairRate ? (1000000 + pairRate / 2) / pairRate : 0;
+  fprintf(output, "# medicao-potencia waveform v1\n");
+  fprintf(output, "# period_us %u\n", periodMicros);
+  fprintf(output, "# voltage_lag_us %u\n", dualRange ? (periodMicros + 1) / 3 : (periodMicros + numPhases) / (2 * numPhases));
+  fprintf(output, "# load capture\n");
+  fprintf(output, "# source %s phase %u, %u pairs/s, gain %u, channels %u %u %u%s\n", device, selectedPhase, pairRate, gain,
+          channels[selectedPhase - 1][0], channels[selectedPhase - 1][1], channels[selectedPhase - 1][2],
+          dualRange ? ", dual range" : "");
+
+  size_t nextGap = 0;
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    for (; nextGap < gaps.size() && gaps[nextGap].pair == i; ++nextGap) {
+      if (gaps[nextGap].reference) {
+        fprintf(output, "# gap: reference conversions\n");
+      }
+      else {
+        fprintf(output, "# gap: %u blocks lost\n", gaps[nextGap].lostBlocks);
+      }
+    }
+    uint16_t standard, amplified;
+    if (pairs[i].standard) {
+      standard = pairs[i].current;
+      amplified = clampCode(meanAmplified + (pairs[i].current - meanStandard) * gain);
+    }
+    else {
+      amplified = pairs[i].current;
+      standard = clampCode(meanStandard + (pairs[i].current - meanAmplified) / gain);
+    }
+    fprintf(output, "%u %u %u\n", standard, amplified, pairs[i].voltage);
+  }
+  fclose(output);
+
+  fprintf(stderr, "%s: %zu pairs (%.2f s), %u frames, %u bad frames, %u blocks skipped by the link, "
+          "%u dropped by the acquisition, %u reference gaps\n",
+          outputPath, pairs.size(), pairRate ? double(pairs.size()) / pairRate : 0, frames, badFrames,
+          skippedBlocks, droppedBlocks, referenceGaps);
+  if (pairRate && 1000000 % pairRate) {
+    fprintf(stderr, "Warning: %u pairs/s is not a whole number of microseconds per pair, the fixture period is rounded\n", pairRate);
+  }
+  if (!complete) {
+    fprintf(stderr, "Stream end not received (%u blocks sent)\n", sentBlocks);
+  }
+  return 0;
+}
@@ -0,0 +1,292 @@
+// Code by Marcelo Soares and Douglas Quintanilha
+// Released to the public domain
+
+
+/*----------------------------------------------------------------------------
+ *  Host runner
+ *  Measure and record loop of the sketch, driven by a synthetic or recorded
+ *  waveform and writing to a directory backed SD Card
+ *
+ *  Usage: medicao-host [-n readings] [-r pairRate] [-c cyclesPerWindow] [-k] [-D] [-I currentRMS] [-P phases] [-H] [-l] [-a readingsPerDay] [-b] [-T] [-E] [-w waveform.txt] [-s sdRoot] [-d folder]
+ *    -P: 2 or 3 phases interleaved in one continuous acquisition (-r is the pair rate of each phase)
+ *    -a: day files of the persistent log preallocated for this many readings (needs -l)
+ *    -E: power quality events of the first phase to EVENTS_FILE (needs -r). The synthetic
+ *        load gets a sag, an interruption, a swell and an inrush current, one per reading at 4000 pairs/s
+ */
+
+#include <unistd.h>
+
+#include "../Measure.h"
+#include "../PhaseSet.h"
+#include "../FileSystem.h"
+#include "../TimeCounter.h"
+
+
+// Same configuration as the sketch
+#define SAMPLES_PER_WINDOW 5000
+#define NUM_WINDOWS        5
+
+#define STANDARD_CURRENT_PIN    A0
+#define AMPLIFIED_CURRENT_PIN   A1
+#define VOLTAGE_PIN             A2
+#define SENSOR_SENSIBILITY      0.100
+#define VOLTAGE_MEASURING_RATIO 5.0/680
+#define MAX_CURRENT_VALUE       20
+#define CURRENT_GAIN            10
+
+// Pins of the second and third phases (Mega)
+#define PHASE2_STANDARD_CURRENT_PIN  A3
+#define PHASE2_AMPLIFIED_CURRENT_PIN A4
+#define PHASE2_VOLTAGE_PIN           A5
+#define PHASE3_STANDARD_CURRENT_PIN  A6
+#define PHASE3_AMPLIFIED_CURRENT_PIN A7
+#define PHASE3_VOLTAGE_PIN           A8
+
+#define FILE_NAME_FORMAT        "%4d.%02d.%02d.csv"
+#define EVENTS_FILE             "events.csv"
+#define BINARY_FILE_NAME_FORMAT "%4d.%02d.%02d.bin"
+
+// Synthetic load: 127V grid feeding 5A with power factor 0.866
+#define SYNTHETIC_VOLTAGE_RMS 127.0
+#define SYNTHETIC_CURRENT_RMS 5.0
+#define SYNTHETIC_PHASE_DEG   30.0
+
+// Events of the synthetic load (-E), from the start and a reading apart at
+// 4000 pairs/s (us of the sampling clock), and the inrush limit (A)
+#define SYNTHETIC_EVENTS_START 2000000
+#define SYNTHETIC_EVENTS_STEP  7000000
+#define INRUSH_CURRENT         10.0
+
+
+TimeCounter timeCounter;
+ArduinoOutStream cout(Serial);
+
+Measure measure(STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+Measure phase2(PHASE2_STANDARD_CURRENT_PIN, PHASE2_AMPLIFIED_CURRENT_PIN, PHASE2_VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+Measure phase3(PHASE3_STANDARD_CURRENT_PIN, PHASE3_AMPLIFIED_CURRENT_PIN, PHASE3_VOLTAGE_PIN, MAX_CURRENT_VALUE, CURRENT_GAIN, SENSOR_SENSIBILITY, VOLTAGE_MEASURING_RATIO);
+SampleBuffer sampleBuffer;
+PhaseSet phaseSet;
+FileSystem fileSystem;
+Harmonics harmonics;
+PhaseStats phaseStats;
+PowerEvents powerEvents;
+
+char fileName[15];
+
+
+int main(int argc, char** argv) {
+
+  uint32_t readings = 10;
+  uint16_t pairRate = 0;
+  uint8_t cyclesPerWindow = 0;
+  uint8_t kernel = KERNEL_FLOAT;
+  bool dualRange = false;
+  float currentRMS = SYNTHETIC_CURRENT_RMS;
+  uint8_t phases = 1;
+  bool harmonicAnalysis = false;
+  bool persistentLog = false;
+  uint32_t preallocatedReadings = 0;
+  bool timingStats = false;
+  bool eventDetection = false;
+  uint8_t logFormat = LOG_FORMAT_CSV;
+  const char* waveformPath = NULL;
+  const char* sdRoot = NULL;
+  char folder[20] = "host";
+
+  int option;
+  while ((option = getopt(argc, argv, "n:r:c:kDI:P:Hla:bTEw:s:d:")) != -1) {
+    switch (option) {
+      case 'n': readings = strtoul(optarg, NULL, 10); break;
+      case 'r': pairRate = strtoul(optarg, NULL, 10); break;
+      case 'c': cyclesPerWindow = strtoul(optarg, NULL, 10); break;
+      case 'k': kernel = KERNEL_INTEGER; break;
+      case 'D': dualRange = true; break;
+      case 'I': currentRMS = atof(optarg); break;
+      case 'P': phases = strtoul(optarg, NULL, 10); break;
+      case 'H': harmonicAnalysis = true; break;
+      case 'l': persistentLog = true; break;
+      case 'a': preallocatedReadings = strtoul(optarg, NULL, 10); break;
+      case 'b': logFormat = LOG_FORMAT_BINARY; break;
+      case 'T': timingStats = true; break;
+      case 'E': eventDetection = true; break;
+      case 'w': waveformPath = optarg; break;
+      case 's': sdRoot = optarg; break;
+      case 'd': snprintf(folder, sizeof(folder), "%s", optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n readings] [-r pairRate] [-c cyclesPerWindow] [-k] [-D] [-I currentRMS] [-P phases] [-H] [-l] [-a readingsPerDay] [-b] [-T] [-E] [-w waveform.txt] [-s sdRoot] [-d folder]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (phases < 1 || phases > SAMPLE_MAX_PHASES || (phases > 1 && (pairRate == 0 || dualRange))) {
+    fprintf(stderr, "Phases must be 1 to %u, and more than one needs -r and no -D\n", SAMPLE_MAX_PHASES);
+    return 2;
+  }
+  if (preallocatedReadings && !persistentLog) {
+    fprintf(stderr, "Preallocation needs the persistent log (-l)\n");
+    return 2;
+  }
+  if (eventDetection && pairRate == 0) {
+    fprintf(stderr, "Event detection needs the continuous acquisition (-r)\n");
+    return 2;
+  }
+
+  // Signal source: fixture file or synthetic load seen through the sensors
+  SyntheticWaveform synthetic;
+  RecordedWaveform recorded;
+  if (waveformPath) {
+    if (!recorded.load(waveformPath)) {
+      fprintf(stderr, "Could not load waveform '%s'\n", waveformPath);
+      return 1;
+    }
+    HalADC::setWaveform(&recorded);
+  }
+  else {
+    // Phases 120 degrees apart, the second one with half of the current
+    const uint8_t pins[SAMPLE_MAX_PHASES][3] = {
+      { STANDARD_CURRENT_PIN, AMPLIFIED_CURRENT_PIN, VOLTAGE_PIN },
+      { PHASE2_STANDARD_CURRENT_PIN, PHASE2_AMPLIFIED_CURRENT_PIN, PHASE2_VOLTAGE_PIN },
+      { PHASE3_STANDARD_CURRENT_PIN, PHASE3_AMPLIFIED_CURRENT_PIN, PHASE3_VOLTAGE_PIN }
+    };
+    for (uint8_t phase = 0; phase < phases; ++phase) {
+      float currentVolts = currentRMS * SENSOR_SENSIBILITY / (phase + 1);
+      float phaseDegrees = -120.0 * phase;
+      synthetic.setSignal(pins[phase][0] - A0, 2.5, currentVolts, phaseDegrees - SYNTHETIC_PHASE_DEG);
+      synthetic.setSignal(pins[phase][1] - A0, 2.5, currentVolts * CURRENT_GAIN, phaseDegrees - SYNTHETIC_PHASE_DEG);
+      synthetic.setSignal(pins[phase][2] - A0, 2.5, SYNTHETIC_VOLTAGE_RMS * VOLTAGE_MEASURING_RATIO, phaseDegrees);
+    }
+    synthetic.setNoise(0.5);
+
+    // Sag to 60% (100 ms), interruption (50 ms), swell to 120% (200 ms) and
+    // the current tripled (150 ms)
+    if (eventDetection) {
+      synthetic.addStep(VOLTAGE_PIN - A0, SYNTHETIC_EVENTS_START, 100000, 0.6);
+      synthetic.addStep(VOLTAGE_PIN - A0, SYNTHETIC_EVENTS_START + SYNTHETIC_EVENTS_STEP, 50000, 0.02);
+      synthetic.addStep(VOLTAGE_PIN - A0, SYNTHETIC_EVENTS_START + 2 * SYNTHETIC_EVENTS_STEP, 200000, 1.2);
+      synthetic.addStep(STANDARD_CURRENT_PIN - A0, SYNTHETIC_EVENTS_START + 3 * SYNTHETIC_EVENTS_STEP, 150000, 3.0);
+      synthetic.addStep(AMPLIFIED_CURRENT_PIN - A0, SYNTHETIC_EVENTS_START + 3 * SYNTHETIC_EVENTS_STEP, 150000, 3.0);
+    }
+    HalADC::setWaveform(&synthetic);
+  }
+
+  const char* fileNameFormat = (logFormat == LOG_FORMAT_BINARY) ? BINARY_FILE_NAME_FORMAT : FILE_NAME_FORMAT;
+
+  Serial.begin();
+  timeCounter.begin();
+  sprintf(fileName, fileNameFormat, timeCounter.getYear(), timeCounter.getMonth(), timeCounter.getDay());
+  Measure* loads[SAMPLE_MAX_PHASES] = { &measure, &phase2, &phase3 };
+  for (uint8_t phase = 0; phase < phases; ++phase) {
+    loads[phase]->setKernel(kernel);
+    loads[phase]->setCyclesPerWindow(cyclesPerWindow);
+  }
+  if (dualRange) {
+    measure.setDualRange();
+  }
+  if (harmonicAnalysis) {
+    measure.setHarmonics(&harmonics);
+    fileSystem.setHarmonicColumns(true);
+  }
+  if (timingStats) {
+    measure.setStats(&phaseStats);
+    fileSystem.setStats(&phaseStats);
+  }
+  if (eventDetection) {
+    powerEvents.setNominalVoltage(SYNTHETIC_VOLTAGE_RMS);
+    powerEvents.setInrushCurrent(INRUSH_CURRENT);
+    measure.setEvents(&powerEvents);
+  }
+  if (phases > 1) {
+    for (uint8_t phase = 0; phase < phases; ++phase) {
+      phaseSet.addPhase(loads[phase]);
+    }
+    phaseSet.setSampleBuffer(&sampleBuffer);
+    phaseSet.begin(SAMPLES_PER_WINDOW, NUM_WINDOWS, pairRate);
+    fileSystem.setPhaseColumns(phases);
+  }
+  else {
+    measure.setSampleBuffer(&sampleBuffer);
+    measure.begin(SAMPLES_PER_WINDOW, NUM_WINDOWS, pairRate);
+  }
+
+  if (sdRoot) {
+    setenv(HOST_SD_ROOT_ENV, sdRoot, 1);
+  }
+  if (!fileSystem.begin() || !fileSystem.makeDir(folder) || !fileSystem.changeDir(folder)) {
+    fprintf(stderr, "File System initialization failed!\n");
+    return 1;
+  }
+  fileSystem.setPersistentLog(persistentLog);
+  fileSystem.setPreallocation(preallocatedReadings);
+  fileSystem.setLogFormat(logFormat);
+
+  char eventsName[] = EVENTS_FILE;
+  uint32_t totalMicros = 0;
+  for (uint32_t reading = 0; reading < readings; ++reading) {
+
+    uint32_t sTime = micros();
+    if (phases > 1) {
+      while (!phaseSet.update());
+    }
+    else {
+      measure.acquireAndCalculate();
+    }
+    if (timeCounter.updateDateTime()) {
+      sprintf(fileName, fileNameFormat, timeCounter.getYear(), timeCounter.getMonth(), timeCounter.getDay());
+    }
+    bool recorded = (phases > 1) ? fileSystem.recordValues(fileName, &phaseSet) : fileSystem.recordValues(fileName, &measure);
+    if (!recorded) {
+      fprintf(stderr, "Could not open/create file to write!\n");
+      return 1;
+    }
+
+    // The event of the reading, in the steps the sketch takes between blocks
+    while (powerEvents.isRecordPending()) {
+      if (!fileSystem.recordEvent(eventsName, &powerEvents)) {
+        fprintf(stderr, "Could not open/create the events file!\n");
+        return 1;
+      }
+    }
+    totalMicros += micros() - sTime;
+
+    if (phases > 1) {
+      cout << timeCounter.getDate() << ' ' << timeCounter.getTime() << setprecision(3);
+      for (uint8_t phase = 0; phase < phases; ++phase) {
+        cout << F("  I") << int(phase + 1) << '=' << loads[phase]->getCurrentRMS() << F(" A V") << int(phase + 1);
+        cout << '=' << loads[phase]->getVoltageRMS() << F(" V PF") << int(phase + 1) << '=' << loads[phase]->getPowerFactor();
+      }
+      cout << F("  P=") << phaseSet.getRealPower() << F(" W  S=") << phaseSet.getApparentPower();
+      cout << F(" VA  PF=") << phaseSet.getPowerFactor() << F("  f=") << phaseSet.getLineFrequency() << F(" Hz") << endl;
+      continue;
+    }
+
+    cout << timeCounter.getDate() << ' ' << timeCounter.getTime() << setprecision(3);
+    cout << F("  I=") << measure.getCurrentRMS() << F(" A  V=") << measure.getVoltageRMS();
+    cout << F(" V  P=") << measure.getRealPower() << F(" W  S=") << measure.getApparentPower();
+    cout << F(" VA  PF=") << measure.getPowerFactor() << F("  f=") << measure.getLineFrequency();
+    cout << F(" Hz  (") << measure.getLastPeriod() << F(" s)");
+    if (dualRange) {
+      cout << F("  standard=") << int(measure.getStandardShare()) << '%';
+    }
+    if (harmonicAnalysis) {
+      cout << F("  THDv=") << harmonics.getVoltageTHD() << F("%  THDi=") << harmonics.getCurrentTHD() << '%';
+    }
+    cout << endl;
+  }
+
+  uint32_t samples = readings * uint32_t(SAMPLES_PER_WINDOW) * NUM_WINDOWS * phases;
+  cout << F("Readings: ") << readings << F("  host time/reading: ") << (readings ? totalMicros / readings : 0);
+  cout << F(" us  ns/sample pair: ") << (samples ? uint32_t(1000.0 * totalMicros / samples) : 0) << endl;
+  if (measure.isContinuous()) {
+    cout << F("Dropped blocks: ") << measure.getDroppedBlocks() << F("  discarded blocks: ") << measure.getDiscardedBlocks() << endl;
+  }
+  cout << F("Worst case record latency: ") << fileSystem.getMaxRecordMicros() << F(" us") << endl;
+  if (eventDetection) {
+    cout << F("Power events: ") << powerEvents.getEventCount() << F("  missed: ") << powerEvents.getMissedEvents() << endl;
+  }
+
+  fileSystem.closeLog();
+  if (timingStats) {
+    cout << PHASE_STATS_HEADER << endl;
+    phaseStats.print(&cout);
+  }
+  return 0;
+}